@@ -0,0 +1,137 @@
+#ifndef ACK_RING_H
+#define ACK_RING_H
+
+#include <stdint.h>
+
+// Fixed-capacity FIFO whose entries stay queued until acknowledged.
+//
+// Entries are addressed by sequence number (slot = seq % CAPACITY):
+// [head, sendSeq) has been taken for sending and awaits an acknowledgement,
+// [sendSeq, tail) has not been sent. Acknowledgements may arrive in any order;
+// head only moves past a contiguous run of acknowledged entries. rewind()
+// makes every unacknowledged entry pending again, e.g. after a reconnect.
+// When full, push() drops the oldest entry, sent or not.
+//
+// Not thread-safe; QueueManager wraps it in a mutex. Header-only and free of
+// Arduino dependencies so it can be tested on the host (testing/).
+template <typename T, int CAPACITY>
+class AckRing {
+  static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0,
+                "CAPACITY must be a power of two so slots stay put when sequence numbers wrap");
+
+private:
+  T* items;
+  bool acked[CAPACITY];
+  uint32_t head;
+  uint32_t sendSeq;
+  uint32_t tail;
+  uint32_t dropped;
+  
+  static uint32_t slot(uint32_t seq) { return seq % CAPACITY; }
+
+public:
+  AckRing() : items(nullptr), head(0), sendSeq(0), tail(0), dropped(0) {}
+  
+  // `storage` holds CAPACITY entries and must outlive the ring
+  void begin(T* storage) {
+    items = storage;
+    clear();
+  }
+  
+  // Returns false if the oldest entry had to be dropped to make room
+  bool push(const T& item) {
+    bool kept = true;
+    if (tail - head >= (uint32_t)CAPACITY) {
+      head++;
+      dropped++;
+      kept = false;
+      if ((int32_t)(sendSeq - head) < 0) {
+        sendSeq = head;
+      }
+    }
+    items[slot(tail)] = item;
+    acked[slot(tail)] = false;
+    tail++;
+    return kept;
+  }
+  
+  // Remove the oldest entry, whatever its state
+  bool pop(T& item) {
+    if (head == tail) return false;
+    item = items[slot(head)];
+    head++;
+    if ((int32_t)(sendSeq - head) < 0) {
+      sendSeq = head;
+    }
+    return true;
+  }
+  
+  bool front(T& item) const {
+    if (head == tail) return false;
+    item = items[slot(head)];
+    return true;
+  }
+  
+  // Copy the oldest unsent entry and mark it sent; `seq` identifies it to
+  // acknowledge(). Entries acknowledged before a rewind are not sent again.
+  bool takeNext(T& item, uint32_t& seq) {
+    if (!peekNext()) return false;
+    seq = sendSeq++;
+    item = items[slot(seq)];
+    return true;
+  }
+  
+  // The entry takeNext() would return, left unsent; nullptr if there is none
+  const T* peekNext() {
+    while (sendSeq != tail && acked[slot(sendSeq)]) {
+      sendSeq++;
+    }
+    return sendSeq == tail ? nullptr : &items[slot(sendSeq)];
+  }
+  
+  // Unknown sequence numbers (dropped, or never sent) are ignored
+  void acknowledge(uint32_t seq) {
+    if (seq - head >= sendSeq - head) return;
+    acked[slot(seq)] = true;
+    while (head != sendSeq && acked[slot(head)]) {
+      head++;
+    }
+  }
+  
+  // Every sent entry from `first` through `last`, e.g. those carried by one
+  // batched message; entries in between already acknowledged are unaffected
+  void acknowledgeRange(uint32_t first, uint32_t last) {
+    if (last - first >= (uint32_t)CAPACITY) return;
+    for (uint32_t seq = first; seq != last + 1; seq++) {
+      if (seq - head < sendSeq - head) {
+        acked[slot(seq)] = true;
+      }
+    }
+    while (head != sendSeq && acked[slot(head)]) {
+      head++;
+    }
+  }
+  
+  void rewind() { sendSeq = head; }
+  
+  // Make `seq` and every entry taken after it unsent again, e.g. those taken
+  // for a message that could not be written yet
+  void unsend(uint32_t seq) {
+    if ((int32_t)(seq - head) < 0) seq = head;
+    if (seq - head <= sendSeq - head) sendSeq = seq;
+  }
+  
+  void clear() {
+    head = tail;
+    sendSeq = tail;
+  }
+  
+  uint32_t size() const { return tail - head; }
+  uint32_t unsent() const { return tail - sendSeq; }
+  uint32_t inFlight() const { return sendSeq - head; }
+  uint32_t getDropped() const { return dropped; }
+  bool empty() const { return head == tail; }
+  bool full() const { return tail - head >= (uint32_t)CAPACITY; }
+};
+
+#endif
\ No newline at end of file
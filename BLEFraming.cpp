@@ -0,0 +1,239 @@
+#include "BLEFraming.h"
+#include <string.h>
+
+static void putU16(uint8_t* out, uint16_t value) {
+  out[0] = value & 0xFF;
+  out[1] = value >> 8;
+}
+
+static uint16_t getU16(const uint8_t* in) {
+  return in[0] | (in[1] << 8);
+}
+
+static void putU32(uint8_t* out, uint32_t value) {
+  putU16(out, value & 0xFFFF);
+  putU16(out + 2, value >> 16);
+}
+
+static uint32_t getU32(const uint8_t* in) {
+  return getU16(in) | ((uint32_t)getU16(in + 2) << 16);
+}
+
+size_t encodeFrameHeader(uint8_t* out, size_t capacity, const FrameHeader& header) {
+  size_t size = frameHeaderSize(header.flags);
+  if (capacity < size) return 0;
+  
+  out[0] = header.version;
+  out[1] = header.flags;
+  putU16(out + 2, header.messageId);
+  putU16(out + 4, header.sequence);
+  putU16(out + 6, header.length);
+  if (header.flags & FRAME_FIRST) {
+    putU32(out + FRAME_HEADER_SIZE, header.totalLength);
+  }
+  return size;
+}
+
+size_t decodeFrameHeader(const uint8_t* data, size_t size, FrameHeader& header) {
+  if (size < FRAME_HEADER_SIZE || data[0] != FRAME_VERSION) return 0;
+  
+  header.version = data[0];
+  header.flags = data[1];
+  header.messageId = getU16(data + 2);
+  header.sequence = getU16(data + 4);
+  header.length = getU16(data + 6);
+  header.totalLength = 0;
+  
+  size_t headerSize = frameHeaderSize(header.flags);
+  if (size < headerSize) return 0;
+  if (header.flags & FRAME_FIRST) {
+    header.totalLength = getU32(data + FRAME_HEADER_SIZE);
+  }
+  
+  // The declared payload must be exactly what arrived
+  if (size - headerSize != header.length) return 0;
+  return headerSize;
+}
+
+FrameAssembler::FrameAssembler() : slotCount(0), slotCapacity(0) {
+  for (int i = 0; i < MAX_SLOTS; i++) {
+    slots[i].buffer = nullptr;
+    slots[i].unframed = false;
+    slots[i].error = nullptr;
+    slots[i].state = SLOT_FREE;
+  }
+}
+
+bool FrameAssembler::begin(uint8_t* arena, size_t arenaSize, int count) {
+  if (!arena || count <= 0 || count > MAX_SLOTS || arenaSize / count < 2) return false;
+  
+  slotCount = count;
+  size_t slotBytes = arenaSize / count;
+  slotCapacity = slotBytes - 1;
+  for (int i = 0; i < slotCount; i++) {
+    slots[i].buffer = arena + i * slotBytes;
+    slots[i].state = SLOT_FREE;
+  }
+  return true;
+}
+
+int FrameAssembler::findSlot(uint16_t messageId, SlotState state, bool unframed) const {
+  for (int i = 0; i < slotCount; i++) {
+    if (slots[i].state == state &&
+        (state == SLOT_FREE || (slots[i].unframed == unframed && (unframed || slots[i].messageId == messageId)))) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+FrameAssembler::Result FrameAssembler::push(const uint8_t* data, size_t size, Message& message, const char*& error) {
+  message.messageId = size >= FRAME_HEADER_SIZE ? getU16(data + 2) : 0;
+  message.data = nullptr;
+  message.length = 0;
+  message.slot = -1;
+  
+  FrameHeader header;
+  size_t headerSize = decodeFrameHeader(data, size, header);
+  if (headerSize == 0) {
+    error = "Malformed frame";
+    return FRAME_ERROR;
+  }
+  
+  int index = findSlot(header.messageId, SLOT_ASSEMBLING);
+  if (header.flags & FRAME_FIRST) {
+    // A restarted message replaces whatever was left of the previous attempt
+    if (index < 0) {
+      index = findSlot(0, SLOT_FREE);
+    }
+    if (index < 0) {
+      error = "Too many outstanding messages";
+      return FRAME_ERROR;
+    }
+    if (header.sequence != 0 || header.totalLength > slotCapacity) {
+      slots[index].state = SLOT_FREE;
+      error = header.sequence != 0 ? "Sequence gap" : "Message too large";
+      return FRAME_ERROR;
+    }
+    Slot& slot = slots[index];
+    slot.state = SLOT_ASSEMBLING;
+    slot.unframed = false;
+    slot.messageId = header.messageId;
+    slot.totalLength = header.totalLength;
+    slot.received = 0;
+    slot.nextSequence = 0;
+  } else if (index < 0) {
+    error = "Frame for unknown message";
+    return FRAME_ERROR;
+  }
+  
+  // Lost or reordered frames abandon the whole message
+  Slot& slot = slots[index];
+  size_t limit = slot.totalLength > 0 ? slot.totalLength : slotCapacity;
+  if (header.sequence != slot.nextSequence) {
+    slot.state = SLOT_FREE;
+    error = "Sequence gap";
+    return FRAME_ERROR;
+  }
+  if (slot.received + header.length > limit) {
+    slot.state = SLOT_FREE;
+    error = "Message too large";
+    return FRAME_ERROR;
+  }
+  
+  memcpy(slot.buffer + slot.received, data + headerSize, header.length);
+  slot.received += header.length;
+  slot.nextSequence++;
+  
+  if (!(header.flags & FRAME_LAST)) {
+    return FRAME_PENDING;
+  }
+  if (slot.totalLength > 0 && slot.received != slot.totalLength) {
+    slot.state = SLOT_FREE;
+    error = "Message length mismatch";
+    return FRAME_ERROR;
+  }
+  
+  slot.buffer[slot.received] = '\0';
+  slot.state = SLOT_COMPLETE;
+  message.data = slot.buffer;
+  message.length = slot.received;
+  message.slot = index;
+  return FRAME_COMPLETE;
+}
+
+FrameAssembler::Result FrameAssembler::pushText(const uint8_t* data, size_t size, Message& message, const char*& error) {
+  message.messageId = 0;
+  message.data = nullptr;
+  message.length = 0;
+  message.slot = -1;
+  
+  // v1 has no message IDs, so there is at most one text message in assembly
+  bool end = size == 5 && memcmp(data, "<END>", 5) == 0;
+  int index = findSlot(0, SLOT_ASSEMBLING, true);
+  if (index < 0) {
+    index = findSlot(0, SLOT_FREE);
+    if (index < 0) {
+      // Swallow the rest of the message, like any other rejected one
+      if (end) {
+        error = "Too many outstanding messages";
+        return FRAME_ERROR;
+      }
+      return FRAME_PENDING;
+    }
+    Slot& slot = slots[index];
+    slot.state = SLOT_ASSEMBLING;
+    slot.unframed = true;
+    slot.error = nullptr;
+    slot.messageId = 0;
+    slot.totalLength = 0;
+    slot.received = 0;
+  }
+  
+  Slot& slot = slots[index];
+  if (end) {
+    if (slot.error) {
+      error = slot.error;
+      slot.state = SLOT_FREE;
+      return FRAME_ERROR;
+    }
+    slot.buffer[slot.received] = '\0';
+    slot.state = SLOT_COMPLETE;
+    message.data = slot.buffer;
+    message.length = slot.received;
+    message.slot = index;
+    return FRAME_COMPLETE;
+  }
+  
+  if (!slot.error) {
+    if (slot.received + size > slotCapacity) {
+      slot.error = "Message too large";
+    } else {
+      memcpy(slot.buffer + slot.received, data, size);
+      slot.received += size;
+    }
+  }
+  return FRAME_PENDING;
+}
+
+void FrameAssembler::release(const Message& message) {
+  if (message.slot >= 0 && message.slot < slotCount) {
+    slots[message.slot].state = SLOT_FREE;
+  }
+}
+
+void FrameAssembler::reset() {
+  for (int i = 0; i < slotCount; i++) {
+    if (slots[i].state == SLOT_ASSEMBLING) {
+      slots[i].state = SLOT_FREE;
+    }
+  }
+}
+
+int FrameAssembler::getPendingCount() const {
+  int count = 0;
+  for (int i = 0; i < slotCount; i++) {
+    if (slots[i].state != SLOT_FREE) count++;
+  }
+  return count;
+}
\ No newline at end of file
@@ -0,0 +1,114 @@
+#ifndef BLE_FRAMING_H
+#define BLE_FRAMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// v2 BLE framing. Every write/notification is one frame:
+//
+//   version:u8  flags:u8  messageId:u16  sequence:u16  length:u16  [totalLength:u32]  payload[length]
+//
+// Little-endian. totalLength is present only on FRAME_FIRST frames (0 = not known
+// up front). v1 clients send raw JSON text terminated by an "<END>" write; those
+// never start with FRAME_VERSION, so the first byte tells the two apart.
+//
+// Free of Arduino dependencies so the same codec is used by host tools and
+// unit-tested on Linux (testing/).
+static const uint8_t FRAME_VERSION = 2;
+static const size_t FRAME_HEADER_SIZE = 8;
+static const size_t FRAME_LENGTH_SIZE = 4;
+
+enum FrameFlags : uint8_t {
+  FRAME_FIRST = 0x01,  // Starts a message; totalLength follows the header
+  FRAME_LAST = 0x02,   // Completes a message
+  FRAME_COMPRESSED = 0x04  // Payload is LZSS (LzssCodec.h); set on every frame of the message
+};
+
+struct FrameHeader {
+  uint8_t version;
+  uint8_t flags;
+  uint16_t messageId;
+  uint16_t sequence;     // Frame number within the message, from 0
+  uint16_t length;       // Payload bytes in this frame
+  uint32_t totalLength;  // FRAME_FIRST only
+};
+
+inline size_t frameHeaderSize(uint8_t flags) {
+  return FRAME_HEADER_SIZE + ((flags & FRAME_FIRST) ? FRAME_LENGTH_SIZE : 0);
+}
+
+inline bool isFramed(const uint8_t* data, size_t size) {
+  return size >= FRAME_HEADER_SIZE && data[0] == FRAME_VERSION;
+}
+
+// Returns the header size written, 0 if `capacity` is too small
+size_t encodeFrameHeader(uint8_t* out, size_t capacity, const FrameHeader& header);
+
+// Returns the header size read, 0 if the frame is malformed or truncated
+size_t decodeFrameHeader(const uint8_t* data, size_t size, FrameHeader& header);
+
+// Reassembles messages in place into a caller-provided arena (PSRAM on the
+// gateway). The arena is split into equal slots, one per message being
+// assembled, so several requests can be outstanding at once. A completed
+// message stays in its slot, NUL-terminated, until release(), so the consumer
+// can parse it where it lies. v1 text messages use the same slots.
+class FrameAssembler {
+public:
+  static const int MAX_SLOTS = 8;
+  
+  enum Result {
+    FRAME_PENDING,   // Frame accepted, message not complete yet
+    FRAME_COMPLETE,  // `message` holds a complete message
+    FRAME_ERROR      // Frame rejected; `message.messageId` and `error` say which and why
+  };
+  
+  struct Message {
+    uint16_t messageId;
+    uint8_t* data;
+    size_t length;
+    int slot;
+  };
+
+private:
+  enum SlotState : uint8_t { SLOT_FREE, SLOT_ASSEMBLING, SLOT_COMPLETE };
+  
+  struct Slot {
+    uint8_t* buffer;
+    uint32_t totalLength;
+    uint32_t received;
+    uint16_t messageId;
+    uint16_t nextSequence;
+    bool unframed;             // v1 text message, completed by an "<END>" write
+    const char* error;         // v1 message being discarded until its "<END>"
+    volatile SlotState state;  // Completed slots are released by the consumer task
+  };
+  
+  Slot slots[MAX_SLOTS];
+  int slotCount;
+  size_t slotCapacity;  // Payload bytes per slot; one more is kept for the terminator
+  
+  int findSlot(uint16_t messageId, SlotState state, bool unframed = false) const;
+
+public:
+  FrameAssembler();
+  
+  // Use `arena` for `slotCount` message slots; the arena must outlive the assembler
+  bool begin(uint8_t* arena, size_t arenaSize, int slotCount);
+  
+  // Feed one received frame
+  Result push(const uint8_t* data, size_t size, Message& message, const char*& error);
+  
+  // Feed one v1 text fragment or the "<END>" marker; errors are reported at "<END>"
+  Result pushText(const uint8_t* data, size_t size, Message& message, const char*& error);
+  
+  // Hand a completed message's slot back for reuse
+  void release(const Message& message);
+  
+  // Drop partial messages (e.g. on disconnect); completed ones stay with their consumer
+  void reset();
+  
+  size_t getSlotCapacity() const { return slotCapacity; }
+  int getPendingCount() const;
+};
+
+#endif
\ No newline at end of file
@@ -1,13 +1,22 @@
 #include "BLEManager.h"
 #include "CRUDHandler.h"
-#include "QueueManager.h"
+#include "StreamSubscriptions.h"
+#include "JsonCapacity.h"
 #include <esp_heap_caps.h>
-#include <new>
+
+BLEManager* BLEManager::instance = nullptr;
 
 BLEManager::BLEManager(const String& name, CRUDHandler* cmdHandler) 
-  : serviceName(name), handler(cmdHandler), processing(false), streamTaskHandle(nullptr) {
-  commandBuffer.reserve(COMMAND_BUFFER_SIZE);
-  commandQueue = xQueueCreate(20, sizeof(String*));  // Increased queue size
+  : serviceName(name), handler(cmdHandler), frameArena(nullptr), commandDoc(nullptr), sessionVersion(1),
+    responseMessageId(0), responseVersion(1), commandTaskHandle(nullptr), streamTaskHandle(nullptr), chunkSize(CHUNK_SIZE),
+    compressResponses(false), linkCongested(false), connected(false) {
+  commandQueue = xQueueCreate(20, sizeof(QueuedCommand));  // Increased queue size
+  responseMutex = xSemaphoreCreateMutex();
+  notifyCredits = xSemaphoreCreateCounting(NOTIFY_WINDOW, NOTIFY_WINDOW);
+  uncongested = xSemaphoreCreateBinary();
+  replyStream = new BLEResponseStream(this, false);
+  memset(&stats, 0, sizeof(stats));
+  instance = this;
 }
 
 BLEManager::~BLEManager() {
@@ -15,11 +24,43 @@ BLEManager::~BLEManager() {
   if (commandQueue) {
     vQueueDelete(commandQueue);
   }
+  if (responseMutex) {
+    vSemaphoreDelete(responseMutex);
+  }
+  if (notifyCredits) {
+    vSemaphoreDelete(notifyCredits);
+  }
+  if (frameArena) {
+    heap_caps_free(frameArena);
+  }
+  delete commandDoc;
+  delete replyStream;
+  if (uncongested) {
+    vSemaphoreDelete(uncongested);
+  }
+  instance = nullptr;
 }
 
 bool BLEManager::begin() {
-  // Initialize BLE
+  // Fixed reassembly arena and parse document: command memory is bounded and
+  // allocated once, whatever the commands look like
+  size_t arenaSize = FRAME_ARENA_SIZE;
+  frameArena = (uint8_t*)heap_caps_malloc(arenaSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!frameArena) {
+    arenaSize = FRAME_FALLBACK_ARENA_SIZE;
+    frameArena = (uint8_t*)heap_caps_malloc(arenaSize, MALLOC_CAP_8BIT);
+    Serial.printf("No PSRAM for the BLE command arena, commands limited to %u bytes\n", arenaSize / FRAME_SLOTS - 1);
+  }
+  if (frameArena && frameAssembler.begin(frameArena, arenaSize, FRAME_SLOTS)) {
+    commandDoc = new PsramJsonDocument(jsonCapacityFor(frameAssembler.getSlotCapacity()));
+  } else {
+    Serial.println("No memory for the BLE command arena, commands disabled");
+  }
+  
+  // Initialize BLE; clients that request a larger MTU get up to BLE_MAX_MTU
+  BLEDevice::setCustomGattsHandler(gattsEventHandler);
   BLEDevice::init(serviceName.c_str());
+  BLEDevice::setMTU(BLE_MAX_MTU);
   
   // Create BLE Server
   pServer = BLEDevice::createServer();
@@ -68,7 +109,7 @@ bool BLEManager::begin() {
   xTaskCreatePinnedToCore(
     streamingTask,
     "BLE_STREAM_TASK",
-    4096,
+    6144,  // Holds a batch of samples
     this,
     1,
     &streamTaskHandle,
@@ -98,165 +139,375 @@ void BLEManager::stop() {
 
 void BLEManager::onConnect(BLEServer* pServer) {
   Serial.println("BLE Client connected");
+  memset(&stats, 0, sizeof(stats));
+  stats.connectedAt = millis();
+  stats.mtu = chunkSize + 3;
+  resetFlowControl();
+  connected = true;
 }
 
 void BLEManager::onDisconnect(BLEServer* pServer) {
   Serial.println("BLE Client disconnected");
+  connected = false;
+  if (handler) {
+    handler->endSession(*this);
+  }
+  chunkSize = CHUNK_SIZE;
+  sessionVersion = 1;
+  compressResponses = false;
+  frameAssembler.reset();
+  resetFlowControl();
   
+  unsigned long seconds = (millis() - stats.connectedAt) / 1000;
+  Serial.printf("BLE link: %lu s, %u commands (%u B in), %u notifications (%u B out, %u B/s), "
+                "%u congestion waits, %u credit timeouts\n",
+                seconds, stats.commands, stats.bytesIn, stats.notifications, stats.bytesOut,
+                seconds > 0 ? (unsigned)(stats.bytesOut / seconds) : stats.bytesOut,
+                stats.congestionWaits, stats.creditTimeouts);
+                
   // Stop streaming when client disconnects
-  extern CRUDHandler* crudHandler;
-  if (crudHandler) {
-    crudHandler->clearStreamDeviceId();
-    QueueManager* queueMgr = QueueManager::getInstance();
-    if (queueMgr) {
-      queueMgr->clearStream();
-    }
-    Serial.println("Cleared streaming on disconnect");
-  }
+  StreamSubscriptions::getInstance()->clear();
+  Serial.println("Cleared streaming on disconnect");
   
   BLEDevice::startAdvertising(); // Restart advertising
 }
 
+void BLEManager::onMtuChanged(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+  // Notifications carry MTU - 3 bytes; clients that never exchange MTUs keep 18
+  uint16_t payload = param->mtu.mtu > 3 ? param->mtu.mtu - 3 : CHUNK_SIZE;
+  chunkSize = constrain(payload, CHUNK_SIZE, MAX_CHUNK_SIZE);
+  stats.mtu = chunkSize + 3;
+  Serial.printf("BLE MTU negotiated: %u (chunk %u bytes)\n", param->mtu.mtu, chunkSize);
+}
+
 void BLEManager::onWrite(BLECharacteristic* pCharacteristic) {
   if (pCharacteristic == pCommandChar) {
-    String value = pCharacteristic->getValue().c_str();
-    receiveFragment(value);
+    std::string value = pCharacteristic->getValue();
+    stats.bytesIn += value.length();
+    if (isFramed((const uint8_t*)value.data(), value.length())) {
+      receiveFrame((const uint8_t*)value.data(), value.length());
+    } else {
+      receiveFragment((const uint8_t*)value.data(), value.length());
+    }
   }
 }
 
-void BLEManager::receiveFragment(const String& fragment) {
-  if (processing) return;
-  
-  if (fragment == "<END>") {
-    processing = true;
-    String* cmd = new String(commandBuffer);
-    xQueueSend(commandQueue, &cmd, 0);
-    commandBuffer = "";
-    processing = false;
+void BLEManager::receiveFragment(const uint8_t* data, size_t length) {
+  FrameAssembler::Message message;
+  const char* error = nullptr;
+  FrameAssembler::Result result = commandDoc ? frameAssembler.pushText(data, length, message, error)
+                                             : FrameAssembler::FRAME_PENDING;
+  if (result != FrameAssembler::FRAME_PENDING) {
+    sessionVersion = 1;
+    queueCommand(message, result == FrameAssembler::FRAME_ERROR ? error : nullptr, 1);
+  }
+}
+
+void BLEManager::receiveFrame(const uint8_t* data, size_t length) {
+  sessionVersion = FRAME_VERSION;
+  FrameAssembler::Message message;
+  const char* error = nullptr;
+  FrameAssembler::Result result = FrameAssembler::FRAME_ERROR;
+  if (commandDoc) {
+    result = frameAssembler.push(data, length, message, error);
   } else {
-    commandBuffer += fragment;
+    message = {(uint16_t)(data[2] | (data[3] << 8)), nullptr, 0, -1};
+    error = "Command arena unavailable";
+  }
+  
+  // Errors are answered from the command task; notifying from the BLE task would block on credits
+  if (result != FrameAssembler::FRAME_PENDING) {
+    queueCommand(message, result == FrameAssembler::FRAME_ERROR ? error : nullptr, FRAME_VERSION);
   }
 }
 
+void BLEManager::queueCommand(const FrameAssembler::Message& message, const char* error, uint8_t version) {
+  QueuedCommand command = {message, error, version};
+  if (xQueueSend(commandQueue, &command, 0) != pdTRUE) {
+    Serial.println("BLE command queue full, command dropped");
+    frameAssembler.release(message);
+    return;
+  }
+  stats.commands++;
+}
+
 void BLEManager::commandProcessingTask(void* parameter) {
   BLEManager* manager = static_cast<BLEManager*>(parameter);
-  String* command;
+  QueuedCommand command;
   
   while (true) {
     if (xQueueReceive(manager->commandQueue, &command, portMAX_DELAY)) {
-      manager->handleCompleteCommand(*command);
-      delete command;
+      // Responses sent from this task answer this request
+      manager->responseMessageId = command.message.messageId;
+      manager->responseVersion = command.version;
+      if (command.message.data) {
+        manager->handleCompleteCommand(command.message);
+        manager->frameAssembler.release(command.message);
+      } else {
+        manager->sendError(command.error);
+      }
     }
   }
 }
 
-void BLEManager::handleCompleteCommand(const String& command) {
-  Serial.printf("DEBUG: Raw JSON command: %s\n", command.c_str());
-  
-  // Allocate JSON document in PSRAM for large commands
-  DynamicJsonDocument* doc = (DynamicJsonDocument*)heap_caps_malloc(sizeof(DynamicJsonDocument), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-  if (!doc) {
-    // Fallback to stack allocation
-    DynamicJsonDocument stackDoc(2048);
-    DeserializationError error = deserializeJson(stackDoc, command);
-    if (error) {
-      sendError("Invalid JSON: " + String(error.c_str()));
-      return;
-    }
-    if (handler) {
-      handler->handle(this, stackDoc);
-    }
-    return;
-  }
-  
-  new(doc) DynamicJsonDocument(4096);  // Larger size for PSRAM
-  DeserializationError error = deserializeJson(*doc, command);
+void BLEManager::handleCompleteCommand(const FrameAssembler::Message& message) {
+  Serial.printf("DEBUG: Raw JSON command: %s\n", (const char*)message.data);
   
+  // Parse in place: the document's strings point into the arena slot, which is
+  // only released after the handler returns
+  DeserializationError error = deserializeJson(*commandDoc, (char*)message.data, message.length);
   if (error) {
     sendError("Invalid JSON: " + String(error.c_str()));
-    doc->~DynamicJsonDocument();
-    heap_caps_free(doc);
     return;
   }
   
   if (handler) {
-    handler->handle(this, *doc);
+    handler->handle(*this, *commandDoc);
   } else {
     sendError("No handler configured");
   }
-  
-  // Clean up PSRAM allocation
-  doc->~DynamicJsonDocument();
-  heap_caps_free(doc);
+  commandDoc->clear();
 }
 
-void BLEManager::sendResponse(const JsonDocument& data) {
-  String response;
-  serializeJson(data, response);
-  sendFragmented(response);
+Print& BLEManager::beginResponse() {
+  replyStream->begin();
+  return *replyStream;
 }
 
-void BLEManager::sendError(const String& message) {
-  DynamicJsonDocument doc(256);
-  doc["status"] = "error";
-  doc["message"] = message;
-  sendResponse(doc);
+void BLEManager::endResponse() {
+  replyStream->end();
 }
 
-void BLEManager::sendSuccess() {
-  DynamicJsonDocument doc(128);
-  doc["status"] = "ok";
-  sendResponse(doc);
+// Own stream on the caller's stack, so the streaming task can send while a
+// reply is being written
+void BLEManager::sendResponse(const JsonDocument& data) {
+  BLEResponseStream stream(this);
+  serializeJson(data, stream);
+  stream.end();
 }
 
-void BLEManager::sendFragmented(const String& data) {
+bool BLEManager::setResponseEncoding(const String& encoding, String& error) {
+  if (encoding == "none") {
+    compressResponses = false;
+    return true;
+  }
+  if (encoding != "lzss") {
+    error = "Unsupported encoding: " + encoding;
+    return false;
+  }
+  if (responseVersion != FRAME_VERSION) {
+    error = "Compression requires v2 framing";
+    return false;
+  }
+  compressResponses = true;
+  return true;
+}
+
+
+// Sends as fast as the connection drains: at most NOTIFY_WINDOW notifications are
+// unconfirmed at a time, and nothing is queued while the stack is congested.
+// A missing confirmation costs NOTIFY_CREDIT_TIMEOUT_MS instead of stalling.
+void BLEManager::notifyFragment(const uint8_t* data, size_t length) {
   if (!pResponseChar) return;
   
-  int i = 0;
-  while (i < data.length()) {
-    int end = i + CHUNK_SIZE;
-    if (end > data.length()) {
-      end = data.length();
+  if (xSemaphoreTake(notifyCredits, pdMS_TO_TICKS(NOTIFY_CREDIT_TIMEOUT_MS)) != pdTRUE) {
+    stats.creditTimeouts++;
+  }
+  while (linkCongested && connected) {
+    stats.congestionWaits++;
+    xSemaphoreTake(uncongested, pdMS_TO_TICKS(NOTIFY_CREDIT_TIMEOUT_MS));
+  }
+  
+  pResponseChar->setValue((uint8_t*)data, length);
+  pResponseChar->notify();
+  stats.notifications++;
+  stats.bytesOut += length;
+}
+
+void BLEManager::resetFlowControl() {
+  linkCongested = false;
+  while (xSemaphoreGive(notifyCredits) == pdTRUE) {}  // Refill to NOTIFY_WINDOW
+  xSemaphoreGive(uncongested);
+}
+
+// Runs in the BLE stack task, alongside the library's own GATTS handling
+void BLEManager::gattsEventHandler(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t* param) {
+  BLEManager* manager = instance;
+  if (!manager || !manager->pResponseChar) return;
+  
+  if (event == ESP_GATTS_CONF_EVT && param->conf.handle == manager->pResponseChar->getHandle()) {
+    if (param->conf.status != ESP_GATT_OK) {
+      manager->stats.notifyErrors++;
     }
+    xSemaphoreGive(manager->notifyCredits);
+  } else if (event == ESP_GATTS_CONGEST_EVT) {
+    manager->linkCongested = param->congest.congested;
+    if (!param->congest.congested) {
+      xSemaphoreGive(manager->uncongested);
+    }
+  }
+}
+
+bool BLEManager::getLinkStats(JsonObject& result) {
+  unsigned long elapsed = millis() - stats.connectedAt;
+  result["connected"] = (bool)connected;
+  result["mtu"] = stats.mtu;
+  result["uptime_ms"] = elapsed;
+  result["commands"] = stats.commands;
+  result["bytes_in"] = stats.bytesIn;
+  result["notifications"] = stats.notifications;
+  result["bytes_out"] = stats.bytesOut;
+  result["bytes_out_per_s"] = elapsed > 0 ? (uint32_t)((uint64_t)stats.bytesOut * 1000 / elapsed) : 0;
+  result["congestion_waits"] = stats.congestionWaits;
+  result["credit_timeouts"] = stats.creditTimeouts;
+  result["notify_errors"] = stats.notifyErrors;
+  return true;
+}
+
+BLEResponseStream::BLEResponseStream(BLEManager* owner, bool openNow)
+  : manager(owner), used(0), open(false), sequence(0), frameFlags(0), encoder(nullptr) {
+  if (openNow) {
+    begin();
+  }
+}
+
+void BLEResponseStream::begin() {
+  if (open) return;
+  if (manager->responseMutex) {
+    xSemaphoreTake(manager->responseMutex, portMAX_DELAY);
+  }
+  open = true;
+  chunkSize = manager->chunkSize;
+  sequence = 0;
+  frameFlags = 0;
+  encoder = nullptr;
+  
+  bool isReply = xTaskGetCurrentTaskHandle() == manager->commandTaskHandle;
+  framed = (isReply ? manager->responseVersion : manager->sessionVersion) == FRAME_VERSION;
+  messageId = isReply ? manager->responseMessageId : 0;  // 0 = unsolicited
+  headerSize = framed ? frameHeaderSize(FRAME_FIRST) : 0;
+  used = headerSize;
+  
+  if (framed && manager->compressResponses) {
+    frameFlags = FRAME_COMPRESSED;
+    encoder = &manager->responseEncoder;
+    encoder->begin(appendCompressed, this);
+  }
+}
+
+BLEResponseStream::~BLEResponseStream() {
+  end();
+}
+
+size_t BLEResponseStream::write(uint8_t value) {
+  return write(&value, 1);
+}
+
+size_t BLEResponseStream::write(const uint8_t* buffer, size_t size) {
+  if (!open) return 0;
+  
+  if (encoder) {
+    encoder->write(buffer, size);
+  } else {
+    append(buffer, size);
+  }
+  return size;
+}
+
+void BLEResponseStream::appendCompressed(void* context, const uint8_t* data, size_t size) {
+  static_cast<BLEResponseStream*>(context)->append(data, size);
+}
+
+void BLEResponseStream::append(const uint8_t* buffer, size_t size) {
+  size_t remaining = size;
+  while (remaining > 0) {
+    size_t count = chunkSize - used;
+    if (count > remaining) {
+      count = remaining;
+    }
+    memcpy(chunk + used, buffer, count);
+    used += count;
+    buffer += count;
+    remaining -= count;
     
-    String chunk = data.substring(i, end);
-    pResponseChar->setValue(chunk.c_str());
-    pResponseChar->notify();
-    
-    vTaskDelay(pdMS_TO_TICKS(FRAGMENT_DELAY_MS));
-    i = end;
+    if (used == chunkSize) {
+      flush(false);
+    }
   }
+}
+
+void BLEResponseStream::flush(bool last) {
+  if (framed) {
+    // Responses are streamed, so the total length is not known up front
+    uint8_t flags = (sequence == 0 ? FRAME_FIRST : 0) | (last ? FRAME_LAST : 0) | frameFlags;
+    FrameHeader header = {FRAME_VERSION, flags, messageId, sequence++, (uint16_t)(used - headerSize), 0};
+    encodeFrameHeader(chunk, headerSize, header);
+  }
+  manager->notifyFragment(chunk, used);
+  headerSize = framed ? frameHeaderSize(0) : 0;
+  used = headerSize;
+}
+
+void BLEResponseStream::end() {
+  if (!open) return;
+  open = false;
   
-  // Send end marker
-  pResponseChar->setValue("<END>");
-  pResponseChar->notify();
+  if (framed) {
+    if (encoder) {
+      encoder->finish();
+    }
+    // The last frame carries FRAME_LAST, even with no payload left
+    flush(true);
+  } else {
+    if (used > 0) {
+      flush(false);
+    }
+    
+    // Send end marker
+    manager->notifyFragment((const uint8_t*)"<END>", 5);
+  }
+  if (manager->responseMutex) {
+    xSemaphoreGive(manager->responseMutex);
+  }
+}
+
+static void dataRecordToJson(const DataRecord& record, JsonObject& dataPoint) {
+  dataPoint["time"] = record.time;
+  dataPoint["name"] = (const char*)record.name;
+  dataPoint["address"] = record.address;
+  dataPoint["datatype"] = (const char*)record.dataType;
+  dataPoint["value"] = record.value;
+  dataPoint["device_id"] = (const char*)record.deviceId;
+  dataPoint["register_id"] = (const char*)record.registerId;
 }
 
+// Sleeps until a subscribed sample arrives or a rate-limited one falls due, then
+// sends every due sample, STREAM_BATCH per message. Samples that arrive while a
+// message is going out are coalesced per register by StreamSubscriptions.
 void BLEManager::streamingTask(void* parameter) {
   BLEManager* manager = static_cast<BLEManager*>(parameter);
-  QueueManager* queueMgr = QueueManager::getInstance();
+  StreamSubscriptions* streams = StreamSubscriptions::getInstance();
+  streams->setConsumer(xTaskGetCurrentTaskHandle());
   
-  Serial.println("BLE Streaming task started");
-  int loopCount = 0;
+  DataRecord batch[STREAM_BATCH];
+  DynamicJsonDocument response(STREAM_BATCH * 256);
+  uint32_t waitMs = StreamSubscriptions::NOTHING_PENDING;
   
+  Serial.println("BLE Streaming task started");
   while (true) {
-    if (queueMgr && !queueMgr->isStreamEmpty()) {
-      DynamicJsonDocument dataDoc(512);
-      JsonObject dataPoint = dataDoc.to<JsonObject>();
-      
-      if (queueMgr->dequeueStream(dataPoint)) {
-        Serial.println("Streaming data via BLE");
-        DynamicJsonDocument response(512);
-        response["status"] = "data";
-        response["data"] = dataPoint;
-        manager->sendResponse(response);
-      }
-    } else {
-      loopCount++;
-      if (loopCount % 100 == 0) {
-        Serial.printf("Stream queue empty, loop count: %d\n", loopCount);
+    ulTaskNotifyTake(pdTRUE, waitMs == StreamSubscriptions::NOTHING_PENDING ? portMAX_DELAY : pdMS_TO_TICKS(waitMs));
+    
+    int count;
+    while ((count = streams->take(batch, STREAM_BATCH, millis(), waitMs)) > 0) {
+      if (!manager->connected) continue;
+      response.clear();
+      response["status"] = "data";
+      JsonArray data = response.createNestedArray("data");
+      for (int i = 0; i < count; i++) {
+        JsonObject dataPoint = data.createNestedObject();
+        dataRecordToJson(batch[i], dataPoint);
       }
+      manager->sendResponse(response);
     }
-    vTaskDelay(pdMS_TO_TICKS(100));
   }
 }
\ No newline at end of file
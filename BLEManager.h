@@ -9,6 +9,11 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include "BLEFraming.h"
+#include "PsramJson.h"
+#include "LzssCodec.h"
+#include "ResponseSink.h"
 
 // BLE UUIDs
 #define SERVICE_UUID        "00001830-0000-1000-8000-00805f9b34fb"
@@ -16,13 +21,33 @@
 #define RESPONSE_CHAR_UUID  "11111111-1111-1111-1111-111111111102"
 
 // Constants
-#define CHUNK_SIZE 18
-#define FRAGMENT_DELAY_MS 50
-#define COMMAND_BUFFER_SIZE 4096  // Increased for PSRAM usage
+#define CHUNK_SIZE 18              // Fragment size at the default ATT MTU of 23
+#define BLE_MAX_MTU 512            // Largest MTU offered to clients
+#define MAX_CHUNK_SIZE (BLE_MAX_MTU - 3)
+#define NOTIFY_WINDOW 8            // Notifications in flight before waiting for confirmations
+#define NOTIFY_CREDIT_TIMEOUT_MS 50
+#define FRAME_SLOTS 4              // Requests that can be outstanding at once
+#define FRAME_ARENA_SIZE (FRAME_SLOTS * 32 * 1024)
+#define FRAME_FALLBACK_ARENA_SIZE (FRAME_SLOTS * 4 * 1024)  // Internal RAM when there is no PSRAM
+#define STREAM_BATCH 8             // Live samples packed into one data message
 
 class CRUDHandler; // Forward declaration
+class BLEResponseStream;
 
-class BLEManager : public BLEServerCallbacks, public BLECharacteristicCallbacks {
+// Counters for the current connection, reset on connect
+struct BLELinkStats {
+  unsigned long connectedAt;
+  uint32_t commands;
+  uint32_t bytesIn;
+  uint32_t notifications;
+  uint32_t bytesOut;
+  uint32_t congestionWaits;  // Sends held back while the stack reported congestion
+  uint32_t creditTimeouts;   // Sends released without a confirmation for an earlier one
+  uint32_t notifyErrors;
+  uint16_t mtu;
+};
+
+class BLEManager : public ResponseSink, public BLEServerCallbacks, public BLECharacteristicCallbacks {
 private:
   BLEServer* pServer;
   BLEService* pService;
@@ -32,21 +57,56 @@ private:
   String serviceName;
   CRUDHandler* handler;
   
-  // Command processing
-  String commandBuffer;
-  bool processing;
+  // Command processing. v1 commands are text fragments ended by "<END>"; v2
+  // commands are frames (BLEFraming.h). Both are reassembled in a fixed arena
+  // and queued by pointer; the command task parses them in place and releases
+  // the slot, so a command costs no allocation.
+  struct QueuedCommand {
+    FrameAssembler::Message message;  // data is nullptr when rejected during reassembly
+    const char* error;
+    uint8_t version;
+  };
   QueueHandle_t commandQueue;
+  FrameAssembler frameAssembler;
+  uint8_t* frameArena;
+  PsramJsonDocument* commandDoc;    // Reused for every command
+  volatile uint8_t sessionVersion;  // Framing the client last used; unsolicited messages follow it
+  uint16_t responseMessageId;       // Request being answered by the command task
+  uint8_t responseVersion;
   TaskHandle_t commandTaskHandle;
   TaskHandle_t streamTaskHandle;
+  SemaphoreHandle_t responseMutex;  // One response on the notify channel at a time
+  BLEResponseStream* replyStream;   // beginResponse()/endResponse()
+  volatile uint16_t chunkSize;      // Notification payload for the negotiated MTU
+  
+  // Session option set by "update session": v2 messages are sent LZSS-compressed.
+  // The encoder is only used by the stream holding responseMutex.
+  volatile bool compressResponses;
+  LzssEncoder responseEncoder;
+  
+  // Notification pacing: a credit is spent per notification and returned when the
+  // stack confirms it, and sending pauses while the stack reports congestion
+  SemaphoreHandle_t notifyCredits;
+  SemaphoreHandle_t uncongested;
+  volatile bool linkCongested;
+  volatile bool connected;
+  BLELinkStats stats;
+  static BLEManager* instance;  // For the GATTS event hook
   
   // FreeRTOS task functions
   static void commandProcessingTask(void* parameter);
   static void streamingTask(void* parameter);
   
   // Fragment handling
-  void receiveFragment(const String& fragment);
-  void handleCompleteCommand(const String& command);
-  void sendFragmented(const String& data);
+  void receiveFragment(const uint8_t* data, size_t length);
+  void receiveFrame(const uint8_t* data, size_t length);
+  void queueCommand(const FrameAssembler::Message& message, const char* error, uint8_t version);
+  void handleCompleteCommand(const FrameAssembler::Message& message);
+  void notifyFragment(const uint8_t* data, size_t length);
+  void resetFlowControl();
+  static void gattsEventHandler(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t* param);
+  
+  friend class BLEResponseStream;
 
 public:
   BLEManager(const String& name, CRUDHandler* cmdHandler);
@@ -55,15 +115,64 @@ public:
   bool begin();
   void stop();
   
-  // Response methods
-  void sendResponse(const JsonDocument& data);
-  void sendError(const String& message);
-  void sendSuccess();
+  // ResponseSink
+  Print& beginResponse() override;
+  void endResponse() override;
+  void sendResponse(const JsonDocument& data) override;  // Safe from any task
+  bool supportsStreaming() const override { return true; }
+  
+  // Throughput of the current connection
+  bool getLinkStats(JsonObject& result) override;
+  
+  // Response encoding for the rest of the session: "lzss" or "none". Only
+  // sessions using v2 framing can compress, since v1 ends messages in-band.
+  bool setResponseEncoding(const String& encoding, String& error) override;
+  const char* getResponseEncoding() const override { return compressResponses ? "lzss" : "none"; }
   
   // BLE callbacks
   void onConnect(BLEServer* pServer) override;
   void onDisconnect(BLEServer* pServer) override;
+  void onMtuChanged(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) override;
   void onWrite(BLECharacteristic* pCharacteristic) override;
 };
 
+// Print sink that fragments serialized output into response notifications as it
+// is produced, so a large response never exists as one String. It owns the
+// response channel from construction until end(). Responses use the framing of
+// the request they answer; messages from other tasks use the session's framing.
+class BLEResponseStream : public Print {
+private:
+  BLEManager* manager;
+  uint8_t chunk[MAX_CHUNK_SIZE];
+  size_t chunkSize;  // Fixed for the whole response
+  size_t used;
+  bool open;
+  
+  // v2 responses: each notification is a frame; the header is filled in on flush
+  bool framed;
+  uint16_t messageId;
+  uint16_t sequence;
+  size_t headerSize;
+  uint8_t frameFlags;      // FRAME_COMPRESSED when the session compresses responses
+  LzssEncoder* encoder;    // Output goes through the encoder before framing, or nullptr
+  
+  void append(const uint8_t* buffer, size_t size);
+  void flush(bool last);
+  static void appendCompressed(void* context, const uint8_t* data, size_t size);
+
+public:
+  // Takes the response channel unless `openNow` is false (see begin())
+  BLEResponseStream(BLEManager* owner, bool openNow = true);
+  ~BLEResponseStream();
+  
+  size_t write(uint8_t value) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  
+  // Take the response channel and start a response
+  void begin();
+  
+  // Send the last partial fragment and the end marker, then release the channel
+  void end();
+};
+
 #endif
\ No newline at end of file
@@ -1,212 +1,677 @@
 #include "CRUDHandler.h"
-#include "BLEManager.h"
-#include "QueueManager.h"
+#include "StreamSubscriptions.h"
+#include "PsramJson.h"
+#include <esp_heap_caps.h>
 
 CRUDHandler::CRUDHandler(ConfigManager* config, ServerConfig* serverCfg, LoggingConfig* loggingCfg) 
-  : configManager(config), serverConfig(serverCfg), loggingConfig(loggingCfg), streamDeviceId("") {}
-
-void CRUDHandler::handle(BLEManager* manager, const JsonDocument& command) {
-  String op = command["op"] | "";
-  String type = command["type"] | "";
-  
-  Serial.printf("DEBUG: Command - op: '%s', type: '%s'\n", op.c_str(), type.c_str());
-  
-  if (op == "read") {
-    handleRead(manager, type, command);
-  } else if (op == "create") {
-    handleCreate(manager, type, command);
-  } else if (op == "update") {
-    handleUpdate(manager, type, command);
-  } else if (op == "delete") {
-    handleDelete(manager, type, command);
+  : configManager(config), serverConfig(serverCfg), loggingConfig(loggingCfg),
+    importStaging(nullptr), importReplace(false), importSink(nullptr), importLastChunk(0), endedSession(nullptr) {
+  commandMutex = xSemaphoreCreateRecursiveMutex();
+  registerCommands();
+}
+
+CRUDHandler::~CRUDHandler() {
+  discardImport();
+  if (commandMutex) {
+    vSemaphoreDelete(commandMutex);
+  }
+}
+
+void CRUDHandler::registerCommands() {
+  commands.add("read", "devices", &CRUDHandler::readDevices);
+  commands.add("read", "devices_summary", &CRUDHandler::readDevicesSummary);
+  commands.add("read", "device", &CRUDHandler::readDevice);
+  commands.add("read", "registers", &CRUDHandler::readRegisters);
+  commands.add("read", "registers_summary", &CRUDHandler::readRegisters);
+  commands.add("read", "server_config", &CRUDHandler::readServerConfig);
+  commands.add("read", "logging_config", &CRUDHandler::readLoggingConfig);
+  commands.add("read", "memory_report", &CRUDHandler::readMemoryReport);
+  commands.add("read", "link_stats", &CRUDHandler::readLinkStats);
+  commands.add("read", "data", &CRUDHandler::readData);
+  commands.add("create", "device", &CRUDHandler::createDevice);
+  commands.add("create", "register", &CRUDHandler::createRegister);
+  commands.add("update", "server_config", &CRUDHandler::updateServerConfig);
+  commands.add("update", "logging_config", &CRUDHandler::updateLoggingConfig);
+  commands.add("update", "device", &CRUDHandler::updateDevice);
+  commands.add("update", "register", &CRUDHandler::updateRegister);
+  commands.add("update", "session", &CRUDHandler::updateSession);
+  commands.add("delete", "device", &CRUDHandler::deleteDevice);
+  commands.add("delete", "register", &CRUDHandler::deleteRegister);
+  commands.add("import", "devices", &CRUDHandler::importDevices);
+  commands.add("export", "devices", &CRUDHandler::exportDevices);
+  commands.add("batch", "", &CRUDHandler::runBatch);
+}
+
+void CRUDHandler::handle(ResponseSink& out, const JsonDocument& command) {
+  const char* op = command["op"] | "";
+  const char* type = command["type"] | "";
+  
+  Serial.printf("DEBUG: Command - op: '%s', type: '%s'\n", op, type);
+  
+  xSemaphoreTakeRecursive(commandMutex, portMAX_DELAY);
+  ResponseSink* ended = endedSession;
+  if (ended) {
+    endedSession = nullptr;
+    if (ended == importSink) {
+      discardImport();
+    }
+  }
+  
+  const CommandHandler* handler = commands.find(op, type);
+  if (handler) {
+    (this->*(*handler))(out, command);
+  } else if (commands.hasOp(op)) {
+    out.sendError(String("Unsupported ") + op + " type: " + type);
   } else {
-    manager->sendError("Unsupported operation: " + op);
+    out.sendError(String("Unsupported operation: ") + op);
   }
+  xSemaphoreGiveRecursive(commandMutex);
 }
 
-void CRUDHandler::handleRead(BLEManager* manager, const String& type, const JsonDocument& command) {
-  if (type == "devices") {
-    DynamicJsonDocument response(512);
+// Builds an "ok" response with `fill`, retrying with a larger document while
+// it overflows. Returns false when `fill` reports a failure (nothing is sent).
+template <typename Fill>
+bool CRUDHandler::sendSized(ResponseSink& out, Fill fill) {
+  for (size_t capacity = RESPONSE_MIN_CAPACITY; capacity <= RESPONSE_MAX_CAPACITY; capacity *= 2) {
+    DynamicJsonDocument response(capacity);
     response["status"] = "ok";
+    if (!fill(response)) return false;
+    if (!response.overflowed()) {
+      out.sendResponse(response);
+      return true;
+    }
+  }
+  out.sendError("Response too large");
+  return true;
+}
+
+void CRUDHandler::sendMessage(ResponseSink& out, const char* message) {
+  DynamicJsonDocument response(128);
+  response["status"] = "ok";
+  response["message"] = message;
+  out.sendResponse(response);
+}
+
+void CRUDHandler::readDevices(ResponseSink& out, const JsonDocument& command) {
+  sendSized(out, [&](JsonDocument& response) {
     JsonArray devices = response.createNestedArray("devices");
     configManager->listDevices(devices);
-    manager->sendResponse(response);
-    
-  } else if (type == "devices_summary") {
-    DynamicJsonDocument response(1024);
-    response["status"] = "ok";
+    return true;
+  });
+}
+
+void CRUDHandler::readDevicesSummary(ResponseSink& out, const JsonDocument& command) {
+  sendSized(out, [&](JsonDocument& response) {
     JsonArray summary = response.createNestedArray("devices_summary");
     configManager->getDevicesSummary(summary);
-    manager->sendResponse(response);
-    
-  } else if (type == "device") {
-    String deviceId = command["device_id"] | "";
-    DynamicJsonDocument response(1024);
-    response["status"] = "ok";
+    return true;
+  });
+}
+
+void CRUDHandler::readDevice(ResponseSink& out, const JsonDocument& command) {
+  String deviceId = command["device_id"] | "";
+  bool found = sendSized(out, [&](JsonDocument& response) {
     JsonObject data = response.createNestedObject("data");
-    if (configManager->readDevice(deviceId, data)) {
-      manager->sendResponse(response);
-    } else {
-      manager->sendError("Device not found");
+    return configManager->readDevice(deviceId, data);
+  });
+  if (!found) {
+    out.sendError("Device not found");
+  }
+}
+
+// Register listings are paginated and serialized straight into the response,
+// one register at a time
+void CRUDHandler::readRegisters(ResponseSink& out, const JsonDocument& command) {
+  String deviceId = command["device_id"] | "";
+  if (!configManager->hasDevice(deviceId)) {
+    out.sendError("No registers found");
+    return;
+  }
+  
+  const char* type = command["type"];
+  size_t offset = command["offset"] | 0;
+  size_t limit = command["limit"] | 0;
+  Print& stream = out.beginResponse();
+  stream.print("{\"status\":\"ok\",\"offset\":");
+  stream.print(offset);
+  stream.print(",\"");
+  stream.print(type);
+  stream.print("\":");
+  int total = configManager->streamRegisters(deviceId, stream, offset, limit, strcmp(type, "registers_summary") == 0);
+  stream.print(",\"total\":");
+  stream.print(total < 0 ? 0 : total);
+  stream.print('}');
+  out.endResponse();
+}
+
+void CRUDHandler::readServerConfig(ResponseSink& out, const JsonDocument& command) {
+  bool found = sendSized(out, [&](JsonDocument& response) {
+    JsonObject serverConfigObj = response.createNestedObject("server_config");
+    return serverConfig->getConfig(serverConfigObj);
+  });
+  if (!found) {
+    out.sendError("Failed to get server config");
+  }
+}
+
+void CRUDHandler::readLoggingConfig(ResponseSink& out, const JsonDocument& command) {
+  bool found = sendSized(out, [&](JsonDocument& response) {
+    JsonObject loggingConfigObj = response.createNestedObject("logging_config");
+    return loggingConfig->getConfig(loggingConfigObj);
+  });
+  if (!found) {
+    out.sendError("Failed to get logging config");
+  }
+}
+
+void CRUDHandler::readMemoryReport(ResponseSink& out, const JsonDocument& command) {
+  sendSized(out, [&](JsonDocument& response) {
+    JsonObject report = response.createNestedObject("memory_report");
+    configManager->getMemoryReport(report);
+    return true;
+  });
+}
+
+void CRUDHandler::readLinkStats(ResponseSink& out, const JsonDocument& command) {
+  bool supported = sendSized(out, [&](JsonDocument& response) {
+    JsonObject stats = response.createNestedObject("link_stats");
+    return out.getLinkStats(stats);
+  });
+  if (!supported) {
+    out.sendError("No link statistics for this transport");
+  }
+}
+
+// Live data subscriptions. A bare "device_id" streams one whole device, as
+// before; "subscriptions" lists devices and registers with per-register rate
+// limits. The reply lists what is now subscribed.
+void CRUDHandler::readData(ResponseSink& out, const JsonDocument& command) {
+  if (!out.supportsStreaming()) {
+    out.sendError("Live data streaming is only available over BLE");
+    return;
+  }
+  
+  StreamSubscriptions* streams = StreamSubscriptions::getInstance();
+  String device = command["device_id"] | "";
+  
+  if (device == "stop") {
+    streams->clear();
+    Serial.println("Data streaming stopped");
+    sendMessage(out, "Data streaming stopped");
+    return;
+  }
+  
+  String error;
+  bool applied = true;
+  if (!device.isEmpty()) {
+    DynamicJsonDocument single(256);
+    single.createNestedObject()["device_id"] = device;
+    applied = streams->apply(single.as<JsonArrayConst>(), "replace", error);
+  } else if (command.containsKey("subscriptions")) {
+    applied = streams->apply(command["subscriptions"].as<JsonArrayConst>(), command["mode"] | "replace", error);
+  }
+  if (!applied) {
+    out.sendError(error);
+    return;
+  }
+  
+  sendSized(out, [&](JsonDocument& response) {
+    if (!device.isEmpty()) {
+      response["message"] = "Data streaming started for device: " + device;
     }
-    
-  } else if (type == "registers") {
-    String deviceId = command["device_id"] | "";
-    DynamicJsonDocument response(1024);
+    JsonArray subscriptions = response.createNestedArray("subscriptions");
+    streams->getSubscriptions(subscriptions);
+    JsonObject stats = response.createNestedObject("stream_stats");
+    streams->getStats(stats);
+    return true;
+  });
+}
+
+void CRUDHandler::createDevice(ResponseSink& out, const JsonDocument& command) {
+  JsonObjectConst config = command["config"];
+  String deviceId = configManager->createDevice(config);
+  if (!deviceId.isEmpty()) {
+    DynamicJsonDocument response(128);
     response["status"] = "ok";
-    JsonArray registers = response.createNestedArray("registers");
-    if (configManager->listRegisters(deviceId, registers)) {
-      manager->sendResponse(response);
-    } else {
-      manager->sendError("No registers found");
-    }
-    
-  } else if (type == "registers_summary") {
-    String deviceId = command["device_id"] | "";
-    DynamicJsonDocument response(1024);
+    response["device_id"] = deviceId;
+    out.sendResponse(response);
+  } else {
+    out.sendError("Device creation failed");
+  }
+}
+
+void CRUDHandler::createRegister(ResponseSink& out, const JsonDocument& command) {
+  String deviceId = command["device_id"] | "";
+  JsonObjectConst config = command["config"];
+  String registerId = configManager->createRegister(deviceId, config);
+  if (!registerId.isEmpty()) {
+    DynamicJsonDocument response(128);
     response["status"] = "ok";
-    JsonArray summary = response.createNestedArray("registers_summary");
-    if (configManager->getRegistersSummary(deviceId, summary)) {
-      manager->sendResponse(response);
-    } else {
-      manager->sendError("No registers found");
-    }
-    
-  } else if (type == "server_config") {
-    DynamicJsonDocument response(2048);
+    response["register_id"] = registerId;
+    out.sendResponse(response);
+  } else {
+    out.sendError("Register creation failed");
+  }
+}
+
+void CRUDHandler::updateServerConfig(ResponseSink& out, const JsonDocument& command) {
+  JsonObjectConst config = command["config"];
+  if (serverConfig->updateConfig(config)) {
+    sendMessage(out, "Server configuration updated");
+  } else {
+    out.sendError("Server configuration update failed");
+  }
+}
+
+void CRUDHandler::updateLoggingConfig(ResponseSink& out, const JsonDocument& command) {
+  JsonObjectConst config = command["config"];
+  if (loggingConfig->updateConfig(config)) {
+    sendMessage(out, "Logging configuration updated");
+  } else {
+    out.sendError("Logging configuration update failed");
+  }
+}
+
+void CRUDHandler::updateDevice(ResponseSink& out, const JsonDocument& command) {
+  String deviceId = command["device_id"] | "";
+  JsonObjectConst config = command["config"];
+  String error;
+  if (configManager->updateDevice(deviceId, config, error)) {
+    sendMessage(out, "Device updated");
+  } else {
+    out.sendError("Device update failed: " + error);
+  }
+}
+
+void CRUDHandler::updateRegister(ResponseSink& out, const JsonDocument& command) {
+  String deviceId = command["device_id"] | "";
+  String registerId = command["register_id"] | "";
+  JsonObjectConst config = command["config"];
+  String error;
+  if (configManager->updateRegister(deviceId, registerId, config, error)) {
+    sendMessage(out, "Register updated");
+  } else {
+    out.sendError("Register update failed: " + error);
+  }
+}
+
+// Frames carry FRAME_COMPRESSED, so the reply is already in the new encoding
+void CRUDHandler::updateSession(ResponseSink& out, const JsonDocument& command) {
+  String encoding = command["config"]["compression"] | "none";
+  String error;
+  if (out.setResponseEncoding(encoding, error)) {
+    DynamicJsonDocument response(128);
     response["status"] = "ok";
-    JsonObject serverConfigObj = response.createNestedObject("server_config");
-    if (serverConfig->getConfig(serverConfigObj)) {
-      manager->sendResponse(response);
-    } else {
-      manager->sendError("Failed to get server config");
+    response["compression"] = out.getResponseEncoding();
+    out.sendResponse(response);
+  } else {
+    out.sendError("Session update failed: " + error);
+  }
+}
+
+void CRUDHandler::deleteDevice(ResponseSink& out, const JsonDocument& command) {
+  String deviceId = command["device_id"] | "";
+  if (configManager->deleteDevice(deviceId)) {
+    sendMessage(out, "Device deleted");
+  } else {
+    out.sendError("Device deletion failed");
+  }
+}
+
+void CRUDHandler::deleteRegister(ResponseSink& out, const JsonDocument& command) {
+  String deviceId = command["device_id"] | "";
+  String registerId = command["register_id"] | "";
+  if (configManager->deleteRegister(deviceId, registerId)) {
+    sendMessage(out, "Register deleted");
+  } else {
+    out.sendError("Register deletion failed");
+  }
+}
+
+// Never waits for the command lock: a transport callback may run while that
+// transport's own command is sending. If the lock is busy, the next command
+// picks the ended session up.
+void CRUDHandler::endSession(ResponseSink& sink) {
+  if (xSemaphoreTakeRecursive(commandMutex, 0) != pdTRUE) {
+    endedSession = &sink;
+    return;
+  }
+  if (importSink == &sink) {
+    discardImport();
+  }
+  xSemaphoreGiveRecursive(commandMutex);
+}
+
+void CRUDHandler::discardImport() {
+  delete importStaging;
+  importStaging = nullptr;
+  importReplace = false;
+  importSink = nullptr;
+}
+
+// Appends a chunk to the staged device list, growing the staging document
+// geometrically so a long stream is not copied once per chunk
+bool CRUDHandler::stageImport(JsonArrayConst devices) {
+  size_t needed = jsonCapacityFor(measureJson(devices));
+  size_t used = importStaging ? importStaging->memoryUsage() : 0;
+  size_t capacity = importStaging ? importStaging->capacity() : 0;
+  
+  if (capacity - used < needed) {
+    size_t grown = capacity * 2 > used + needed ? capacity * 2 : used + needed + JSON_ARRAY_SIZE(1);
+    DynamicJsonDocument* next = new DynamicJsonDocument(grown);
+    if (next->capacity() == 0) {
+      delete next;
+      return false;
     }
-    
-  } else if (type == "logging_config") {
-    DynamicJsonDocument response(512);
-    response["status"] = "ok";
-    JsonObject loggingConfigObj = response.createNestedObject("logging_config");
-    if (loggingConfig->getConfig(loggingConfigObj)) {
-      manager->sendResponse(response);
+    if (importStaging) {
+      next->set(*importStaging);
     } else {
-      manager->sendError("Failed to get logging config");
+      next->to<JsonArray>();
     }
-    
-  } else if (type == "data") {
-    String device = command["device_id"] | "";
-    Serial.printf("DEBUG: Received device_id field: '%s'\n", device.c_str());
-    if (device == "stop") {
-      streamDeviceId = "";
-      Serial.println("Data streaming stopped");
-      QueueManager* queueMgr = QueueManager::getInstance();
-      if (queueMgr) {
-        queueMgr->clearStream();
-      }
-      DynamicJsonDocument response(128);
-      response["status"] = "ok";
-      response["message"] = "Data streaming stopped";
-      manager->sendResponse(response);
-    } else if (!device.isEmpty()) {
-      streamDeviceId = device;
-      Serial.printf("Data streaming started for device: %s\n", device.c_str());
-      DynamicJsonDocument response(128);
-      response["status"] = "ok";
-      response["message"] = "Data streaming started for device: " + device;
-      manager->sendResponse(response);
-    } else {
-      Serial.println("ERROR: Empty device ID received");
-      manager->sendError("Empty device ID");
+    delete importStaging;
+    importStaging = next;
+  }
+  
+  JsonArray staged = importStaging->as<JsonArray>();
+  for (JsonVariantConst device : devices) {
+    copyJsonElement(staged, device);
+  }
+  return !importStaging->overflowed();
+}
+
+void CRUDHandler::importDevices(ResponseSink& out, const JsonDocument& command) {
+  if (importStaging && millis() - importLastChunk > IMPORT_TIMEOUT_MS) {
+    Serial.println("Discarding abandoned import stream");
+    discardImport();
+  }
+  if (importStaging && importSink != &out) {
+    out.sendError("Another client's import is in progress");
+    return;
+  }
+  
+  JsonArrayConst devices = command["devices"];
+  if (devices.isNull()) {
+    discardImport();
+    out.sendError("Import requires a devices array");
+    return;
+  }
+  if (!importStaging) {
+    importReplace = strcmp(command["mode"] | "merge", "replace") == 0;
+  }
+  
+  // A single-command import is applied straight from the command document
+  bool more = command["more"] | false;
+  if (more || importStaging) {
+    importSink = &out;
+    importLastChunk = millis();
+    if (!stageImport(devices)) {
+      discardImport();
+      out.sendError("Import staging out of memory");
+      return;
     }
-    
+    devices = importStaging->as<JsonArrayConst>();
+  }
+  
+  if (more) {
+    DynamicJsonDocument response(128);
+    response["status"] = "ok";
+    response["staged"] = devices.size();
+    out.sendResponse(response);
+    return;
+  }
+  
+  // Sized up front: the import must run exactly once, so it cannot go through sendSized
+  size_t count = devices.size();
+  DynamicJsonDocument response(JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(count) + count * 12 + 64);
+  response["status"] = "ok";
+  JsonArray deviceIds = response.createNestedArray("device_ids");
+  String error;
+  bool imported = configManager->importDevices(devices, importReplace, deviceIds, error);
+  
+  size_t registerCount = 0;
+  for (JsonVariantConst device : devices) {
+    registerCount += device["registers"].size();
+  }
+  discardImport();
+  
+  if (imported) {
+    response["devices"] = count;
+    response["registers"] = registerCount;
+    out.sendResponse(response);
   } else {
-    manager->sendError("Unsupported read type: " + type);
+    out.sendError("Import failed: " + error);
   }
 }
 
-void CRUDHandler::handleCreate(BLEManager* manager, const String& type, const JsonDocument& command) {
-  if (type == "device") {
-    JsonObjectConst config = command["config"];
-    String deviceId = configManager->createDevice(config);
-    if (!deviceId.isEmpty()) {
-      DynamicJsonDocument response(128);
-      response["status"] = "ok";
-      response["device_id"] = deviceId;
-      manager->sendResponse(response);
-    } else {
-      manager->sendError("Device creation failed");
+// Streams the whole device tree in the format "import" accepts
+void CRUDHandler::exportDevices(ResponseSink& out, const JsonDocument& command) {
+  Print& stream = out.beginResponse();
+  stream.print("{\"status\":\"ok\",\"devices\":");
+  int total = configManager->streamDevices(stream);
+  stream.print(",\"total\":");
+  stream.print(total);
+  stream.print('}');
+  out.endResponse();
+}
+
+// Growable PSRAM buffer the batch results are collected in while the config
+// write lock is held; they go to the transport only once it is released, so
+// a slow link never holds up other config writers
+class BatchResultBuffer : public Print {
+private:
+  uint8_t* data;
+  size_t length;
+  size_t capacity;
+  bool overflow;
+
+public:
+  BatchResultBuffer() : data(nullptr), length(0), capacity(0), overflow(false) {}
+  ~BatchResultBuffer() { heap_caps_free(data); }
+  
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    if (overflow) return 0;
+    if (length + size > capacity) {
+      size_t grown = capacity ? capacity : 4096;
+      while (grown < length + size) grown *= 2;
+      uint8_t* larger = (uint8_t*)heap_caps_realloc(data, grown, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+      if (!larger) {
+        overflow = true;
+        return 0;
+      }
+      data = larger;
+      capacity = grown;
     }
+    memcpy(data + length, buffer, size);
+    length += size;
+    return size;
+  }
+  
+  const uint8_t* getData() const { return data; }
+  size_t getLength() const { return length; }
+  bool overflowed() const { return overflow; }
+};
+
+// Writes each batch operation's response into the batch response as one compact
+// result: "status" and "message" are dropped from successes and errors become
+// {"error": ...}. Streamed responses (register pages) are embedded as sent.
+// Transport features are those of the sink the batch answers on.
+class BatchResultSink : public ResponseSink {
+private:
+  ResponseSink& parent;
+  Print& out;
+  size_t results;
+
+public:
+  bool failed;      // Outcome of the current operation
+  String createdId; // device_id/register_id the current operation returned
+  
+  BatchResultSink(ResponseSink& transport, Print& stream)
+    : parent(transport), out(stream), results(0), failed(false) {}
     
-  } else if (type == "register") {
-    String deviceId = command["device_id"] | "";
-    JsonObjectConst config = command["config"];
-    String registerId = configManager->createRegister(deviceId, config);
-    if (!registerId.isEmpty()) {
-      DynamicJsonDocument response(128);
-      response["status"] = "ok";
-      response["register_id"] = registerId;
-      manager->sendResponse(response);
-    } else {
-      manager->sendError("Register creation failed");
+  void nextOperation() {
+    if (results++ > 0) {
+      out.print(',');
     }
-    
-  } else {
-    manager->sendError("Unsupported create type: " + type);
+    failed = false;
+    createdId = "";
   }
-}
-
-void CRUDHandler::handleUpdate(BLEManager* manager, const String& type, const JsonDocument& command) {
-  if (type == "server_config") {
-    JsonObjectConst config = command["config"];
-    if (serverConfig->updateConfig(config)) {
-      DynamicJsonDocument response(128);
-      response["status"] = "ok";
-      response["message"] = "Server configuration updated";
-      manager->sendResponse(response);
-    } else {
-      manager->sendError("Server configuration update failed");
+  
+  Print& beginResponse() override { return out; }
+  void endResponse() override {}
+  
+  void sendResponse(const JsonDocument& data) override {
+    if (strcmp(data["status"] | "", "error") == 0) {
+      failed = true;
+      out.print("{\"error\":");
+      serializeJson(data["message"], out);
+      out.print('}');
+      return;
     }
     
-  } else if (type == "logging_config") {
-    JsonObjectConst config = command["config"];
-    if (loggingConfig->updateConfig(config)) {
-      DynamicJsonDocument response(128);
-      response["status"] = "ok";
-      response["message"] = "Logging configuration updated";
-      manager->sendResponse(response);
-    } else {
-      manager->sendError("Logging configuration update failed");
+    out.print('{');
+    bool first = true;
+    for (JsonPairConst kv : data.as<JsonObjectConst>()) {
+      if (kv.key() == "status" || kv.key() == "message") continue;
+      if (!first) {
+        out.print(',');
+      }
+      first = false;
+      out.print('"');
+      out.print(kv.key().c_str());
+      out.print("\":");
+      serializeJson(kv.value(), out);
     }
+    out.print('}');
     
+    if (data.containsKey("register_id")) {
+      createdId = data["register_id"].as<const char*>();
+    } else if (data.containsKey("device_id")) {
+      createdId = data["device_id"].as<const char*>();
+    }
+  }
+  
+  bool supportsStreaming() const override { return parent.supportsStreaming(); }
+  bool getLinkStats(JsonObject& result) override { return parent.getLinkStats(result); }
+  bool setResponseEncoding(const String& encoding, String& error) override {
+    return parent.setResponseEncoding(encoding, error);
+  }
+  const char* getResponseEncoding() const override { return parent.getResponseEncoding(); }
+};
+
+// Runs "operations" in order against one config working copy that is persisted
+// and published once. Results are collected in operation order and sent once
+// the working copy has been committed or discarded. A later operation can
+// name the ID created by operation n as "$n". With "atomic": true
+// the batch stops at the first failure and nothing is committed; otherwise the
+// successful operations are committed. Reads see the config from before the batch.
+void CRUDHandler::runBatch(ResponseSink& out, const JsonDocument& command) {
+  JsonArrayConst operations = command["operations"];
+  if (operations.isNull() || operations.size() == 0) {
+    out.sendError("Batch requires an operations array");
+    return;
+  }
+  if (operations.size() > MAX_BATCH_OPERATIONS) {
+    out.sendError("Batch limited to " + String(MAX_BATCH_OPERATIONS) + " operations");
+    return;
+  }
+  bool atomic = command["atomic"] | false;
+  
+  // Room for the operations' content plus the IDs created for it
+  size_t extraBytes = jsonCapacityFor(measureJson(operations)) + operations.size() * (JSON_OBJECT_SIZE(1) + 8);
+  if (!configManager->beginBatch(extraBytes)) {
+    out.sendError("Config busy");
+    return;
+  }
+  
+  String* createdIds = new String[operations.size()];
+  BatchResultBuffer buffered;
+  BatchResultSink results(out, buffered);
+  size_t executed = 0;
+  bool aborted = false;
+  for (JsonVariantConst operation : operations) {
+    results.nextOperation();
+    runBatchOperation(results, operation.as<JsonObjectConst>(), createdIds, executed);
+    createdIds[executed++] = results.createdId;
+    if (results.failed && atomic) {
+      aborted = true;
+      break;
+    }
+  }
+  delete[] createdIds;
+  
+  String error = "Batch aborted at operation " + String(executed - 1);
+  bool committed = false;
+  if (aborted) {
+    configManager->abortBatch();
   } else {
-    manager->sendError("Unsupported update type: " + type);
+    committed = configManager->commitBatch(error);
+  }
+  
+  // Results that ran out of memory are dropped, the outcome is still reported
+  Print& stream = out.beginResponse();
+  stream.print("{\"results\":[");
+  if (!buffered.overflowed()) {
+    stream.write(buffered.getData(), buffered.getLength());
+  }
+  stream.print("],\"executed\":");
+  stream.print(executed);
+  stream.print(",\"committed\":");
+  stream.print(committed ? "true" : "false");
+  if (buffered.overflowed()) {
+    stream.print(",\"results_dropped\":true");
   }
+  if (committed) {
+    stream.print(",\"status\":\"ok\"}");
+  } else {
+    DynamicJsonDocument message(128);
+    message.set(error);
+    stream.print(",\"status\":\"error\",\"message\":");
+    serializeJson(message, stream);
+    stream.print('}');
+  }
+  out.endResponse();
 }
 
-void CRUDHandler::handleDelete(BLEManager* manager, const String& type, const JsonDocument& command) {
-  if (type == "device") {
-    String deviceId = command["device_id"] | "";
-    if (configManager->deleteDevice(deviceId)) {
-      DynamicJsonDocument response(128);
-      response["status"] = "ok";
-      response["message"] = "Device deleted";
-      manager->sendResponse(response);
-    } else {
-      manager->sendError("Device deletion failed");
+void CRUDHandler::runBatchOperation(ResponseSink& out, JsonObjectConst operation, const String* createdIds, size_t index) {
+  // Only device and register commands belong to the batch's config
+  // transaction; anything else would take effect even if the batch aborts
+  static const char* const BATCH_TYPES[] = {
+    "device", "devices", "devices_summary", "register", "registers", "registers_summary"
+  };
+  const char* op = operation["op"] | "";
+  const char* type = operation["type"] | "";
+  bool allowed = strcmp(op, "read") == 0 || strcmp(op, "create") == 0 ||
+                 strcmp(op, "update") == 0 || strcmp(op, "delete") == 0;
+  if (allowed) {
+    allowed = false;
+    for (const char* batchType : BATCH_TYPES) {
+      if (strcmp(type, batchType) == 0) {
+        allowed = true;
+        break;
+      }
     }
+  }
+  if (!allowed) {
+    out.sendError(String("Operation not allowed in a batch: ") + op + (type[0] ? String(" ") + type : String()));
+    return;
+  }
+  
+  DynamicJsonDocument single(jsonCapacityFor(measureJson(operation)) + 64);
+  single.set(operation);
+  
+  static const char* const REFERENCE_KEYS[] = { "device_id", "register_id" };
+  for (const char* key : REFERENCE_KEYS) {
+    const char* value = operation[key];
+    if (!value || value[0] != '$') continue;
     
-  } else if (type == "register") {
-    String deviceId = command["device_id"] | "";
-    String registerId = command["register_id"] | "";
-    if (configManager->deleteRegister(deviceId, registerId)) {
-      DynamicJsonDocument response(128);
-      response["status"] = "ok";
-      response["message"] = "Register deleted";
-      manager->sendResponse(response);
-    } else {
-      manager->sendError("Register deletion failed");
+    char* end = nullptr;
+    unsigned long reference = strtoul(value + 1, &end, 10);
+    if (end == value + 1 || *end != '\0' || reference >= index || createdIds[reference].isEmpty()) {
+      out.sendError(String("Unresolved reference: ") + value);
+      return;
     }
-    
-  } else {
-    manager->sendError("Unsupported delete type: " + type);
+    single[key] = createdIds[reference];
   }
+  handle(out, single);
 }
\ No newline at end of file
@@ -2,31 +2,87 @@
 #define CRUD_HANDLER_H
 
 #include <ArduinoJson.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include "ConfigManager.h"
 #include "ServerConfig.h"
 #include "LoggingConfig.h"
-
-class BLEManager; // Forward declaration
+#include "ResponseSink.h"
+#include "CommandTable.h"
 
 class CRUDHandler {
 private:
   ConfigManager* configManager;
   ServerConfig* serverConfig;
   LoggingConfig* loggingConfig;
-  String streamDeviceId;
   
-  // Operation handlers
-  void handleRead(BLEManager* manager, const String& type, const JsonDocument& command);
-  void handleCreate(BLEManager* manager, const String& type, const JsonDocument& command);
-  void handleUpdate(BLEManager* manager, const String& type, const JsonDocument& command);
-  void handleDelete(BLEManager* manager, const String& type, const JsonDocument& command);
+  // BLE and MQTT commands arrive on different tasks and run one at a time.
+  // Recursive, since a batch runs its operations through handle().
+  SemaphoreHandle_t commandMutex;
+  
+  // Streamed bulk import: chunks sent with "more": true are staged here and
+  // applied together with the final chunk. The stream belongs to the sink
+  // that started it and is dropped when that session ends or goes quiet.
+  static const uint32_t IMPORT_TIMEOUT_MS = 60000;
+  DynamicJsonDocument* importStaging;
+  bool importReplace;         // From the first chunk
+  ResponseSink* importSink;
+  uint32_t importLastChunk;
+  ResponseSink* volatile endedSession;    // Set by endSession() while a command runs
+  
+  // One handler per op/type, registered in the constructor
+  typedef void (CRUDHandler::*CommandHandler)(ResponseSink& out, const JsonDocument& command);
+  static const int MAX_COMMANDS = 32;
+  CommandTable<CommandHandler, MAX_COMMANDS> commands;
+  void registerCommands();
+  
+  // Response documents start small and double until the payload fits
+  static const size_t RESPONSE_MIN_CAPACITY = 512;
+  static const size_t RESPONSE_MAX_CAPACITY = 256 * 1024;
+  template <typename Fill>
+  bool sendSized(ResponseSink& out, Fill fill);
+  
+  // Command handlers
+  void readDevices(ResponseSink& out, const JsonDocument& command);
+  void readDevicesSummary(ResponseSink& out, const JsonDocument& command);
+  void readDevice(ResponseSink& out, const JsonDocument& command);
+  void readRegisters(ResponseSink& out, const JsonDocument& command);
+  void readServerConfig(ResponseSink& out, const JsonDocument& command);
+  void readLoggingConfig(ResponseSink& out, const JsonDocument& command);
+  void readMemoryReport(ResponseSink& out, const JsonDocument& command);
+  void readLinkStats(ResponseSink& out, const JsonDocument& command);
+  void readData(ResponseSink& out, const JsonDocument& command);
+  void createDevice(ResponseSink& out, const JsonDocument& command);
+  void createRegister(ResponseSink& out, const JsonDocument& command);
+  void updateServerConfig(ResponseSink& out, const JsonDocument& command);
+  void updateLoggingConfig(ResponseSink& out, const JsonDocument& command);
+  void updateDevice(ResponseSink& out, const JsonDocument& command);
+  void updateRegister(ResponseSink& out, const JsonDocument& command);
+  void updateSession(ResponseSink& out, const JsonDocument& command);
+  void deleteDevice(ResponseSink& out, const JsonDocument& command);
+  void deleteRegister(ResponseSink& out, const JsonDocument& command);
+  void importDevices(ResponseSink& out, const JsonDocument& command);
+  void exportDevices(ResponseSink& out, const JsonDocument& command);
+  void runBatch(ResponseSink& out, const JsonDocument& command);
+  
+  bool stageImport(JsonArrayConst devices);
+  void discardImport();
+  void sendMessage(ResponseSink& out, const char* message);
+  
+  // Batches run up to MAX_BATCH_OPERATIONS operations in one config write
+  static const size_t MAX_BATCH_OPERATIONS = 64;
+  void runBatchOperation(ResponseSink& out, JsonObjectConst operation, const String* createdIds, size_t index);
 
 public:
   CRUDHandler(ConfigManager* config, ServerConfig* serverCfg, LoggingConfig* loggingCfg);
+  ~CRUDHandler();
+  
+  // Run one command and write its response to `out`
+  void handle(ResponseSink& out, const JsonDocument& command);
   
-  void handle(BLEManager* manager, const JsonDocument& command);
-  String getStreamDeviceId() const { return streamDeviceId; }
-  void clearStreamDeviceId() { streamDeviceId = ""; }
+  // The client behind `sink` is gone (BLE disconnect, MQTT reconnect): drop
+  // what it left unfinished. Safe to call from transport callbacks.
+  void endSession(ResponseSink& sink);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,94 @@
+#ifndef COMMAND_TABLE_H
+#define COMMAND_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// FNV-1a over `op`, a separator and `type`: one key per command
+inline uint32_t commandKey(const char* op, const char* type) {
+  uint32_t hash = 2166136261u;
+  for (const char* c = op; *c; c++) {
+    hash = (hash ^ (uint8_t)*c) * 16777619u;
+  }
+  hash = (hash ^ '/') * 16777619u;
+  for (const char* c = type; *c; c++) {
+    hash = (hash ^ (uint8_t)*c) * 16777619u;
+  }
+  return hash;
+}
+
+// Command handlers registered by op/type and kept sorted by hashed key, so a
+// lookup is one hash and a binary search instead of a chain of string compares.
+// Keys are confirmed by comparing the strings, so a hash collision only costs a
+// compare. Op/type strings must outlive the table (string literals).
+//
+// Free of Arduino dependencies so the dispatcher is benchmarked on the host
+// (testing/command_dispatch_benchmark.cpp).
+template <typename Handler, int CAPACITY>
+class CommandTable {
+private:
+  struct Entry {
+    uint32_t key;
+    const char* op;
+    const char* type;
+    Handler handler;
+  };
+  Entry entries[CAPACITY];
+  int count;
+  
+  // First entry whose key is not below `key`
+  int lowerBound(uint32_t key) const {
+    int low = 0;
+    int high = count;
+    while (low < high) {
+      int middle = (low + high) / 2;
+      if (entries[middle].key < key) {
+        low = middle + 1;
+      } else {
+        high = middle;
+      }
+    }
+    return low;
+  }
+
+public:
+  CommandTable() : count(0) {}
+  
+  // False when the table is full or op/type is already registered
+  bool add(const char* op, const char* type, Handler handler) {
+    if (count >= CAPACITY || find(op, type)) return false;
+    
+    uint32_t key = commandKey(op, type);
+    int position = lowerBound(key);
+    for (int i = count; i > position; i--) {
+      entries[i] = entries[i - 1];
+    }
+    entries[position] = {key, op, type, handler};
+    count++;
+    return true;
+  }
+  
+  // Handler for op/type, or nullptr
+  const Handler* find(const char* op, const char* type) const {
+    uint32_t key = commandKey(op, type);
+    for (int i = lowerBound(key); i < count && entries[i].key == key; i++) {
+      if (strcmp(entries[i].op, op) == 0 && strcmp(entries[i].type, type) == 0) {
+        return &entries[i].handler;
+      }
+    }
+    return nullptr;
+  }
+  
+  // Whether any type is registered for `op`; only used to word errors
+  bool hasOp(const char* op) const {
+    for (int i = 0; i < count; i++) {
+      if (strcmp(entries[i].op, op) == 0) return true;
+    }
+    return false;
+  }
+  
+  int size() const { return count; }
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,254 @@
+#include "ConfigIndex.h"
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+// Host builds (testing/config_index_test.cpp) use the plain heap and stdout
+#ifdef ARDUINO
+#include <esp_heap_caps.h>
+#define INDEX_LOG(...) Serial.printf(__VA_ARGS__)
+#else
+#include <stdio.h>
+#define INDEX_LOG(...) printf(__VA_ARGS__)
+#endif
+
+// PSRAM first; free() releases either kind
+static void* indexAlloc(size_t size) {
+  if (size == 0) return nullptr;
+#ifdef ARDUINO
+  void* ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (ptr) return ptr;
+#endif
+  return malloc(size);
+}
+
+ConfigIndex::ConfigIndex() : devices(nullptr), registers(nullptr), deviceSlots(nullptr), registerSlots(nullptr),
+                             deviceMask(0), registerMask(0), deviceLimit(0), registerLimit(0),
+                             deviceSpan(0), registerSpan(0), deviceCursor(0), registerCursor(0),
+                             deviceCount(0), registerCount(0) {}
+
+ConfigIndex::~ConfigIndex() {
+  release();
+}
+
+void ConfigIndex::release() {
+  free(devices);
+  free(registers);
+  free(deviceSlots);
+  free(registerSlots);
+  devices = nullptr;
+  registers = nullptr;
+  deviceSlots = nullptr;
+  registerSlots = nullptr;
+  deviceMask = 0;
+  registerMask = 0;
+  deviceLimit = 0;
+  registerLimit = 0;
+  deviceSpan = 0;
+  registerSpan = 0;
+  deviceCursor = 0;
+  registerCursor = 0;
+  deviceCount = 0;
+  registerCount = 0;
+}
+
+// FNV-1a
+uint32_t ConfigIndex::hashId(const char* id) {
+  uint32_t hash = 2166136261u;
+  while (*id) {
+    hash ^= (uint8_t)*id++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Power-of-two table kept at most half full, so probe sequences stay short
+uint16_t* ConfigIndex::allocSlots(int count, uint32_t& mask) {
+  uint32_t size = 16;
+  while (size < (uint32_t)count * 2) size *= 2;
+  
+  uint16_t* slots = (uint16_t*)indexAlloc(size * sizeof(uint16_t));
+  if (!slots) return nullptr;
+  for (uint32_t i = 0; i < size; i++) {
+    slots[i] = INVALID_HANDLE;
+  }
+  mask = size - 1;
+  return slots;
+}
+
+// Twice the live entries plus some headroom: at least that many new IDs are
+// handed out before a freed handle comes up again. Never smaller than before,
+// so every kept handle still fits and the cursor stays in range.
+uint16_t ConfigIndex::handleSpan(size_t entries, uint16_t previousSpan) {
+  size_t span = entries * 2 + 64;
+  if (span < previousSpan) span = previousSpan;
+  if (span > INVALID_HANDLE) span = INVALID_HANDLE;
+  return (uint16_t)span;
+}
+
+bool ConfigIndex::insertDevice(uint16_t handle) {
+  const char* id = devices[handle].id;
+  for (uint32_t i = hashId(id) & deviceMask; ; i = (i + 1) & deviceMask) {
+    if (deviceSlots[i] == INVALID_HANDLE) {
+      deviceSlots[i] = handle;
+      return true;
+    }
+    if (strcmp(devices[deviceSlots[i]].id, id) == 0) return false;
+  }
+}
+
+bool ConfigIndex::insertRegister(uint16_t handle) {
+  const char* id = registers[handle].id;
+  for (uint32_t i = hashId(id) & registerMask; ; i = (i + 1) & registerMask) {
+    if (registerSlots[i] == INVALID_HANDLE) {
+      registerSlots[i] = handle;
+      return true;
+    }
+    if (strcmp(registers[registerSlots[i]].id, id) == 0) return false;
+  }
+}
+
+uint16_t ConfigIndex::findDevice(const char* id) const {
+  if (!deviceSlots || !id) return INVALID_HANDLE;
+  for (uint32_t i = hashId(id) & deviceMask; ; i = (i + 1) & deviceMask) {
+    uint16_t handle = deviceSlots[i];
+    if (handle == INVALID_HANDLE || strcmp(devices[handle].id, id) == 0) return handle;
+  }
+}
+
+uint16_t ConfigIndex::findRegister(const char* id) const {
+  if (!registerSlots || !id) return INVALID_HANDLE;
+  for (uint32_t i = hashId(id) & registerMask; ; i = (i + 1) & registerMask) {
+    uint16_t handle = registerSlots[i];
+    if (handle == INVALID_HANDLE || strcmp(registers[handle].id, id) == 0) return handle;
+  }
+}
+
+const IndexedDevice* ConfigIndex::device(uint16_t handle) const {
+  if (handle >= deviceLimit || !devices[handle].id) return nullptr;
+  return &devices[handle];
+}
+
+const IndexedRegister* ConfigIndex::reg(uint16_t handle) const {
+  if (handle >= registerLimit || !registers[handle].id) return nullptr;
+  return &registers[handle];
+}
+
+bool ConfigIndex::build(JsonObjectConst devicesConfig, const ConfigIndex* previous) {
+  uint16_t previousDeviceSpan = previous ? previous->deviceSpan : 0;
+  uint16_t previousRegisterSpan = previous ? previous->registerSpan : 0;
+  uint16_t nextDevice = previous ? previous->deviceCursor : 0;
+  uint16_t nextRegister = previous ? previous->registerCursor : 0;
+  release();
+  
+  size_t totalDevices = devicesConfig.size();
+  size_t totalRegisters = 0;
+  for (JsonPairConst kv : devicesConfig) {
+    totalRegisters += kv.value()["registers"].size();
+  }
+  
+  if (totalDevices >= INVALID_HANDLE || totalRegisters >= INVALID_HANDLE) {
+    INDEX_LOG("Config too large to index\n");
+    return false;
+  }
+  size_t deviceHandles = handleSpan(totalDevices, previousDeviceSpan);
+  size_t registerHandles = handleSpan(totalRegisters, previousRegisterSpan);
+  
+  devices = (IndexedDevice*)indexAlloc(deviceHandles * sizeof(IndexedDevice));
+  registers = (IndexedRegister*)indexAlloc(registerHandles * sizeof(IndexedRegister));
+  deviceSlots = allocSlots(totalDevices, deviceMask);
+  registerSlots = allocSlots(totalRegisters, registerMask);
+  if ((deviceHandles && !devices) || (registerHandles && !registers) || !deviceSlots || !registerSlots) {
+    INDEX_LOG("Failed to allocate config index\n");
+    release();
+    return false;
+  }
+  for (size_t i = 0; i < deviceHandles; i++) {
+    new(&devices[i]) IndexedDevice();
+  }
+  for (size_t i = 0; i < registerHandles; i++) {
+    new(&registers[i]) IndexedRegister();
+  }
+  
+  // Devices: keep previous handles first, then hand out free ones from the cursor
+  for (int pass = 0; pass < 2; pass++) {
+    for (JsonPairConst kv : devicesConfig) {
+      const char* id = kv.key().c_str();
+      uint16_t handle = INVALID_HANDLE;
+      
+      if (pass == 0) {
+        handle = previous ? previous->findDevice(id) : INVALID_HANDLE;
+        if (handle == INVALID_HANDLE || handle >= deviceHandles) continue;
+      } else {
+        if (findDevice(id) != INVALID_HANDLE) continue;
+        while (devices[nextDevice].id) nextDevice = (nextDevice + 1) % deviceHandles;
+        handle = nextDevice;
+        nextDevice = (nextDevice + 1) % deviceHandles;
+      }
+      
+      devices[handle].id = id;
+      devices[handle].config = kv.value().as<JsonObjectConst>();
+      insertDevice(handle);
+      deviceCount++;
+      if (handle >= deviceLimit) deviceLimit = handle + 1;
+    }
+  }
+  
+  // Registers, same scheme; duplicated register IDs keep the first occurrence
+  for (int pass = 0; pass < 2; pass++) {
+    for (JsonPairConst kv : devicesConfig) {
+      uint16_t deviceHandle = findDevice(kv.key().c_str());
+      uint16_t position = 0;
+      
+      for (JsonVariantConst regVar : kv.value()["registers"].as<JsonArrayConst>()) {
+        JsonObjectConst reg = regVar.as<JsonObjectConst>();
+        const char* id = reg["register_id"];
+        uint16_t current = position++;
+        if (!id) continue;
+        
+        uint16_t handle = INVALID_HANDLE;
+        if (pass == 0) {
+          handle = previous ? previous->findRegister(id) : INVALID_HANDLE;
+          if (handle == INVALID_HANDLE || handle >= registerHandles || registers[handle].id) continue;
+        } else {
+          uint16_t existing = findRegister(id);
+          if (existing != INVALID_HANDLE) {
+            if (registers[existing].device != deviceHandle || registers[existing].position != current) {
+              INDEX_LOG("Duplicate register id %s ignored\n", id);
+            }
+            continue;
+          }
+          while (registers[nextRegister].id) nextRegister = (nextRegister + 1) % registerHandles;
+          handle = nextRegister;
+          nextRegister = (nextRegister + 1) % registerHandles;
+        }
+        
+        registers[handle].id = id;
+        registers[handle].config = reg;
+        registers[handle].device = deviceHandle;
+        registers[handle].position = current;
+        if (!insertRegister(handle)) {
+          registers[handle] = IndexedRegister();
+          continue;
+        }
+        registerCount++;
+        if (handle >= registerLimit) registerLimit = handle + 1;
+      }
+    }
+  }
+  
+  deviceSpan = deviceHandles;
+  registerSpan = registerHandles;
+  deviceCursor = nextDevice;
+  registerCursor = nextRegister;
+  return true;
+}
+
+size_t ConfigIndex::memoryUsage() const {
+  size_t usage = 0;
+  if (deviceSlots) usage += (deviceMask + 1) * sizeof(uint16_t);
+  if (registerSlots) usage += (registerMask + 1) * sizeof(uint16_t);
+  usage += deviceSpan * sizeof(IndexedDevice);
+  usage += registerSpan * sizeof(IndexedRegister);
+  return usage;
+}
\ No newline at end of file
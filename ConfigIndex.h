@@ -0,0 +1,76 @@
+#ifndef CONFIG_INDEX_H
+#define CONFIG_INDEX_H
+
+#include <ArduinoJson.h>
+
+static const uint16_t INVALID_HANDLE = 0xFFFF;
+
+struct IndexedDevice {
+  const char* id;           // Points into the snapshot document; nullptr = unused handle
+  JsonObjectConst config;
+};
+
+struct IndexedRegister {
+  const char* id;
+  JsonObjectConst config;
+  uint16_t device;          // Owning device handle
+  uint16_t position;        // Index in the device's "registers" array
+};
+
+// Lookup tables built once per config snapshot and immutable afterwards.
+// Open-addressing hash tables map device and register IDs to compact 16-bit
+// handles; handle tables map back to the JSON config. A handle whose ID is
+// still present keeps its value from the previous index, so pollers and
+// subscriptions can hold handles across config changes. New IDs take handles
+// from a cursor that keeps advancing across rebuilds, so a deleted ID's handle
+// is only reused once the cursor wraps around the handle space; records and
+// events still naming it have long been drained by then.
+//
+// Needs only ArduinoJson, so it is unit-tested on the host (testing/).
+class ConfigIndex {
+private:
+  IndexedDevice* devices;
+  IndexedRegister* registers;
+  uint16_t* deviceSlots;    // Hash table of device handles, INVALID_HANDLE = empty
+  uint16_t* registerSlots;
+  uint32_t deviceMask;
+  uint32_t registerMask;
+  uint16_t deviceLimit;     // Every device handle is below this
+  uint16_t registerLimit;
+  uint16_t deviceSpan;      // Size of the handle tables; never shrinks across rebuilds
+  uint16_t registerSpan;
+  uint16_t deviceCursor;    // Where the search for the next new handle starts
+  uint16_t registerCursor;
+  int deviceCount;
+  int registerCount;
+  
+  void release();
+  bool insertDevice(uint16_t handle);
+  bool insertRegister(uint16_t handle);
+  
+  static uint32_t hashId(const char* id);
+  static uint16_t* allocSlots(int count, uint32_t& mask);
+  static uint16_t handleSpan(size_t entries, uint16_t previousSpan);
+
+public:
+  ConfigIndex();
+  ~ConfigIndex();
+  ConfigIndex(const ConfigIndex&) = delete;
+  ConfigIndex& operator=(const ConfigIndex&) = delete;
+  
+  // Index every device and register in `devicesConfig`, reusing handles from `previous`
+  bool build(JsonObjectConst devicesConfig, const ConfigIndex* previous);
+  
+  uint16_t findDevice(const char* id) const;
+  uint16_t findRegister(const char* id) const;
+  const IndexedDevice* device(uint16_t handle) const;
+  const IndexedRegister* reg(uint16_t handle) const;
+  
+  uint16_t getDeviceLimit() const { return deviceLimit; }
+  uint16_t getRegisterLimit() const { return registerLimit; }
+  int getDeviceCount() const { return deviceCount; }
+  int getRegisterCount() const { return registerCount; }
+  size_t memoryUsage() const;
+};
+
+#endif
\ No newline at end of file
@@ -1,20 +1,27 @@
 #include "ConfigManager.h"
+#include "PsramJson.h"
 #include <esp_heap_caps.h>
 #include <new>
 
 const char* ConfigManager::DEVICES_FILE = "/devices.json";
+const char* ConfigManager::DEVICES_DIR = "/dev";
+const char* ConfigManager::DEVICES_COMMIT_FILE = "/dev_commit.json";
 const char* ConfigManager::REGISTERS_FILE = "/registers.json";
+const char* ConfigManager::PLAN_IMAGE_PROTOCOLS[] = { "RTU", "TCP" };
 
-ConfigManager::ConfigManager() : devicesCache(nullptr), registersCache(nullptr), 
-                                 devicesCacheValid(false), registersCacheValid(false) {
-  // Initialize cache in PSRAM
-  devicesCache = (DynamicJsonDocument*)heap_caps_malloc(sizeof(DynamicJsonDocument), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-  if (devicesCache) {
-    new(devicesCache) DynamicJsonDocument(8192);
-  } else {
-    devicesCache = new DynamicJsonDocument(4096);
-  }
-  
+void* ConfigSnapshot::operator new(size_t size) {
+  void* ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  return ptr ? ptr : ::operator new(size);
+}
+
+void ConfigSnapshot::operator delete(void* ptr) {
+  heap_caps_free(ptr); // Also valid for internal RAM allocations
+}
+
+ConfigManager::ConfigManager() : writeMutex(nullptr), registersCache(nullptr), 
+                                 registersCacheValid(false), generation(1), planImagesOnFlash(false),
+                                 observerCount(0), batchSnapshot(nullptr), batchOwner(nullptr),
+                                 batchDeviceCount(0), batchIdCount(0) {
   registersCache = (DynamicJsonDocument*)heap_caps_malloc(sizeof(DynamicJsonDocument), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
   if (registersCache) {
     new(registersCache) DynamicJsonDocument(16384);
@@ -24,14 +31,13 @@ ConfigManager::ConfigManager() : devicesCache(nullptr), registersCache(nullptr),
 }
 
 ConfigManager::~ConfigManager() {
-  if (devicesCache) {
-    devicesCache->~DynamicJsonDocument();
-    heap_caps_free(devicesCache);
-  }
   if (registersCache) {
     registersCache->~DynamicJsonDocument();
     heap_caps_free(registersCache);
   }
+  if (writeMutex) {
+    vSemaphoreDelete(writeMutex);
+  }
 }
 
 bool ConfigManager::begin() {
@@ -40,22 +46,42 @@ bool ConfigManager::begin() {
     return false;
   }
   
-  // Initialize empty files if they don't exist
-  if (!SPIFFS.exists(DEVICES_FILE)) {
-    DynamicJsonDocument doc(64);
-    doc.to<JsonObject>();
-    saveJson(DEVICES_FILE, doc);
+  writeMutex = xSemaphoreCreateMutex();
+  if (!writeMutex) {
+    Serial.println("Failed to create config write mutex");
+    return false;
   }
   
+  // Initialize empty files if they don't exist
   if (!SPIFFS.exists(REGISTERS_FILE)) {
     DynamicJsonDocument doc(64);
     doc.to<JsonObject>();
     saveJson(REGISTERS_FILE, doc);
   }
   
-  // Load cache on startup
+  // Publish the initial snapshot
   Serial.println("Loading configuration cache...");
-  loadDevicesCache();
+  if (SPIFFS.exists(DEVICES_FILE)) {
+    migrateDevicesFile();
+  }
+  recoverDeviceCommit();
+  ConfigSnapshot* initial = new ConfigSnapshot(deviceFilesCapacity());
+  if (!loadDeviceFiles(initial->devices)) {
+    Serial.println("Failed to load device files, starting empty");
+    initial->devices.to<JsonObject>();
+  }
+  initial->devices.shrinkToFit();
+  if (!initial->index.build(initial->devices.as<JsonObjectConst>(), nullptr)) {
+    initial->devices.to<JsonObject>();
+    initial->index.build(initial->devices.as<JsonObjectConst>(), nullptr);
+  }
+  initial->generation = generation;
+  for (const char* protocol : PLAN_IMAGE_PROTOCOLS) {
+    planImagesOnFlash = planImagesOnFlash || SPIFFS.exists(planImagePath(protocol));
+  }
+  devicesSnapshot.publish(initial);
+  Serial.printf("Devices snapshot loaded: %d devices, %u bytes\n",
+                initial->devices.as<JsonObjectConst>().size(), (unsigned)initial->devices.memoryUsage());
   loadRegistersCache();
   
   Serial.println("ConfigManager initialized with cache loaded");
@@ -66,6 +92,26 @@ String ConfigManager::generateId(const String& prefix) {
   return prefix + String(random(100000, 999999), HEX).substring(0, 6);
 }
 
+// Random IDs can collide; retry until neither the index nor the running batch
+// has an entry for it
+String ConfigManager::generateUniqueId(const char* prefix, const ConfigIndex* index) {
+  bool isDevice = prefix[0] == 'D';
+  bool batched = inBatch();
+  while (true) {
+    String id = generateId(prefix);
+    bool taken = index && (isDevice ? index->findDevice(id.c_str()) : index->findRegister(id.c_str())) != INVALID_HANDLE;
+    for (int i = 0; batched && !taken && i < batchIdCount; i++) {
+      taken = batchIds[i] == id;
+    }
+    if (taken) continue;
+    
+    if (batched) {
+      batchIds[batchIdCount++] = id;
+    }
+    return id;
+  }
+}
+
 bool ConfigManager::saveJson(const String& filename, const JsonDocument& doc) {
   File file = SPIFFS.open(filename, "w");
   if (!file) return false;
@@ -93,45 +139,432 @@ bool ConfigManager::loadJson(const String& filename, JsonDocument& doc) {
   buffer[fileSize] = '\0';
   file.close();
   
-  DeserializationError error = deserializeJson(doc, buffer);
+  // const input makes ArduinoJson copy strings; the buffer is freed right after
+  DeserializationError error = deserializeJson(doc, (const char*)buffer);
   heap_caps_free(buffer);
   
   return error == DeserializationError::Ok;
 }
 
+String ConfigManager::devicePath(const String& deviceId) {
+  return String(DEVICES_DIR) + "/" + deviceId + ".json";
+}
+
+String ConfigManager::deviceTempPath(const String& deviceId) {
+  return String(DEVICES_DIR) + "/" + deviceId + ".tmp";
+}
+
+String ConfigManager::deviceStagedPath(const String& deviceId) {
+  return String(DEVICES_DIR) + "/" + deviceId + ".stg";
+}
+
+bool ConfigManager::writeDeviceRecord(const String& path, const String& deviceId, JsonObjectConst device) {
+  File file = SPIFFS.open(path, "w");
+  if (!file) return false;
+  
+  size_t expected = measureJson(device);
+  size_t written = serializeJson(device, file);
+  file.close();
+  if (written != expected) {
+    Serial.printf("Short write for device %s (%u/%u bytes)\n", deviceId.c_str(), (unsigned)written, (unsigned)expected);
+    SPIFFS.remove(path);
+    return false;
+  }
+  return true;
+}
+
+// SPIFFS cannot rename over an existing file, so the live record is removed first
+bool ConfigManager::promoteDeviceFile(const String& fromPath, const String& deviceId) {
+  String path = devicePath(deviceId);
+  if (SPIFFS.exists(path)) {
+    SPIFFS.remove(path);
+  }
+  return SPIFFS.rename(fromPath, path);
+}
+
+bool ConfigManager::saveDeviceFile(const String& deviceId, JsonObjectConst device) {
+  // Write the whole record to a temp file first; the live record is only
+  // replaced once the new one is complete on flash. A crash between removing
+  // the old record and the rename leaves only the complete temp file, which
+  // recoverDeviceFile promotes.
+  String tempPath = deviceTempPath(deviceId);
+  return writeDeviceRecord(tempPath, deviceId, device) && promoteDeviceFile(tempPath, deviceId);
+}
+
+bool ConfigManager::removeDeviceFile(const String& deviceId) {
+  SPIFFS.remove(deviceTempPath(deviceId));
+  return SPIFFS.remove(devicePath(deviceId));
+}
+
+bool ConfigManager::persistDevices(const ConfigSnapshot* next, JsonArrayConst saves, JsonArrayConst removes) {
+  int staged = 0;
+  for (JsonVariantConst idVar : saves) {
+    const char* deviceId = idVar.as<const char*>();
+    const IndexedDevice* entry = next->index.device(next->index.findDevice(deviceId));
+    if (!entry || !writeDeviceRecord(deviceStagedPath(deviceId), deviceId, entry->config)) {
+      Serial.printf("Failed to stage device %s\n", deviceId);
+      discardStagedDevices(saves, staged);
+      return false;
+    }
+    staged++;
+  }
+  
+  // The commit point: a complete commit file (the IDs to remove) means every
+  // staged record is on flash
+  File marker = SPIFFS.open(DEVICES_COMMIT_FILE, "w");
+  size_t expected = measureJson(removes);
+  bool committed = marker && serializeJson(removes, marker) == expected;
+  if (marker) {
+    marker.close();
+  }
+  if (!committed) {
+    Serial.println("Failed to write device commit file");
+    SPIFFS.remove(DEVICES_COMMIT_FILE);
+    discardStagedDevices(saves, staged);
+    return false;
+  }
+  
+  finishDeviceCommit(saves, removes);
+  return true;
+}
+
+// Replace the live records with the staged ones and drop the removed devices.
+// Failures here are finished on the next boot, as the commit file stays.
+void ConfigManager::finishDeviceCommit(JsonArrayConst saves, JsonArrayConst removes) {
+  bool complete = true;
+  for (JsonVariantConst idVar : saves) {
+    String deviceId = idVar.as<const char*>();
+    String stagedPath = deviceStagedPath(deviceId);
+    if (SPIFFS.exists(stagedPath) && !promoteDeviceFile(stagedPath, deviceId)) {
+      Serial.printf("Failed to promote device %s\n", deviceId.c_str());
+      complete = false;
+    }
+  }
+  for (JsonVariantConst idVar : removes) {
+    String deviceId = idVar.as<const char*>();
+    SPIFFS.remove(deviceTempPath(deviceId));
+    if (SPIFFS.exists(devicePath(deviceId)) && !SPIFFS.remove(devicePath(deviceId))) {
+      complete = false;
+    }
+  }
+  if (complete) {
+    SPIFFS.remove(DEVICES_COMMIT_FILE);
+  }
+}
+
+void ConfigManager::discardStagedDevices(JsonArrayConst saves, int count) {
+  for (JsonVariantConst idVar : saves) {
+    if (count-- <= 0) break;
+    SPIFFS.remove(deviceStagedPath(idVar.as<const char*>()));
+  }
+}
+
+// Finish a multi-record commit interrupted by a reset, or discard its staged
+// records if it never reached the commit point
+void ConfigManager::recoverDeviceCommit() {
+  int stagedCount = 0;
+  size_t idBytes = 0;
+  {
+    File dir = SPIFFS.open(DEVICES_DIR);
+    for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+      String path = file.path();
+      if (path.endsWith(".stg")) {
+        stagedCount++;
+        idBytes += path.length() + 1;
+      }
+    }
+  }
+  File marker = SPIFFS.open(DEVICES_COMMIT_FILE, "r");
+  if (stagedCount == 0 && !marker) return;
+  
+  DynamicJsonDocument removes(marker ? jsonCapacityFor(marker.size()) : JSON_ARRAY_SIZE(0));
+  bool committed = marker && deserializeJson(removes, marker) == DeserializationError::Ok && removes.is<JsonArray>();
+  if (marker) {
+    marker.close();
+  }
+  
+  // Directory scan first, changes after, so the iterator stays valid
+  DynamicJsonDocument saves(JSON_ARRAY_SIZE(stagedCount) + idBytes);
+  {
+    File dir = SPIFFS.open(DEVICES_DIR);
+    for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+      String path = file.path();
+      if (path.endsWith(".stg")) {
+        saves.add(path.substring(strlen(DEVICES_DIR) + 1, path.length() - 4));
+      }
+    }
+  }
+  
+  if (committed) {
+    Serial.printf("Completing interrupted commit of %d devices\n", stagedCount);
+    finishDeviceCommit(saves.as<JsonArrayConst>(), removes.as<JsonArrayConst>());
+  } else {
+    Serial.printf("Discarding %d devices staged by an unfinished commit\n", stagedCount);
+    discardStagedDevices(saves.as<JsonArrayConst>(), stagedCount);
+    SPIFFS.remove(DEVICES_COMMIT_FILE);
+  }
+}
+
+void ConfigManager::removeAllDeviceFiles() {
+  // Restart the scan after each removal so the directory iterator stays valid
+  while (true) {
+    File dir = SPIFFS.open(DEVICES_DIR);
+    File file = dir.openNextFile();
+    if (!file) break;
+    String path = file.path();
+    file.close();
+    if (!SPIFFS.remove(path)) break;
+  }
+}
+
+// Finish or discard a device write interrupted by a reset
+void ConfigManager::recoverDeviceFile(const String& deviceId) {
+  String tempPath = deviceTempPath(deviceId);
+  File file = SPIFFS.open(tempPath, "r");
+  if (!file) return;
+  
+  DynamicJsonDocument probe(jsonCapacityFor(file.size()));
+  bool complete = deserializeJson(probe, file) == DeserializationError::Ok && probe.is<JsonObject>();
+  file.close();
+  
+  if (!complete) {
+    Serial.printf("Discarding incomplete write for device %s\n", deviceId.c_str());
+    SPIFFS.remove(tempPath);
+    return;
+  }
+  
+  Serial.printf("Completing interrupted write for device %s\n", deviceId.c_str());
+  String path = devicePath(deviceId);
+  if (SPIFFS.exists(path)) {
+    SPIFFS.remove(path);
+  }
+  if (!SPIFFS.rename(tempPath, path)) {
+    SPIFFS.remove(tempPath);
+  }
+}
+
+bool ConfigManager::loadDeviceFiles(JsonDocument& devices) {
+  devices.to<JsonObject>();
+  
+  // Recover interrupted writes before reading the records. Each recovery
+  // changes the directory, so the scan restarts after it.
+  bool rescan = true;
+  while (rescan) {
+    rescan = false;
+    File dir = SPIFFS.open(DEVICES_DIR);
+    for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+      String path = file.path();
+      if (!path.endsWith(".tmp")) continue;
+      file.close();
+      recoverDeviceFile(path.substring(strlen(DEVICES_DIR) + 1, path.length() - 4));
+      rescan = !SPIFFS.exists(path);
+      break;
+    }
+  }
+  
+  int count = 0;
+  File dir = SPIFFS.open(DEVICES_DIR);
+  for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+    String path = file.path();
+    if (!path.endsWith(".json")) continue;
+    
+    String deviceId = path.substring(strlen(DEVICES_DIR) + 1, path.length() - 5);
+    DynamicJsonDocument device(jsonCapacityFor(file.size()));
+    DeserializationError error = deserializeJson(device, file);
+    if (error) {
+      Serial.printf("Skipping unreadable device file %s: %s\n", path.c_str(), error.c_str());
+      continue;
+    }
+    devices[deviceId].set(device.as<JsonObjectConst>());
+    count++;
+  }
+  
+  if (devices.overflowed()) {
+    Serial.println("Device files exceed snapshot capacity");
+    return false;
+  }
+  Serial.printf("Loaded %d device files\n", count);
+  return true;
+}
+
+// Capacity that holds every device record once parsed
+size_t ConfigManager::deviceFilesCapacity() {
+  size_t textBytes = 0;
+  File dir = SPIFFS.open(DEVICES_DIR);
+  for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+    textBytes += file.size();
+  }
+  return jsonCapacityFor(textBytes);
+}
+
+// One-time conversion of the single-file store into per-device records
+void ConfigManager::migrateDevicesFile() {
+  File file = SPIFFS.open(DEVICES_FILE, "r");
+  size_t textBytes = file ? file.size() : 0;
+  file.close();
+  
+  DynamicJsonDocument legacy(jsonCapacityFor(textBytes));
+  if (!loadJson(DEVICES_FILE, legacy)) {
+    Serial.println("Legacy devices file unreadable, leaving it in place");
+    return;
+  }
+  
+  int migrated = 0;
+  for (JsonPairConst kv : legacy.as<JsonObjectConst>()) {
+    if (!saveDeviceFile(kv.key().c_str(), kv.value().as<JsonObjectConst>())) {
+      Serial.printf("Failed to migrate device %s\n", kv.key().c_str());
+      return; // Keep the legacy file so the next boot retries
+    }
+    migrated++;
+  }
+  SPIFFS.remove(DEVICES_FILE);
+  Serial.printf("Migrated %d devices to per-device files\n", migrated);
+}
+
+ConfigSnapshot* ConfigManager::beginWrite(size_t extraBytes) {
+  // Inside a batch every write goes to its working copy, sized by beginBatch().
+  // A full batch refuses the write before anything is changed.
+  if (inBatch()) {
+    if (batchDeviceCount >= MAX_BATCH_CHANGES || batchIdCount >= MAX_BATCH_CHANGES) {
+      Serial.println("Config batch full");
+      return nullptr;
+    }
+    return batchSnapshot;
+  }
+  
+  if (!writeMutex || xSemaphoreTake(writeMutex, pdMS_TO_TICKS(WRITE_TIMEOUT_MS)) != pdTRUE) {
+    Serial.println("Config write lock timeout");
+    return nullptr;
+  }
+  
+  SnapshotGuard current = devicesSnapshot.pin();
+  size_t used = current ? current->devices.memoryUsage() : 0;
+  ConfigSnapshot* next = new ConfigSnapshot(used + extraBytes + JSON_OBJECT_SIZE(1));
+  if (current) {
+    next->devices.set(current->devices);
+  } else {
+    next->devices.to<JsonObject>();
+  }
+  if (next->devices.overflowed()) {
+    Serial.println("Devices snapshot too large to copy");
+    abortWrite(next);
+    return nullptr;
+  }
+  return next;
+}
+
+// Capacity check, compaction and the handle index; `next` is immutable afterwards
+bool ConfigManager::sealWrite(ConfigSnapshot* next) {
+  if (next->devices.overflowed()) {
+    Serial.println("Devices snapshot capacity exceeded, change rejected");
+    return false;
+  }
+  
+  // Release the write headroom
+  next->devices.shrinkToFit();
+  
+  // Index the final layout, carrying handles over from the current snapshot
+  SnapshotGuard current = devicesSnapshot.pin();
+  return next->index.build(next->devices.as<JsonObjectConst>(), current ? &current->index : nullptr);
+}
+
+uint32_t ConfigManager::publishSnapshot(ConfigSnapshot* next) {
+  // `next` may be retired by the following writer once the lock is released
+  uint32_t committed = ++generation;
+  next->generation = committed;
+  devicesSnapshot.publish(next);
+  xSemaphoreGive(writeMutex);
+  return committed;
+}
+
+void ConfigManager::publishWrite(ConfigSnapshot* next, uint16_t deviceHandle, ConfigChange change) {
+  notifyChange(deviceHandle, change, publishSnapshot(next));
+}
+
+bool ConfigManager::commitWrite(ConfigSnapshot* next, const String& deviceId, ConfigChange change) {
+  if (next == batchSnapshot) {
+    return recordBatchChange(deviceId);
+  }
+  
+  // A deleted device is reported with the handle it had before the change
+  uint16_t deviceHandle = INVALID_HANDLE;
+  if (change == CONFIG_DEVICE_DELETED) {
+    SnapshotGuard current = devicesSnapshot.pin();
+    deviceHandle = current ? current->index.findDevice(deviceId.c_str()) : INVALID_HANDLE;
+  }
+  
+  if (!sealWrite(next)) {
+    abortWrite(next);
+    return false;
+  }
+  if (change != CONFIG_DEVICE_DELETED && change != CONFIG_RESET) {
+    deviceHandle = next->index.findDevice(deviceId.c_str());
+  }
+  
+  // Drop plan images first so a reset mid-commit never leaves a stale one
+  removePlanImages();
+  
+  // Persist only the record that changed; resets manage the files themselves
+  bool saved = true;
+  if (change == CONFIG_DEVICE_DELETED) {
+    saved = removeDeviceFile(deviceId);
+  } else if (change != CONFIG_RESET) {
+    saved = saveDeviceFile(deviceId, next->devices[deviceId].as<JsonObjectConst>());
+  }
+  if (!saved) {
+    Serial.printf("Failed to save device file for %s\n", deviceId.c_str());
+    abortWrite(next);
+    return false;
+  }
+  
+  publishWrite(next, deviceHandle, change);
+  return true;
+}
+
+void ConfigManager::abortWrite(ConfigSnapshot* next) {
+  // Operations fail before touching the document, so a batch's copy stays valid
+  if (next == batchSnapshot) return;
+  
+  delete next;
+  xSemaphoreGive(writeMutex);
+}
+
 String ConfigManager::createDevice(JsonObjectConst config) {
-  if (!loadDevicesCache()) return "";
+  ConfigSnapshot* next = beginWrite(jsonCapacityFor(measureJson(config)));
+  if (!next) return "";
   
-  String deviceId = generateId("D");
-  JsonObject device = devicesCache->createNestedObject(deviceId);
+  String deviceId;
+  {
+    SnapshotGuard current = devicesSnapshot.pin();
+    deviceId = generateUniqueId("D", current ? &current->index : nullptr);
+  }
+  JsonObject device = next->devices.createNestedObject(deviceId);
   
   // Copy config
   for (JsonPairConst kv : config) {
-    device[kv.key()] = kv.value();
+    copyJsonMember(device, kv.key().c_str(), kv.value());
   }
   device["device_id"] = deviceId;
   JsonArray registers = device.createNestedArray("registers");
   Serial.printf("Created device %s with empty registers array\n", deviceId.c_str());
   
-  // Save to file and keep cache valid
-  if (saveJson(DEVICES_FILE, *devicesCache)) {
-    Serial.printf("Device %s created and cache updated\n", deviceId.c_str());
+  if (commitWrite(next, deviceId, CONFIG_DEVICE_CREATED)) {
+    Serial.printf("Device %s created and snapshot published\n", deviceId.c_str());
     return deviceId;
   }
-  
-  invalidateDevicesCache();
   return "";
 }
 
 bool ConfigManager::readDevice(const String& deviceId, JsonObject& result) {
-  if (!loadDevicesCache()) {
-    Serial.println("Failed to load devices cache for readDevice");
+  SnapshotGuard snapshot = devicesSnapshot.pin();
+  if (!snapshot) {
+    Serial.println("No devices snapshot for readDevice");
     return false;
   }
   
-  if (devicesCache->containsKey(deviceId)) {
-    JsonObject device = (*devicesCache)[deviceId];
-    for (JsonPair kv : device) {
+  JsonObjectConst device = snapshot->device(deviceId.c_str());
+  if (!device.isNull()) {
+    for (JsonPairConst kv : device) {
       result[kv.key()] = kv.value();
     }
     Serial.printf("Device %s read from cache\n", deviceId.c_str());
@@ -142,38 +575,280 @@ bool ConfigManager::readDevice(const String& deviceId, JsonObject& result) {
 }
 
 bool ConfigManager::deleteDevice(const String& deviceId) {
-  if (!loadDevicesCache()) return false;
+  ConfigSnapshot* next = beginWrite(0);
+  if (!next) return false;
+  
+  if (!hasDevice(next, deviceId)) {
+    abortWrite(next);
+    return false;
+  }
+  next->devices.remove(deviceId);
+  return commitWrite(next, deviceId, CONFIG_DEVICE_DELETED);
+}
+
+// Merge `patch` into `target`; IDs and nested registers cannot be patched
+static bool applyPatch(JsonObject target, JsonObjectConst patch, String& error) {
+  if (patch.isNull() || patch.size() == 0) {
+    error = "Empty update";
+    return false;
+  }
+  for (JsonPairConst kv : patch) {
+    if (kv.key() == "device_id" || kv.key() == "register_id" || kv.key() == "registers") {
+      error = String("Field ") + kv.key().c_str() + " cannot be updated";
+      return false;
+    }
+  }
   
-  if (devicesCache->containsKey(deviceId)) {
-    devicesCache->remove(deviceId);
-    if (saveJson(DEVICES_FILE, *devicesCache)) {
-      return true;
+  for (JsonPairConst kv : patch) {
+    if (kv.value().isNull()) {
+      target.remove(kv.key());
+    } else {
+      copyJsonMember(target, kv.key().c_str(), kv.value());
     }
-    invalidateDevicesCache();
   }
-  return false;
+  return true;
+}
+
+bool ConfigManager::updateDevice(const String& deviceId, JsonObjectConst patch, String& error) {
+  const char* protocol = patch["protocol"];
+  if (protocol && strcmp(protocol, "RTU") != 0 && strcmp(protocol, "TCP") != 0) {
+    error = "protocol must be RTU or TCP";
+    return false;
+  }
+  
+  ConfigSnapshot* next = beginWrite(jsonCapacityFor(measureJson(patch)));
+  if (!next) {
+    error = "Config busy";
+    return false;
+  }
+  
+  JsonObject device = next->devices[deviceId];
+  if (device.isNull()) {
+    error = "Device not found";
+    abortWrite(next);
+    return false;
+  }
+  if (!applyPatch(device, patch, error)) {
+    abortWrite(next);
+    return false;
+  }
+  
+  if (!commitWrite(next, deviceId, CONFIG_DEVICE_UPDATED)) {
+    error = "Failed to save device";
+    return false;
+  }
+  Serial.printf("Device %s updated (%d fields)\n", deviceId.c_str(), patch.size());
+  return true;
 }
 
 void ConfigManager::listDevices(JsonArray& devices) {
-  if (!loadDevicesCache()) {
-    Serial.println("Failed to load devices cache for listDevices");
+  SnapshotGuard snapshot = devicesSnapshot.pin();
+  if (!snapshot) {
+    Serial.println("No devices snapshot for listDevices");
     return;
   }
   
   int count = 0;
-  for (JsonPair kv : devicesCache->as<JsonObject>()) {
+  for (JsonPairConst kv : snapshot->devices.as<JsonObjectConst>()) {
     devices.add(kv.key().c_str());
     count++;
   }
   Serial.printf("Listed %d devices from cache\n", count);
 }
 
+bool ConfigManager::addObserver(ConfigObserver* observer) {
+  if (observerCount >= MAX_OBSERVERS) {
+    Serial.println("Too many config observers");
+    return false;
+  }
+  observers[observerCount++] = observer;
+  return true;
+}
+
+void ConfigManager::removeObserver(ConfigObserver* observer) {
+  for (int i = 0; i < observerCount; i++) {
+    if (observers[i] == observer) {
+      observers[i] = observers[--observerCount];
+      return;
+    }
+  }
+}
+
+void ConfigManager::notifyChange(uint16_t deviceHandle, ConfigChange change, uint32_t changeGeneration) {
+  for (int i = 0; i < observerCount; i++) {
+    observers[i]->onConfigChanged(deviceHandle, change, changeGeneration);
+  }
+}
+
+bool ConfigManager::compilePlan(RegisterPlan& plan, const char* protocol) {
+  if (loadPlanImage(plan, protocol)) {
+    return true;
+  }
+  
+  {
+    SnapshotGuard snapshot = devicesSnapshot.pin();
+    if (!snapshot) {
+      Serial.println("No devices snapshot for compilePlan");
+      return false;
+    }
+    if (!plan.build(snapshot->index, protocol, snapshot->generation)) {
+      return false;
+    }
+  }
+  savePlanImage(plan, protocol);
+  return true;
+}
+
+String ConfigManager::planImagePath(const char* protocol) {
+  return String("/plan_") + protocol + ".bin";
+}
+
+bool ConfigManager::loadPlanImage(RegisterPlan& plan, const char* protocol) {
+  if (!planImagesOnFlash || !writeMutex) return false;
+  
+  // Held so no commit can land between reading the image and stamping its generation
+  if (xSemaphoreTake(writeMutex, pdMS_TO_TICKS(WRITE_TIMEOUT_MS)) != pdTRUE) return false;
+  
+  bool loaded = false;
+  String path = planImagePath(protocol);
+  File file = SPIFFS.exists(path) ? SPIFFS.open(path, "r") : File();
+  if (file) {
+    size_t size = file.size();
+    uint8_t* image = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!image) {
+      image = (uint8_t*)malloc(size);
+    }
+    if (image) {
+      // Handles are not stored in the image; they are resolved by ID against the current index
+      SnapshotGuard snapshot = devicesSnapshot.pin();
+      loaded = snapshot && file.read(image, size) == size &&
+               plan.loadImage(image, size, snapshot->index, generation);
+      heap_caps_free(image);
+    }
+    file.close();
+  }
+  
+  xSemaphoreGive(writeMutex);
+  return loaded;
+}
+
+bool ConfigManager::savePlanImage(const RegisterPlan& plan, const char* protocol) {
+  if (!writeMutex || xSemaphoreTake(writeMutex, pdMS_TO_TICKS(WRITE_TIMEOUT_MS)) != pdTRUE) return false;
+  
+  // A plan behind the committed config must not be written; the owner saves
+  // again once it has applied the pending changes
+  if (plan.getGeneration() != generation) {
+    xSemaphoreGive(writeMutex);
+    return false;
+  }
+  
+  size_t size = plan.imageSize();
+  uint8_t* image = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!image) {
+    image = (uint8_t*)malloc(size);
+  }
+  
+  bool saved = false;
+  if (image && plan.writeImage(image, size) == size) {
+    String path = planImagePath(protocol);
+    String tempPath = path + ".tmp";
+    File file = SPIFFS.open(tempPath, "w");
+    if (file) {
+      bool complete = file.write(image, size) == size;
+      file.close();
+      if (complete) {
+        if (SPIFFS.exists(path)) {
+          SPIFFS.remove(path);
+        }
+        saved = SPIFFS.rename(tempPath, path);
+      }
+      if (!saved) {
+        SPIFFS.remove(tempPath);
+      }
+    }
+  }
+  if (image) {
+    heap_caps_free(image);
+  }
+  if (saved) {
+    planImagesOnFlash = true;
+    Serial.printf("Saved %s plan image (%u bytes)\n", protocol, (unsigned)size);
+  }
+  
+  xSemaphoreGive(writeMutex);
+  return saved;
+}
+
+void ConfigManager::removePlanImages() {
+  if (!planImagesOnFlash) return;
+  for (const char* protocol : PLAN_IMAGE_PROTOCOLS) {
+    String path = planImagePath(protocol);
+    if (SPIFFS.exists(path)) {
+      SPIFFS.remove(path);
+    }
+  }
+  planImagesOnFlash = false;
+}
+
+bool ConfigManager::updatePlan(RegisterPlan& plan, uint16_t deviceHandle, const char* protocol) {
+  SnapshotGuard snapshot = devicesSnapshot.pin();
+  if (!snapshot) {
+    Serial.println("No devices snapshot for updatePlan");
+    return false;
+  }
+  
+  return plan.updateDevice(snapshot->index, deviceHandle, protocol);
+}
+
+void ConfigManager::getMemoryReport(JsonObject& report) {
+  int deviceCount = 0;
+  int registerCount = 0;
+  {
+    SnapshotGuard snapshot = devicesSnapshot.pin();
+    if (snapshot) {
+      deviceCount = snapshot->index.getDeviceCount();
+      registerCount = snapshot->index.getRegisterCount();
+      report["snapshot_bytes"] = snapshot->devices.memoryUsage();
+      report["index_bytes"] = snapshot->index.memoryUsage();
+      report["snapshot_capacity"] = snapshot->devices.capacity();
+      report["generation"] = snapshot->generation;
+    }
+  }
+  report["devices"] = deviceCount;
+  report["registers"] = registerCount;
+  
+  if (writeMutex && xSemaphoreTake(writeMutex, pdMS_TO_TICKS(WRITE_TIMEOUT_MS)) == pdTRUE) {
+    report["retired_snapshots"] = devicesSnapshot.pendingReclaim();
+    xSemaphoreGive(writeMutex);
+  }
+  
+  report["free_heap"] = ESP.getFreeHeap();
+  report["min_free_heap"] = ESP.getMinFreeHeap();
+  report["free_psram"] = ESP.getFreePsram();
+  report["largest_psram_block"] = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+  report["flash_used"] = SPIFFS.usedBytes();
+  report["flash_total"] = SPIFFS.totalBytes();
+}
+
+int ConfigManager::countDevices(const char* protocol) {
+  SnapshotGuard snapshot = devicesSnapshot.pin();
+  if (!snapshot) return 0;
+  
+  int count = 0;
+  for (JsonPairConst kv : snapshot->devices.as<JsonObjectConst>()) {
+    if (strcmp(kv.value()["protocol"] | "", protocol) == 0) {
+      count++;
+    }
+  }
+  return count;
+}
+
 void ConfigManager::getDevicesSummary(JsonArray& summary) {
-  DynamicJsonDocument devices(4096);
-  if (!loadJson(DEVICES_FILE, devices)) return;
+  SnapshotGuard snapshot = devicesSnapshot.pin();
+  if (!snapshot) return;
   
-  for (JsonPair kv : devices.as<JsonObject>()) {
-    JsonObject device = kv.value();
+  for (JsonPairConst kv : snapshot->devices.as<JsonObjectConst>()) {
+    JsonObjectConst device = kv.value();
     JsonObject deviceSummary = summary.createNestedObject();
     
     deviceSummary["device_id"] = kv.key();
@@ -184,22 +859,27 @@ void ConfigManager::getDevicesSummary(JsonArray& summary) {
 }
 
 String ConfigManager::createRegister(const String& deviceId, JsonObjectConst config) {
-  if (!loadDevicesCache()) {
-    Serial.println("Failed to load devices cache");
-    return "";
-  }
+  ConfigSnapshot* next = beginWrite(jsonCapacityFor(measureJson(config)));
+  if (!next) return "";
   
-  if (!devicesCache->containsKey(deviceId)) {
-    Serial.printf("Device %s not found in cache\n", deviceId.c_str());
-    return "";
+  String registerId;
+  {
+    // A batch may have created the device, so it is looked up in the copy
+    SnapshotGuard current = devicesSnapshot.pin();
+    bool found = inBatch() ? !next->devices[deviceId].isNull()
+                           : current && current->index.findDevice(deviceId.c_str()) != INVALID_HANDLE;
+    if (!found) {
+      Serial.printf("Device %s not found in cache\n", deviceId.c_str());
+      abortWrite(next);
+      return "";
+    }
+    registerId = generateUniqueId("R", current ? &current->index : nullptr);
   }
-  
-  String registerId = generateId("R");
-  JsonObject device = (*devicesCache)[deviceId];
+  JsonObject device = next->devices[deviceId];
   
   // Ensure registers array exists
   if (!device.containsKey("registers")) {
-    device["registers"] = JsonArray();
+    device.createNestedArray("registers");
     Serial.println("Created registers array for device");
   }
   
@@ -208,85 +888,191 @@ String ConfigManager::createRegister(const String& deviceId, JsonObjectConst con
   
   JsonObject newRegister = registers.createNestedObject();
   for (JsonPairConst kv : config) {
-    newRegister[kv.key()] = kv.value();
+    copyJsonMember(newRegister, kv.key().c_str(), kv.value());
   }
   newRegister["register_id"] = registerId;
   
   Serial.printf("Registers array size after: %d\n", registers.size());
   Serial.printf("Created register %s for device %s\n", registerId.c_str(), deviceId.c_str());
   
-  // Save to file and keep cache valid
-  if (saveJson(DEVICES_FILE, *devicesCache)) {
-    Serial.println("Successfully saved devices file and updated cache");
+  if (commitWrite(next, deviceId, CONFIG_DEVICE_UPDATED)) {
+    Serial.println("Successfully saved devices file and published snapshot");
     return registerId;
-  } else {
-    Serial.println("Failed to save devices file");
-    invalidateDevicesCache();
   }
   return "";
 }
 
+static const char* const REGISTER_SUMMARY_FIELDS[] = {
+  "register_id",
+  "register_name",
+  "address",
+  "data_type",
+  "description"
+};
+
+static void fillRegisterSummary(JsonObjectConst reg, JsonObject regSummary) {
+  for (const char* field : REGISTER_SUMMARY_FIELDS) {
+    regSummary[field] = reg[field];
+  }
+}
+
+static void writeRegisterSummary(JsonObjectConst reg, Print& out) {
+  out.print('{');
+  bool first = true;
+  for (const char* field : REGISTER_SUMMARY_FIELDS) {
+    if (!first) {
+      out.print(',');
+    }
+    first = false;
+    out.print('"');
+    out.print(field);
+    out.print("\":");
+    serializeJson(reg[field], out);
+  }
+  out.print('}');
+}
+
+bool ConfigManager::hasDevice(const String& deviceId) {
+  SnapshotGuard snapshot = devicesSnapshot.pin();
+  return snapshot && snapshot->index.findDevice(deviceId.c_str()) != INVALID_HANDLE;
+}
+
 bool ConfigManager::listRegisters(const String& deviceId, JsonArray& registers) {
-  DynamicJsonDocument devices(8192); // Increased size for registers
-  if (!loadJson(DEVICES_FILE, devices)) return false;
+  SnapshotGuard snapshot = devicesSnapshot.pin();
+  if (!snapshot) return false;
   
-  if (devices.containsKey(deviceId)) {
-    JsonArray deviceRegisters = devices[deviceId]["registers"];
-    Serial.printf("Device %s has %d registers in storage\n", deviceId.c_str(), deviceRegisters.size());
-    for (JsonVariant reg : deviceRegisters) {
-      registers.add(reg);
-    }
-    return true;
+  JsonObjectConst device = snapshot->device(deviceId.c_str());
+  if (device.isNull()) return false;
+  
+  JsonArrayConst deviceRegisters = device["registers"];
+  Serial.printf("Device %s has %d registers in cache\n", deviceId.c_str(), deviceRegisters.size());
+  for (JsonVariantConst reg : deviceRegisters) {
+    registers.add(reg);
   }
-  return false;
+  return true;
 }
 
 bool ConfigManager::getRegistersSummary(const String& deviceId, JsonArray& summary) {
-  DynamicJsonDocument devices(4096);
-  if (!loadJson(DEVICES_FILE, devices)) return false;
-  
-  if (devices.containsKey(deviceId)) {
-    JsonArray registers = devices[deviceId]["registers"];
-    for (JsonVariant reg : registers) {
-      JsonObject regSummary = summary.createNestedObject();
-      regSummary["register_id"] = reg["register_id"];
-      regSummary["register_name"] = reg["register_name"];
-      regSummary["address"] = reg["address"];
-      regSummary["data_type"] = reg["data_type"];
-      regSummary["description"] = reg["description"];
+  SnapshotGuard snapshot = devicesSnapshot.pin();
+  if (!snapshot) return false;
+  
+  JsonObjectConst device = snapshot->device(deviceId.c_str());
+  if (device.isNull()) return false;
+  
+  for (JsonVariantConst reg : device["registers"].as<JsonArrayConst>()) {
+    fillRegisterSummary(reg, summary.createNestedObject());
+  }
+  return true;
+}
+
+int ConfigManager::streamRegisters(const String& deviceId, Print& out, size_t offset, size_t limit, bool summaryOnly) {
+  SnapshotGuard snapshot = devicesSnapshot.pin();
+  JsonObjectConst device = snapshot ? snapshot->device(deviceId.c_str()) : JsonObjectConst();
+  JsonArrayConst registers = device["registers"];
+  
+  // Entries are serialized one at a time from the pinned snapshot, so no
+  // response document ever holds the whole page
+  size_t index = 0;
+  size_t written = 0;
+  out.print('[');
+  for (JsonVariantConst reg : registers) {
+    if (index++ < offset) continue;
+    if (limit > 0 && written >= limit) break;
+    
+    if (written++ > 0) {
+      out.print(',');
+    }
+    if (summaryOnly) {
+      writeRegisterSummary(reg, out);
+    } else {
+      serializeJson(reg, out);
     }
-    return true;
   }
-  return false;
+  out.print(']');
+  
+  return device.isNull() ? -1 : (int)registers.size();
 }
 
-bool ConfigManager::deleteRegister(const String& deviceId, const String& registerId) {
-  DynamicJsonDocument devices(4096);
-  if (!loadJson(DEVICES_FILE, devices)) return false;
-  
-  if (devices.containsKey(deviceId)) {
-    JsonArray registers = devices[deviceId]["registers"];
-    for (int i = 0; i < registers.size(); i++) {
-      if (registers[i]["register_id"] == registerId) {
-        registers.remove(i);
-        return saveJson(DEVICES_FILE, devices);
-      }
+// Whether the write copy `next` holds `deviceId`. A plain clone holds the
+// current snapshot's devices, so the index answers; a batch's copy may
+// already differ and is searched instead.
+bool ConfigManager::hasDevice(ConfigSnapshot* next, const String& deviceId) {
+  if (next == batchSnapshot) {
+    return next->devices.containsKey(deviceId);
+  }
+  
+  SnapshotGuard current = devicesSnapshot.pin();
+  return current && current->index.findDevice(deviceId.c_str()) != INVALID_HANDLE;
+}
+
+// Position of a device's register in the write copy `next`, -1 if not found.
+// A plain clone keeps the current snapshot's order, so the indexed position is
+// valid in it; a batch's copy may already differ and is searched instead.
+int ConfigManager::registerPosition(ConfigSnapshot* next, const String& deviceId, const String& registerId) {
+  if (next == batchSnapshot) {
+    int position = 0;
+    for (JsonVariantConst reg : next->devices[deviceId]["registers"].as<JsonArrayConst>()) {
+      if (registerId == (reg["register_id"] | "")) return position;
+      position++;
     }
+    return -1;
   }
-  return false;
+  
+  SnapshotGuard current = devicesSnapshot.pin();
+  if (!current) return -1;
+  const IndexedRegister* reg = current->index.reg(current->index.findRegister(registerId.c_str()));
+  if (reg && reg->device == current->index.findDevice(deviceId.c_str())) {
+    return reg->position;
+  }
+  return -1;
 }
 
-bool ConfigManager::loadDevicesCache() {
-  if (devicesCacheValid) return true;
+bool ConfigManager::deleteRegister(const String& deviceId, const String& registerId) {
+  ConfigSnapshot* next = beginWrite(0);
+  if (!next) return false;
   
-  Serial.println("Loading devices cache...");
-  if (loadJson(DEVICES_FILE, *devicesCache)) {
-    devicesCacheValid = true;
-    Serial.printf("Devices cache loaded: %d devices\n", devicesCache->as<JsonObject>().size());
-    return true;
+  int position = registerPosition(next, deviceId, registerId);
+  if (position < 0) {
+    abortWrite(next);
+    return false;
   }
-  Serial.println("Failed to load devices cache");
-  return false;
+  
+  JsonArray registers = next->devices[deviceId]["registers"];
+  registers.remove(position);
+  return commitWrite(next, deviceId, CONFIG_DEVICE_UPDATED);
+}
+
+bool ConfigManager::updateRegister(const String& deviceId, const String& registerId, JsonObjectConst patch, String& error) {
+  if (!patch["address"].isNull() && !patch["address"].is<int>()) {
+    error = "address must be a number";
+    return false;
+  }
+  
+  ConfigSnapshot* next = beginWrite(jsonCapacityFor(measureJson(patch)));
+  if (!next) {
+    error = "Config busy";
+    return false;
+  }
+  
+  int position = registerPosition(next, deviceId, registerId);
+  if (position < 0) {
+    error = "Register not found";
+    abortWrite(next);
+    return false;
+  }
+  
+  JsonObject reg = next->devices[deviceId]["registers"][position];
+  if (!applyPatch(reg, patch, error)) {
+    abortWrite(next);
+    return false;
+  }
+  
+  if (!commitWrite(next, deviceId, CONFIG_DEVICE_UPDATED)) {
+    error = "Failed to save device";
+    return false;
+  }
+  Serial.printf("Register %s of device %s updated (%d fields)\n", registerId.c_str(), deviceId.c_str(), patch.size());
+  return true;
 }
 
 bool ConfigManager::loadRegistersCache() {
@@ -299,28 +1085,350 @@ bool ConfigManager::loadRegistersCache() {
   return false;
 }
 
-void ConfigManager::invalidateDevicesCache() {
-  devicesCacheValid = false;
-}
-
 void ConfigManager::invalidateRegistersCache() {
   registersCacheValid = false;
 }
 
 void ConfigManager::refreshCache() {
-  invalidateDevicesCache();
+  ConfigSnapshot* next = beginWrite(deviceFilesCapacity());
+  if (!next) return;
+  
+  if (!loadDeviceFiles(next->devices)) {
+    Serial.println("Failed to reload device files");
+    abortWrite(next);
+    return;
+  }
   invalidateRegistersCache();
-  loadDevicesCache();
   loadRegistersCache();
+  commitWrite(next, "", CONFIG_RESET);
 }
 
 void ConfigManager::clearAllConfigurations() {
   Serial.println("Clearing all device and register configurations...");
+  ConfigSnapshot* next = beginWrite(0);
+  if (!next) return;
+  
+  next->devices.to<JsonObject>();
+  removePlanImages();
+  removeAllDeviceFiles();
   DynamicJsonDocument emptyDoc(64);
   emptyDoc.to<JsonObject>();
-  saveJson(DEVICES_FILE, emptyDoc);
   saveJson(REGISTERS_FILE, emptyDoc);
-  invalidateDevicesCache();
   invalidateRegistersCache();
+  commitWrite(next, "", CONFIG_RESET);
   Serial.println("All configurations cleared");
+}
+
+// IDs for one import: consecutive values from a random start cannot collide with
+// each other, and values already in the current index are skipped
+String ConfigManager::nextSequenceId(const char* prefix, uint32_t& cursor, const ConfigIndex* index) {
+  bool isDevice = prefix[0] == 'D';
+  while (true) {
+    if (cursor >= 999999) cursor = 100000;
+    String id = String(prefix) + String(cursor++, HEX);
+    if (!index) return id;
+    uint16_t existing = isDevice ? index->findDevice(id.c_str()) : index->findRegister(id.c_str());
+    if (existing == INVALID_HANDLE) return id;
+  }
+}
+
+// IDs end up in fixed-size DataRecord fields, so imported ones are length-checked
+static bool validImportId(JsonVariantConst id) {
+  if (id.isNull()) return true;
+  const char* value = id.as<const char*>();
+  return value && value[0] != '\0' && strlen(value) < sizeof(DataRecord::deviceId);
+}
+
+bool ConfigManager::validateImport(JsonArrayConst devices, String& error, size_t& registerCount) {
+  registerCount = 0;
+  if (devices.isNull() || devices.size() == 0) {
+    error = "No devices to import";
+    return false;
+  }
+  if (devices.size() >= INVALID_HANDLE) {
+    error = "Too many devices to import";
+    return false;
+  }
+  
+  int d = 0;
+  for (JsonVariantConst entry : devices) {
+    String where = "devices[" + String(d++) + "]";
+    JsonObjectConst device = entry.as<JsonObjectConst>();
+    if (device.isNull()) {
+      error = where + " is not an object";
+      return false;
+    }
+    const char* protocol = device["protocol"] | "";
+    if (strcmp(protocol, "RTU") != 0 && strcmp(protocol, "TCP") != 0) {
+      error = where + ": protocol must be RTU or TCP";
+      return false;
+    }
+    if (!validImportId(device["device_id"])) {
+      error = where + ": invalid device_id";
+      return false;
+    }
+    
+    JsonVariantConst registers = device["registers"];
+    if (!registers.isNull() && !registers.is<JsonArrayConst>()) {
+      error = where + ": registers must be an array";
+      return false;
+    }
+    int r = 0;
+    for (JsonVariantConst regVar : registers.as<JsonArrayConst>()) {
+      String regWhere = where + ".registers[" + String(r++) + "]";
+      JsonObjectConst reg = regVar.as<JsonObjectConst>();
+      if (reg.isNull()) {
+        error = regWhere + " is not an object";
+        return false;
+      }
+      if (!reg["address"].is<int>()) {
+        error = regWhere + ": address required";
+        return false;
+      }
+      if (!validImportId(reg["register_id"])) {
+        error = regWhere + ": invalid register_id";
+        return false;
+      }
+    }
+    registerCount += r;
+  }
+  
+  if (registerCount >= INVALID_HANDLE) {
+    error = "Too many registers to import";
+    return false;
+  }
+  return true;
+}
+
+// One all-or-nothing persistence pass for a sealed import: the imported
+// records and, with `replace`, the removal of every device not imported
+bool ConfigManager::persistImport(ConfigSnapshot* next, JsonArrayConst importedIds, bool replace) {
+  removePlanImages();
+  
+  SnapshotGuard current = devicesSnapshot.pin();
+  size_t currentCount = current ? current->devices.as<JsonObjectConst>().size() : 0;
+  DynamicJsonDocument removes(JSON_ARRAY_SIZE(replace ? currentCount : 0));
+  JsonArray removeIds = removes.to<JsonArray>();
+  if (replace && current) {
+    for (JsonPairConst kv : current->devices.as<JsonObjectConst>()) {
+      if (next->index.findDevice(kv.key().c_str()) == INVALID_HANDLE) {
+        removeIds.add(kv.key().c_str());    // Not copied: the pinned snapshot owns it
+      }
+    }
+  }
+  return persistDevices(next, importedIds, removeIds);
+}
+
+bool ConfigManager::importDevices(JsonArrayConst devices, bool replace, JsonArray deviceIds, String& error) {
+  if (inBatch()) {
+    error = "Import cannot run inside a batch";
+    return false;
+  }
+  
+  size_t registerCount = 0;
+  if (!validateImport(devices, error, registerCount)) {
+    return false;
+  }
+  
+  // Room for the imported content plus the device_id/register_id members added to it
+  size_t idBytes = (devices.size() + registerCount) * (JSON_OBJECT_SIZE(1) + 8);
+  ConfigSnapshot* next = beginWrite(jsonCapacityFor(measureJson(devices)) + idBytes);
+  if (!next) {
+    error = "Config busy";
+    return false;
+  }
+  if (replace) {
+    next->devices.to<JsonObject>();
+  }
+  
+  size_t expectedRegisters = registerCount;
+  {
+    SnapshotGuard current = devicesSnapshot.pin();
+    const ConfigIndex* index = current ? &current->index : nullptr;
+    if (!replace && index) {
+      expectedRegisters += index->getRegisterCount();
+    }
+    uint32_t deviceCursor = random(100000, 999999);
+    uint32_t registerCursor = random(100000, 999999);
+    
+    for (JsonVariantConst entry : devices) {
+      JsonObjectConst config = entry.as<JsonObjectConst>();
+      String deviceId = config["device_id"] | "";
+      if (deviceId.isEmpty()) {
+        do {
+          deviceId = nextSequenceId("D", deviceCursor, index);
+        } while (next->devices.containsKey(deviceId));
+      } else if (next->devices.containsKey(deviceId)) {
+        error = "Device " + deviceId + " already exists";
+        abortWrite(next);
+        return false;
+      }
+      
+      JsonObject device = next->devices.createNestedObject(deviceId);
+      for (JsonPairConst kv : config) {
+        if (kv.key() == "device_id" || kv.key() == "registers") continue;
+        copyJsonMember(device, kv.key().c_str(), kv.value());
+      }
+      device["device_id"] = deviceId;
+      
+      JsonArray registers = device.createNestedArray("registers");
+      for (JsonVariantConst regVar : config["registers"].as<JsonArrayConst>()) {
+        JsonObjectConst regConfig = regVar.as<JsonObjectConst>();
+        JsonObject reg = registers.createNestedObject();
+        for (JsonPairConst kv : regConfig) {
+          if (kv.key() == "register_id") continue;
+          copyJsonMember(reg, kv.key().c_str(), kv.value());
+        }
+        const char* registerId = regConfig["register_id"];
+        if (registerId) {
+          reg["register_id"] = ownedJsonString(registerId);
+        } else {
+          reg["register_id"] = nextSequenceId("R", registerCursor, index);
+        }
+      }
+      deviceIds.add(deviceId);
+    }
+  }
+  
+  // The ID list drives persistence, so it must be complete
+  if (deviceIds.size() != devices.size()) {
+    error = "Import result overflow";
+    abortWrite(next);
+    return false;
+  }
+  
+  if (!sealWrite(next)) {
+    error = "Import too large";
+    abortWrite(next);
+    return false;
+  }
+  
+  // The index keeps only the first of a duplicated register ID
+  if ((size_t)next->index.getRegisterCount() != expectedRegisters) {
+    error = "Duplicate register_id in import";
+    abortWrite(next);
+    return false;
+  }
+  
+  if (!persistImport(next, deviceIds, replace)) {
+    error = "Failed to save imported devices";
+    abortWrite(next);
+    return false;
+  }
+  
+  // Pollers recompile their whole plan once, from the new snapshot
+  publishWrite(next, INVALID_HANDLE, CONFIG_RESET);
+  Serial.printf("Imported %d devices, %u registers\n", deviceIds.size(), (unsigned)registerCount);
+  return true;
+}
+
+bool ConfigManager::beginBatch(size_t extraBytes) {
+  if (inBatch()) return false;
+  
+  ConfigSnapshot* next = beginWrite(extraBytes);
+  if (!next) return false;
+  batchDeviceCount = 0;
+  batchIdCount = 0;
+  batchOwner = xTaskGetCurrentTaskHandle();
+  batchSnapshot = next;
+  return true;
+}
+
+bool ConfigManager::recordBatchChange(const String& deviceId) {
+  for (int i = 0; i < batchDeviceCount; i++) {
+    if (batchDevices[i] == deviceId) return true;
+  }
+  batchDevices[batchDeviceCount++] = deviceId;  // beginWrite refuses a full batch
+  return true;
+}
+
+void ConfigManager::abortBatch() {
+  if (!inBatch()) return;
+  
+  ConfigSnapshot* next = batchSnapshot;
+  batchSnapshot = nullptr;
+  batchOwner = nullptr;
+  abortWrite(next);
+}
+
+// One seal, one all-or-nothing persistence pass over the touched records and
+// one publish; if any record cannot be saved, flash is left as it was.
+bool ConfigManager::commitBatch(String& error) {
+  if (!inBatch()) {
+    error = "No batch in progress";
+    return false;
+  }
+  ConfigSnapshot* next = batchSnapshot;
+  batchSnapshot = nullptr;
+  batchOwner = nullptr;
+  
+  if (batchDeviceCount == 0) {
+    abortWrite(next);
+    return true;
+  }
+  if (!sealWrite(next)) {
+    error = "Batch too large";
+    abortWrite(next);
+    return false;
+  }
+  removePlanImages();
+  
+  // Deleted devices are reported with the handle they had before the batch
+  uint16_t handles[MAX_BATCH_CHANGES];
+  ConfigChange changes[MAX_BATCH_CHANGES];
+  int changeCount = 0;
+  DynamicJsonDocument ids(JSON_ARRAY_SIZE(2) + 2 * JSON_ARRAY_SIZE(MAX_BATCH_CHANGES));
+  JsonArray saves = ids.createNestedArray();
+  JsonArray removes = ids.createNestedArray();
+  {
+    SnapshotGuard current = devicesSnapshot.pin();
+    for (int i = 0; i < batchDeviceCount; i++) {
+      const String& deviceId = batchDevices[i];
+      uint16_t before = current ? current->index.findDevice(deviceId.c_str()) : INVALID_HANDLE;
+      uint16_t after = next->index.findDevice(deviceId.c_str());
+      
+      if (after != INVALID_HANDLE) {
+        saves.add(deviceId.c_str());
+        handles[changeCount] = after;
+        changes[changeCount++] = before == INVALID_HANDLE ? CONFIG_DEVICE_CREATED : CONFIG_DEVICE_UPDATED;
+      } else if (before != INVALID_HANDLE) {
+        removes.add(deviceId.c_str());
+        handles[changeCount] = before;
+        changes[changeCount++] = CONFIG_DEVICE_DELETED;
+      }
+    }
+  }
+  
+  if (!persistDevices(next, saves, removes)) {
+    error = "Failed to save batch";
+    abortWrite(next);
+    return false;
+  }
+  
+  uint32_t committed = publishSnapshot(next);
+  for (int i = 0; i < changeCount; i++) {
+    notifyChange(handles[i], changes[i], committed);
+  }
+  Serial.printf("Committed batch: %d devices changed\n", changeCount);
+  return true;
+}
+
+int ConfigManager::streamDevices(Print& out) {
+  SnapshotGuard snapshot = devicesSnapshot.pin();
+  if (!snapshot) {
+    out.print("[]");
+    return 0;
+  }
+  
+  // Devices are serialized one at a time from the pinned snapshot
+  int written = 0;
+  out.print('[');
+  for (JsonPairConst kv : snapshot->devices.as<JsonObjectConst>()) {
+    if (written++ > 0) {
+      out.print(',');
+    }
+    serializeJson(kv.value(), out);
+  }
+  out.print(']');
+  return written;
 }
\ No newline at end of file
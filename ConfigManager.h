@@ -4,25 +4,135 @@
 #include <ArduinoJson.h>
 #include <SPIFFS.h>
 #include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "RegisterPlan.h"
+#include "ConfigIndex.h"
+#include "RcuSnapshot.h"
+#include "JsonCapacity.h"
+
+enum ConfigChange : uint8_t {
+  CONFIG_DEVICE_CREATED = 0,
+  CONFIG_DEVICE_UPDATED,   // Device fields or its register list changed
+  CONFIG_DEVICE_DELETED,
+  CONFIG_RESET             // Everything changed (clear/refresh); handle is INVALID_HANDLE
+};
+
+// Implemented by components that cache compiled config (e.g. poller read plans).
+// Called from the task that made the change, after it has been applied.
+class ConfigObserver {
+public:
+  virtual ~ConfigObserver() {}
+  virtual void onConfigChanged(uint16_t deviceHandle, ConfigChange change, uint32_t generation) = 0;
+};
+
+// Immutable, versioned copy of the device config. Never modified once published.
+struct ConfigSnapshot {
+  DynamicJsonDocument devices;
+  ConfigIndex index;  // Built at commit, after the document's final layout is fixed
+  uint32_t generation;
+  
+  ConfigSnapshot(size_t capacity) : devices(capacity), generation(0) {}
+  
+  JsonObjectConst device(const char* deviceId) const {
+    const IndexedDevice* entry = index.device(index.findDevice(deviceId));
+    return entry ? entry->config : JsonObjectConst();
+  }
+  
+  // Prefer PSRAM, like the caches this replaces
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr);
+};
 
 class ConfigManager {
 private:
-  static const char* DEVICES_FILE;
+  static const char* DEVICES_FILE;   // Legacy single-file store, migrated on boot
+  static const char* DEVICES_DIR;    // One "<device_id>.json" record per device
+  static const char* DEVICES_COMMIT_FILE;   // Present while a multi-record commit is promoted
   static const char* REGISTERS_FILE;
+  static const char* PLAN_IMAGE_PROTOCOLS[];
   
-  // Cache for devices and registers
-  DynamicJsonDocument* devicesCache;
+  static const uint32_t WRITE_TIMEOUT_MS = 5000;
+  
+  // Device config is published as snapshots: readers (pollers, status, CRUD reads)
+  // pin the current one lock-free; writers clone it, apply the change and swap it in.
+  RcuSnapshot<ConfigSnapshot> devicesSnapshot;
+  SemaphoreHandle_t writeMutex;  // Serializes writers only
   DynamicJsonDocument* registersCache;
-  bool devicesCacheValid;
   bool registersCacheValid;
+  volatile uint32_t generation;  // Bumped on every device/register change
+  bool planImagesOnFlash;        // Any plan image exists; cleared before a commit touches records
+  
+  static const int MAX_OBSERVERS = 4;
+  ConfigObserver* observers[MAX_OBSERVERS];
+  int observerCount;
+  
+  // Batch in progress: writes made by batchOwner go to batchSnapshot, which is
+  // persisted and published once by commitBatch()
+  static const int MAX_BATCH_CHANGES = 64;
+  ConfigSnapshot* volatile batchSnapshot;
+  TaskHandle_t volatile batchOwner;
+  String batchDevices[MAX_BATCH_CHANGES];  // Devices the batch touched
+  int batchDeviceCount;
+  String batchIds[MAX_BATCH_CHANGES];      // IDs generated by the batch, not indexed yet
+  int batchIdCount;
+  
+  bool inBatch() const { return batchSnapshot && batchOwner == xTaskGetCurrentTaskHandle(); }
+  bool recordBatchChange(const String& deviceId);
   
   String generateId(const String& prefix);
+  String generateUniqueId(const char* prefix, const ConfigIndex* index);
   bool saveJson(const String& filename, const JsonDocument& doc);
   bool loadJson(const String& filename, JsonDocument& doc);
-  void invalidateDevicesCache();
+  
+  // Per-device persistence: each change rewrites only its device's record
+  String devicePath(const String& deviceId);
+  String deviceTempPath(const String& deviceId);
+  String deviceStagedPath(const String& deviceId);
+  bool writeDeviceRecord(const String& path, const String& deviceId, JsonObjectConst device);
+  bool promoteDeviceFile(const String& fromPath, const String& deviceId);
+  bool saveDeviceFile(const String& deviceId, JsonObjectConst device);
+  bool removeDeviceFile(const String& deviceId);
+  
+  // All-or-nothing persistence of several records (imports, batches): every
+  // record is staged first, a commit file then marks the set complete, and
+  // only then are live records replaced and removed. Boot finishes a
+  // committed set and discards an uncommitted one.
+  bool persistDevices(const ConfigSnapshot* next, JsonArrayConst saves, JsonArrayConst removes);
+  void finishDeviceCommit(JsonArrayConst saves, JsonArrayConst removes);
+  void discardStagedDevices(JsonArrayConst saves, int count);
+  void recoverDeviceCommit();
+  void removeAllDeviceFiles();
+  void recoverDeviceFile(const String& deviceId);
+  bool loadDeviceFiles(JsonDocument& devices);
+  size_t deviceFilesCapacity();
+  void migrateDevicesFile();
+  
+  // Binary plan images: present on flash only while they match the device records
+  String planImagePath(const char* protocol);
+  bool loadPlanImage(RegisterPlan& plan, const char* protocol);
+  void removePlanImages();
+  
+  void notifyChange(uint16_t deviceHandle, ConfigChange change, uint32_t changeGeneration);
   void invalidateRegistersCache();
-  bool loadDevicesCache();
   bool loadRegistersCache();
+  
+  // Writer side: lock, copy the current snapshot with room for `extraBytes`
+  // of new content, then commit or abort the copy
+  ConfigSnapshot* beginWrite(size_t extraBytes);
+  bool commitWrite(ConfigSnapshot* next, const String& deviceId, ConfigChange change);
+  void abortWrite(ConfigSnapshot* next);
+  bool sealWrite(ConfigSnapshot* next);
+  uint32_t publishSnapshot(ConfigSnapshot* next);
+  void publishWrite(ConfigSnapshot* next, uint16_t deviceHandle, ConfigChange change);
+  bool hasDevice(ConfigSnapshot* next, const String& deviceId);
+  int registerPosition(ConfigSnapshot* next, const String& deviceId, const String& registerId);
+  
+  // Bulk import helpers
+  String nextSequenceId(const char* prefix, uint32_t& cursor, const ConfigIndex* index);
+  static bool validateImport(JsonArrayConst devices, String& error, size_t& registerCount);
+  bool persistImport(ConfigSnapshot* next, JsonArrayConst importedIds, bool replace);
 
 public:
   ConfigManager();
@@ -34,20 +144,67 @@ public:
   String createDevice(JsonObjectConst config);
   bool readDevice(const String& deviceId, JsonObject& result);
   bool deleteDevice(const String& deviceId);
+  
+  // Patch fields of one device in place (a null value removes the field). Only
+  // that device's record is rewritten and only its plan entry is recompiled.
+  bool updateDevice(const String& deviceId, JsonObjectConst patch, String& error);
   void listDevices(JsonArray& devices);
   void getDevicesSummary(JsonArray& summary);
   
+  // Bulk import of device trees (each device with its "registers" array) as one
+  // write: validated up front, then one snapshot, one persistence pass and one
+  // plan rebuild. `replace` drops every device not in the import. The IDs of the
+  // imported devices are appended to `deviceIds` in import order.
+  bool importDevices(JsonArrayConst devices, bool replace, JsonArray deviceIds, String& error);
+  
+  // Serialize the whole device tree as a JSON array straight into `out`, in the
+  // format importDevices accepts. Returns the number of devices written.
+  int streamDevices(Print& out);
+  
+  // Batched writes: device and register changes made by the calling task until
+  // commitBatch() go to one working copy (with room for `extraBytes` of new
+  // content), then are persisted and published together, one notification per
+  // device. Other writers wait for the batch. Reads still see the config as it
+  // was before the batch. Imports cannot run inside a batch.
+  bool beginBatch(size_t extraBytes);
+  bool commitBatch(String& error);
+  void abortBatch();
+  
   // Clear all configurations
   void clearAllConfigurations();
   
   // Cache management
   void refreshCache();
   
+  // Lock-free read access to the current device config
+  typedef RcuSnapshot<ConfigSnapshot>::Guard SnapshotGuard;
+  SnapshotGuard pinDevices() { return devicesSnapshot.pin(); }
+  
+  // Compiled read plans for pollers, rebuilt fully or per changed device
+  uint32_t getGeneration() const { return generation; }
+  bool compilePlan(RegisterPlan& plan, const char* protocol);
+  bool updatePlan(RegisterPlan& plan, uint16_t deviceHandle, const char* protocol);
+  bool savePlanImage(const RegisterPlan& plan, const char* protocol);
+  int countDevices(const char* protocol);
+  
+  // Config store and heap usage, for sizing deployments
+  void getMemoryReport(JsonObject& report);
+  
+  // Change notifications
+  bool addObserver(ConfigObserver* observer);
+  void removeObserver(ConfigObserver* observer);
+  
   // Register operations
   String createRegister(const String& deviceId, JsonObjectConst config);
   bool listRegisters(const String& deviceId, JsonArray& registers);
   bool getRegistersSummary(const String& deviceId, JsonArray& summary);
+  bool hasDevice(const String& deviceId);
+  
+  // Serialize one page of a device's registers as a JSON array straight into `out`
+  // (limit 0 = to the end). Returns the device's total register count, -1 if unknown.
+  int streamRegisters(const String& deviceId, Print& out, size_t offset, size_t limit, bool summaryOnly);
   bool deleteRegister(const String& deviceId, const String& registerId);
+  bool updateRegister(const String& deviceId, const String& registerId, JsonObjectConst patch, String& error);
 };
 
 #endif
\ No newline at end of file
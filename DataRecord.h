@@ -0,0 +1,22 @@
+#ifndef DATA_RECORD_H
+#define DATA_RECORD_H
+
+#include <stdint.h>
+
+// Fixed-size sample record passed by value through the data queue and the live
+// stream slots.
+// Pollers fill it straight from the compiled register plan, so acquisition never
+// builds a JSON document; consumers convert it only when they serialize a payload.
+struct DataRecord {
+  uint32_t time;
+  float value;
+  uint16_t address;
+  uint16_t deviceHandle;    // ConfigIndex handles, stable across config changes
+  uint16_t registerHandle;
+  char deviceId[12];
+  char registerId[12];
+  char dataType[12];
+  char name[32];
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,13 @@
+#ifndef JSON_CAPACITY_H
+#define JSON_CAPACITY_H
+
+#include <stddef.h>
+
+// Upper bound for the DynamicJsonDocument capacity needed to hold `textBytes`
+// of serialized JSON with copied strings. Worst case is many tiny members,
+// e.g. "a":1, where a 16-byte slot plus the key copy costs ~3x the text.
+inline size_t jsonCapacityFor(size_t textBytes) {
+  return textBytes * 3 + 256;
+}
+
+#endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "LoggingConfig.h"
+#include "PsramJson.h"
 
 const char* LoggingConfig::CONFIG_FILE = "/logging_config.json";
 
@@ -82,7 +83,7 @@ bool LoggingConfig::updateConfig(JsonObjectConst newConfig) {
   }
   
   // Update main config
-  config.set(newConfig);
+  copyJsonObject(config.to<JsonObject>(), newConfig);
   return saveConfig();
 }
 
@@ -0,0 +1,174 @@
+#include "LzssCodec.h"
+#include <string.h>
+
+static const uint32_t WINDOW_MASK = LZSS_WINDOW - 1;
+
+LzssEncoder::LzssEncoder() : position(0), end(0), groupSize(1), items(0), bytesIn(0), bytesOut(0),
+                             sink(nullptr), context(nullptr) {
+  group[0] = 0;
+}
+
+void LzssEncoder::begin(LzssSink output, void* outputContext) {
+  sink = output;
+  context = outputContext;
+  position = 0;
+  end = 0;
+  group[0] = 0;
+  groupSize = 1;
+  items = 0;
+  bytesIn = 0;
+  bytesOut = 0;
+  memset(head, 0, sizeof(head));
+}
+
+uint32_t LzssEncoder::hash(const uint8_t* window, uint32_t at) {
+  uint32_t key = window[at & WINDOW_MASK] | (window[(at + 1) & WINDOW_MASK] << 8) |
+                 (window[(at + 2) & WINDOW_MASK] << 16);
+  return (key * 2654435761u) >> (32 - HASH_BITS);
+}
+
+void LzssEncoder::insert(uint32_t at) {
+  if (at + LZSS_MIN_MATCH > end) return;  // Too close to the end to hash yet
+  uint32_t h = hash(window, at);
+  prev[at & WINDOW_MASK] = head[h];
+  head[h] = (uint16_t)at;
+}
+
+// Positions are kept as 16 bits, so a chain can lead to an unrelated position;
+// candidates are always verified byte by byte, which keeps any match correct
+void LzssEncoder::encodeOne() {
+  uint32_t available = end - position;
+  size_t limit = available < LZSS_MAX_MATCH ? available : LZSS_MAX_MATCH;
+  size_t bestLength = 0;
+  uint32_t bestOffset = 0;
+  
+  if (limit >= LZSS_MIN_MATCH) {
+    uint16_t candidate = head[hash(window, position)];
+    uint32_t lastOffset = 0;
+    for (int chain = 0; chain < MAX_CHAIN; chain++) {
+      uint32_t offset = (uint16_t)(position - candidate);
+      if (offset <= lastOffset || offset > LZSS_MAX_OFFSET || offset > position) break;
+      
+      size_t length = 0;
+      while (length < limit &&
+             window[(position - offset + length) & WINDOW_MASK] == window[(position + length) & WINDOW_MASK]) {
+        length++;
+      }
+      if (length > bestLength) {
+        bestLength = length;
+        bestOffset = offset;
+        if (length == limit) break;
+      }
+      lastOffset = offset;
+      candidate = prev[candidate & WINDOW_MASK];
+    }
+  }
+  
+  if (bestLength >= LZSS_MIN_MATCH) {
+    uint32_t code = bestOffset - 1;
+    group[0] |= 1 << items;
+    group[groupSize++] = code & 0xFF;
+    group[groupSize++] = (code >> 8) | ((bestLength - LZSS_MIN_MATCH) << 4);
+  } else {
+    bestLength = 1;
+    group[groupSize++] = window[position & WINDOW_MASK];
+  }
+  
+  for (size_t i = 0; i < bestLength; i++) {
+    insert(position++);
+  }
+  if (++items == 8) {
+    emitGroup();
+  }
+}
+
+void LzssEncoder::emitGroup() {
+  if (sink) {
+    sink(context, group, groupSize);
+  }
+  bytesOut += groupSize;
+  group[0] = 0;
+  groupSize = 1;
+  items = 0;
+}
+
+void LzssEncoder::write(const uint8_t* data, size_t size) {
+  bytesIn += size;
+  for (size_t i = 0; i < size; i++) {
+    // Keep exactly one longest match of lookahead; the window behind it is history
+    if (end - position == LZSS_MAX_MATCH) {
+      encodeOne();
+    }
+    window[end & WINDOW_MASK] = data[i];
+    end++;
+  }
+}
+
+void LzssEncoder::finish() {
+  while (position < end) {
+    encodeOne();
+  }
+  if (items > 0) {
+    emitGroup();
+  }
+}
+
+LzssDecoder::LzssDecoder() : produced(0), control(0), items(0), pendingMatch(false), matchLow(0), failed(false),
+                             outUsed(0), sink(nullptr), context(nullptr) {}
+
+void LzssDecoder::begin(LzssSink output, void* outputContext) {
+  sink = output;
+  context = outputContext;
+  produced = 0;
+  control = 0;
+  items = 0;
+  pendingMatch = false;
+  failed = false;
+  outUsed = 0;
+}
+
+void LzssDecoder::emit(uint8_t value) {
+  window[produced & WINDOW_MASK] = value;
+  produced++;
+  out[outUsed++] = value;
+  if (outUsed == sizeof(out)) {
+    if (sink) sink(context, out, outUsed);
+    outUsed = 0;
+  }
+}
+
+bool LzssDecoder::write(const uint8_t* data, size_t size) {
+  for (size_t i = 0; i < size && !failed; i++) {
+    uint8_t value = data[i];
+    if (items == 0) {
+      control = value;
+      items = 8;
+    } else if (pendingMatch) {
+      uint32_t offset = (matchLow | ((value & 0x0F) << 8)) + 1;
+      size_t length = (value >> 4) + LZSS_MIN_MATCH;
+      pendingMatch = false;
+      if (offset > produced) {
+        failed = true;
+        break;
+      }
+      for (size_t k = 0; k < length; k++) {
+        emit(window[(produced - offset) & WINDOW_MASK]);
+      }
+      control >>= 1;
+      items--;
+    } else if (control & 1) {
+      matchLow = value;
+      pendingMatch = true;
+    } else {
+      emit(value);
+      control >>= 1;
+      items--;
+    }
+  }
+  
+  if (outUsed > 0) {
+    if (sink) sink(context, out, outUsed);
+    outUsed = 0;
+  }
+  return !failed;
+}
\ No newline at end of file
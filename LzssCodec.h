@@ -0,0 +1,96 @@
+#ifndef LZSS_CODEC_H
+#define LZSS_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming LZSS for BLE responses: small fixed state, no allocation, and
+// output produced as input arrives, so a response is compressed while it is
+// being serialized.
+//
+// Stream format: groups of a control byte followed by up to 8 items, one per
+// control bit from the least significant. A 0 bit is a literal byte; a 1 bit is
+// a 2-byte back-reference:
+//
+//   byte 0: (offset - 1) & 0xFF
+//   byte 1: ((offset - 1) >> 8) | ((length - LZSS_MIN_MATCH) << 4)
+//
+// copying `length` bytes starting `offset` bytes back in the output (the copy
+// may overlap what it produces). The stream ends with the input; a trailing
+// control byte may announce fewer items than it has bits.
+//
+// Free of Arduino dependencies so host tools can decode it and it can be
+// unit-tested on Linux (testing/).
+static const size_t LZSS_WINDOW = 4096;
+static const size_t LZSS_MIN_MATCH = 3;
+static const size_t LZSS_MAX_MATCH = 18;
+static const size_t LZSS_MAX_OFFSET = LZSS_WINDOW - LZSS_MAX_MATCH - 1;
+
+typedef void (*LzssSink)(void* context, const uint8_t* data, size_t size);
+
+class LzssEncoder {
+private:
+  static const int HASH_BITS = 12;
+  static const int MAX_CHAIN = 16;  // Candidates tried per position
+  
+  uint8_t window[LZSS_WINDOW];
+  uint16_t head[1 << HASH_BITS];    // Latest position per 3-byte hash
+  uint16_t prev[LZSS_WINDOW];       // Previous position with the same hash
+  uint32_t position;                // Next input byte to encode
+  uint32_t end;                     // Input bytes received
+  uint8_t group[1 + 8 * 2];
+  size_t groupSize;
+  int items;
+  uint32_t bytesIn;
+  uint32_t bytesOut;
+  LzssSink sink;
+  void* context;
+  
+  static uint32_t hash(const uint8_t* window, uint32_t position);
+  void insert(uint32_t at);
+  void encodeOne();
+  void emitGroup();
+
+public:
+  LzssEncoder();
+  
+  void begin(LzssSink output, void* outputContext);
+  void write(const uint8_t* data, size_t size);
+  
+  // Encode what is left and emit the last group
+  void finish();
+  
+  uint32_t getBytesIn() const { return bytesIn; }
+  uint32_t getBytesOut() const { return bytesOut; }
+};
+
+class LzssDecoder {
+private:
+  uint8_t window[LZSS_WINDOW];
+  uint32_t produced;
+  uint8_t control;
+  int items;          // Items left in the current group; 0 = a control byte is next
+  bool pendingMatch;  // Have the first byte of a back-reference
+  uint8_t matchLow;
+  bool failed;
+  uint8_t out[256];   // Output handed to the sink in runs
+  size_t outUsed;
+  LzssSink sink;
+  void* context;
+  
+  void emit(uint8_t value);
+
+public:
+  LzssDecoder();
+  
+  void begin(LzssSink output, void* outputContext);
+  
+  // False once the stream refers back past its start
+  bool write(const uint8_t* data, size_t size);
+  
+  // True if the stream ended on an item boundary
+  bool finish() const { return !failed && !pendingMatch; }
+  uint32_t getProduced() const { return produced; }
+};
+
+#endif
\ No newline at end of file
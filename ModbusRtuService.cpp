@@ -1,12 +1,11 @@
 #include "ModbusRtuService.h"
 #include "QueueManager.h"
-#include "CRUDHandler.h"
+#include "StreamSubscriptions.h"
 #include "RTCManager.h"
 
-extern CRUDHandler* crudHandler;
-
 ModbusRtuService::ModbusRtuService(ConfigManager* config) 
-  : configManager(config), running(false), taskHandle(nullptr), 
+  : configManager(config), running(false), taskHandle(nullptr), plan(nullptr), changeQueue(nullptr), planStale(true),
+    imagePending(false), lastPlanChange(0),
     serial1(nullptr), serial2(nullptr), modbus1(nullptr), modbus2(nullptr) {}
 
 bool ModbusRtuService::init() {
@@ -32,6 +31,11 @@ bool ModbusRtuService::init() {
   modbus2 = new ModbusMaster();
   modbus2->begin(1, *serial2);
   
+  // Compiled descriptor table, rebuilt by the polling task when config changes
+  plan = new RegisterPlan();
+  changeQueue = xQueueCreate(CHANGE_QUEUE_SIZE, sizeof(ConfigChangeEvent));
+  configManager->addObserver(this);
+  
   Serial.println("Modbus RTU service initialized successfully");
   return true;
 }
@@ -80,51 +84,66 @@ void ModbusRtuService::readRtuDevicesTask(void* parameter) {
   service->readRtuDevicesLoop();
 }
 
-void ModbusRtuService::readRtuDevicesLoop() {
-  DeviceTimer deviceTimers[10];
-  int timerCount = 0;
+void ModbusRtuService::onConfigChanged(uint16_t deviceHandle, ConfigChange change, uint32_t generation) {
+  // Runs in the task that changed the config; only hand the device over to the poller
+  if (change == CONFIG_RESET || !changeQueue) {
+    planStale = true;
+    return;
+  }
   
+  ConfigChangeEvent event;
+  event.deviceHandle = deviceHandle;
+  event.generation = generation;
+  if (xQueueSend(changeQueue, &event, 0) != pdTRUE) {
+    planStale = true;
+  }
+}
+
+void ModbusRtuService::applyConfigChanges() {
+  if (planStale || !plan->isBuilt()) {
+    // Full recompile: first run, config reset, or change events were dropped
+    planStale = false;
+    if (changeQueue) {
+      xQueueReset(changeQueue);
+    }
+    if (!configManager->compilePlan(*plan, "RTU")) {
+      planStale = true;
+    }
+    return;
+  }
+  
+  // Recompile only the devices that changed; every other device keeps its state
+  ConfigChangeEvent event;
+  while (xQueueReceive(changeQueue, &event, 0) == pdTRUE) {
+    if (configManager->updatePlan(*plan, event.deviceHandle, "RTU")) {
+      plan->setGeneration(event.generation);
+      imagePending = true;
+      lastPlanChange = millis();
+    } else {
+      planStale = true;
+    }
+  }
+  
+  // Refresh the boot image once provisioning has gone quiet
+  if (imagePending && millis() - lastPlanChange >= PLAN_IMAGE_DELAY_MS) {
+    imagePending = false;
+    configManager->savePlanImage(*plan, "RTU");
+  }
+}
+
+void ModbusRtuService::readRtuDevicesLoop() {
   while (running) {
-    DynamicJsonDocument devicesDoc(2048);
-    JsonArray devices = devicesDoc.to<JsonArray>();
-    configManager->listDevices(devices);
+    applyConfigChanges();
     
     unsigned long currentTime = millis();
     
-    for (JsonVariant deviceVar : devices) {
+    for (int i = 0; i < plan->getDeviceCount(); i++) {
       if (!running) break;
       
-      String deviceId = deviceVar.as<String>();
-      
-      DynamicJsonDocument deviceDoc(2048);
-      JsonObject deviceObj = deviceDoc.to<JsonObject>();
-      if (configManager->readDevice(deviceId, deviceObj)) {
-        String protocol = deviceObj["protocol"] | "";
-        
-        if (protocol == "RTU") {
-          int refreshRate = deviceObj["refresh_rate_ms"] | 5000;
-          
-          int timerIndex = -1;
-          for (int i = 0; i < timerCount; i++) {
-            if (deviceTimers[i].deviceId == deviceId) {
-              timerIndex = i;
-              break;
-            }
-          }
-          
-          if (timerIndex == -1 && timerCount < 10) {
-            timerIndex = timerCount++;
-            deviceTimers[timerIndex].deviceId = deviceId;
-            deviceTimers[timerIndex].lastRead = 0;
-          }
-          
-          if (timerIndex >= 0) {
-            if (currentTime - deviceTimers[timerIndex].lastRead >= refreshRate) {
-              readRtuDeviceData(deviceObj);
-              deviceTimers[timerIndex].lastRead = currentTime;
-            }
-          }
-        }
+      DeviceDescriptor& device = plan->device(i);
+      if (currentTime - device.lastRead >= device.refreshRateMs) {
+        readRtuDeviceData(device);
+        device.lastRead = currentTime;
       }
     }
     
@@ -132,68 +151,61 @@ void ModbusRtuService::readRtuDevicesLoop() {
   }
 }
 
-void ModbusRtuService::readRtuDeviceData(const JsonObject& deviceConfig) {
-  String deviceId = deviceConfig["device_id"] | "UNKNOWN";
-  int serialPort = deviceConfig["serial_port"] | 1;
-  uint8_t slaveId = deviceConfig["slave_id"] | 1;
-  JsonArray registers = deviceConfig["registers"];
+void ModbusRtuService::readRtuDeviceData(const DeviceDescriptor& device) {
+  const char* deviceId = device.id();
   
-  if (registers.size() == 0) {
+  if (device.registerCount == 0) {
     return;
   }
   
-  ModbusMaster* modbus = getModbusForBus(serialPort);
+  ModbusMaster* modbus = getModbusForBus(device.serialPort);
   if (!modbus) {
     return;
   }
   
-  for (JsonVariant regVar : registers) {
+  for (int i = 0; i < device.registerCount; i++) {
     if (!running) break;
     
-    JsonObject reg = regVar.as<JsonObject>();
-    uint8_t functionCode = reg["function_code"] | 3;
-    uint16_t address = reg["address"] | 0;
-    String registerName = reg["register_name"] | "Unknown";
+    const RegisterDescriptor& reg = device.registers[i];
+    const char* registerName = device.str(reg.nameHandle);
     
     uint8_t result;
     
-    if (functionCode == 1) {
-      result = modbus->readCoils(address, 1);
+    if (reg.functionCode == 1) {
+      result = modbus->readCoils(reg.address, 1);
       if (result == modbus->ku8MBSuccess) {
         float value = (modbus->getResponseBuffer(0) & 0x01) ? 1.0 : 0.0;
-        storeRegisterValue(deviceId, reg, value);
-        Serial.printf("%s: %s = %.0f\n", deviceId.c_str(), registerName.c_str(), value);
+        storeRegisterValue(device, i, value);
+        Serial.printf("%s: %s = %.0f\n", deviceId, registerName, value);
       } else {
-        Serial.printf("%s: %s = ERROR\n", deviceId.c_str(), registerName.c_str());
+        Serial.printf("%s: %s = ERROR\n", deviceId, registerName);
       }
-    } else if (functionCode == 2) {
-      result = modbus->readDiscreteInputs(address, 1);
+    } else if (reg.functionCode == 2) {
+      result = modbus->readDiscreteInputs(reg.address, 1);
       if (result == modbus->ku8MBSuccess) {
         float value = (modbus->getResponseBuffer(0) & 0x01) ? 1.0 : 0.0;
-        storeRegisterValue(deviceId, reg, value);
-        Serial.printf("%s: %s = %.0f\n", deviceId.c_str(), registerName.c_str(), value);
+        storeRegisterValue(device, i, value);
+        Serial.printf("%s: %s = %.0f\n", deviceId, registerName, value);
       } else {
-        Serial.printf("%s: %s = ERROR\n", deviceId.c_str(), registerName.c_str());
+        Serial.printf("%s: %s = ERROR\n", deviceId, registerName);
       }
-    } else if (functionCode == 3) {
-      result = modbus->readHoldingRegisters(address, 1);
+    } else if (reg.functionCode == 3) {
+      result = modbus->readHoldingRegisters(reg.address, 1);
       if (result == modbus->ku8MBSuccess) {
-        uint16_t rawValue = modbus->getResponseBuffer(0);
-        float value = processRegisterValue(reg, rawValue);
-        storeRegisterValue(deviceId, reg, value);
-        Serial.printf("%s: %s = %.2f\n", deviceId.c_str(), registerName.c_str(), value);
+        float value = reg.codec(modbus->getResponseBuffer(0)) * reg.scale;
+        storeRegisterValue(device, i, value);
+        Serial.printf("%s: %s = %.2f\n", deviceId, registerName, value);
       } else {
-        Serial.printf("%s: %s = ERROR\n", deviceId.c_str(), registerName.c_str());
+        Serial.printf("%s: %s = ERROR\n", deviceId, registerName);
       }
-    } else if (functionCode == 4) {
-      result = modbus->readInputRegisters(address, 1);
+    } else if (reg.functionCode == 4) {
+      result = modbus->readInputRegisters(reg.address, 1);
       if (result == modbus->ku8MBSuccess) {
-        uint16_t rawValue = modbus->getResponseBuffer(0);
-        float value = processRegisterValue(reg, rawValue);
-        storeRegisterValue(deviceId, reg, value);
-        Serial.printf("%s: %s = %.2f\n", deviceId.c_str(), registerName.c_str(), value);
+        float value = reg.codec(modbus->getResponseBuffer(0)) * reg.scale;
+        storeRegisterValue(device, i, value);
+        Serial.printf("%s: %s = %.2f\n", deviceId, registerName, value);
       } else {
-        Serial.printf("%s: %s = ERROR\n", deviceId.c_str(), registerName.c_str());
+        Serial.printf("%s: %s = ERROR\n", deviceId, registerName);
       }
     }
     
@@ -201,54 +213,34 @@ void ModbusRtuService::readRtuDeviceData(const JsonObject& deviceConfig) {
   }
 }
 
-float ModbusRtuService::processRegisterValue(const JsonObject& reg, uint16_t rawValue) {
-  String dataType = reg["data_type"];
+void ModbusRtuService::storeRegisterValue(const DeviceDescriptor& device, int regIndex, float value) {
+  QueueManager* queueMgr = QueueManager::getInstance();
+  const RegisterDescriptor& reg = device.registers[regIndex];
   
-  if (dataType == "int16") {
-    return (int16_t)rawValue;
-  } else if (dataType == "int32") {
-    return rawValue;
-  } else if (dataType == "float32") {
-    return rawValue / 100.0;
-  } else if (dataType == "bool") {
-    return rawValue != 0 ? 1.0 : 0.0;
-  }
+  // Report-by-exception: only queue samples that leave the register's deadband
+  bool report = ReportFilter::shouldReport(reg.report, device.lastValues[regIndex], value, millis());
   
-  return rawValue;
-}
-
-void ModbusRtuService::storeRegisterValue(const String& deviceId, const JsonObject& reg, float value) {
-  QueueManager* queueMgr = QueueManager::getInstance();
+  // Live streaming: a lock-free bitmap test, no copies or locks per sample
+  StreamSubscriptions* streams = StreamSubscriptions::getInstance();
+  bool streamed = streams->isStreamed(reg.handle);
   
-  // Create data point in required format
-  DynamicJsonDocument dataDoc(256);
-  JsonObject dataPoint = dataDoc.to<JsonObject>();
+  if (!report && !streamed) {
+    return;
+  }
   
   RTCManager* rtc = RTCManager::getInstance();
-  if (rtc) {
-    DateTime now = rtc->getCurrentTime();
-    dataPoint["time"] = now.unixtime();
-  } else {
-    dataPoint["time"] = millis();
-  }
-  dataPoint["name"] = reg["register_name"].as<String>();
-  dataPoint["address"] = reg["address"];
-  dataPoint["datatype"] = reg["data_type"].as<String>();
-  dataPoint["value"] = value;
-  dataPoint["device_id"] = deviceId;
-  dataPoint["register_id"] = reg["register_id"].as<String>();
+  uint32_t timestamp = rtc ? rtc->getCurrentTime().unixtime() : millis();
+  
+  DataRecord record;
+  RegisterPlan::fillRecord(device, regIndex, value, timestamp, record);
   
   // Add to message queue
-  queueMgr->enqueue(dataPoint);
+  if (report) {
+    queueMgr->enqueue(record);
+  }
   
-  // Check if this device is being streamed
-  String streamId = crudHandler ? crudHandler->getStreamDeviceId() : "";
-  Serial.printf("RTU: Device %s, StreamID '%s', Match: %s\n", 
-                deviceId.c_str(), streamId.c_str(), 
-                (streamId == deviceId) ? "YES" : "NO");
-  if (!streamId.isEmpty() && streamId == deviceId) {
-    Serial.printf("Streaming data for device %s\n", deviceId.c_str());
-    queueMgr->enqueueStream(dataPoint);
+  if (streamed) {
+    streams->offer(record);
   }
 }
 
@@ -264,29 +256,17 @@ ModbusMaster* ModbusRtuService::getModbusForBus(int serialPort) {
 void ModbusRtuService::getStatus(JsonObject& status) {
   status["running"] = running;
   status["service_type"] = "modbus_rtu";
-  
-  DynamicJsonDocument devicesDoc(1024);
-  JsonArray devices = devicesDoc.to<JsonArray>();
-  configManager->listDevices(devices);
-  
-  int rtuDeviceCount = 0;
-  for (JsonVariant deviceVar : devices) {
-    String deviceId = deviceVar.as<String>();
-    DynamicJsonDocument deviceDoc(512);
-    JsonObject deviceObj = deviceDoc.to<JsonObject>();
-    if (configManager->readDevice(deviceId, deviceObj)) {
-      String protocol = deviceObj["protocol"] | "";
-      if (protocol == "RTU") {
-        rtuDeviceCount++;
-      }
-    }
-  }
-  
-  status["rtu_device_count"] = rtuDeviceCount;
+  status["rtu_device_count"] = configManager->countDevices("RTU");
 }
 
 ModbusRtuService::~ModbusRtuService() {
   stop();
+  if (configManager) {
+    configManager->removeObserver(this);
+  }
+  if (changeQueue) {
+    vQueueDelete(changeQueue);
+  }
   if (serial1) {
     delete serial1;
   }
@@ -299,4 +279,7 @@ ModbusRtuService::~ModbusRtuService() {
   if (modbus2) {
     delete modbus2;
   }
+  if (plan) {
+    delete plan;
+  }
 }
\ No newline at end of file
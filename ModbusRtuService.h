@@ -5,14 +5,31 @@
 #include <HardwareSerial.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/queue.h>
 #include <ModbusMaster.h>
 #include "ConfigManager.h"
+#include "RegisterPlan.h"
 
-class ModbusRtuService {
+class ModbusRtuService : public ConfigObserver {
 private:
   ConfigManager* configManager;
   bool running;
   TaskHandle_t taskHandle;
+  RegisterPlan* plan;  // Compiled RTU devices/registers, owned by the polling task
+  
+  // Device changes reported by ConfigManager, applied by the polling task
+  struct ConfigChangeEvent {
+    uint16_t deviceHandle;
+    uint32_t generation;
+  };
+  static const int CHANGE_QUEUE_SIZE = 16;
+  QueueHandle_t changeQueue;
+  volatile bool planStale;  // Set when a change could not be queued or config was reset
+  
+  // Plan image is rewritten only after changes stop arriving for a while
+  static const unsigned long PLAN_IMAGE_DELAY_MS = 30000;
+  bool imagePending;
+  unsigned long lastPlanChange;
   
   // Hardware configuration for dual RTU buses
   static const int RTU_RX1 = 15;   // GPIO15 RXD1_RS485
@@ -26,19 +43,11 @@ private:
   ModbusMaster* modbus1;
   ModbusMaster* modbus2;
   
-  // Device timers for refresh rate control
-  struct DeviceTimer {
-    String deviceId;
-    unsigned long lastRead;
-  };
-  
-
-  
   static void readRtuDevicesTask(void* parameter);
   void readRtuDevicesLoop();
-  void readRtuDeviceData(const JsonObject& deviceConfig);
-  float processRegisterValue(const JsonObject& reg, uint16_t rawValue);
-  void storeRegisterValue(const String& deviceId, const JsonObject& reg, float value);
+  void applyConfigChanges();
+  void readRtuDeviceData(const DeviceDescriptor& device);
+  void storeRegisterValue(const DeviceDescriptor& device, int regIndex, float value);
   ModbusMaster* getModbusForBus(int serialPort);
 
 public:
@@ -49,6 +58,8 @@ public:
   void stop();
   void getStatus(JsonObject& status);
   
+  void onConfigChanged(uint16_t deviceHandle, ConfigChange change, uint32_t generation) override;
+  
   ~ModbusRtuService();
 };
 
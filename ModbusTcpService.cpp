@@ -1,14 +1,13 @@
 #include "ModbusTcpService.h"
 #include "QueueManager.h"
-#include "CRUDHandler.h"
+#include "StreamSubscriptions.h"
 #include "RTCManager.h"
 
-extern CRUDHandler* crudHandler;
-
 uint16_t ModbusTcpService::transactionCounter = 1;
 
 ModbusTcpService::ModbusTcpService(ConfigManager* config, EthernetManager* ethernet) 
-  : configManager(config), ethernetManager(ethernet), running(false), taskHandle(nullptr) {}
+  : configManager(config), ethernetManager(ethernet), running(false), taskHandle(nullptr), plan(nullptr),
+    changeQueue(nullptr), planStale(true), imagePending(false), lastPlanChange(0) {}
 
 bool ModbusTcpService::init() {
   Serial.println("Initializing custom Modbus TCP service...");
@@ -23,6 +22,11 @@ bool ModbusTcpService::init() {
     return false;
   }
   
+  // Compiled descriptor table, rebuilt by the polling task when config changes
+  plan = new RegisterPlan();
+  changeQueue = xQueueCreate(CHANGE_QUEUE_SIZE, sizeof(ConfigChangeEvent));
+  configManager->addObserver(this);
+  
   Serial.printf("Ethernet available: %s\n", ethernetManager->isAvailable() ? "YES" : "NO");
   Serial.println("Custom Modbus TCP service initialized successfully");
   return true;
@@ -71,10 +75,54 @@ void ModbusTcpService::readTcpDevicesTask(void* parameter) {
   service->readTcpDevicesLoop();
 }
 
-void ModbusTcpService::readTcpDevicesLoop() {
-  DeviceTimer deviceTimers[10]; // Support up to 10 devices
-  int timerCount = 0;
+void ModbusTcpService::onConfigChanged(uint16_t deviceHandle, ConfigChange change, uint32_t generation) {
+  // Runs in the task that changed the config; only hand the device over to the poller
+  if (change == CONFIG_RESET || !changeQueue) {
+    planStale = true;
+    return;
+  }
+  
+  ConfigChangeEvent event;
+  event.deviceHandle = deviceHandle;
+  event.generation = generation;
+  if (xQueueSend(changeQueue, &event, 0) != pdTRUE) {
+    planStale = true;
+  }
+}
+
+void ModbusTcpService::applyConfigChanges() {
+  if (planStale || !plan->isBuilt()) {
+    // Full recompile: first run, config reset, or change events were dropped
+    planStale = false;
+    if (changeQueue) {
+      xQueueReset(changeQueue);
+    }
+    if (!configManager->compilePlan(*plan, "TCP")) {
+      planStale = true;
+    }
+    return;
+  }
+  
+  // Recompile only the devices that changed; every other device keeps its state
+  ConfigChangeEvent event;
+  while (xQueueReceive(changeQueue, &event, 0) == pdTRUE) {
+    if (configManager->updatePlan(*plan, event.deviceHandle, "TCP")) {
+      plan->setGeneration(event.generation);
+      imagePending = true;
+      lastPlanChange = millis();
+    } else {
+      planStale = true;
+    }
+  }
   
+  // Refresh the boot image once provisioning has gone quiet
+  if (imagePending && millis() - lastPlanChange >= PLAN_IMAGE_DELAY_MS) {
+    imagePending = false;
+    configManager->savePlanImage(*plan, "TCP");
+  }
+}
+
+void ModbusTcpService::readTcpDevicesLoop() {
   // Custom Modbus TCP loop started
   
   while (running) {
@@ -84,48 +132,17 @@ void ModbusTcpService::readTcpDevicesLoop() {
       continue;
     }
     
-    // Get TCP devices
-    DynamicJsonDocument devicesDoc(2048);
-    JsonArray devices = devicesDoc.to<JsonArray>();
-    configManager->listDevices(devices);
+    applyConfigChanges();
     
     unsigned long currentTime = millis();
     
-    for (JsonVariant deviceVar : devices) {
+    for (int i = 0; i < plan->getDeviceCount(); i++) {
       if (!running) break; // Exit if stopped
       
-      String deviceId = deviceVar.as<String>();
-      
-      DynamicJsonDocument deviceDoc(2048);
-      JsonObject deviceObj = deviceDoc.to<JsonObject>();
-      if (configManager->readDevice(deviceId, deviceObj)) {
-        String protocol = deviceObj["protocol"] | "";
-        
-        if (protocol == "TCP") {
-          int refreshRate = deviceObj["refresh_rate_ms"] | 5000;
-          
-          // Find or create timer for this device
-          int timerIndex = -1;
-          for (int i = 0; i < timerCount; i++) {
-            if (deviceTimers[i].deviceId == deviceId) {
-              timerIndex = i;
-              break;
-            }
-          }
-          
-          if (timerIndex == -1 && timerCount < 10) {
-            timerIndex = timerCount++;
-            deviceTimers[timerIndex].deviceId = deviceId;
-            deviceTimers[timerIndex].lastRead = 0;
-          }
-          
-          if (timerIndex >= 0) {
-            if (currentTime - deviceTimers[timerIndex].lastRead >= refreshRate) {
-              readTcpDeviceData(deviceObj);
-              deviceTimers[timerIndex].lastRead = currentTime;
-            }
-          }
-        }
+      DeviceDescriptor& device = plan->device(i);
+      if (currentTime - device.lastRead >= device.refreshRateMs) {
+        readTcpDeviceData(device);
+        device.lastRead = currentTime;
       }
     }
     
@@ -133,47 +150,42 @@ void ModbusTcpService::readTcpDevicesLoop() {
   }
 }
 
-void ModbusTcpService::readTcpDeviceData(const JsonObject& deviceConfig) {
-  String deviceId = deviceConfig["device_id"] | "UNKNOWN";
-  String ip = deviceConfig["ip"] | "";
-  int port = deviceConfig["port"] | 502;
-  uint8_t slaveId = deviceConfig["slave_id"] | 1;
-  JsonArray registers = deviceConfig["registers"];
-  
-  if (ip.isEmpty() || registers.size() == 0) {
+void ModbusTcpService::readTcpDeviceData(const DeviceDescriptor& device) {
+  const char* deviceId = device.id();
+  const char* ip = device.str(device.ipHandle);
+  
+  if (ip[0] == '\0' || device.registerCount == 0) {
     return;
   }
   
-  Serial.printf("Reading Ethernet device %s at %s:%d\n", deviceId.c_str(), ip.c_str(), port);
+  Serial.printf("Reading Ethernet device %s at %s:%d\n", deviceId, ip, device.port);
   Serial.printf("Ethernet available: %s\n", ethernetManager->isAvailable() ? "YES" : "NO");
   
-  for (JsonVariant regVar : registers) {
+  for (int i = 0; i < device.registerCount; i++) {
     if (!running) break;
     
-    JsonObject reg = regVar.as<JsonObject>();
-    uint8_t functionCode = reg["function_code"] | 3;
-    uint16_t address = reg["address"] | 0;
-    String registerName = reg["register_name"] | "Unknown";
+    const RegisterDescriptor& reg = device.registers[i];
+    const char* registerName = device.str(reg.nameHandle);
     
-    if (functionCode == 1 || functionCode == 2) {
+    if (reg.functionCode == 1 || reg.functionCode == 2) {
       // Read coils/discrete inputs
       bool result = false;
-      if (readModbusCoil(ip, port, slaveId, address, &result)) {
+      if (readModbusCoil(ip, device.port, device.slaveId, reg.address, &result)) {
         float value = result ? 1.0 : 0.0;
-        storeRegisterValue(deviceId, reg, value);
-        Serial.printf("%s: %s = %.0f\n", deviceId.c_str(), registerName.c_str(), value);
+        storeRegisterValue(device, i, value);
+        Serial.printf("%s: %s = %.0f\n", deviceId, registerName, value);
       } else {
-        Serial.printf("%s: %s = ERROR\n", deviceId.c_str(), registerName.c_str());
+        Serial.printf("%s: %s = ERROR\n", deviceId, registerName);
       }
     } else {
       // Read registers
       uint16_t result = 0;
-      if (readModbusRegister(ip, port, slaveId, functionCode, address, &result)) {
-        float value = processRegisterValue(reg, result);
-        storeRegisterValue(deviceId, reg, value);
-        Serial.printf("%s: %s = %.2f\n", deviceId.c_str(), registerName.c_str(), value);
+      if (readModbusRegister(ip, device.port, device.slaveId, reg.functionCode, reg.address, &result)) {
+        float value = reg.codec(result) * reg.scale;
+        storeRegisterValue(device, i, value);
+        Serial.printf("%s: %s = %.2f\n", deviceId, registerName, value);
       } else {
-        Serial.printf("%s: %s = ERROR\n", deviceId.c_str(), registerName.c_str());
+        Serial.printf("%s: %s = ERROR\n", deviceId, registerName);
       }
     }
     
@@ -181,10 +193,10 @@ void ModbusTcpService::readTcpDeviceData(const JsonObject& deviceConfig) {
   }
 }
 
-bool ModbusTcpService::readModbusRegister(const String& ip, int port, uint8_t slaveId, uint8_t functionCode, uint16_t address, uint16_t* result) {
+bool ModbusTcpService::readModbusRegister(const char* ip, int port, uint8_t slaveId, uint8_t functionCode, uint16_t address, uint16_t* result) {
   EthernetClient client;
   
-  if (!client.connect(ip.c_str(), port)) {
+  if (!client.connect(ip, port)) {
     return false;
   }
   
@@ -215,10 +227,10 @@ bool ModbusTcpService::readModbusRegister(const String& ip, int port, uint8_t sl
   return parseModbusResponse(response, bytesRead, functionCode, result);
 }
 
-bool ModbusTcpService::readModbusCoil(const String& ip, int port, uint8_t slaveId, uint16_t address, bool* result) {
+bool ModbusTcpService::readModbusCoil(const char* ip, int port, uint8_t slaveId, uint16_t address, bool* result) {
   EthernetClient client;
   
-  if (!client.connect(ip.c_str(), port)) {
+  if (!client.connect(ip, port)) {
     return false;
   }
   
@@ -307,54 +319,34 @@ bool ModbusTcpService::parseModbusResponse(uint8_t* buffer, int length, uint8_t
   return false;
 }
 
-float ModbusTcpService::processRegisterValue(const JsonObject& reg, uint16_t rawValue) {
-  String dataType = reg["data_type"];
-  
-  if (dataType == "int16") {
-    return (int16_t)rawValue;
-  } else if (dataType == "int32") {
-    return rawValue; // For 32-bit, would need to read 2 registers
-  } else if (dataType == "float32") {
-    return rawValue / 100.0; // Simple scaling, adjust as needed
-  } else if (dataType == "bool") {
-    return rawValue != 0 ? 1.0 : 0.0;
-  }
-  
-  return rawValue;
-}
-
-void ModbusTcpService::storeRegisterValue(const String& deviceId, const JsonObject& reg, float value) {
+void ModbusTcpService::storeRegisterValue(const DeviceDescriptor& device, int regIndex, float value) {
   QueueManager* queueMgr = QueueManager::getInstance();
+  const RegisterDescriptor& reg = device.registers[regIndex];
   
-  // Create data point in required format
-  DynamicJsonDocument dataDoc(256);
-  JsonObject dataPoint = dataDoc.to<JsonObject>();
+  // Report-by-exception: only queue samples that leave the register's deadband
+  bool report = ReportFilter::shouldReport(reg.report, device.lastValues[regIndex], value, millis());
   
-  RTCManager* rtc = RTCManager::getInstance();
-  if (rtc) {
-    DateTime now = rtc->getCurrentTime();
-    dataPoint["time"] = now.unixtime();
-  } else {
-    dataPoint["time"] = millis();
+  // Live streaming: a lock-free bitmap test, no copies or locks per sample
+  StreamSubscriptions* streams = StreamSubscriptions::getInstance();
+  bool streamed = streams->isStreamed(reg.handle);
+  
+  if (!report && !streamed) {
+    return;
   }
-  dataPoint["name"] = reg["register_name"].as<String>();
-  dataPoint["address"] = reg["address"];
-  dataPoint["datatype"] = reg["data_type"].as<String>();
-  dataPoint["value"] = value;
-  dataPoint["device_id"] = deviceId;
-  dataPoint["register_id"] = reg["register_id"].as<String>();
+  
+  RTCManager* rtc = RTCManager::getInstance();
+  uint32_t timestamp = rtc ? rtc->getCurrentTime().unixtime() : millis();
+  
+  DataRecord record;
+  RegisterPlan::fillRecord(device, regIndex, value, timestamp, record);
   
   // Add to message queue
-  queueMgr->enqueue(dataPoint);
-  
-  // Check if this device is being streamed
-  String streamId = crudHandler ? crudHandler->getStreamDeviceId() : "";
-  Serial.printf("TCP: Device %s, StreamID '%s', Match: %s\n", 
-                deviceId.c_str(), streamId.c_str(), 
-                (streamId == deviceId) ? "YES" : "NO");
-  if (!streamId.isEmpty() && streamId == deviceId) {
-    Serial.printf("Streaming data for device %s\n", deviceId.c_str());
-    queueMgr->enqueueStream(dataPoint);
+  if (report) {
+    queueMgr->enqueue(record);
+  }
+  
+  if (streamed) {
+    streams->offer(record);
   }
 }
 
@@ -363,27 +355,18 @@ void ModbusTcpService::getStatus(JsonObject& status) {
   status["service_type"] = "modbus_tcp";
   status["ethernet_available"] = ethernetManager->isAvailable();
   
-  // Count TCP devices
-  DynamicJsonDocument devicesDoc(1024);
-  JsonArray devices = devicesDoc.to<JsonArray>();
-  configManager->listDevices(devices);
-  
-  int tcpDeviceCount = 0;
-  for (JsonVariant deviceVar : devices) {
-    String deviceId = deviceVar.as<String>();
-    DynamicJsonDocument deviceDoc(512);
-    JsonObject deviceObj = deviceDoc.to<JsonObject>();
-    if (configManager->readDevice(deviceId, deviceObj)) {
-      String protocol = deviceObj["protocol"] | "";
-      if (protocol == "TCP") {
-        tcpDeviceCount++;
-      }
-    }
-  }
-  
-  status["tcp_device_count"] = tcpDeviceCount;
+  status["tcp_device_count"] = configManager->countDevices("TCP");
 }
 
 ModbusTcpService::~ModbusTcpService() {
   stop();
+  if (configManager) {
+    configManager->removeObserver(this);
+  }
+  if (changeQueue) {
+    vQueueDelete(changeQueue);
+  }
+  if (plan) {
+    delete plan;
+  }
 }
\ No newline at end of file
@@ -5,21 +5,32 @@
 #include <Ethernet.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/queue.h>
 #include "ConfigManager.h"
+#include "RegisterPlan.h"
 #include "EthernetManager.h"
 
-class ModbusTcpService {
+class ModbusTcpService : public ConfigObserver {
 private:
   ConfigManager* configManager;
   EthernetManager* ethernetManager;
   bool running;
   TaskHandle_t taskHandle;
+  RegisterPlan* plan;  // Compiled TCP devices/registers, owned by the polling task
   
-  // Device timers for refresh rate control
-  struct DeviceTimer {
-    String deviceId;
-    unsigned long lastRead;
+  // Device changes reported by ConfigManager, applied by the polling task
+  struct ConfigChangeEvent {
+    uint16_t deviceHandle;
+    uint32_t generation;
   };
+  static const int CHANGE_QUEUE_SIZE = 16;
+  QueueHandle_t changeQueue;
+  volatile bool planStale;  // Set when a change could not be queued or config was reset
+  
+  // Plan image is rewritten only after changes stop arriving for a while
+  static const unsigned long PLAN_IMAGE_DELAY_MS = 30000;
+  bool imagePending;
+  unsigned long lastPlanChange;
   
   // Modbus TCP protocol implementation
   struct ModbusFrame {
@@ -36,13 +47,13 @@ private:
   
   static void readTcpDevicesTask(void* parameter);
   void readTcpDevicesLoop();
-  void readTcpDeviceData(const JsonObject& deviceConfig);
-  bool readModbusRegister(const String& ip, int port, uint8_t slaveId, uint8_t functionCode, uint16_t address, uint16_t* result);
-  bool readModbusCoil(const String& ip, int port, uint8_t slaveId, uint16_t address, bool* result);
+  void applyConfigChanges();
+  void readTcpDeviceData(const DeviceDescriptor& device);
+  bool readModbusRegister(const char* ip, int port, uint8_t slaveId, uint8_t functionCode, uint16_t address, uint16_t* result);
+  bool readModbusCoil(const char* ip, int port, uint8_t slaveId, uint16_t address, bool* result);
   void buildModbusRequest(uint8_t* buffer, uint16_t transId, uint8_t unitId, uint8_t funcCode, uint16_t addr, uint16_t qty);
   bool parseModbusResponse(uint8_t* buffer, int length, uint8_t expectedFunc, uint16_t* result, bool* boolResult = nullptr);
-  float processRegisterValue(const JsonObject& reg, uint16_t rawValue);
-  void storeRegisterValue(const String& deviceId, const JsonObject& reg, float value);
+  void storeRegisterValue(const DeviceDescriptor& device, int regIndex, float value);
 
 public:
   ModbusTcpService(ConfigManager* config, EthernetManager* ethernet);
@@ -52,6 +63,8 @@ public:
   void stop();
   void getStatus(JsonObject& status);
   
+  void onConfigChanged(uint16_t deviceHandle, ConfigChange change, uint32_t generation) override;
+  
   ~ModbusTcpService();
 };
 
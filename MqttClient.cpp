@@ -0,0 +1,518 @@
+#include "MqttClient.h"
+#include <string.h>
+
+enum MqttPacketType : uint8_t {
+  MQTT_CONNECT = 1,
+  MQTT_CONNACK = 2,
+  MQTT_PUBLISH = 3,
+  MQTT_PUBACK = 4,
+  MQTT_SUBSCRIBE = 8,
+  MQTT_SUBACK = 9,
+  MQTT_PINGREQ = 12,
+  MQTT_PINGRESP = 13,
+  MQTT_DISCONNECT = 14
+};
+
+static const uint32_t MQTT_MAX_LENGTH = 268435455;  // Four Remaining Length bytes
+
+MqttClient::MqttClient()
+  : transport(nullptr), buffer(nullptr), capacity(0), sendBuffer(nullptr), sendCapacity(0), sendStart(0), sendPending(0),
+    handler(nullptr), handlerContext(nullptr),
+    state(MQTT_DISCONNECTED), connectResult(0xFF), keepAliveMs(0), clock(0), lastSent(0), stateSince(0),
+    pingSentAt(0), pingPending(false), nextPacketId(0), inflightCount(0), inflightWindow(16),
+    ackHandler(nullptr), ackContext(nullptr), publishOpen(false), publishRemaining(0), rxStage(RX_HEADER), rxHeader(0), rxShift(0), rxLength(0), rxReceived(0) {
+  memset(&stats, 0, sizeof(stats));
+}
+
+void MqttClient::begin(MqttTransport* stream, uint8_t* receiveBuffer, size_t bufferSize,
+                       uint8_t* sendBufferStorage, size_t sendBufferSize) {
+  transport = stream;
+  buffer = receiveBuffer;
+  capacity = bufferSize;
+  sendBuffer = sendBufferStorage;
+  sendCapacity = sendBufferSize;
+}
+
+void MqttClient::setHandler(MqttMessageHandler messageHandler, void* context) {
+  handler = messageHandler;
+  handlerContext = context;
+}
+
+void MqttClient::setAckHandler(MqttAckHandler handler, void* context) {
+  ackHandler = handler;
+  ackContext = context;
+}
+
+void MqttClient::setInflightWindow(int window) {
+  inflightWindow = window < 1 ? 1 : (window > MAX_INFLIGHT ? MAX_INFLIGHT : window);
+}
+
+size_t MqttClient::encodeLength(uint8_t* out, uint32_t length) {
+  size_t count = 0;
+  do {
+    uint8_t digit = length % 128;
+    length /= 128;
+    if (length > 0) {
+      digit |= 0x80;
+    }
+    out[count++] = digit;
+  } while (length > 0);
+  return count;
+}
+
+size_t MqttClient::publishSize(size_t topicLength, size_t length, uint8_t qos) {
+  size_t remaining = 2 + topicLength + (qos ? 2 : 0) + length;
+  size_t lengthBytes = remaining < 128 ? 1 : remaining < 16384 ? 2 : remaining < 2097152 ? 3 : 4;
+  return 1 + lengthBytes + remaining;
+}
+
+bool MqttClient::connect(const char* host, uint16_t port, const MqttConnectOptions& options, uint32_t now) {
+  disconnect();
+  clock = now;
+  if (!transport || !buffer || capacity < MIN_BUFFER_SIZE || !sendBuffer || sendCapacity < MIN_BUFFER_SIZE ||
+      !transport->open(host, port)) {
+    return false;
+  }
+  
+  rxStage = RX_HEADER;
+  pingPending = false;
+  connectResult = 0xFF;
+  keepAliveMs = options.keepAliveSeconds * 1000UL;
+  state = MQTT_CONNECTING;
+  stateSince = now;
+  
+  // A password is only sent with a user name (MQTT 3.1.1, 3.1.2.9)
+  const char* clientId = options.clientId ? options.clientId : "";
+  bool hasUser = options.username && options.username[0];
+  bool hasPassword = hasUser && options.password && options.password[0];
+  uint32_t length = 10 + 2 + strlen(clientId);
+  if (hasUser) length += 2 + strlen(options.username);
+  if (hasPassword) length += 2 + strlen(options.password);
+  
+  uint8_t header[5 + 10];
+  size_t used = 0;
+  header[used++] = MQTT_CONNECT << 4;
+  used += encodeLength(header + used, length);
+  static const uint8_t PROTOCOL[] = { 0, 4, 'M', 'Q', 'T', 'T', 4 };
+  memcpy(header + used, PROTOCOL, sizeof(PROTOCOL));
+  used += sizeof(PROTOCOL);
+  header[used++] = (options.cleanSession ? 0x02 : 0) | (hasUser ? 0x80 : 0) | (hasPassword ? 0x40 : 0);
+  header[used++] = options.keepAliveSeconds >> 8;
+  header[used++] = options.keepAliveSeconds & 0xFF;
+  
+  if (!send(header, used) || !sendString(clientId) ||
+      (hasUser && !sendString(options.username)) || (hasPassword && !sendString(options.password))) {
+    return false;
+  }
+  stats.packetsOut++;
+  return true;
+}
+
+void MqttClient::disconnect() {
+  if (state == MQTT_DISCONNECTED) return;
+  if (state == MQTT_CONNECTED && !publishOpen && sendControl(MQTT_DISCONNECT << 4)) {
+    flush();   // Best effort: whatever the transport does not take now is lost
+  }
+  fail();
+}
+
+void MqttClient::fail() {
+  if (transport) {
+    transport->close();
+  }
+  state = MQTT_DISCONNECTED;
+  rxStage = RX_HEADER;
+  pingPending = false;
+  inflightCount = 0;
+  publishOpen = false;
+  sendStart = 0;
+  sendPending = 0;
+}
+
+bool MqttClient::poll(uint32_t now) {
+  clock = now;
+  if (state == MQTT_DISCONNECTED) return false;
+  if (!flush()) return false;
+  if (publishOpen) return true;   // A PINGREQ or PUBACK now would land inside the payload
+  
+  // Body bytes that fit are read straight into the receive buffer; headers and
+  // the overflow of an oversized packet go through a small scratch chunk
+  uint8_t chunk[256];
+  while (state != MQTT_DISCONNECTED) {
+    bool direct = rxStage == RX_BODY && rxReceived < capacity;
+    uint8_t* target = chunk;
+    size_t room = sizeof(chunk);
+    if (direct) {
+      target = buffer + rxReceived;
+      room = capacity - rxReceived;
+      if (room > rxLength - rxReceived) {
+        room = rxLength - rxReceived;
+      }
+    }
+    
+    int count = transport->read(target, room);
+    if (count < 0) {
+      fail();
+      return false;
+    }
+    if (count == 0) break;
+    stats.bytesIn += count;
+    
+    bool ok;
+    if (direct) {
+      rxReceived += count;
+      ok = true;
+      if (rxReceived == rxLength) {
+        rxStage = RX_HEADER;
+        ok = handlePacket();
+      }
+    } else {
+      ok = receive(chunk, count);
+    }
+    if (!ok) {
+      fail();
+      return false;
+    }
+  }
+  
+  if (state == MQTT_CONNECTING && now - stateSince > CONNECT_TIMEOUT_MS) {
+    fail();
+    return false;
+  }
+  
+  if (state == MQTT_CONNECTED && inflightCount > 0 && now - inflight[0].sentAt > ACK_TIMEOUT_MS) {
+    stats.ackTimeouts++;
+    fail();
+    return false;
+  }
+  
+  // Ping after half a keepalive period without sending; no answer within a
+  // whole period means the connection is dead
+  if (state == MQTT_CONNECTED && keepAliveMs > 0) {
+    if (pingPending && now - pingSentAt > keepAliveMs) {
+      stats.keepaliveTimeouts++;
+      fail();
+      return false;
+    }
+    if (!pingPending && now - lastSent >= keepAliveMs / 2) {
+      if (!sendControl(MQTT_PINGREQ << 4)) return false;
+      pingPending = true;
+      pingSentAt = now;
+    }
+  }
+  return state != MQTT_DISCONNECTED;
+}
+
+// Feeds received bytes through the packet state machine. Returns false on a
+// protocol error.
+bool MqttClient::receive(const uint8_t* data, size_t size) {
+  while (size > 0) {
+    if (rxStage == RX_HEADER) {
+      rxHeader = *data++;
+      size--;
+      rxLength = 0;
+      rxShift = 0;
+      rxReceived = 0;
+      rxStage = RX_LENGTH;
+      
+    } else if (rxStage == RX_LENGTH) {
+      uint8_t digit = *data++;
+      size--;
+      rxLength |= (uint32_t)(digit & 0x7F) << rxShift;
+      rxShift += 7;
+      if (digit & 0x80) {
+        if (rxShift >= 28) return false;
+        continue;
+      }
+      rxStage = RX_BODY;
+      if (rxLength == 0) {
+        rxStage = RX_HEADER;
+        if (!handlePacket()) return false;
+      }
+      
+    } else {
+      size_t count = rxLength - rxReceived;
+      if (count > size) {
+        count = size;
+      }
+      if (rxReceived < capacity) {
+        size_t kept = capacity - rxReceived < count ? capacity - rxReceived : count;
+        memcpy(buffer + rxReceived, data, kept);
+      }
+      rxReceived += count;
+      data += count;
+      size -= count;
+      if (rxReceived == rxLength) {
+        rxStage = RX_HEADER;
+        if (!handlePacket()) return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool MqttClient::handlePacket() {
+  stats.packetsIn++;
+  uint8_t type = rxHeader >> 4;
+  
+  if (state == MQTT_CONNECTING) {
+    if (type != MQTT_CONNACK || rxLength != 2) return false;
+    connectResult = buffer[1];
+    if (connectResult != 0) return false;
+    state = MQTT_CONNECTED;
+    stateSince = clock;
+    return true;
+  }
+  
+  switch (type) {
+    case MQTT_PUBLISH:
+      return handlePublish();
+    case MQTT_PUBACK:
+      if (rxLength != 2) return false;
+      handleAck();
+      return true;
+    case MQTT_SUBACK:
+      for (uint32_t i = 2; i < rxLength && i < capacity; i++) {
+        if (buffer[i] == 0x80) {
+          stats.subscribeFailures++;
+        }
+      }
+      return true;
+    case MQTT_PINGRESP:
+      pingPending = false;
+      return true;
+    case MQTT_CONNACK:
+      return false;  // Only valid once, during the handshake
+    default:
+      return true;
+  }
+}
+
+bool MqttClient::handlePublish() {
+  uint8_t qos = (rxHeader >> 1) & 0x03;
+  if (qos > 1 || rxLength < 2) return false;  // QoS 2 is never subscribed to
+  
+  size_t kept = rxLength < capacity ? rxLength : capacity;
+  size_t topicLength = (buffer[0] << 8) | buffer[1];
+  size_t headerSize = 2 + topicLength + (qos ? 2 : 0);
+  if (headerSize > rxLength) return false;
+  stats.messagesIn++;
+  if (headerSize > kept) {
+    // Not even the topic fits; nothing can be said about this message
+    stats.oversized++;
+    return true;
+  }
+  
+  // Acknowledged before it is handled: a command is run at most once
+  if (qos == 1) {
+    uint16_t packetId = (buffer[2 + topicLength] << 8) | buffer[3 + topicLength];
+    if (!sendAck(MQTT_PUBACK << 4, packetId)) return false;
+  }
+  
+  // Terminate the topic in place; the payload starts after it
+  memmove(buffer, buffer + 2, topicLength);
+  buffer[topicLength] = '\0';
+  
+  MqttMessage message;
+  message.topic = (const char*)buffer;
+  message.truncated = rxLength > capacity;
+  message.payload = message.truncated ? nullptr : buffer + headerSize;
+  message.length = rxLength - headerSize;
+  message.qos = qos;
+  message.retained = rxHeader & 0x01;
+  if (message.truncated) {
+    stats.oversized++;
+  }
+  if (handler) {
+    handler(handlerContext, message);
+  }
+  return true;
+}
+
+// Acknowledgements for unknown packet IDs (e.g. from before a reconnect) are
+// ignored
+void MqttClient::handleAck() {
+  uint16_t packetId = (buffer[0] << 8) | buffer[1];
+  for (int i = 0; i < inflightCount; i++) {
+    if (inflight[i].packetId != packetId) continue;
+    
+    uint32_t tag = inflight[i].tag;
+    memmove(&inflight[i], &inflight[i + 1], (inflightCount - i - 1) * sizeof(InFlight));
+    inflightCount--;
+    stats.acked++;
+    if (ackHandler) {
+      ackHandler(ackContext, tag);
+    }
+    return;
+  }
+}
+
+bool MqttClient::subscribe(const char* topic, uint8_t qos) {
+  if (state != MQTT_CONNECTED || qos > 1) return false;
+  size_t topicLength = strlen(topic);
+  if (topicLength > 0xFFFF) return false;
+  
+  uint16_t packetId = allocatePacketId();
+  uint8_t header[9];
+  size_t used = 0;
+  header[used++] = (MQTT_SUBSCRIBE << 4) | 0x02;
+  used += encodeLength(header + used, 2 + 2 + topicLength + 1);
+  header[used++] = packetId >> 8;
+  header[used++] = packetId & 0xFF;
+  if (!send(header, used) || !sendString(topic) || !send(&qos, 1)) {
+    return false;
+  }
+  stats.packetsOut++;
+  return true;
+}
+
+bool MqttClient::publish(const char* topic, const uint8_t* payload, size_t length, bool retain) {
+  return beginPublish(topic, length, 0, 0, retain) && writePayload(payload, length) && endPublish();
+}
+
+bool MqttClient::publishAcked(const char* topic, const uint8_t* payload, size_t length, uint32_t tag) {
+  return beginPublish(topic, length, 1, tag) && writePayload(payload, length) && endPublish();
+}
+
+bool MqttClient::beginPublish(const char* topic, size_t length, uint8_t qos, uint32_t tag, bool retain) {
+  if (state != MQTT_CONNECTED || publishOpen || qos > 1) return false;
+  if (qos == 1 && inflightCount >= inflightWindow) return false;
+  size_t topicLength = strlen(topic);
+  size_t idLength = qos ? 2 : 0;
+  if (topicLength > 0xFFFF || 2 + topicLength + idLength + length > MQTT_MAX_LENGTH) return false;
+  if (!canPublish(publishSize(topicLength, length, qos))) return false;
+  
+  uint16_t packetId = qos ? allocatePacketId() : 0;
+  uint8_t header[5 + 2];
+  size_t used = 0;
+  header[used++] = (MQTT_PUBLISH << 4) | (qos << 1) | (retain ? 0x01 : 0);
+  used += encodeLength(header + used, 2 + topicLength + idLength + length);
+  if (!send(header, used) || !sendString(topic)) {
+    return false;
+  }
+  if (qos) {
+    header[0] = packetId >> 8;
+    header[1] = packetId & 0xFF;
+    if (!send(header, 2)) return false;
+    
+    InFlight& entry = inflight[inflightCount++];
+    entry.packetId = packetId;
+    entry.tag = tag;
+    entry.sentAt = clock;
+  }
+  publishOpen = true;
+  publishRemaining = length;
+  return true;
+}
+
+bool MqttClient::writePayload(const uint8_t* data, size_t size) {
+  if (!publishOpen) return false;
+  if (size > publishRemaining) {
+    fail();
+    return false;
+  }
+  if (size > 0 && !send(data, size)) {
+    return false;
+  }
+  publishRemaining -= size;
+  return true;
+}
+
+bool MqttClient::endPublish() {
+  if (!publishOpen) return false;
+  publishOpen = false;
+  if (publishRemaining != 0) {
+    fail();
+    return false;
+  }
+  stats.packetsOut++;
+  return true;
+}
+
+bool MqttClient::canPublish(size_t packetSize) {
+  return state == MQTT_CONNECTED && !publishOpen && inflightCount < inflightWindow &&
+         sendPending + SEND_RESERVE <= sendCapacity && packetSize <= sendCapacity - sendPending - SEND_RESERVE;
+}
+
+// Hands buffered bytes to the transport until it stops taking them
+bool MqttClient::flush() {
+  while (sendPending > 0) {
+    size_t chunk = sendCapacity - sendStart < sendPending ? sendCapacity - sendStart : sendPending;
+    int count = transport->write(sendBuffer + sendStart, chunk);
+    if (count < 0) {
+      fail();
+      return false;
+    }
+    if (count == 0) break;
+    sendStart = (sendStart + count) % sendCapacity;
+    sendPending -= count;
+  }
+  if (sendPending == 0) {
+    sendStart = 0;
+  }
+  return true;
+}
+
+// Goes straight to the transport while nothing is buffered; the rest is
+// queued behind what is. Running out of send buffer, which canPublish() and
+// the reserve leave room against, means the broker stopped reading.
+bool MqttClient::send(const uint8_t* data, size_t size) {
+  size_t taken = 0;
+  if (sendPending == 0) {
+    int count = transport->write(data, size);
+    if (count < 0) {
+      fail();
+      return false;
+    }
+    taken = count;
+  }
+  
+  size_t rest = size - taken;
+  if (rest > sendCapacity - sendPending) {
+    fail();
+    return false;
+  }
+  size_t end = (sendStart + sendPending) % sendCapacity;
+  size_t first = sendCapacity - end < rest ? sendCapacity - end : rest;
+  memcpy(sendBuffer + end, data + taken, first);
+  memcpy(sendBuffer, data + taken + first, rest - first);
+  sendPending += rest;
+  
+  stats.bytesOut += size;
+  lastSent = clock;
+  return true;
+}
+
+bool MqttClient::sendString(const char* text) {
+  size_t length = strlen(text);
+  uint8_t prefix[2] = { (uint8_t)(length >> 8), (uint8_t)(length & 0xFF) };
+  return send(prefix, 2) && (length == 0 || send((const uint8_t*)text, length));
+}
+
+bool MqttClient::sendControl(uint8_t header) {
+  uint8_t packet[2] = { header, 0 };
+  if (!send(packet, 2)) return false;
+  stats.packetsOut++;
+  return true;
+}
+
+bool MqttClient::sendAck(uint8_t header, uint16_t packetId) {
+  uint8_t packet[4] = { header, 2, (uint8_t)(packetId >> 8), (uint8_t)(packetId & 0xFF) };
+  if (!send(packet, 4)) return false;
+  stats.packetsOut++;
+  return true;
+}
+
+// Skips IDs still awaiting PUBACK
+uint16_t MqttClient::allocatePacketId() {
+  while (true) {
+    if (++nextPacketId == 0) {
+      nextPacketId = 1;
+    }
+    bool inUse = false;
+    for (int i = 0; i < inflightCount && !inUse; i++) {
+      inUse = inflight[i].packetId == nextPacketId;
+    }
+    if (!inUse) return nextPacketId;
+  }
+}
\ No newline at end of file
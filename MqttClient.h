@@ -0,0 +1,204 @@
+#ifndef MQTT_CLIENT_H
+#define MQTT_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Minimal MQTT 3.1.1 client: CONNECT, SUBSCRIBE, PUBLISH (QoS 0/1 both ways)
+// and keepalive. Incoming packets are assembled incrementally into a caller
+// supplied buffer (PSRAM on the gateway), so a command is not limited by a
+// fixed library buffer and reading never blocks the calling task. QoS 1
+// publishes are pipelined: up to a window of them await PUBACK at once.
+// Outgoing payloads go straight to the transport, optionally streamed in
+// pieces (beginPublish/writePayload/endPublish); whatever the transport
+// cannot take right away is kept in a caller supplied send buffer and
+// written from poll(), so writing never blocks either.
+//
+// Free of Arduino dependencies: the gateway runs it over WiFiClient or
+// EthernetClient, host tests over an in-memory broker stand-in (testing/).
+
+// Byte stream under the client
+class MqttTransport {
+public:
+  virtual ~MqttTransport() {}
+  virtual bool open(const char* host, uint16_t port) = 0;
+  virtual void close() = 0;
+  
+  // Bytes read into `data`, 0 if nothing is pending, -1 once the connection is gone
+  virtual int read(uint8_t* data, size_t size) = 0;
+  
+  // Bytes of `data` taken without waiting (0 while the network stack has no
+  // room), -1 once the connection is gone
+  virtual int write(const uint8_t* data, size_t size) = 0;
+};
+
+struct MqttConnectOptions {
+  const char* clientId;
+  const char* username;   // nullptr or "" = none
+  const char* password;
+  uint16_t keepAliveSeconds;
+  bool cleanSession;
+};
+
+// One received PUBLISH. `topic` is NUL-terminated; both it and `payload` point
+// into the receive buffer and are valid until the handler returns. A message
+// larger than the buffer is reported with `truncated` set and no payload.
+struct MqttMessage {
+  const char* topic;
+  uint8_t* payload;
+  size_t length;
+  uint8_t qos;
+  bool retained;
+  bool truncated;
+};
+
+typedef void (*MqttMessageHandler)(void* context, const MqttMessage& message);
+
+// Called with the caller's tag when the broker acknowledges a QoS 1 publish
+typedef void (*MqttAckHandler)(void* context, uint32_t tag);
+
+struct MqttClientStats {
+  uint32_t packetsIn;
+  uint32_t packetsOut;
+  uint32_t bytesIn;
+  uint32_t bytesOut;
+  uint32_t messagesIn;
+  uint32_t oversized;         // Messages larger than the receive buffer
+  uint32_t subscribeFailures;
+  uint32_t keepaliveTimeouts;
+  uint32_t acked;             // QoS 1 publishes acknowledged
+  uint32_t ackTimeouts;
+};
+
+class MqttClient {
+public:
+  enum State : uint8_t {
+    MQTT_DISCONNECTED,
+    MQTT_CONNECTING,  // CONNECT sent, waiting for CONNACK
+    MQTT_CONNECTED
+  };
+  
+  static const uint32_t CONNECT_TIMEOUT_MS = 10000;
+  static const uint32_t ACK_TIMEOUT_MS = 30000;   // Then the connection is assumed dead
+  static const size_t MIN_BUFFER_SIZE = 64;
+  static const size_t SEND_RESERVE = 32;   // Send buffer room kept for PUBACK, PINGREQ and DISCONNECT
+  static const int MAX_INFLIGHT = 32;
+
+private:
+  MqttTransport* transport;
+  uint8_t* buffer;
+  size_t capacity;
+  
+  // Bytes written but not yet taken by the transport, a ring in the send buffer
+  uint8_t* sendBuffer;
+  size_t sendCapacity;
+  size_t sendStart;
+  size_t sendPending;
+  MqttMessageHandler handler;
+  void* handlerContext;
+  
+  State state;
+  uint8_t connectResult;   // Last CONNACK return code, 0xFF = none
+  uint32_t keepAliveMs;
+  uint32_t clock;          // `now` of the current connect()/poll() call
+  uint32_t lastSent;
+  uint32_t stateSince;
+  uint32_t pingSentAt;
+  bool pingPending;
+  uint16_t nextPacketId;
+  MqttClientStats stats;
+  
+  // QoS 1 publishes awaiting PUBACK, oldest first
+  struct InFlight {
+    uint16_t packetId;
+    uint32_t tag;
+    uint32_t sentAt;
+  };
+  InFlight inflight[MAX_INFLIGHT];
+  int inflightCount;
+  int inflightWindow;
+  MqttAckHandler ackHandler;
+  void* ackContext;
+  bool publishOpen;         // Between beginPublish() and endPublish()
+  size_t publishRemaining;  // Payload bytes still owed to the open publish
+  
+  // Receive state machine: fixed header byte, remaining length, then the body
+  // (the part that fits in the buffer) and the rest of an oversized packet
+  enum RxStage : uint8_t { RX_HEADER, RX_LENGTH, RX_BODY };
+  RxStage rxStage;
+  uint8_t rxHeader;
+  uint8_t rxShift;
+  uint32_t rxLength;
+  uint32_t rxReceived;
+  
+  bool receive(const uint8_t* data, size_t size);
+  bool handlePacket();
+  bool handlePublish();
+  void handleAck();
+  bool flush();
+  bool send(const uint8_t* data, size_t size);
+  bool sendString(const char* text);
+  bool sendControl(uint8_t header);
+  bool sendAck(uint8_t header, uint16_t packetId);
+  uint16_t allocatePacketId();
+  void fail();
+
+public:
+  MqttClient();
+  
+  // `receiveBuffer` holds one incoming packet; larger ones are truncated.
+  // `sendBuffer` holds what the transport has not taken yet; a publish is only
+  // started when all of it fits there.
+  void begin(MqttTransport* stream, uint8_t* receiveBuffer, size_t bufferSize,
+             uint8_t* sendBuffer, size_t sendBufferSize);
+  void setHandler(MqttMessageHandler messageHandler, void* context);
+  void setAckHandler(MqttAckHandler handler, void* context);
+  void setInflightWindow(int window);   // 1 to MAX_INFLIGHT, default 16
+  
+  // Open the transport and send CONNECT; poll() completes the handshake
+  bool connect(const char* host, uint16_t port, const MqttConnectOptions& options, uint32_t now);
+  void disconnect();
+  
+  // Write what the send buffer holds, read and dispatch whatever has arrived
+  // and keep the session alive. Never waits. Returns false when the client is
+  // disconnected.
+  bool poll(uint32_t now);
+  
+  bool subscribe(const char* topic, uint8_t qos);
+  bool publish(const char* topic, const uint8_t* payload, size_t length, bool retain = false);
+  
+  // QoS 1 publish; `tag` is handed to the ack handler on PUBACK. Messages still
+  // in flight when the connection drops are forgotten: the caller sends them
+  // again after reconnecting (at-least-once).
+  bool publishAcked(const char* topic, const uint8_t* payload, size_t length, uint32_t tag);
+  
+  // Streamed publish of exactly `length` payload bytes, handed over in pieces
+  // with writePayload(). QoS 1 takes an in-flight slot and `tag` as in
+  // publishAcked(). Nothing else is sent, and poll() reads nothing, until
+  // endPublish(); a payload shorter or longer than announced drops the
+  // connection. Refused, with nothing sent, unless the whole packet fits in
+  // the send buffer.
+  bool beginPublish(const char* topic, size_t length, uint8_t qos, uint32_t tag = 0, bool retain = false);
+  bool writePayload(const uint8_t* data, size_t size);
+  bool endPublish();
+  
+  // Connected, with a free in-flight slot and room in the send buffer for a
+  // packet of `packetSize` bytes (publishSize())
+  bool canPublish(size_t packetSize);
+  int getInflight() const { return inflightCount; }
+  size_t getSendPending() const { return sendPending; }
+  
+  State getState() const { return state; }
+  bool connected() const { return state == MQTT_CONNECTED; }
+  uint8_t getConnectResult() const { return connectResult; }
+  const MqttClientStats& getStats() const { return stats; }
+  
+  // Remaining Length field helpers, exposed for tests and tools
+  static size_t encodeLength(uint8_t* out, uint32_t length);
+  
+  // Bytes on the wire for a PUBLISH of `length` payload bytes to a topic of
+  // `topicLength` characters
+  static size_t publishSize(size_t topicLength, size_t length, uint8_t qos);
+};
+
+#endif
\ No newline at end of file
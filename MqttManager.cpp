@@ -1,10 +1,82 @@
 #include "MqttManager.h"
+#include "CRUDHandler.h"
+#include "JsonCapacity.h"
+#include <esp_heap_caps.h>
+#include <lwip/sockets.h>
+#include <errno.h>
+
+bool ArduinoMqttTransport::open(const char* host, uint16_t port) {
+  return client && client->connect(host, port) == 1;
+}
+
+void ArduinoMqttTransport::close() {
+  if (client) {
+    client->stop();
+  }
+}
+
+int ArduinoMqttTransport::read(uint8_t* data, size_t size) {
+  int pending = client->available();
+  if (pending <= 0) {
+    return client->connected() ? 0 : -1;
+  }
+  return client->read(data, (size_t)pending < size ? pending : size);
+}
+
+// Never waits: WiFiClient::write retries until everything is sent, so the
+// WiFi socket is written directly with MSG_DONTWAIT, and the W5500 only gets
+// as much as its transmit buffer has room for
+int ArduinoMqttTransport::write(const uint8_t* data, size_t size) {
+  if (socketClient) {
+    int fd = static_cast<WiFiClient*>(client)->fd();
+    if (fd < 0) return -1;
+    int sent = send(fd, data, size, MSG_DONTWAIT);
+    if (sent >= 0) return sent;
+    return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+  }
+  
+  if (!client->connected()) return -1;
+  int room = static_cast<EthernetClient*>(client)->availableForWrite();
+  if (room <= 0) return 0;
+  return client->write(data, (size_t)room < size ? room : size);
+}
+
+size_t MqttReplyBuffer::write(const uint8_t* buffer, size_t size) {
+  if (length + size > capacity) {
+    overflow = true;
+    return 0;
+  }
+  memcpy(data + length, buffer, size);
+  length += size;
+  return size;
+}
+
+size_t MqttPayloadStream::write(const uint8_t* buffer, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (used == sizeof(chunk)) {
+      failed = failed || !client->writePayload(chunk, used);
+      used = 0;
+    }
+    chunk[used++] = buffer[i];
+  }
+  return size;
+}
+
+bool MqttPayloadStream::finish() {
+  failed = failed || !client->writePayload(chunk, used);
+  used = 0;
+  return !failed;
+}
 
 MqttManager* MqttManager::instance = nullptr;
 
 MqttManager::MqttManager(ConfigManager* config, ServerConfig* serverCfg, NetworkMgr* netMgr) 
-  : configManager(config), queueManager(nullptr), serverConfig(serverCfg), networkManager(netMgr), mqttClient(wifiClient),
-    running(false), taskHandle(nullptr), brokerPort(1883), lastReconnectAttempt(0) {
+  : configManager(config), queueManager(nullptr), serverConfig(serverCfg), networkManager(netMgr), commandHandler(nullptr),
+    receiveBuffer(nullptr), receiveCapacity(0), sendStorage(nullptr), replyStorage(nullptr), commandDoc(nullptr),
+    topicCache(nullptr), topicPerDevice(false), batchPayload(false), batch(nullptr), batchEnd(nullptr),
+    payloadEncoding(PAYLOAD_JSON), schemaCache(nullptr),
+    running(false), taskHandle(nullptr), pollTimer(nullptr), networkWasAvailable(false),
+    brokerPort(1883), keepAlive(60), cleanSession(true), lingerMs(0), batchSize(10), qos(1), lastReconnectAttempt(0) {
   queueManager = QueueManager::getInstance();
 }
 
@@ -23,11 +95,61 @@ bool MqttManager::init() {
     return false;
   }
   
+  if (!allocateBuffers()) {
+    Serial.println("[MQTT] Failed to allocate MQTT buffers");
+    return false;
+  }
+  
   loadMqttConfig();
   Serial.println("MQTT Manager initialized successfully");
   return true;
 }
 
+bool MqttManager::allocateBuffers() {
+  receiveCapacity = RECEIVE_BUFFER_SIZE;
+  receiveBuffer = (uint8_t*)heap_caps_malloc(receiveCapacity, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!receiveBuffer) {
+    receiveCapacity = RECEIVE_FALLBACK_SIZE;
+    receiveBuffer = (uint8_t*)heap_caps_malloc(receiveCapacity, MALLOC_CAP_8BIT);
+    Serial.printf("[MQTT] No PSRAM for the receive buffer, commands limited to %u bytes\n", receiveCapacity);
+  }
+  
+  size_t replyCapacity = REPLY_BUFFER_SIZE;
+  size_t sendCapacity = REPLY_BUFFER_SIZE + SEND_DATA_ROOM;
+  replyStorage = (uint8_t*)heap_caps_malloc(replyCapacity, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  sendStorage = (uint8_t*)heap_caps_malloc(sendCapacity, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!replyStorage || !sendStorage) {
+    heap_caps_free(replyStorage);
+    heap_caps_free(sendStorage);
+    replyCapacity = REPLY_FALLBACK_SIZE;
+    sendCapacity = REPLY_FALLBACK_SIZE + SEND_DATA_FALLBACK_ROOM;
+    replyStorage = (uint8_t*)heap_caps_malloc(replyCapacity, MALLOC_CAP_8BIT);
+    sendStorage = (uint8_t*)heap_caps_malloc(sendCapacity, MALLOC_CAP_8BIT);
+  }
+  
+  size_t publishBytes = QueueManager::getCapacity() * (sizeof(DataRecord) + sizeof(uint32_t)) +
+                        TOPIC_CACHE_SLOTS * sizeof(TopicSlot) + SCHEMA_CACHE_SLOTS * sizeof(SchemaSlot);
+  uint8_t* publishState = (uint8_t*)heap_caps_malloc(publishBytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!publishState) {
+    publishState = (uint8_t*)heap_caps_malloc(publishBytes, MALLOC_CAP_8BIT);
+  }
+  if (!receiveBuffer || !replyStorage || !sendStorage || !publishState) {
+    return false;
+  }
+  batch = (DataRecord*)publishState;
+  batchEnd = (uint32_t*)(batch + QueueManager::getCapacity());
+  topicCache = (TopicSlot*)(batchEnd + QueueManager::getCapacity());
+  schemaCache = (SchemaSlot*)(topicCache + TOPIC_CACHE_SLOTS);
+  
+  commandDoc = new PsramJsonDocument(jsonCapacityFor(receiveCapacity));
+  transport.setClient(&wifiClient, true);
+  mqttClient.begin(&transport, receiveBuffer, receiveCapacity, sendStorage, sendCapacity);
+  mqttClient.setHandler(onMessage, this);
+  mqttClient.setAckHandler(onAck, this);
+  reply.begin(replyStorage, replyCapacity);
+  return true;
+}
+
 void MqttManager::start() {
   Serial.println("Starting MQTT Manager...");
   
@@ -35,11 +157,19 @@ void MqttManager::start() {
     return;
   }
   
+  if (!pollTimer) {
+    pollTimer = xTimerCreate("MQTT_POLL", pdMS_TO_TICKS(POLL_INTERVAL_MS), pdTRUE, this, onPollTimer);
+    if (!pollTimer) {
+      Serial.println("Failed to create MQTT poll timer");
+      return;
+    }
+  }
+  
   running = true;
   BaseType_t result = xTaskCreatePinnedToCore(
     mqttTask,
     "MQTT_TASK",
-    8192,
+    10240,  // Commands run the CRUD handlers on this stack
     this,
     1,
     &taskHandle,
@@ -57,14 +187,16 @@ void MqttManager::start() {
 
 void MqttManager::stop() {
   running = false;
+  queueManager->setConsumer(nullptr, 1);
+  if (pollTimer) {
+    xTimerStop(pollTimer, portMAX_DELAY);
+  }
   if (taskHandle) {
     vTaskDelay(pdMS_TO_TICKS(100));
     vTaskDelete(taskHandle);
     taskHandle = nullptr;
   }
-  if (mqttClient.connected()) {
-    mqttClient.disconnect();
-  }
+  mqttClient.disconnect();
   Serial.println("MQTT Manager stopped");
 }
 
@@ -73,66 +205,113 @@ void MqttManager::mqttTask(void* parameter) {
   manager->mqttLoop();
 }
 
+void MqttManager::onPollTimer(TimerHandle_t timer) {
+  MqttManager* manager = static_cast<MqttManager*>(pvTimerGetTimerID(timer));
+  TaskHandle_t task = manager->taskHandle;
+  if (task) {
+    xTaskNotify(task, MQTT_EVENT_POLL, eSetBits);
+  }
+}
+
+// Sleeps until the queue or the poll timer wakes it. Queued data is published
+// as soon as it arrives, or, with linger_ms set, once a batch has filled or
+// the oldest record has waited linger_ms.
 void MqttManager::mqttLoop() {
-  bool wasConnected = false;
-  bool wifiWasConnected = false;
-  
   Serial.println("[MQTT] Task started");
   
+  queueManager->setConsumer(xTaskGetCurrentTaskHandle(), batchSize);
+  xTimerStart(pollTimer, portMAX_DELAY);
+  serviceConnection();
+  
+  bool lingering = false;
+  unsigned long lingerStart = 0;
+  
   while (running) {
-    // Check network availability
-    bool networkAvailable = isNetworkAvailable();
-    
-    if (!networkAvailable) {
-      if (wifiWasConnected) {
-        Serial.println("[MQTT] Network disconnected");
-        wifiWasConnected = false;
-        wasConnected = false;
+    TickType_t wait = portMAX_DELAY;
+    if (mqttClient.connected()) {
+      bool pending = queueManager->unsentCount() > 0;
+      if (pending && lingering) {
+        unsigned long waited = millis() - lingerStart;
+        wait = waited >= lingerMs ? 0 : pdMS_TO_TICKS(lingerMs - waited);
+      } else if (pending && mqttClient.getSendPending() == 0 && mqttClient.canPublish(replyRoom())) {
+        wait = 0;   // Backlog left over from the last pass, or from before a reconnect
+      } else if (mqttClient.getInflight() > 0 || mqttClient.getSendPending() > 0) {
+        wait = pdMS_TO_TICKS(ACK_POLL_MS);   // PUBACKs are due, or poll() has bytes to write
       }
-      Serial.printf("[MQTT] Waiting for network... Mode: %s, IP: %s\n", 
-                    networkManager->getCurrentMode().c_str(), 
-                    networkManager->getLocalIP().toString().c_str());
-      
-      vTaskDelay(pdMS_TO_TICKS(5000));
+    }
+    
+    uint32_t events = 0;
+    xTaskNotifyWait(0, UINT32_MAX, &events, wait);
+    
+    if (events & MQTT_EVENT_POLL) {
+      serviceConnection();
+    } else if (mqttClient.connected() && !mqttClient.poll(millis())) {
+      Serial.println("[MQTT] Connection lost, attempting reconnect...");
+    }
+    if (!mqttClient.connected() || queueManager->unsentCount() == 0) {
+      lingering = false;
       continue;
-    } else if (!wifiWasConnected) {
-      Serial.printf("[MQTT] Network available - %s IP: %s\n", 
-                    networkManager->getCurrentMode().c_str(),
-                    networkManager->getLocalIP().toString().c_str());
-      wifiWasConnected = true;
     }
     
-    // Connect to MQTT if not connected
-    if (!mqttClient.connected()) {
-      if (wasConnected) {
-        Serial.println("[MQTT] Connection lost, attempting reconnect...");
-        wasConnected = false;
-      }
-      
-      unsigned long now = millis();
-      if (now - lastReconnectAttempt > 5000) {
-        lastReconnectAttempt = now;
-        static unsigned long lastDebug = 0;
-        if (now - lastDebug > 30000) {
-          debugNetworkConnectivity();
-          lastDebug = now;
-        }
-        
-        if (connectToMqtt()) {
-          Serial.println("[MQTT] Successfully connected to broker");
-          wasConnected = true;
-        }
+    if (lingerMs > 0 && queueManager->unsentCount() < batchSize) {
+      if (!lingering) {
+        lingering = true;
+        lingerStart = millis();
       }
-    } else {
-      if (!wasConnected) {
-        Serial.println("[MQTT] Connection active, publishing data...");
-        wasConnected = true;
-      }
-      mqttClient.loop();
-      publishQueueData();
+      if (millis() - lingerStart < lingerMs) continue;
+    }
+    lingering = false;
+    publishQueueData();
+  }
+}
+
+// Runs on every poll tick: services the session (incoming commands,
+// keepalive) and reconnects at most every RECONNECT_INTERVAL_MS
+void MqttManager::serviceConnection() {
+  unsigned long now = millis();
+  if (mqttClient.connected()) {
+    if (mqttClient.poll(now)) return;
+    Serial.println("[MQTT] Connection lost, attempting reconnect...");
+  }
+  
+  if (now - lastReconnectAttempt < RECONNECT_INTERVAL_MS) return;
+  lastReconnectAttempt = now;
+  
+  if (!isNetworkAvailable()) {
+    if (networkWasAvailable) {
+      Serial.println("[MQTT] Network disconnected");
+      networkWasAvailable = false;
     }
+    Serial.printf("[MQTT] Waiting for network... Mode: %s, IP: %s\n", 
+                  networkManager->getCurrentMode().c_str(), 
+                  networkManager->getLocalIP().toString().c_str());
+    return;
+  }
+  if (!networkWasAvailable) {
+    Serial.printf("[MQTT] Network available - %s IP: %s\n", 
+                  networkManager->getCurrentMode().c_str(),
+                  networkManager->getLocalIP().toString().c_str());
+    networkWasAvailable = true;
+  }
+  
+  static unsigned long lastDebug = 0;
+  if (now - lastDebug > 30000) {
+    debugNetworkConnectivity();
+    lastDebug = now;
+  }
+  
+  if (connectToMqtt()) {
+    Serial.println("[MQTT] Successfully connected to broker");
+    
+    // Records in flight when the last connection dropped are sent again, and
+    // so are metric schemas that may not have arrived
+    queueManager->rewind();
+    forgetMetricSchemas();
     
-    vTaskDelay(pdMS_TO_TICKS(1000));
+    // A command stream (import) from before the reconnect is not resumed
+    if (commandHandler) {
+      commandHandler->endSession(*this);
+    }
   }
 }
 
@@ -146,38 +325,51 @@ bool MqttManager::connectToMqtt() {
   Serial.printf("[MQTT] Network Mode: %s\n", networkMode.c_str());
   Serial.printf("[MQTT] Local IP: %s\n", localIP.toString().c_str());
   
-
   
-  // Set buffer sizes and timeouts
-  mqttClient.setBufferSize(512, 512);
-  mqttClient.setKeepAlive(60);
-  mqttClient.setSocketTimeout(5);
   
   // Use correct client for MQTT based on network mode
   if (networkMode == "ETH") {
-    mqttClient.setClient(ethernetClient);
+    transport.setClient(&ethernetClient, false);
   } else {
-    mqttClient.setClient(wifiClient);
+    transport.setClient(&wifiClient, true);
   }
   
-  mqttClient.setServer(brokerAddress.c_str(), brokerPort);
+  bool useAuth = username.length() > 0 && password.length() > 0;
+  Serial.println(useAuth ? "[MQTT] Using authentication" : "[MQTT] No authentication");
+  MqttConnectOptions options;
+  options.clientId = clientId.c_str();
+  options.username = useAuth ? username.c_str() : nullptr;
+  options.password = useAuth ? password.c_str() : nullptr;
+  options.keepAliveSeconds = keepAlive;
+  options.cleanSession = cleanSession;
   
-  bool connected;
-  if (username.length() > 0 && password.length() > 0) {
-    Serial.println("[MQTT] Using authentication");
-    connected = mqttClient.connect(clientId.c_str(), username.c_str(), password.c_str());
-  } else {
-    Serial.println("[MQTT] No authentication");
-    connected = mqttClient.connect(clientId.c_str());
+  if (!mqttClient.connect(brokerAddress.c_str(), brokerPort, options, millis())) {
+    Serial.println("[MQTT] Connection failed, broker unreachable");
+    return false;
   }
   
-  if (connected) {
-    Serial.printf("[MQTT] Connected to %s:%d\n", brokerAddress.c_str(), brokerPort);
-  } else {
-    Serial.printf("[MQTT] Connection failed, error: %d\n", mqttClient.state());
+  // Wait for CONNACK
+  unsigned long start = millis();
+  while (mqttClient.getState() == MqttClient::MQTT_CONNECTING && millis() - start < CONNACK_TIMEOUT_MS) {
+    mqttClient.poll(millis());
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+  
+  if (!mqttClient.connected()) {
+    Serial.printf("[MQTT] Connection failed, CONNACK code: %d\n", mqttClient.getConnectResult());
+    mqttClient.disconnect();
+    return false;
   }
+  Serial.printf("[MQTT] Connected to %s:%d\n", brokerAddress.c_str(), brokerPort);
   
-  return connected;
+  if (topicSubscribe.length() > 0) {
+    if (mqttClient.subscribe(topicSubscribe.c_str(), 1)) {
+      Serial.printf("[MQTT] Commands on %s, replies on %s\n", topicSubscribe.c_str(), topicResponse.c_str());
+    } else {
+      Serial.printf("[MQTT] Subscribe failed: %s\n", topicSubscribe.c_str());
+    }
+  }
+  return true;
 }
 
 void MqttManager::loadMqttConfig() {
@@ -193,6 +385,21 @@ void MqttManager::loadMqttConfig() {
     username = mqttConfig["username"] | "";
     password = mqttConfig["password"] | "";
     topicPublish = mqttConfig["topic_publish"] | "device/data";
+    topicSubscribe = mqttConfig["topic_subscribe"] | "";
+    topicResponse = mqttConfig["topic_response"] | "";
+    keepAlive = mqttConfig["keep_alive"] | 60;
+    cleanSession = mqttConfig["clean_session"] | true;
+    lingerMs = mqttConfig["linger_ms"] | 0;
+    batchSize = mqttConfig["batch_size"] | 10;
+    batchSize = constrain(batchSize, 1, QueueManager::getCapacity());
+    qos = (mqttConfig["qos"] | 1) == 0 ? 0 : 1;
+    batchPayload = mqttConfig["batch_payload"] | false;
+    const char* encoding = mqttConfig["payload_encoding"] | "json";
+    if (!parsePayloadEncoding(encoding, payloadEncoding)) {
+      Serial.printf("[MQTT] Unknown payload_encoding '%s', using json\n", encoding);
+      payloadEncoding = PAYLOAD_JSON;
+    }
+    mqttClient.setInflightWindow(mqttConfig["inflight_window"] | 16);
     
     Serial.printf("[MQTT] Config loaded - Broker: %s:%d, Client: %s, Topic: %s\n", 
                   brokerAddress.c_str(), brokerPort, clientId.c_str(), topicPublish.c_str());
@@ -203,44 +410,166 @@ void MqttManager::loadMqttConfig() {
     brokerPort = 1883;
     clientId = "esp32_gateway_" + String(random(1000, 9999));
     topicPublish = "device/data";
+    topicSubscribe = "";
     Serial.printf("[MQTT] Default config - Broker: %s:%d, Client: %s\n", 
                   brokerAddress.c_str(), brokerPort, clientId.c_str());
   }
+  
+  if (topicResponse.length() == 0 && topicSubscribe.length() > 0) {
+    topicResponse = topicSubscribe + "/response";
+  }
+  
+  topicPerDevice = topicPublish.indexOf("{device_id}") >= 0;
+  if (topicPerDevice && topicPublish.length() + sizeof(DataRecord::deviceId) > TOPIC_CAPACITY) {
+    Serial.printf("[MQTT] topic_publish longer than %u characters, {device_id} not expanded\n",
+                  TOPIC_CAPACITY - sizeof(DataRecord::deviceId));
+    topicPerDevice = false;
+  }
+  for (int i = 0; i < TOPIC_CACHE_SLOTS; i++) {
+    topicCache[i].topic[0] = '\0';
+  }
+  forgetMetricSchemas();
 }
 
-void MqttManager::publishQueueData() {
-  if (!mqttClient.connected()) {
-    return;
+const char* MqttManager::topicFor(const DataRecord& record) {
+  if (!topicPerDevice) {
+    return topicPublish.c_str();
   }
   
-  // Process up to 10 items per loop to avoid blocking
-  for (int i = 0; i < 10; i++) {
-    DynamicJsonDocument dataDoc(512);
-    JsonObject dataPoint = dataDoc.to<JsonObject>();
+  TopicSlot& slot = topicCache[record.deviceHandle % TOPIC_CACHE_SLOTS];
+  if (slot.topic[0] == '\0' || strncmp(slot.deviceId, record.deviceId, sizeof(slot.deviceId)) != 0) {
+    int at = topicPublish.indexOf("{device_id}");
+    snprintf(slot.topic, sizeof(slot.topic), "%.*s%.*s%s", at, topicPublish.c_str(),
+             (int)sizeof(record.deviceId), record.deviceId, topicPublish.c_str() + at + strlen("{device_id}"));
+    memcpy(slot.deviceId, record.deviceId, sizeof(slot.deviceId));
+  }
+  return slot.topic;
+}
+
+// Send buffer space data publishes leave free, so a reply always fits
+size_t MqttManager::replyRoom() const {
+  return MqttClient::publishSize(topicResponse.length(), reply.getCapacity(), 0);
+}
+
+static void toPayloadStream(void* context, const uint8_t* data, size_t size) {
+  static_cast<MqttPayloadStream*>(context)->write(data, size);
+}
+
+// FNV-1a over the fields encodeMetricSchema writes
+static uint32_t hashSchemaField(uint32_t hash, const char* field, size_t capacity) {
+  for (size_t i = 0; i < capacity && field[i] != '\0'; i++) {
+    hash = (hash ^ (uint8_t)field[i]) * 16777619u;
+  }
+  return (hash ^ 0xFF) * 16777619u;
+}
+
+static uint32_t metricSchemaHash(const DataRecord& record) {
+  uint32_t hash = 2166136261u;
+  hash = hashSchemaField(hash, record.deviceId, sizeof(record.deviceId));
+  hash = hashSchemaField(hash, record.registerId, sizeof(record.registerId));
+  hash = hashSchemaField(hash, record.name, sizeof(record.name));
+  hash = hashSchemaField(hash, record.dataType, sizeof(record.dataType));
+  hash = (hash ^ (record.address & 0xFF)) * 16777619u;
+  return (hash ^ (record.address >> 8)) * 16777619u;
+}
+
+void MqttManager::forgetMetricSchemas() {
+  for (int i = 0; i < SCHEMA_CACHE_SLOTS; i++) {
+    schemaCache[i].described = false;
+  }
+}
+
+// Publishes the schema of every metric in the batch not yet described on this
+// connection. QoS 0 is enough: the schema goes out ahead of the samples on the
+// same connection, so once they are acknowledged the broker has it as well.
+bool MqttManager::publishMetricSchemas(int count) {
+  for (int i = 0; i < count; i++) {
+    const DataRecord& record = batch[i];
+    SchemaSlot& slot = schemaCache[record.registerHandle % SCHEMA_CACHE_SLOTS];
+    uint32_t schemaHash = metricSchemaHash(record);
+    if (slot.described && slot.registerHandle == record.registerHandle && slot.schemaHash == schemaHash) {
+      continue;
+    }
     
-    if (!queueManager->dequeue(dataPoint)) {
-      break; // No more data in queue
+    char topic[TOPIC_CAPACITY + 16];
+    snprintf(topic, sizeof(topic), "%s/schema/%u", topicFor(record), (unsigned)record.registerHandle);
+    size_t length = encodeMetricSchema(record, nullptr, nullptr);
+    if (!mqttClient.beginPublish(topic, length, 0, 0, true)) {
+      return false;
+    }
+    payloadStream.begin(&mqttClient);
+    encodeMetricSchema(record, toPayloadStream, &payloadStream);
+    if (!payloadStream.finish() || !mqttClient.endPublish()) {
+      return false;
     }
     
-    // Create MQTT payload
-    String payload;
-    serializeJson(dataPoint, payload);
+    slot.registerHandle = record.registerHandle;
+    slot.described = true;
+    slot.schemaHash = schemaHash;
+  }
+  return true;
+}
+
+// Publishes unsent records while the client has room. QoS 1 records stay
+// queued until their PUBACK arrives (onAck); QoS 0 ones are released once
+// written. Records whose message does not fit in the send buffer go back to
+// the queue until poll() has written enough of it.
+void MqttManager::publishQueueData() {
+  int limit = batchPayload ? batchSize : 1;
+  uint32_t first;
+  while (mqttClient.canPublish(replyRoom()) && queueManager->takeNext(batch[0], first)) {
+    // A batch shares one topic: with per-device topics it stops at the first
+    // record of another device
+    uint32_t last = first;
+    int count = 1;
+    while (count < limit &&
+           (topicPerDevice ? queueManager->takeNextFrom(batch[0].deviceHandle, batch[count], last)
+                           : queueManager->takeNext(batch[count], last))) {
+      count++;
+    }
+    const char* topic = topicFor(batch[0]);
     
-    // Publish to MQTT
-    String topic = topicPublish;
+    // Measured first, then encoded straight into the open publish. A batch
+    // too large for an empty send buffer is halved.
+    size_t length = encodePayload(payloadEncoding, batch, count, batchPayload, nullptr, nullptr);
+    if (!mqttClient.canPublish(MqttClient::publishSize(strlen(topic), length, qos) + replyRoom())) {
+      queueManager->unsend(first);
+      if (count == 1 || mqttClient.getSendPending() > 0) break;
+      limit = count / 2;
+      continue;
+    }
+    batchEnd[first % QueueManager::getCapacity()] = last;
     
-    if (mqttClient.publish(topic.c_str(), payload.c_str())) {
-      Serial.printf("[MQTT] Published: %s\n", topic.c_str());
-    } else {
-      Serial.printf("[MQTT] Publish failed: %s\n", topic.c_str());
-      queueManager->enqueue(dataPoint);
+    bool sent = (payloadEncoding != PAYLOAD_PACKED || publishMetricSchemas(count)) &&
+                mqttClient.beginPublish(topic, length, qos, first);
+    if (sent) {
+      payloadStream.begin(&mqttClient);
+      encodePayload(payloadEncoding, batch, count, batchPayload, toPayloadStream, &payloadStream);
+      sent = payloadStream.finish() && mqttClient.endPublish();
+    }
+    if (!sent) {
+      // Still connected: refused for lack of room (the schemas took it), and
+      // nothing of the batch was written
+      if (mqttClient.connected()) {
+        queueManager->unsend(first);
+        break;
+      }
+      Serial.printf("[MQTT] Publish failed: %s\n", topic);
+      queueManager->rewind();
       break;
     }
-    
-    vTaskDelay(pdMS_TO_TICKS(10)); // Small delay between publishes
+    Serial.printf("[MQTT] Published %d record(s): %s\n", count, topic);
+    if (qos == 0) {
+      queueManager->acknowledgeRange(first, last);
+    }
   }
 }
 
+void MqttManager::onAck(void* context, uint32_t tag) {
+  MqttManager* manager = static_cast<MqttManager*>(context);
+  manager->queueManager->acknowledgeRange(tag, manager->batchEnd[tag % QueueManager::getCapacity()]);
+}
+
 bool MqttManager::isNetworkAvailable() {
   if (!networkManager) return false;
   
@@ -285,9 +614,103 @@ void MqttManager::getStatus(JsonObject& status) {
   status["broker_port"] = brokerPort;
   status["client_id"] = clientId;
   status["topic_publish"] = topicPublish;
+  status["topic_subscribe"] = topicSubscribe;
+  status["topic_response"] = topicResponse;
   status["queue_size"] = queueManager->size();
+  status["linger_ms"] = lingerMs;
+  status["batch_size"] = batchSize;
+  status["qos"] = qos;
+  status["batch_payload"] = batchPayload;
+  status["payload_encoding"] = payloadEncodingName(payloadEncoding);
+  status["in_flight"] = mqttClient.getInflight();
+}
+
+void MqttManager::onMessage(void* context, const MqttMessage& message) {
+  static_cast<MqttManager*>(context)->handleMessage(message);
+}
+
+// Runs on the MQTT task from inside poll(); the payload is parsed in place in
+// the receive buffer, which stays untouched until this returns
+void MqttManager::handleMessage(const MqttMessage& message) {
+  requestId = JsonVariantConst();
+  
+  // A retained command would run again on every reconnect
+  if (message.retained) {
+    Serial.printf("[MQTT] Ignoring retained message on %s\n", message.topic);
+    return;
+  }
+  if (message.truncated) {
+    sendError("Command too large: " + String(message.length) + " bytes, limit " + String(receiveCapacity));
+    return;
+  }
+  if (!commandHandler) {
+    sendError("No handler configured");
+    return;
+  }
+  
+  DeserializationError error = deserializeJson(*commandDoc, (char*)message.payload, message.length);
+  if (error) {
+    sendError("Invalid JSON: " + String(error.c_str()));
+    return;
+  }
+  
+  requestId = (*commandDoc)["request_id"];
+  commandHandler->handle(*this, *commandDoc);
+  requestId = JsonVariantConst();
+  commandDoc->clear();
+}
+
+// Replies are wrapped as {"request_id":<from the command>,"response":<reply>}
+Print& MqttManager::beginResponse() {
+  reply.reset();
+  reply.print("{\"request_id\":");
+  serializeJson(requestId, reply);
+  reply.print(",\"response\":");
+  return reply;
+}
+
+void MqttManager::endResponse() {
+  reply.print('}');
+  if (reply.overflowed()) {
+    Serial.printf("[MQTT] Reply larger than %u bytes dropped\n", reply.getLength());
+    sendError("Response too large for MQTT");
+    return;
+  }
+  if (topicResponse.length() == 0) return;
+  
+  if (!mqttClient.publish(topicResponse.c_str(), reply.getData(), reply.getLength())) {
+    Serial.printf("[MQTT] Reply publish failed: %s\n", topicResponse.c_str());
+  }
+}
+
+bool MqttManager::getLinkStats(JsonObject& result) {
+  const MqttClientStats& stats = mqttClient.getStats();
+  result["transport"] = "mqtt";
+  result["connected"] = mqttClient.connected();
+  result["receive_buffer"] = receiveCapacity;
+  result["send_pending"] = mqttClient.getSendPending();
+  result["bytes_in"] = stats.bytesIn;
+  result["bytes_out"] = stats.bytesOut;
+  result["packets_in"] = stats.packetsIn;
+  result["packets_out"] = stats.packetsOut;
+  result["messages_in"] = stats.messagesIn;
+  result["oversized"] = stats.oversized;
+  result["subscribe_failures"] = stats.subscribeFailures;
+  result["keepalive_timeouts"] = stats.keepaliveTimeouts;
+  result["in_flight"] = mqttClient.getInflight();
+  result["acked"] = stats.acked;
+  result["ack_timeouts"] = stats.ackTimeouts;
+  return true;
 }
 
 MqttManager::~MqttManager() {
   stop();
+  if (pollTimer) {
+    xTimerDelete(pollTimer, portMAX_DELAY);
+  }
+  delete commandDoc;
+  heap_caps_free(receiveBuffer);
+  heap_caps_free(replyStorage);
+  heap_caps_free(sendStorage);
+  heap_caps_free(batch);
 }
\ No newline at end of file
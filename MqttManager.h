@@ -2,15 +2,87 @@
 #define MQTT_MANAGER_H
 
 #include <WiFi.h>
-#include <PubSubClient.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
 #include <ArduinoJson.h>
 #include "ConfigManager.h"
 #include "ServerConfig.h"
 #include "QueueManager.h"
 #include "NetworkManager.h"
+#include "MqttClient.h"
+#include "ResponseSink.h"
+#include "PsramJson.h"
+#include "PayloadEncoder.h"
 #include <Ethernet.h>
 
-class MqttManager {
+class CRUDHandler;
+
+// MqttClient transport over the Arduino Client of the active network interface
+class ArduinoMqttTransport : public MqttTransport {
+private:
+  Client* client;
+  bool socketClient;    // A WiFiClient, written with non-blocking socket sends
+
+public:
+  ArduinoMqttTransport() : client(nullptr), socketClient(false) {}
+  void setClient(Client* networkClient, bool isWiFiClient) {
+    client = networkClient;
+    socketClient = isWiFiClient;
+  }
+  
+  bool open(const char* host, uint16_t port) override;
+  void close() override;
+  int read(uint8_t* data, size_t size) override;
+  int write(const uint8_t* data, size_t size) override;
+};
+
+// Fixed buffer a reply is serialized into before it is published as one
+// message. Output past the capacity is dropped and flagged.
+class MqttReplyBuffer : public Print {
+private:
+  uint8_t* data;
+  size_t capacity;
+  size_t length;
+  bool overflow;
+
+public:
+  MqttReplyBuffer() : data(nullptr), capacity(0), length(0), overflow(false) {}
+  void begin(uint8_t* buffer, size_t size) { data = buffer; capacity = size; reset(); }
+  void reset() { length = 0; overflow = false; }
+  size_t getCapacity() const { return capacity; }
+  
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override;
+  
+  const uint8_t* getData() const { return data; }
+  size_t getLength() const { return length; }
+  bool overflowed() const { return overflow; }
+};
+
+// Hands a payload to the open publish (MqttClient::beginPublish) in small
+// chunks, so records are serialized straight into the socket
+class MqttPayloadStream : public Print {
+private:
+  MqttClient* client;
+  uint8_t chunk[256];
+  size_t used;
+  bool failed;
+
+public:
+  MqttPayloadStream() : client(nullptr), used(0), failed(false) {}
+  void begin(MqttClient* target) { client = target; used = 0; failed = false; }
+  
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override;
+  
+  // Send what is still buffered; false if any part of the payload failed
+  bool finish();
+};
+
+// Publishes queued data and runs configuration commands received on
+// topic_subscribe; each reply is published to the response topic, tagged
+// with the command's request_id
+class MqttManager : public ResponseSink {
 private:
   static MqttManager* instance;
   ConfigManager* configManager;
@@ -19,26 +91,107 @@ private:
   NetworkMgr* networkManager;
   WiFiClient wifiClient;
   EthernetClient ethernetClient;
-  PubSubClient mqttClient;
+  ArduinoMqttTransport transport;
+  MqttClient mqttClient;
+  CRUDHandler* commandHandler;
+  
+  // Commands are received and parsed in place in PSRAM, so their size is not
+  // bound by a small library buffer; replies are collected before publishing.
+  // The send buffer holds what the socket has not taken yet: room for one
+  // reply, which data publishes leave free, plus room for data.
+  static const size_t RECEIVE_BUFFER_SIZE = 32 * 1024;
+  static const size_t RECEIVE_FALLBACK_SIZE = 4 * 1024;    // Internal RAM without PSRAM
+  static const size_t REPLY_BUFFER_SIZE = 256 * 1024;
+  static const size_t REPLY_FALLBACK_SIZE = 8 * 1024;
+  static const size_t SEND_DATA_ROOM = 32 * 1024;
+  static const size_t SEND_DATA_FALLBACK_ROOM = 2 * 1024;
+  static const uint32_t CONNACK_TIMEOUT_MS = 5000;
+  uint8_t* receiveBuffer;
+  size_t receiveCapacity;
+  uint8_t* sendStorage;
+  uint8_t* replyStorage;
+  MqttReplyBuffer reply;
+  PsramJsonDocument* commandDoc;
+  JsonVariantConst requestId;   // Of the command being handled, null otherwise
   
   bool running;
   TaskHandle_t taskHandle;
   
+  // The task blocks on notifications: QueueEvent bits from the data queue and
+  // MQTT_EVENT_POLL from a timer that drives receiving, keepalive and reconnects
+  static const uint32_t MQTT_EVENT_POLL = 1 << 8;
+  static const uint32_t POLL_INTERVAL_MS = 100;
+  static const unsigned long RECONNECT_INTERVAL_MS = 5000;
+  static const uint32_t ACK_POLL_MS = 10;   // Pace while publishes await PUBACK or the socket is full
+  TimerHandle_t pollTimer;
+  bool networkWasAvailable;
+  
   String brokerAddress;
   int brokerPort;
   String clientId;
   String username;
   String password;
   String topicPublish;
+  String topicSubscribe;
+  String topicResponse;
+  
+  // Per-device publish topics when topic_publish contains "{device_id}",
+  // built once per device: direct-mapped by device handle, checked by ID
+  static const int TOPIC_CACHE_SLOTS = 64;
+  static const size_t TOPIC_CAPACITY = 128;
+  struct TopicSlot {
+    char deviceId[12];
+    char topic[TOPIC_CAPACITY];
+  };
+  TopicSlot* topicCache;
+  bool topicPerDevice;
+  
+  // With batch_payload, one message carries up to batch_size records sharing
+  // a topic, as an array (packed frames always hold a count). A message is
+  // tagged with the sequence number of its first record; batchEnd (by slot)
+  // holds that of its last.
+  bool batchPayload;
+  DataRecord* batch;
+  uint32_t* batchEnd;
+  MqttPayloadStream payloadStream;
+  PayloadEncoding payloadEncoding;
+  
+  // Packed frames name metrics by ID only. Each metric's schema is published,
+  // retained, to <topic>/schema/<id> before its first sample on a connection;
+  // described metrics are remembered here, direct-mapped by register handle,
+  // with a hash of the schema fields so an edited register is described again.
+  static const int SCHEMA_CACHE_SLOTS = 256;
+  struct SchemaSlot {
+    uint16_t registerHandle;
+    bool described;
+    uint32_t schemaHash;
+  };
+  SchemaSlot* schemaCache;
+  
+  uint16_t keepAlive;
+  bool cleanSession;
+  uint32_t lingerMs;    // How long a partial batch may wait; 0 = publish on arrival
+  int batchSize;
+  uint8_t qos;          // Data publishes: 1 = kept queued until PUBACK
   unsigned long lastReconnectAttempt;
   
   MqttManager(ConfigManager* config, ServerConfig* serverCfg, NetworkMgr* netMgr);
   
   static void mqttTask(void* parameter);
   void mqttLoop();
+  static void onPollTimer(TimerHandle_t timer);
+  void serviceConnection();
   bool connectToMqtt();
   void loadMqttConfig();
   void publishQueueData();
+  const char* topicFor(const DataRecord& record);
+  size_t replyRoom() const;
+  bool publishMetricSchemas(int count);
+  void forgetMetricSchemas();
+  static void onAck(void* context, uint32_t tag);
+  static void onMessage(void* context, const MqttMessage& message);
+  void handleMessage(const MqttMessage& message);
+  bool allocateBuffers();
   void debugNetworkConnectivity();
   bool isNetworkAvailable();
 
@@ -50,6 +203,14 @@ public:
   void stop();
   void getStatus(JsonObject& status);
   
+  // Commands arriving before this is set are answered with an error
+  void setCommandHandler(CRUDHandler* handler) { commandHandler = handler; }
+  
+  // ResponseSink: replies go to the response topic
+  Print& beginResponse() override;
+  void endResponse() override;
+  bool getLinkStats(JsonObject& result) override;
+  
   ~MqttManager();
 };
 
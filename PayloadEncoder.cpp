@@ -0,0 +1,232 @@
+#include "PayloadEncoder.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char* const ENCODING_NAMES[PAYLOAD_ENCODING_COUNT] = { "json", "cbor", "packed" };
+
+// Hands bytes to the sink, if any, and counts them
+struct PayloadWriter {
+  PayloadSink sink;
+  void* context;
+  size_t size;
+  
+  void put(const void* data, size_t length) {
+    if (sink && length > 0) {
+      sink(context, (const uint8_t*)data, length);
+    }
+    size += length;
+  }
+  void put(const char* text) { put(text, strlen(text)); }
+  void byte(uint8_t value) { put(&value, 1); }
+};
+
+// --- JSON ---
+
+static void putJsonString(PayloadWriter& out, const char* text, size_t capacity) {
+  size_t length = strnlen(text, capacity);
+  size_t start = 0;
+  out.byte('"');
+  for (size_t i = 0; i < length; i++) {
+    uint8_t c = text[i];
+    if (c != '"' && c != '\\' && c >= 0x20) continue;
+    
+    out.put(text + start, i - start);
+    char escape[8];
+    int used = (c == '"' || c == '\\') ? snprintf(escape, sizeof(escape), "\\%c", c)
+                                       : snprintf(escape, sizeof(escape), "\\u%04x", c);
+    out.put(escape, used);
+    start = i + 1;
+  }
+  out.put(text + start, length - start);
+  out.byte('"');
+}
+
+static void putJsonUnsigned(PayloadWriter& out, uint32_t value) {
+  char text[12];
+  out.put(text, snprintf(text, sizeof(text), "%lu", (unsigned long)value));
+}
+
+// Seven significant digits round-trip a float; JSON has no NaN or infinity
+static void putJsonFloat(PayloadWriter& out, float value) {
+  if (!isfinite(value)) {
+    out.put("null");
+    return;
+  }
+  char text[20];
+  out.put(text, snprintf(text, sizeof(text), "%.7g", (double)value));
+}
+
+static void putJsonRecord(PayloadWriter& out, const DataRecord& record) {
+  out.put("{\"time\":");
+  putJsonUnsigned(out, record.time);
+  out.put(",\"name\":");
+  putJsonString(out, record.name, sizeof(record.name));
+  out.put(",\"address\":");
+  putJsonUnsigned(out, record.address);
+  out.put(",\"datatype\":");
+  putJsonString(out, record.dataType, sizeof(record.dataType));
+  out.put(",\"value\":");
+  putJsonFloat(out, record.value);
+  out.put(",\"device_id\":");
+  putJsonString(out, record.deviceId, sizeof(record.deviceId));
+  out.put(",\"register_id\":");
+  putJsonString(out, record.registerId, sizeof(record.registerId));
+  out.byte('}');
+}
+
+// --- CBOR ---
+
+enum CborMajor : uint8_t { CBOR_UNSIGNED = 0, CBOR_TEXT = 3, CBOR_ARRAY = 4, CBOR_MAP = 5 };
+
+// Initial byte and argument in the shortest form
+static void putCborHead(PayloadWriter& out, uint8_t major, uint32_t value) {
+  uint8_t head[5];
+  size_t used = 1;
+  if (value < 24) {
+    head[0] = (major << 5) | value;
+  } else if (value <= 0xFF) {
+    head[0] = (major << 5) | 24;
+    head[used++] = value;
+  } else if (value <= 0xFFFF) {
+    head[0] = (major << 5) | 25;
+    head[used++] = value >> 8;
+    head[used++] = value & 0xFF;
+  } else {
+    head[0] = (major << 5) | 26;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      head[used++] = (value >> shift) & 0xFF;
+    }
+  }
+  out.put(head, used);
+}
+
+static void putCborText(PayloadWriter& out, const char* text, size_t capacity) {
+  size_t length = strnlen(text, capacity);
+  putCborHead(out, CBOR_TEXT, length);
+  out.put(text, length);
+}
+
+static void putCborKey(PayloadWriter& out, const char* key) {
+  putCborText(out, key, strlen(key));
+}
+
+static void putCborFloat(PayloadWriter& out, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint8_t item[5] = { 0xFA, (uint8_t)(bits >> 24), (uint8_t)(bits >> 16), (uint8_t)(bits >> 8), (uint8_t)bits };
+  out.put(item, sizeof(item));
+}
+
+static void putCborRecord(PayloadWriter& out, const DataRecord& record) {
+  putCborHead(out, CBOR_MAP, 7);
+  putCborKey(out, "time");
+  putCborHead(out, CBOR_UNSIGNED, record.time);
+  putCborKey(out, "name");
+  putCborText(out, record.name, sizeof(record.name));
+  putCborKey(out, "address");
+  putCborHead(out, CBOR_UNSIGNED, record.address);
+  putCborKey(out, "datatype");
+  putCborText(out, record.dataType, sizeof(record.dataType));
+  putCborKey(out, "value");
+  putCborFloat(out, record.value);
+  putCborKey(out, "device_id");
+  putCborText(out, record.deviceId, sizeof(record.deviceId));
+  putCborKey(out, "register_id");
+  putCborText(out, record.registerId, sizeof(record.registerId));
+}
+
+// --- Packed ---
+
+static void putVarint(PayloadWriter& out, uint32_t value) {
+  uint8_t bytes[5];
+  size_t used = 0;
+  while (value >= 0x80) {
+    bytes[used++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  bytes[used++] = value;
+  out.put(bytes, used);
+}
+
+static void putU32(PayloadWriter& out, uint32_t value) {
+  uint8_t bytes[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+  out.put(bytes, sizeof(bytes));
+}
+
+static void putPackedFrame(PayloadWriter& out, const DataRecord* records, int count) {
+  out.byte(PACKED_FRAME_VERSION);
+  putU32(out, count > 0 ? records[0].time : 0);
+  putVarint(out, count);
+  
+  uint32_t previous = count > 0 ? records[0].time : 0;
+  for (int i = 0; i < count; i++) {
+    int32_t delta = (int32_t)(records[i].time - previous);
+    previous = records[i].time;
+    uint32_t bits;
+    memcpy(&bits, &records[i].value, sizeof(bits));
+    
+    putVarint(out, records[i].registerHandle);
+    putVarint(out, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+    putU32(out, bits);
+  }
+}
+
+size_t encodePayload(PayloadEncoding encoding, const DataRecord* records, int count, bool asArray,
+                     PayloadSink sink, void* context) {
+  PayloadWriter out = { sink, context, 0 };
+  switch (encoding) {
+    case PAYLOAD_CBOR:
+      if (asArray) putCborHead(out, CBOR_ARRAY, count);
+      for (int i = 0; i < count; i++) {
+        putCborRecord(out, records[i]);
+      }
+      break;
+      
+    case PAYLOAD_PACKED:
+      putPackedFrame(out, records, count);
+      break;
+      
+    default:
+      if (asArray) out.byte('[');
+      for (int i = 0; i < count; i++) {
+        if (i > 0) out.byte(',');
+        putJsonRecord(out, records[i]);
+      }
+      if (asArray) out.byte(']');
+      break;
+  }
+  return out.size;
+}
+
+size_t encodeMetricSchema(const DataRecord& record, PayloadSink sink, void* context) {
+  PayloadWriter out = { sink, context, 0 };
+  out.put("{\"metric\":");
+  putJsonUnsigned(out, record.registerHandle);
+  out.put(",\"device_id\":");
+  putJsonString(out, record.deviceId, sizeof(record.deviceId));
+  out.put(",\"register_id\":");
+  putJsonString(out, record.registerId, sizeof(record.registerId));
+  out.put(",\"name\":");
+  putJsonString(out, record.name, sizeof(record.name));
+  out.put(",\"datatype\":");
+  putJsonString(out, record.dataType, sizeof(record.dataType));
+  out.put(",\"address\":");
+  putJsonUnsigned(out, record.address);
+  out.byte('}');
+  return out.size;
+}
+
+bool parsePayloadEncoding(const char* name, PayloadEncoding& encoding) {
+  for (int i = 0; i < PAYLOAD_ENCODING_COUNT; i++) {
+    if (strcmp(name, ENCODING_NAMES[i]) == 0) {
+      encoding = (PayloadEncoding)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* payloadEncodingName(PayloadEncoding encoding) {
+  return encoding < PAYLOAD_ENCODING_COUNT ? ENCODING_NAMES[encoding] : "unknown";
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+#ifndef PAYLOAD_ENCODER_H
+#define PAYLOAD_ENCODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "DataRecord.h"
+
+// Encoders for MQTT data payloads, fed straight from queued records. Free of
+// Arduino dependencies so the encodings are compared on the host
+// (testing/payload_encoding_benchmark.cpp).
+
+// mqtt_config "payload_encoding"
+enum PayloadEncoding : uint8_t {
+  PAYLOAD_JSON = 0,   // {"time":..,"name":..,"address":..,"datatype":..,"value":..,"device_id":..,"register_id":..}
+  PAYLOAD_CBOR,       // The same map in CBOR (RFC 8949), value as a float32
+  PAYLOAD_PACKED,     // Metric ID, time and value only; see below
+  PAYLOAD_ENCODING_COUNT
+};
+
+// Packed frame, little-endian. A metric is a register, identified by its
+// config handle; its names are published once as a metric schema (JSON,
+// encodeMetricSchema) so samples do not repeat them:
+//
+//   u8      PACKED_FRAME_VERSION
+//   u32     time of the first sample
+//   varint  sample count
+//   per sample:
+//     varint  metric ID
+//     varint  zigzag time delta from the previous sample (the first: 0)
+//     f32     value
+//
+// Varints are LEB128: 7 bits per byte, least significant group first.
+static const uint8_t PACKED_FRAME_VERSION = 0xB1;
+
+// Receives encoded bytes in pieces as they are produced
+typedef void (*PayloadSink)(void* context, const uint8_t* data, size_t size);
+
+// Encode `count` records as one payload and return its size. With `asArray`
+// JSON and CBOR wrap the records in an array even when there is one; a packed
+// frame always holds a count. A null sink only measures. Nothing is
+// allocated, so the same call sizes a payload and then streams it.
+size_t encodePayload(PayloadEncoding encoding, const DataRecord* records, int count, bool asArray,
+                     PayloadSink sink, void* context);
+
+// Metric schema for packed frames, as JSON:
+// {"metric":..,"device_id":..,"register_id":..,"name":..,"datatype":..,"address":..}
+size_t encodeMetricSchema(const DataRecord& record, PayloadSink sink, void* context);
+
+// "json", "cbor" or "packed"; false if `name` is none of them
+bool parsePayloadEncoding(const char* name, PayloadEncoding& encoding);
+const char* payloadEncodingName(PayloadEncoding encoding);
+
+#endif
\ No newline at end of file
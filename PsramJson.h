@@ -0,0 +1,70 @@
+#ifndef PSRAM_JSON_H
+#define PSRAM_JSON_H
+
+#include <ArduinoJson.h>
+#include <esp_heap_caps.h>
+
+// ArduinoJson pool allocator that prefers PSRAM and falls back to internal RAM
+struct PsramAllocator {
+  void* allocate(size_t size) {
+    void* ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return ptr ? ptr : heap_caps_malloc(size, MALLOC_CAP_8BIT);
+  }
+  void deallocate(void* ptr) {
+    heap_caps_free(ptr);
+  }
+  void* reallocate(void* ptr, size_t newSize) {
+    return heap_caps_realloc(ptr, newSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  }
+};
+
+typedef BasicJsonDocument<PsramAllocator> PsramJsonDocument;
+
+// Commands are parsed in place (deserializeJson from a char*), so their keys and
+// string values point into the receive buffer, and a plain set() or assignment
+// copies those pointers rather than the text. Anything kept beyond the command
+// must be copied with these, which hand ArduinoJson char* to force a copy.
+inline char* ownedJsonString(const char* str) {
+  return const_cast<char*>(str);
+}
+
+inline void copyJsonMember(JsonObject dst, const char* key, JsonVariantConst src);
+inline void copyJsonElement(JsonArray dst, JsonVariantConst src);
+
+inline void copyJsonObject(JsonObject dst, JsonObjectConst src) {
+  for (JsonPairConst kv : src) {
+    copyJsonMember(dst, kv.key().c_str(), kv.value());
+  }
+}
+
+inline void copyJsonMember(JsonObject dst, const char* key, JsonVariantConst src) {
+  if (src.is<JsonObjectConst>()) {
+    copyJsonObject(dst.createNestedObject(ownedJsonString(key)), src.as<JsonObjectConst>());
+  } else if (src.is<JsonArrayConst>()) {
+    JsonArray array = dst.createNestedArray(ownedJsonString(key));
+    for (JsonVariantConst element : src.as<JsonArrayConst>()) {
+      copyJsonElement(array, element);
+    }
+  } else if (src.is<const char*>()) {
+    dst[ownedJsonString(key)] = ownedJsonString(src.as<const char*>());
+  } else {
+    dst[ownedJsonString(key)] = src;
+  }
+}
+
+inline void copyJsonElement(JsonArray dst, JsonVariantConst src) {
+  if (src.is<JsonObjectConst>()) {
+    copyJsonObject(dst.createNestedObject(), src.as<JsonObjectConst>());
+  } else if (src.is<JsonArrayConst>()) {
+    JsonArray array = dst.createNestedArray();
+    for (JsonVariantConst element : src.as<JsonArrayConst>()) {
+      copyJsonElement(array, element);
+    }
+  } else if (src.is<const char*>()) {
+    dst.add(ownedJsonString(src.as<const char*>()));
+  } else {
+    dst.add(src);
+  }
+}
+
+#endif
\ No newline at end of file
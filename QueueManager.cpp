@@ -3,7 +3,7 @@
 
 QueueManager* QueueManager::instance = nullptr;
 
-QueueManager::QueueManager() : dataQueue(nullptr), streamQueue(nullptr), queueMutex(nullptr), streamMutex(nullptr) {}
+QueueManager::QueueManager() : queueMutex(nullptr), storage(nullptr), consumer(nullptr), batchSize(1) {}
 
 QueueManager* QueueManager::getInstance() {
   if (instance == nullptr) {
@@ -13,12 +13,16 @@ QueueManager* QueueManager::getInstance() {
 }
 
 bool QueueManager::init() {
-  // Create FreeRTOS queue for data points
-  dataQueue = xQueueCreate(MAX_QUEUE_SIZE, sizeof(char*));
-  if (dataQueue == nullptr) {
+  // Records are stored by value, no per-item allocation
+  storage = (DataRecord*)heap_caps_malloc(MAX_QUEUE_SIZE * sizeof(DataRecord), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (storage == nullptr) {
+    storage = (DataRecord*)heap_caps_malloc(MAX_QUEUE_SIZE * sizeof(DataRecord), MALLOC_CAP_8BIT);
+  }
+  if (storage == nullptr) {
     Serial.println("Failed to create data queue");
     return false;
   }
+  records.begin(storage);
   
   // Create mutex for thread safety
   queueMutex = xSemaphoreCreateMutex();
@@ -27,26 +31,17 @@ bool QueueManager::init() {
     return false;
   }
   
-  // Create streaming queue
-  streamQueue = xQueueCreate(MAX_STREAM_QUEUE_SIZE, sizeof(char*));
-  if (streamQueue == nullptr) {
-    Serial.println("Failed to create stream queue");
-    return false;
-  }
-  
-  // Create streaming mutex
-  streamMutex = xSemaphoreCreateMutex();
-  if (streamMutex == nullptr) {
-    Serial.println("Failed to create stream mutex");
-    return false;
-  }
-  
   Serial.println("QueueManager initialized successfully");
   return true;
 }
 
-bool QueueManager::enqueue(const JsonObject& dataPoint) {
-  if (dataQueue == nullptr || queueMutex == nullptr) {
+void QueueManager::setConsumer(TaskHandle_t task, int batch) {
+  batchSize = batch < 1 ? 1 : (batch > MAX_QUEUE_SIZE ? MAX_QUEUE_SIZE : batch);
+  consumer = task;
+}
+
+bool QueueManager::enqueue(const DataRecord& record) {
+  if (storage == nullptr || queueMutex == nullptr) {
     return false;
   }
   
@@ -55,47 +50,25 @@ bool QueueManager::enqueue(const JsonObject& dataPoint) {
     return false;
   }
   
-  // Check if queue is full
-  if (uxQueueMessagesWaiting(dataQueue) >= MAX_QUEUE_SIZE) {
-    // Remove oldest item to make space
-    char* oldItem;
-    if (xQueueReceive(dataQueue, &oldItem, 0) == pdTRUE) {
-      free(oldItem);
-    }
-  }
+  // Add to queue; the oldest record makes room when it is full
+  records.push(record);
+  Serial.printf("Data queued: %s\n", record.name);
   
-  // Serialize JSON to string
-  String jsonString;
-  serializeJson(dataPoint, jsonString);
-  
-  // Allocate memory for string in PSRAM
-  char* jsonCopy = (char*)heap_caps_malloc(jsonString.length() + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-  if (jsonCopy == nullptr) {
-    // Fallback to internal RAM
-    jsonCopy = (char*)malloc(jsonString.length() + 1);
-    if (jsonCopy == nullptr) {
-      xSemaphoreGive(queueMutex);
-      return false;
+  TaskHandle_t task = consumer;
+  if (task) {
+    uint32_t unsent = records.unsent();
+    uint32_t events = (unsent == 1 ? QUEUE_EVENT_DATA : 0) | (unsent == (uint32_t)batchSize ? QUEUE_EVENT_BATCH_FULL : 0);
+    if (events) {
+      xTaskNotify(task, events, eSetBits);
     }
   }
   
-  strcpy(jsonCopy, jsonString.c_str());
-  
-  // Add to queue
-  bool success = xQueueSend(dataQueue, &jsonCopy, 0) == pdTRUE;
-  
-  if (success) {
-    Serial.printf("Data queued: %s\n", dataPoint["name"].as<String>().c_str());
-  } else {
-    heap_caps_free(jsonCopy);
-  }
-  
   xSemaphoreGive(queueMutex);
-  return success;
+  return true;
 }
 
-bool QueueManager::dequeue(JsonObject& dataPoint) {
-  if (dataQueue == nullptr || queueMutex == nullptr) {
+bool QueueManager::dequeue(DataRecord& record) {
+  if (storage == nullptr || queueMutex == nullptr) {
     return false;
   }
   
@@ -103,30 +76,14 @@ bool QueueManager::dequeue(JsonObject& dataPoint) {
     return false;
   }
   
-  char* jsonString;
-  bool success = false;
-  
-  if (xQueueReceive(dataQueue, &jsonString, 0) == pdTRUE) {
-    DynamicJsonDocument doc(512);
-    DeserializationError error = deserializeJson(doc, jsonString);
-    
-    if (error == DeserializationError::Ok) {
-      JsonObject obj = doc.as<JsonObject>();
-      for (JsonPair kv : obj) {
-        dataPoint[kv.key()] = kv.value();
-      }
-      success = true;
-    }
-    
-    heap_caps_free(jsonString);
-  }
+  bool success = records.pop(record);
   
   xSemaphoreGive(queueMutex);
   return success;
 }
 
-bool QueueManager::peek(JsonObject& dataPoint) {
-  if (dataQueue == nullptr || queueMutex == nullptr) {
+bool QueueManager::peek(DataRecord& record) {
+  if (storage == nullptr || queueMutex == nullptr) {
     return false;
   }
   
@@ -134,178 +91,131 @@ bool QueueManager::peek(JsonObject& dataPoint) {
     return false;
   }
   
-  char* jsonString;
-  bool success = false;
-  
-  if (xQueuePeek(dataQueue, &jsonString, 0) == pdTRUE) {
-    DynamicJsonDocument doc(512);
-    DeserializationError error = deserializeJson(doc, jsonString);
-    
-    if (error == DeserializationError::Ok) {
-      JsonObject obj = doc.as<JsonObject>();
-      for (JsonPair kv : obj) {
-        dataPoint[kv.key()] = kv.value();
-      }
-      success = true;
-    }
-  }
+  bool success = records.front(record);
   
   xSemaphoreGive(queueMutex);
   return success;
 }
 
-bool QueueManager::isEmpty() {
-  if (dataQueue == nullptr) {
-    return true;
-  }
-  return uxQueueMessagesWaiting(dataQueue) == 0;
-}
-
-bool QueueManager::isFull() {
-  if (dataQueue == nullptr) {
+bool QueueManager::takeNext(DataRecord& record, uint32_t& seq) {
+  if (storage == nullptr || queueMutex == nullptr) {
     return false;
   }
-  return uxQueueMessagesWaiting(dataQueue) >= MAX_QUEUE_SIZE;
-}
-
-int QueueManager::size() {
-  if (dataQueue == nullptr) {
-    return 0;
-  }
-  return uxQueueMessagesWaiting(dataQueue);
-}
-
-void QueueManager::clear() {
-  if (dataQueue == nullptr || queueMutex == nullptr) {
-    return;
-  }
   
   if (xSemaphoreTake(queueMutex, pdMS_TO_TICKS(100)) != pdTRUE) {
-    return;
+    return false;
   }
   
-  char* jsonString;
-  while (xQueueReceive(dataQueue, &jsonString, 0) == pdTRUE) {
-    heap_caps_free(jsonString);
-  }
+  bool success = records.takeNext(record, seq);
   
   xSemaphoreGive(queueMutex);
-  Serial.println("Queue cleared");
-}
-
-void QueueManager::getStats(JsonObject& stats) {
-  stats["size"] = size();
-  stats["max_size"] = MAX_QUEUE_SIZE;
-  stats["is_empty"] = isEmpty();
-  stats["is_full"] = isFull();
+  return success;
 }
 
-bool QueueManager::enqueueStream(const JsonObject& dataPoint) {
-  if (streamQueue == nullptr || streamMutex == nullptr) {
+bool QueueManager::takeNextFrom(uint16_t deviceHandle, DataRecord& record, uint32_t& seq) {
+  if (storage == nullptr || queueMutex == nullptr) {
     return false;
   }
   
-  if (xSemaphoreTake(streamMutex, pdMS_TO_TICKS(10)) != pdTRUE) {
+  if (xSemaphoreTake(queueMutex, pdMS_TO_TICKS(100)) != pdTRUE) {
     return false;
   }
   
-  // Remove oldest if full
-  if (uxQueueMessagesWaiting(streamQueue) >= MAX_STREAM_QUEUE_SIZE) {
-    char* oldItem;
-    if (xQueueReceive(streamQueue, &oldItem, 0) == pdTRUE) {
-      free(oldItem);
-    }
-  }
-  
-  String jsonString;
-  serializeJson(dataPoint, jsonString);
-  
-  char* jsonCopy = (char*)heap_caps_malloc(jsonString.length() + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-  if (jsonCopy == nullptr) {
-    jsonCopy = (char*)malloc(jsonString.length() + 1);
-    if (jsonCopy == nullptr) {
-      xSemaphoreGive(streamMutex);
-      return false;
-    }
-  }
-  
-  strcpy(jsonCopy, jsonString.c_str());
-  bool success = xQueueSend(streamQueue, &jsonCopy, 0) == pdTRUE;
-  
-  if (success) {
-    Serial.printf("Stream queue: Added data, size now: %d\n", uxQueueMessagesWaiting(streamQueue));
-  } else {
-    Serial.println("Stream queue: Failed to add data");
-    heap_caps_free(jsonCopy);
-  }
+  const DataRecord* next = records.peekNext();
+  bool success = next && next->deviceHandle == deviceHandle && records.takeNext(record, seq);
   
-  xSemaphoreGive(streamMutex);
+  xSemaphoreGive(queueMutex);
   return success;
 }
 
-bool QueueManager::dequeueStream(JsonObject& dataPoint) {
-  if (streamQueue == nullptr || streamMutex == nullptr) {
-    return false;
+void QueueManager::acknowledge(uint32_t seq) {
+  if (storage == nullptr || queueMutex == nullptr) {
+    return;
   }
   
-  if (xSemaphoreTake(streamMutex, pdMS_TO_TICKS(10)) != pdTRUE) {
-    return false;
+  xSemaphoreTake(queueMutex, portMAX_DELAY);
+  records.acknowledge(seq);
+  xSemaphoreGive(queueMutex);
+}
+
+void QueueManager::acknowledgeRange(uint32_t first, uint32_t last) {
+  if (storage == nullptr || queueMutex == nullptr) {
+    return;
   }
   
-  char* jsonString;
-  bool success = false;
+  xSemaphoreTake(queueMutex, portMAX_DELAY);
+  records.acknowledgeRange(first, last);
+  xSemaphoreGive(queueMutex);
+}
+
+void QueueManager::rewind() {
+  if (storage == nullptr || queueMutex == nullptr) {
+    return;
+  }
   
-  if (xQueueReceive(streamQueue, &jsonString, 0) == pdTRUE) {
-    Serial.printf("Stream queue: Dequeued data, size now: %d\n", uxQueueMessagesWaiting(streamQueue));
-    DynamicJsonDocument doc(512);
-    if (deserializeJson(doc, jsonString) == DeserializationError::Ok) {
-      JsonObject obj = doc.as<JsonObject>();
-      for (JsonPair kv : obj) {
-        dataPoint[kv.key()] = kv.value();
-      }
-      success = true;
-    }
-    heap_caps_free(jsonString);
+  xSemaphoreTake(queueMutex, portMAX_DELAY);
+  records.rewind();
+  xSemaphoreGive(queueMutex);
+}
+
+void QueueManager::unsend(uint32_t seq) {
+  if (storage == nullptr || queueMutex == nullptr) {
+    return;
   }
   
-  xSemaphoreGive(streamMutex);
-  return success;
+  xSemaphoreTake(queueMutex, portMAX_DELAY);
+  records.unsend(seq);
+  xSemaphoreGive(queueMutex);
 }
 
-bool QueueManager::isStreamEmpty() {
-  return streamQueue == nullptr || uxQueueMessagesWaiting(streamQueue) == 0;
+bool QueueManager::isEmpty() {
+  return records.empty();
+}
+
+bool QueueManager::isFull() {
+  return records.full();
+}
+
+int QueueManager::size() {
+  return records.size();
 }
 
-void QueueManager::clearStream() {
-  if (streamQueue == nullptr || streamMutex == nullptr) {
+int QueueManager::unsentCount() {
+  return records.unsent();
+}
+
+int QueueManager::inFlightCount() {
+  return records.inFlight();
+}
+
+void QueueManager::clear() {
+  if (storage == nullptr || queueMutex == nullptr) {
     return;
   }
   
-  if (xSemaphoreTake(streamMutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+  if (xSemaphoreTake(queueMutex, pdMS_TO_TICKS(100)) != pdTRUE) {
     return;
   }
   
-  char* jsonString;
-  while (xQueueReceive(streamQueue, &jsonString, 0) == pdTRUE) {
-    heap_caps_free(jsonString);
-  }
+  records.clear();
   
-  xSemaphoreGive(streamMutex);
+  xSemaphoreGive(queueMutex);
+  Serial.println("Queue cleared");
+}
+
+void QueueManager::getStats(JsonObject& stats) {
+  stats["size"] = size();
+  stats["max_size"] = MAX_QUEUE_SIZE;
+  stats["in_flight"] = inFlightCount();
+  stats["dropped"] = records.getDropped();
+  stats["is_empty"] = isEmpty();
+  stats["is_full"] = isFull();
 }
 
 QueueManager::~QueueManager() {
   clear();
-  clearStream();
-  if (dataQueue) {
-    vQueueDelete(dataQueue);
-  }
-  if (streamQueue) {
-    vQueueDelete(streamQueue);
-  }
+  heap_caps_free(storage);
   if (queueMutex) {
     vSemaphoreDelete(queueMutex);
   }
-  if (streamMutex) {
-    vSemaphoreDelete(streamMutex);
-  }
 }
\ No newline at end of file
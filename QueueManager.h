@@ -3,18 +3,31 @@
 
 #include <ArduinoJson.h>
 #include <freertos/FreeRTOS.h>
-#include <freertos/queue.h>
 #include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "DataRecord.h"
+#include "AckRing.h"
 
+// Notification bits sent to the consumer task (xTaskNotify, eSetBits)
+enum QueueEvent : uint32_t {
+  QUEUE_EVENT_DATA = 1 << 0,        // A record arrived with nothing else waiting to be sent
+  QUEUE_EVENT_BATCH_FULL = 1 << 1   // Unsent records reached the consumer's batch size
+};
+
+// Data records between the pollers and the uplink. A record is taken for
+// sending with takeNext() but stays queued, in flight, until it is
+// acknowledged (MQTT PUBACK); rewind() makes every unacknowledged record
+// pending again after a reconnect. When full, the oldest record is dropped.
 class QueueManager {
 private:
   static QueueManager* instance;
-  QueueHandle_t dataQueue;
-  QueueHandle_t streamQueue;
   SemaphoreHandle_t queueMutex;
-  SemaphoreHandle_t streamMutex;
-  static const int MAX_QUEUE_SIZE = 100;
-  static const int MAX_STREAM_QUEUE_SIZE = 50;
+  static const int MAX_QUEUE_SIZE = 128;
+  DataRecord* storage;
+  AckRing<DataRecord, MAX_QUEUE_SIZE> records;
+  
+  TaskHandle_t consumer;
+  int batchSize;
   
   QueueManager();
 
@@ -22,21 +35,33 @@ public:
   static QueueManager* getInstance();
   
   bool init();
-  bool enqueue(const JsonObject& dataPoint);
-  bool dequeue(JsonObject& dataPoint);
-  bool peek(JsonObject& dataPoint);
+  
+  // Wake `task` on queue activity instead of having it poll; nullptr stops it
+  void setConsumer(TaskHandle_t task, int batch);
+  static int getCapacity() { return MAX_QUEUE_SIZE; }
+  bool enqueue(const DataRecord& record);
+  bool dequeue(DataRecord& record);
+  bool peek(DataRecord& record);
+  
+  // Copy the oldest unsent record and mark it in flight; `seq` identifies it
+  // to acknowledge()
+  bool takeNext(DataRecord& record, uint32_t& seq);
+  
+  // takeNext(), only if the next unsent record belongs to `deviceHandle`
+  bool takeNextFrom(uint16_t deviceHandle, DataRecord& record, uint32_t& seq);
+  void acknowledge(uint32_t seq);
+  void acknowledgeRange(uint32_t first, uint32_t last);
+  void rewind();
+  void unsend(uint32_t seq);   // Give back `seq` and everything taken after it
+  
   bool isEmpty();
   bool isFull();
-  int size();
+  int size();          // Including records in flight
+  int unsentCount();
+  int inFlightCount();
   void clear();
   void getStats(JsonObject& stats);
   
-  // Streaming queue methods
-  bool enqueueStream(const JsonObject& dataPoint);
-  bool dequeueStream(JsonObject& dataPoint);
-  bool isStreamEmpty();
-  void clearStream();
-  
   ~QueueManager();
 };
 
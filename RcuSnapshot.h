@@ -0,0 +1,130 @@
+#ifndef RCU_SNAPSHOT_H
+#define RCU_SNAPSHOT_H
+
+#include <atomic>
+#include <thread>
+
+// Publishes immutable snapshots of T by atomic pointer swap.
+//
+// Readers pin the current snapshot without locks: they claim a reader slot,
+// announce the pointer they are about to use in it and re-check that it is
+// still current (hazard pointers). Writers swap in a new snapshot and retire
+// the old one; a retired snapshot is deleted once no reader slot holds it.
+//
+// Writers must be serialized by the caller. Header-only and free of Arduino
+// dependencies so it can be stress-tested on the host (testing/).
+template <typename T, int MAX_READERS = 8, int MAX_RETIRED = 16>
+class RcuSnapshot {
+private:
+  std::atomic<T*> current;
+  std::atomic<T*> hazards[MAX_READERS];
+  std::atomic<bool> slotBusy[MAX_READERS];
+  T* retired[MAX_RETIRED];
+  int retiredCount;
+  
+  int acquireSlot() {
+    while (true) {
+      for (int i = 0; i < MAX_READERS; i++) {
+        bool expected = false;
+        if (!slotBusy[i].load(std::memory_order_relaxed) &&
+            slotBusy[i].compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+          return i;
+        }
+      }
+      std::this_thread::yield();
+    }
+  }
+  
+  bool isPinned(T* snapshot) const {
+    for (int i = 0; i < MAX_READERS; i++) {
+      if (hazards[i].load(std::memory_order_seq_cst) == snapshot) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+public:
+  class Guard {
+  private:
+    RcuSnapshot* owner;
+    int slot;
+    T* snapshot;
+  
+  public:
+    Guard(RcuSnapshot* rcu, int readerSlot, T* pinned) : owner(rcu), slot(readerSlot), snapshot(pinned) {}
+    Guard(Guard&& other) : owner(other.owner), slot(other.slot), snapshot(other.snapshot) {
+      other.owner = nullptr;
+    }
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+    ~Guard() {
+      if (owner) {
+        owner->hazards[slot].store(nullptr, std::memory_order_release);
+        owner->slotBusy[slot].store(false, std::memory_order_release);
+      }
+    }
+    
+    const T* get() const { return snapshot; }
+    const T* operator->() const { return snapshot; }
+    explicit operator bool() const { return snapshot != nullptr; }
+  };
+  
+  RcuSnapshot() : current(nullptr), retiredCount(0) {
+    for (int i = 0; i < MAX_READERS; i++) {
+      hazards[i].store(nullptr);
+      slotBusy[i].store(false);
+    }
+  }
+  
+  ~RcuSnapshot() {
+    reclaim();
+    for (int i = 0; i < retiredCount; i++) {
+      delete retired[i];
+    }
+    delete current.load();
+  }
+  
+  // Pin the current snapshot for the lifetime of the returned guard (lock-free)
+  Guard pin() {
+    int slot = acquireSlot();
+    T* snapshot;
+    do {
+      snapshot = current.load(std::memory_order_seq_cst);
+      hazards[slot].store(snapshot, std::memory_order_seq_cst);
+    } while (snapshot != current.load(std::memory_order_seq_cst));
+    return Guard(this, slot, snapshot);
+  }
+  
+  // Writer only: the new snapshot is visible to every pin() that follows
+  void publish(T* next) {
+    T* previous = current.exchange(next, std::memory_order_seq_cst);
+    if (!previous) return;
+    
+    while (retiredCount >= MAX_RETIRED) {
+      reclaim();
+      if (retiredCount >= MAX_RETIRED) {
+        std::this_thread::yield();
+      }
+    }
+    retired[retiredCount++] = previous;
+    reclaim();
+  }
+  
+  // Writer only: delete retired snapshots no reader still holds
+  void reclaim() {
+    int kept = 0;
+    for (int i = 0; i < retiredCount; i++) {
+      if (isPinned(retired[i])) {
+        retired[kept++] = retired[i];
+      } else {
+        delete retired[i];
+      }
+    }
+    retiredCount = kept;
+  }
+  
+  int pendingReclaim() const { return retiredCount; }
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,461 @@
+#include "RegisterPlan.h"
+#include <esp_heap_caps.h>
+#include <esp_rom_crc.h>
+
+static const uint32_t PLAN_IMAGE_MAGIC = 0x4E4C5052; // "RPLN"
+static const uint16_t PLAN_IMAGE_VERSION = 2;
+
+static float decodeUint16(uint16_t rawValue) {
+  return rawValue;
+}
+
+static float decodeInt16(uint16_t rawValue) {
+  return (int16_t)rawValue;
+}
+
+static float decodeInt32(uint16_t rawValue) {
+  return rawValue; // For 32-bit, would need to read 2 registers
+}
+
+static float decodeFloat32(uint16_t rawValue) {
+  return rawValue / 100.0; // Simple scaling, adjust as needed
+}
+
+static float decodeBool(uint16_t rawValue) {
+  return rawValue != 0 ? 1.0 : 0.0;
+}
+
+static const RegisterCodec CODECS[DATA_TYPE_COUNT] = {
+  decodeUint16,
+  decodeInt16,
+  decodeInt32,
+  decodeFloat32,
+  decodeBool
+};
+
+static const char* const DATA_TYPE_NAMES[DATA_TYPE_COUNT] = {
+  "uint16",
+  "int16",
+  "int32",
+  "float32",
+  "bool"
+};
+
+static void* planAlloc(size_t size) {
+  if (size == 0) return nullptr;
+  void* ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!ptr) {
+    ptr = malloc(size);
+  }
+  return ptr;
+}
+
+static uint16_t appendString(char* pool, size_t& used, const char* value) {
+  if (!value || value[0] == '\0') {
+    return 0; // Handle 0 is the shared empty string
+  }
+  size_t length = strlen(value) + 1;
+  uint16_t handle = used;
+  memcpy(pool + used, value, length);
+  used += length;
+  return handle;
+}
+
+RegisterPlan::RegisterPlan()
+  : devices(nullptr), slotByHandle(nullptr), deviceCount(0), deviceCapacity(0), slotCapacity(0), generation(0) {}
+
+RegisterPlan::~RegisterPlan() {
+  release();
+}
+
+void RegisterPlan::release() {
+  for (int i = 0; i < deviceCount; i++) {
+    heap_caps_free(devices[i].registers); // Start of the device's block
+  }
+  if (devices) heap_caps_free(devices);
+  if (slotByHandle) heap_caps_free(slotByHandle);
+  devices = nullptr;
+  slotByHandle = nullptr;
+  deviceCount = 0;
+  deviceCapacity = 0;
+  slotCapacity = 0;
+}
+
+bool RegisterPlan::reserve(int capacity) {
+  if (capacity <= deviceCapacity) return true;
+  
+  int newCapacity = deviceCapacity > 0 ? deviceCapacity * 2 : 8;
+  while (newCapacity < capacity) newCapacity *= 2;
+  
+  DeviceDescriptor* grown = (DeviceDescriptor*)planAlloc(newCapacity * sizeof(DeviceDescriptor));
+  if (!grown) {
+    Serial.println("Failed to grow register plan");
+    return false;
+  }
+  if (devices) {
+    memcpy(grown, devices, deviceCount * sizeof(DeviceDescriptor));
+    heap_caps_free(devices);
+  }
+  devices = grown;
+  deviceCapacity = newCapacity;
+  return true;
+}
+
+bool RegisterPlan::reserveSlots(int handleLimit) {
+  if (handleLimit <= slotCapacity) return true;
+  
+  int newCapacity = slotCapacity > 0 ? slotCapacity * 2 : 16;
+  while (newCapacity < handleLimit) newCapacity *= 2;
+  
+  int16_t* grown = (int16_t*)planAlloc(newCapacity * sizeof(int16_t));
+  if (!grown) {
+    Serial.println("Failed to grow register plan handle table");
+    return false;
+  }
+  for (int i = 0; i < newCapacity; i++) {
+    grown[i] = i < slotCapacity ? slotByHandle[i] : -1;
+  }
+  if (slotByHandle) heap_caps_free(slotByHandle);
+  slotByHandle = grown;
+  slotCapacity = newCapacity;
+  return true;
+}
+
+int RegisterPlan::findDevice(uint16_t deviceHandle) const {
+  return deviceHandle < slotCapacity ? slotByHandle[deviceHandle] : -1;
+}
+
+uint8_t RegisterPlan::parseDataType(const char* dataType) {
+  for (uint8_t i = 0; i < DATA_TYPE_COUNT; i++) {
+    if (strcmp(dataType, DATA_TYPE_NAMES[i]) == 0) {
+      return i;
+    }
+  }
+  return DATA_TYPE_UINT16;
+}
+
+RegisterCodec RegisterPlan::codecFor(uint8_t dataType) {
+  return dataType < DATA_TYPE_COUNT ? CODECS[dataType] : decodeUint16;
+}
+
+bool RegisterPlan::compileDevice(DeviceDescriptor& dev, const ConfigIndex& index, uint16_t deviceHandle) {
+  const IndexedDevice* entry = index.device(deviceHandle);
+  const char* deviceId = entry->id;
+  JsonObjectConst device = entry->config;
+  JsonArrayConst registerConfigs = device["registers"].as<JsonArrayConst>();
+  size_t count = registerConfigs.size();
+  
+  // Size the device block: descriptors, last-value slots and string table
+  size_t stringBytes = 1 + strlen(deviceId) + 1 + strlen(device["ip"] | "") + 1;
+  for (JsonVariantConst regVar : registerConfigs) {
+    JsonObjectConst reg = regVar.as<JsonObjectConst>();
+    stringBytes += strlen(reg["register_name"] | "Unknown") + 1;
+    stringBytes += strlen(reg["register_id"] | "") + 1;
+    stringBytes += strlen(reg["data_type"] | "") + 1;
+  }
+  
+  if (stringBytes > 0xFFFF || count > 0xFFFF) {
+    Serial.printf("Device %s too large for register plan (%u registers)\n", deviceId, (unsigned)count);
+    return false;
+  }
+  
+  size_t registerBytes = count * sizeof(RegisterDescriptor);
+  size_t stateBytes = count * sizeof(ReportState);
+  uint8_t* block = (uint8_t*)planAlloc(registerBytes + stateBytes + stringBytes);
+  if (!block) {
+    Serial.printf("Failed to allocate register plan for device %s\n", deviceId);
+    return false;
+  }
+  
+  RegisterDescriptor* registers = (RegisterDescriptor*)block;
+  ReportState* lastValues = (ReportState*)(block + registerBytes);
+  char* strings = (char*)(block + registerBytes + stateBytes);
+  size_t stringsUsed = 1;
+  strings[0] = '\0';
+  memset(lastValues, 0, stateBytes);
+  
+  int position = 0;
+  for (JsonVariantConst regVar : registerConfigs) {
+    JsonObjectConst reg = regVar.as<JsonObjectConst>();
+    RegisterDescriptor& desc = registers[position++];
+    const char* dataType = reg["data_type"] | "";
+    const char* registerId = reg["register_id"] | "";
+    
+    desc.dataType = parseDataType(dataType);
+    desc.codec = codecFor(desc.dataType);
+    desc.scale = reg["scale"] | 1.0f;
+    desc.report = ReportFilter::parsePolicy(reg);
+    desc.address = reg["address"] | 0;
+    desc.functionCode = reg["function_code"] | 3;
+    desc.nameHandle = appendString(strings, stringsUsed, reg["register_name"] | "Unknown");
+    desc.idHandle = appendString(strings, stringsUsed, registerId);
+    desc.typeHandle = appendString(strings, stringsUsed, dataType);
+    desc.handle = index.findRegister(registerId);
+  }
+  
+  // Swap in the new block; the scheduler timestamp survives recompilation
+  if (dev.registers) {
+    heap_caps_free(dev.registers);
+  }
+  dev.registers = registers;
+  dev.lastValues = lastValues;
+  dev.strings = strings;
+  dev.handle = deviceHandle;
+  dev.registerCount = count;
+  dev.idHandle = appendString(strings, stringsUsed, deviceId);
+  dev.ipHandle = appendString(strings, stringsUsed, device["ip"] | "");
+  dev.stringBytes = stringsUsed;
+  dev.port = device["port"] | 502;
+  dev.serialPort = device["serial_port"] | 1;
+  dev.slaveId = device["slave_id"] | 1;
+  dev.refreshRateMs = device["refresh_rate_ms"] | 5000;
+  return true;
+}
+
+// Swap-remove: the last device takes the freed slot, so removal is O(1)
+void RegisterPlan::removeDevice(int index) {
+  heap_caps_free(devices[index].registers);
+  slotByHandle[devices[index].handle] = -1;
+  deviceCount--;
+  if (index != deviceCount) {
+    devices[index] = devices[deviceCount];
+    slotByHandle[devices[index].handle] = index;
+  }
+}
+
+bool RegisterPlan::build(const ConfigIndex& index, const char* protocol, uint32_t configGeneration) {
+  release();
+  if (!reserveSlots(index.getDeviceLimit())) return false;
+  
+  int registerCount = 0;
+  for (uint16_t handle = 0; handle < index.getDeviceLimit(); handle++) {
+    const IndexedDevice* entry = index.device(handle);
+    if (!entry || strcmp(entry->config["protocol"] | "", protocol) != 0) continue;
+    
+    if (!reserve(deviceCount + 1)) {
+      release();
+      return false;
+    }
+    
+    DeviceDescriptor& dev = devices[deviceCount];
+    memset(&dev, 0, sizeof(DeviceDescriptor));
+    if (!compileDevice(dev, index, handle)) {
+      release();
+      return false;
+    }
+    slotByHandle[handle] = deviceCount;
+    registerCount += dev.registerCount;
+    deviceCount++;
+  }
+  
+  generation = configGeneration;
+  Serial.printf("Compiled %s plan: %d devices, %d registers\n", protocol, deviceCount, registerCount);
+  return true;
+}
+
+bool RegisterPlan::updateDevice(const ConfigIndex& index, uint16_t deviceHandle, const char* protocol) {
+  if (deviceHandle == INVALID_HANDLE) return true;
+  
+  int slot = findDevice(deviceHandle);
+  const IndexedDevice* entry = index.device(deviceHandle);
+  bool matches = entry && strcmp(entry->config["protocol"] | "", protocol) == 0;
+  
+  if (!matches) {
+    // Deleted, or no longer handled by this poller
+    if (slot >= 0) {
+      Serial.printf("Removed device %s from %s plan\n", devices[slot].id(), protocol);
+      removeDevice(slot);
+    }
+    return true;
+  }
+  
+  if (slot < 0) {
+    if (!reserve(deviceCount + 1) || !reserveSlots(deviceHandle + 1)) return false;
+    DeviceDescriptor& dev = devices[deviceCount];
+    memset(&dev, 0, sizeof(DeviceDescriptor));
+    if (!compileDevice(dev, index, deviceHandle)) return false;
+    slotByHandle[deviceHandle] = deviceCount;
+    deviceCount++;
+    Serial.printf("Added device %s to %s plan (%d registers)\n", entry->id, protocol, dev.registerCount);
+    return true;
+  }
+  
+  if (!compileDevice(devices[slot], index, deviceHandle)) return false;
+  Serial.printf("Recompiled device %s in %s plan (%d registers)\n", entry->id, protocol, devices[slot].registerCount);
+  return true;
+}
+
+size_t RegisterPlan::imageSize() const {
+  size_t size = sizeof(PlanImageHeader);
+  for (int i = 0; i < deviceCount; i++) {
+    size += sizeof(PlanImageDevice);
+    size += devices[i].registerCount * sizeof(RegisterDescriptor);
+    size += devices[i].stringBytes;
+  }
+  return size;
+}
+
+size_t RegisterPlan::writeImage(uint8_t* image, size_t capacity) const {
+  size_t size = imageSize();
+  if (capacity < size) return 0;
+  
+  uint8_t* cursor = image + sizeof(PlanImageHeader);
+  for (int i = 0; i < deviceCount; i++) {
+    const DeviceDescriptor& dev = devices[i];
+    PlanImageDevice record;
+    memset(&record, 0, sizeof(record));
+    record.refreshRateMs = dev.refreshRateMs;
+    record.idHandle = dev.idHandle;
+    record.ipHandle = dev.ipHandle;
+    record.registerCount = dev.registerCount;
+    record.stringBytes = dev.stringBytes;
+    record.port = dev.port;
+    record.serialPort = dev.serialPort;
+    record.slaveId = dev.slaveId;
+    memcpy(cursor, &record, sizeof(record));
+    cursor += sizeof(record);
+    
+    size_t registerBytes = dev.registerCount * sizeof(RegisterDescriptor);
+    memcpy(cursor, dev.registers, registerBytes);
+    cursor += registerBytes;
+    memcpy(cursor, dev.strings, dev.stringBytes);
+    cursor += dev.stringBytes;
+  }
+  
+  PlanImageHeader header;
+  header.magic = PLAN_IMAGE_MAGIC;
+  header.version = PLAN_IMAGE_VERSION;
+  header.descriptorSize = sizeof(RegisterDescriptor);
+  header.deviceCount = deviceCount;
+  header.payloadBytes = size - sizeof(PlanImageHeader);
+  header.checksum = esp_rom_crc32_le(0, image + sizeof(PlanImageHeader), header.payloadBytes);
+  memcpy(image, &header, sizeof(header));
+  return size;
+}
+
+// The CRC only catches corruption, not a well-formed image whose string
+// handles, data types or function codes are out of range; those are checked
+// before anything is resolved or read through them
+static bool imageDeviceValid(const PlanImageDevice& record, const RegisterDescriptor* registers, const char* strings) {
+  uint16_t limit = record.stringBytes;
+  if (limit == 0 || strings[limit - 1] != '\0') return false;
+  if (record.idHandle >= limit || record.ipHandle >= limit) return false;
+  for (uint16_t r = 0; r < record.registerCount; r++) {
+    const RegisterDescriptor& desc = registers[r];
+    if (desc.idHandle >= limit || desc.nameHandle >= limit || desc.typeHandle >= limit) return false;
+    if (desc.dataType >= DATA_TYPE_COUNT || desc.functionCode < 1 || desc.functionCode > 4) return false;
+  }
+  return true;
+}
+
+bool RegisterPlan::loadImage(const uint8_t* image, size_t size, const ConfigIndex& index, uint32_t configGeneration) {
+  PlanImageHeader header;
+  if (size < sizeof(header)) return false;
+  memcpy(&header, image, sizeof(header));
+  
+  if (header.magic != PLAN_IMAGE_MAGIC || header.version != PLAN_IMAGE_VERSION ||
+      header.descriptorSize != sizeof(RegisterDescriptor) ||
+      header.payloadBytes != size - sizeof(header)) {
+    Serial.println("Plan image header mismatch");
+    return false;
+  }
+  const uint8_t* cursor = image + sizeof(header);
+  const uint8_t* end = cursor + header.payloadBytes;
+  if (esp_rom_crc32_le(0, cursor, header.payloadBytes) != header.checksum) {
+    Serial.println("Plan image checksum mismatch");
+    return false;
+  }
+  
+  release();
+  if (!reserve(header.deviceCount) || !reserveSlots(index.getDeviceLimit())) {
+    release();
+    return false;
+  }
+  
+  int registerCount = 0;
+  for (uint32_t i = 0; i < header.deviceCount; i++) {
+    PlanImageDevice record;
+    if (end - cursor < (ptrdiff_t)sizeof(record)) break;
+    memcpy(&record, cursor, sizeof(record));
+    cursor += sizeof(record);
+    
+    size_t registerBytes = record.registerCount * sizeof(RegisterDescriptor);
+    size_t stateBytes = record.registerCount * sizeof(ReportState);
+    if ((size_t)(end - cursor) < registerBytes + record.stringBytes) break;
+    
+    // Same block layout as compileDevice: [registers][last values][strings]
+    uint8_t* block = (uint8_t*)planAlloc(registerBytes + stateBytes + record.stringBytes);
+    if (!block) {
+      Serial.println("Failed to allocate register plan from image");
+      release();
+      return false;
+    }
+    
+    DeviceDescriptor& dev = devices[deviceCount];
+    memset(&dev, 0, sizeof(DeviceDescriptor));
+    dev.registers = (RegisterDescriptor*)block;
+    dev.lastValues = (ReportState*)(block + registerBytes);
+    dev.strings = (char*)(block + registerBytes + stateBytes);
+    memcpy(dev.registers, cursor, registerBytes);
+    cursor += registerBytes;
+    memset(dev.lastValues, 0, stateBytes);
+    memcpy(dev.strings, cursor, record.stringBytes);
+    cursor += record.stringBytes;
+    if (!imageDeviceValid(record, dev.registers, dev.strings)) {
+      heap_caps_free(block);
+      Serial.println("Plan image malformed");
+      release();
+      return false;
+    }
+    
+    dev.idHandle = record.idHandle;
+    dev.handle = index.findDevice(dev.id());
+    bool resolved = dev.handle != INVALID_HANDLE && slotByHandle[dev.handle] < 0;
+    for (uint16_t r = 0; r < record.registerCount; r++) {
+      RegisterDescriptor& desc = dev.registers[r];
+      desc.codec = codecFor(desc.dataType);
+      desc.handle = index.findRegister(dev.str(desc.idHandle));
+      resolved = resolved && desc.handle != INVALID_HANDLE;
+    }
+    if (!resolved) {
+      // The image names a device or register the config no longer has
+      heap_caps_free(block);
+      Serial.println("Plan image does not match config index");
+      release();
+      return false;
+    }
+    slotByHandle[dev.handle] = deviceCount;
+    dev.ipHandle = record.ipHandle;
+    dev.registerCount = record.registerCount;
+    dev.stringBytes = record.stringBytes;
+    dev.port = record.port;
+    dev.serialPort = record.serialPort;
+    dev.slaveId = record.slaveId;
+    dev.refreshRateMs = record.refreshRateMs;
+    registerCount += dev.registerCount;
+    deviceCount++;
+  }
+  
+  if (deviceCount != (int)header.deviceCount) {
+    Serial.println("Plan image truncated");
+    release();
+    return false;
+  }
+  
+  generation = configGeneration;
+  Serial.printf("Loaded plan image: %d devices, %d registers\n", deviceCount, registerCount);
+  return true;
+}
+
+void RegisterPlan::fillRecord(const DeviceDescriptor& dev, int regIndex, float value, uint32_t time, DataRecord& record) {
+  const RegisterDescriptor& desc = dev.registers[regIndex];
+  record.time = time;
+  record.value = value;
+  record.address = desc.address;
+  record.deviceHandle = dev.handle;
+  record.registerHandle = desc.handle;
+  strlcpy(record.deviceId, dev.id(), sizeof(record.deviceId));
+  strlcpy(record.registerId, dev.str(desc.idHandle), sizeof(record.registerId));
+  strlcpy(record.dataType, dev.str(desc.typeHandle), sizeof(record.dataType));
+  strlcpy(record.name, dev.str(desc.nameHandle), sizeof(record.name));
+}
\ No newline at end of file
@@ -0,0 +1,126 @@
+#ifndef REGISTER_PLAN_H
+#define REGISTER_PLAN_H
+
+#include <ArduinoJson.h>
+#include "ReportFilter.h"
+#include "DataRecord.h"
+#include "ConfigIndex.h"
+
+// Converts a raw 16-bit Modbus word into an engineering value
+typedef float (*RegisterCodec)(uint16_t rawValue);
+
+enum RegisterDataType : uint8_t {
+  DATA_TYPE_UINT16 = 0,
+  DATA_TYPE_INT16,
+  DATA_TYPE_INT32,
+  DATA_TYPE_FLOAT32,
+  DATA_TYPE_BOOL,
+  DATA_TYPE_COUNT
+};
+
+// Flat, JSON-free description of one register, compiled from the device config.
+// Strings are stored once in the owning device's string table and referenced by handle.
+struct RegisterDescriptor {
+  RegisterCodec codec;
+  float scale;
+  ReportPolicy report;
+  uint16_t address;
+  uint8_t functionCode;
+  uint8_t dataType;
+  uint16_t nameHandle;
+  uint16_t idHandle;
+  uint16_t typeHandle;
+  uint16_t handle;          // ConfigIndex register handle
+};
+
+// Scheduler entry for one device. Each device owns a single block holding its
+// register descriptors, last-value slots and string table, so a config change
+// to one device is recompiled without touching any other device.
+struct DeviceDescriptor {
+  RegisterDescriptor* registers;
+  ReportState* lastValues;
+  char* strings;
+  uint16_t handle;          // ConfigIndex device handle
+  uint16_t idHandle;
+  uint16_t ipHandle;
+  uint16_t registerCount;
+  uint16_t stringBytes;
+  uint16_t port;
+  uint8_t serialPort;
+  uint8_t slaveId;
+  uint32_t refreshRateMs;
+  uint32_t lastRead;
+  
+  const char* str(uint16_t handle) const { return strings + handle; }
+  const char* id() const { return strings + idHandle; }
+};
+
+// Binary plan image: a header followed, per device, by a PlanImageDevice record,
+// its register descriptors and its string table, copied as-is from the plan.
+// Codec pointers and config handles are not trusted on load; they are re-resolved
+// from dataType and from the stored IDs.
+struct PlanImageHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t descriptorSize;  // sizeof(RegisterDescriptor) of the firmware that wrote it
+  uint32_t deviceCount;
+  uint32_t payloadBytes;
+  uint32_t checksum;        // CRC-32 of the payload
+};
+
+struct PlanImageDevice {
+  uint32_t refreshRateMs;
+  uint16_t idHandle;
+  uint16_t ipHandle;
+  uint16_t registerCount;
+  uint16_t stringBytes;
+  uint16_t port;
+  uint8_t serialPort;
+  uint8_t slaveId;
+};
+
+class RegisterPlan {
+private:
+  DeviceDescriptor* devices;
+  int16_t* slotByHandle;    // Device handle -> index in devices, -1 = not in this plan
+  int deviceCount;
+  int deviceCapacity;
+  int slotCapacity;
+  uint32_t generation;
+  
+  void release();
+  bool reserve(int capacity);
+  bool reserveSlots(int handleLimit);
+  int findDevice(uint16_t deviceHandle) const;
+  bool compileDevice(DeviceDescriptor& dev, const ConfigIndex& index, uint16_t deviceHandle);
+  void removeDevice(int index);
+
+public:
+  RegisterPlan();
+  ~RegisterPlan();
+  
+  // Compile every device whose "protocol" matches into descriptor blocks
+  bool build(const ConfigIndex& index, const char* protocol, uint32_t configGeneration);
+  
+  // Recompile, add or drop a single device after a config change notification
+  bool updateDevice(const ConfigIndex& index, uint16_t deviceHandle, const char* protocol);
+  
+  bool isBuilt() const { return generation != 0; }
+  uint32_t getGeneration() const { return generation; }
+  void setGeneration(uint32_t configGeneration) { generation = configGeneration; }
+  int getDeviceCount() const { return deviceCount; }
+  DeviceDescriptor& device(int index) { return devices[index]; }
+  
+  // Flat binary image of the plan, loaded at boot without touching JSON
+  size_t imageSize() const;
+  size_t writeImage(uint8_t* image, size_t capacity) const;
+  bool loadImage(const uint8_t* image, size_t size, const ConfigIndex& index, uint32_t configGeneration);
+  
+  // Fill a queue record for a decoded sample of register `regIndex` of `dev`
+  static void fillRecord(const DeviceDescriptor& dev, int regIndex, float value, uint32_t time, DataRecord& record);
+  
+  static uint8_t parseDataType(const char* dataType);
+  static RegisterCodec codecFor(uint8_t dataType);
+};
+
+#endif
\ No newline at end of file
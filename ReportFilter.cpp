@@ -0,0 +1,58 @@
+#include "ReportFilter.h"
+#include <math.h>
+
+ReportPolicy ReportFilter::parsePolicy(JsonObjectConst reg) {
+  ReportPolicy policy;
+  String mode = reg["deadband_mode"] | "none";
+  
+  if (mode == "any") {
+    policy.mode = REPORT_ON_CHANGE;
+  } else if (mode == "absolute") {
+    policy.mode = REPORT_ABSOLUTE;
+  } else if (mode == "percent") {
+    policy.mode = REPORT_PERCENT;
+  } else {
+    policy.mode = REPORT_ALWAYS;
+  }
+  
+  policy.deadband = fabsf(reg["deadband"] | 0.0f);
+  policy.maxSilenceMs = reg["max_silence_ms"] | 0;
+  return policy;
+}
+
+bool ReportFilter::shouldReport(const ReportPolicy& policy, ReportState& state, float value, uint32_t now) {
+  bool report;
+  
+  if (policy.mode == REPORT_ALWAYS || !state.published) {
+    report = true;
+  } else if (policy.maxSilenceMs > 0 && now - state.lastPublishMs >= policy.maxSilenceMs) {
+    report = true;
+  } else {
+    float delta = fabsf(value - state.lastValue);
+    switch (policy.mode) {
+      case REPORT_ON_CHANGE:
+        report = delta > 0.0f;
+        break;
+      case REPORT_ABSOLUTE:
+        report = delta >= policy.deadband && delta > 0.0f;
+        break;
+      case REPORT_PERCENT:
+        if (state.lastValue == 0.0f) {
+          report = delta > 0.0f;
+        } else {
+          report = delta >= fabsf(state.lastValue) * policy.deadband / 100.0f && delta > 0.0f;
+        }
+        break;
+      default:
+        report = true;
+        break;
+    }
+  }
+  
+  if (report) {
+    state.lastValue = value;
+    state.lastPublishMs = now;
+    state.published = true;
+  }
+  return report;
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef REPORT_FILTER_H
+#define REPORT_FILTER_H
+
+#include <ArduinoJson.h>
+
+// Report-by-exception modes, configured per register via "deadband_mode"
+enum ReportMode : uint8_t {
+  REPORT_ALWAYS = 0,    // "none": every sample is queued
+  REPORT_ON_CHANGE,     // "any": queue when the value differs from the last published one
+  REPORT_ABSOLUTE,      // "absolute": queue when |delta| >= deadband
+  REPORT_PERCENT        // "percent": queue when |delta| >= deadband % of the last published value
+};
+
+struct ReportPolicy {
+  uint8_t mode;
+  float deadband;
+  uint32_t maxSilenceMs;  // Heartbeat: force a publish after this long without one (0 = off)
+};
+
+struct ReportState {
+  float lastValue;
+  uint32_t lastPublishMs;
+  bool published;
+};
+
+class ReportFilter {
+public:
+  static ReportPolicy parsePolicy(JsonObjectConst reg);
+  
+  // Returns true when the sample must be queued; updates the last published value if so
+  static bool shouldReport(const ReportPolicy& policy, ReportState& state, float value, uint32_t now);
+};
+
+#endif
\ No newline at end of file
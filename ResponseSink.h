@@ -0,0 +1,48 @@
+#ifndef RESPONSE_SINK_H
+#define RESPONSE_SINK_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Where command responses go. Command handlers (CRUDHandler) only write to this
+// interface, so BLE, MQTT and the serial console share one implementation;
+// each transport frames, fragments or publishes the serialized output.
+class ResponseSink {
+public:
+  virtual ~ResponseSink() {}
+  
+  // Streamed response: serialized output is printed to the returned stream
+  // until endResponse(). One response is open at a time.
+  virtual Print& beginResponse() = 0;
+  virtual void endResponse() = 0;
+  
+  virtual void sendResponse(const JsonDocument& data) {
+    serializeJson(data, beginResponse());
+    endResponse();
+  }
+  
+  void sendError(const String& message) {
+    DynamicJsonDocument doc(256);
+    doc["status"] = "error";
+    doc["message"] = message;
+    sendResponse(doc);
+  }
+  
+  void sendSuccess() {
+    DynamicJsonDocument doc(128);
+    doc["status"] = "ok";
+    sendResponse(doc);
+  }
+  
+  // Transport features; by default a transport has none of them
+  virtual bool supportsStreaming() const { return false; }  // Live data subscriptions
+  virtual bool getLinkStats(JsonObject&) { return false; }
+  virtual bool setResponseEncoding(const String& encoding, String& error) {
+    if (encoding == "none") return true;
+    error = "Unsupported encoding: " + encoding;
+    return false;
+  }
+  virtual const char* getResponseEncoding() const { return "none"; }
+};
+
+#endif
\ No newline at end of file
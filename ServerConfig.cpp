@@ -1,4 +1,5 @@
 #include "ServerConfig.h"
+#include "PsramJson.h"
 #include <esp_heap_caps.h>
 #include <new>
 
@@ -148,7 +149,7 @@ bool ServerConfig::updateConfig(JsonObjectConst newConfig) {
   }
   
   // Update main config
-  config->set(newConfig);
+  copyJsonObject(config->to<JsonObject>(), newConfig);
   if (saveConfig()) {
     Serial.println("Server configuration updated successfully");
     scheduleDeviceRestart();
@@ -0,0 +1,330 @@
+#include "StreamSubscriptions.h"
+#include <esp_heap_caps.h>
+#include <new>
+
+StreamSubscriptions* StreamSubscriptions::instance = nullptr;
+
+StreamSubscriptions::StreamSubscriptions() : samples(nullptr), spareSamples(nullptr), sampleCount(0), takeCursor(0),
+                                             consumer(nullptr), configManager(nullptr), writeMutex(nullptr),
+                                             subscriptionCount(0) {
+  portMUX_TYPE unlocked = portMUX_INITIALIZER_UNLOCKED;
+  slotLock = unlocked;
+  for (int i = 0; i < MEMBER_WORDS; i++) {
+    members[i].store(0, std::memory_order_relaxed);
+  }
+  memset(&stats, 0, sizeof(stats));
+}
+
+StreamSubscriptions* StreamSubscriptions::getInstance() {
+  if (instance == nullptr) {
+    // The membership bitmap is 8 KB; keep it out of internal RAM when possible
+    void* memory = heap_caps_malloc(sizeof(StreamSubscriptions), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    instance = memory ? new(memory) StreamSubscriptions() : new StreamSubscriptions();
+  }
+  return instance;
+}
+
+bool StreamSubscriptions::init(ConfigManager* config) {
+  configManager = config;
+  writeMutex = xSemaphoreCreateMutex();
+  if (writeMutex == nullptr) {
+    Serial.println("Failed to create stream subscription mutex");
+    return false;
+  }
+  
+  size_t bytes = MAX_STREAM_REGISTERS * sizeof(PendingSample);
+  samples = (PendingSample*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  spareSamples = (PendingSample*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!samples || !spareSamples) {
+    Serial.println("Failed to allocate stream sample slots");
+    return false;
+  }
+  
+  configManager->addObserver(this);
+  return true;
+}
+
+bool StreamSubscriptions::resolve(Subscription& subscription, const ConfigIndex& index) {
+  subscription.deviceHandle = index.findDevice(subscription.deviceId);
+  subscription.registerHandle = INVALID_HANDLE;
+  if (subscription.deviceHandle == INVALID_HANDLE) return false;
+  if (subscription.registerId[0] == '\0') return true;
+  
+  subscription.registerHandle = index.findRegister(subscription.registerId);
+  const IndexedRegister* reg = index.reg(subscription.registerHandle);
+  return reg && reg->device == subscription.deviceHandle;
+}
+
+int StreamSubscriptions::find(const char* deviceId, const char* registerId) const {
+  for (int i = 0; i < subscriptionCount; i++) {
+    if (strcmp(subscriptions[i].deviceId, deviceId) == 0 && strcmp(subscriptions[i].registerId, registerId) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// A register subscription takes precedence over its device's
+const StreamSubscriptions::Subscription* StreamSubscriptions::match(uint16_t deviceHandle, uint16_t registerHandle) const {
+  const Subscription* found = nullptr;
+  for (int i = 0; i < subscriptionCount; i++) {
+    const Subscription& subscription = subscriptions[i];
+    if (subscription.deviceHandle != deviceHandle) continue;
+    if (subscription.registerHandle == registerHandle) return &subscription;
+    if (subscription.registerHandle == INVALID_HANDLE) found = &subscription;
+  }
+  return found;
+}
+
+// Writers only: expand the subscriptions into one slot per register, swap the
+// slot table in and publish the membership bitmap. Pending samples and rate
+// state carry over for registers that stay subscribed. Returns false, changing
+// nothing, if more than MAX_STREAM_REGISTERS registers are covered and
+// `truncate` is not set.
+bool StreamSubscriptions::rebuild(const ConfigIndex* index, bool truncate) {
+  PendingSample* next = spareSamples;
+  int count = 0;
+  uint32_t now = millis();
+  
+  uint16_t limit = index && subscriptionCount > 0 ? index->getRegisterLimit() : 0;
+  for (uint16_t handle = 0; handle < limit; handle++) {
+    const IndexedRegister* reg = index->reg(handle);
+    const Subscription* subscription = reg ? match(reg->device, handle) : nullptr;
+    if (!subscription) continue;
+    if (count == MAX_STREAM_REGISTERS) {
+      if (!truncate) return false;
+      Serial.printf("Stream subscriptions cover more than %d registers, the rest are not streamed\n", MAX_STREAM_REGISTERS);
+      break;
+    }
+    PendingSample& slot = next[count++];
+    slot.registerHandle = handle;
+    slot.minIntervalMs = subscription->minIntervalMs;
+    slot.lastSent = now - subscription->minIntervalMs;  // The first sample is due at once
+    slot.pending = false;
+  }
+  
+  portENTER_CRITICAL(&slotLock);
+  int old = 0;
+  for (int i = 0; i < count; i++) {
+    while (old < sampleCount && samples[old].registerHandle < next[i].registerHandle) old++;
+    if (old < sampleCount && samples[old].registerHandle == next[i].registerHandle && samples[old].pending) {
+      next[i].record = samples[old].record;
+      next[i].lastSent = samples[old].lastSent;
+      next[i].pending = true;
+    }
+  }
+  spareSamples = samples;
+  samples = next;
+  sampleCount = count;
+  takeCursor = 0;
+  portEXIT_CRITICAL(&slotLock);
+  
+  // Slots are sorted by handle, so the bitmap is written word by word
+  int slot = 0;
+  for (int word = 0; word < MEMBER_WORDS; word++) {
+    uint32_t bits = 0;
+    while (slot < count && (next[slot].registerHandle >> 5) == word) {
+      bits |= 1u << (next[slot].registerHandle & 31);
+      slot++;
+    }
+    members[word].store(bits, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+// Caller holds slotLock
+StreamSubscriptions::PendingSample* StreamSubscriptions::slotFor(uint16_t registerHandle) {
+  int low = 0;
+  int high = sampleCount - 1;
+  while (low <= high) {
+    int middle = (low + high) / 2;
+    if (samples[middle].registerHandle == registerHandle) return &samples[middle];
+    if (samples[middle].registerHandle < registerHandle) {
+      low = middle + 1;
+    } else {
+      high = middle - 1;
+    }
+  }
+  return nullptr;
+}
+
+bool StreamSubscriptions::apply(JsonArrayConst list, const char* mode, String& error) {
+  bool replace = strcmp(mode, "replace") == 0;
+  bool remove = strcmp(mode, "remove") == 0;
+  if (!replace && !remove && strcmp(mode, "add") != 0) {
+    error = String("Unknown mode: ") + mode;
+    return false;
+  }
+  if (list.size() > MAX_SUBSCRIPTIONS) {
+    error = "Too many subscriptions (max " + String(MAX_SUBSCRIPTIONS) + ")";
+    return false;
+  }
+  
+  ConfigManager::SnapshotGuard snapshot = configManager->pinDevices();
+  Subscription parsed[MAX_SUBSCRIPTIONS];
+  int parsedCount = 0;
+  for (JsonVariantConst entryVar : list) {
+    JsonObjectConst entry = entryVar.as<JsonObjectConst>();
+    Subscription& subscription = parsed[parsedCount++];
+    const char* deviceId = entry["device_id"] | "";
+    const char* registerId = entry["register_id"] | "";
+    if (deviceId[0] == '\0') {
+      error = "Subscription without device_id";
+      return false;
+    }
+    strlcpy(subscription.deviceId, deviceId, sizeof(subscription.deviceId));
+    strlcpy(subscription.registerId, registerId, sizeof(subscription.registerId));
+    subscription.minIntervalMs = entry["min_interval_ms"] | 0;
+    
+    if (!remove && (!snapshot || !resolve(subscription, snapshot->index))) {
+      error = String("Unknown ") + (registerId[0] ? "register " : "device ") + (registerId[0] ? registerId : deviceId);
+      return false;
+    }
+  }
+  
+  xSemaphoreTake(writeMutex, portMAX_DELAY);
+  int added = 0;
+  for (int i = 0; i < parsedCount && !remove; i++) {
+    if (replace || find(parsed[i].deviceId, parsed[i].registerId) < 0) added++;
+  }
+  if ((replace ? 0 : subscriptionCount) + added > MAX_SUBSCRIPTIONS) {
+    xSemaphoreGive(writeMutex);
+    error = "Too many subscriptions (max " + String(MAX_SUBSCRIPTIONS) + ")";
+    return false;
+  }
+  
+  Subscription previous[MAX_SUBSCRIPTIONS];
+  int previousCount = subscriptionCount;
+  memcpy(previous, subscriptions, sizeof(Subscription) * subscriptionCount);
+  
+  if (replace) {
+    subscriptionCount = 0;
+  }
+  for (int i = 0; i < parsedCount; i++) {
+    int index = find(parsed[i].deviceId, parsed[i].registerId);
+    if (remove) {
+      if (index >= 0) {
+        subscriptions[index] = subscriptions[--subscriptionCount];
+      }
+    } else if (index >= 0) {
+      subscriptions[index] = parsed[i];
+    } else {
+      subscriptions[subscriptionCount++] = parsed[i];
+    }
+  }
+  
+  if (!rebuild(snapshot ? &snapshot->index : nullptr, false)) {
+    memcpy(subscriptions, previous, sizeof(Subscription) * previousCount);
+    subscriptionCount = previousCount;
+    xSemaphoreGive(writeMutex);
+    error = "Subscriptions cover more than " + String(MAX_STREAM_REGISTERS) + " registers";
+    return false;
+  }
+  xSemaphoreGive(writeMutex);
+  
+  Serial.printf("Streaming %d subscriptions\n", parsedCount);
+  return true;
+}
+
+void StreamSubscriptions::clear() {
+  if (!writeMutex) return;
+  xSemaphoreTake(writeMutex, portMAX_DELAY);
+  subscriptionCount = 0;
+  rebuild(nullptr, true);
+  memset(&stats, 0, sizeof(stats));
+  xSemaphoreGive(writeMutex);
+}
+
+void StreamSubscriptions::getSubscriptions(JsonArray& result) {
+  xSemaphoreTake(writeMutex, portMAX_DELAY);
+  for (int i = 0; i < subscriptionCount; i++) {
+    JsonObject entry = result.createNestedObject();
+    entry["device_id"] = String(subscriptions[i].deviceId);
+    if (subscriptions[i].registerId[0]) {
+      entry["register_id"] = String(subscriptions[i].registerId);
+    }
+    entry["min_interval_ms"] = subscriptions[i].minIntervalMs;
+  }
+  xSemaphoreGive(writeMutex);
+}
+
+void StreamSubscriptions::getStats(JsonObject& result) {
+  result["offered"] = stats.offered;
+  result["streamed"] = stats.streamed;
+  result["coalesced"] = stats.coalesced;
+  result["registers"] = sampleCount;
+}
+
+void StreamSubscriptions::offer(const DataRecord& record) {
+  bool wake = false;
+  portENTER_CRITICAL(&slotLock);
+  PendingSample* slot = slotFor(record.registerHandle);
+  if (slot) {
+    stats.offered++;
+    if (slot->pending) {
+      stats.coalesced++;
+    }
+    wake = !slot->pending;
+    slot->record = record;
+    slot->pending = true;
+  }
+  portEXIT_CRITICAL(&slotLock);
+  
+  if (wake && consumer) {
+    xTaskNotifyGive(consumer);
+  }
+}
+
+int StreamSubscriptions::take(DataRecord* out, int max, uint32_t now, uint32_t& nextDueMs) {
+  nextDueMs = NOTHING_PENDING;
+  int count = 0;
+  
+  portENTER_CRITICAL(&slotLock);
+  for (int n = 0; n < sampleCount; n++) {
+    int i = (takeCursor + n) % sampleCount;
+    PendingSample& slot = samples[i];
+    if (!slot.pending) continue;
+    
+    uint32_t elapsed = now - slot.lastSent;
+    if (elapsed < slot.minIntervalMs) {
+      if (slot.minIntervalMs - elapsed < nextDueMs) {
+        nextDueMs = slot.minIntervalMs - elapsed;
+      }
+      continue;
+    }
+    if (count == max) {
+      nextDueMs = 0;  // More are due right away
+      takeCursor = i;
+      break;
+    }
+    out[count++] = slot.record;
+    slot.pending = false;
+    slot.lastSent = now;
+  }
+  stats.streamed += count;
+  portEXIT_CRITICAL(&slotLock);
+  return count;
+}
+
+void StreamSubscriptions::onConfigChanged(uint16_t deviceHandle, ConfigChange change, uint32_t generation) {
+  ConfigManager::SnapshotGuard snapshot = configManager->pinDevices();
+  xSemaphoreTake(writeMutex, portMAX_DELAY);
+  if (subscriptionCount == 0) {
+    xSemaphoreGive(writeMutex);
+    return;
+  }
+  
+  int kept = 0;
+  for (int i = 0; i < subscriptionCount; i++) {
+    Subscription& subscription = subscriptions[i];
+    if (snapshot && resolve(subscription, snapshot->index)) {
+      subscriptions[kept++] = subscription;
+    } else {
+      Serial.printf("Stream subscription %s %s dropped, no longer configured\n",
+                    subscription.deviceId, subscription.registerId);
+    }
+  }
+  subscriptionCount = kept;
+  rebuild(snapshot ? &snapshot->index : nullptr, true);
+  xSemaphoreGive(writeMutex);
+}
\ No newline at end of file
@@ -0,0 +1,109 @@
+#ifndef STREAM_SUBSCRIPTIONS_H
+#define STREAM_SUBSCRIPTIONS_H
+
+#include <ArduinoJson.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include "DataRecord.h"
+#include "ConfigManager.h"
+
+// Live BLE streaming: the set of subscribed devices and registers, and the
+// samples waiting to be sent.
+//
+// A subscription covers one device (all of its registers) or one register, with
+// a minimum interval between streamed samples of each register. Subscribed
+// samples land in a per-register slot that newer samples overwrite until it is
+// sent, so a link that cannot keep up gets the latest value of every register
+// instead of a growing backlog. The streaming task is woken when a slot fills.
+//
+// Pollers test membership in an atomic bitmap indexed by register handle, a
+// single load per sample. Subscription changes resolve handles and build the
+// next slot table without holding anything pollers use, then swap it in with
+// a brief spinlock.
+class StreamSubscriptions : public ConfigObserver {
+public:
+  static const int MAX_SUBSCRIPTIONS = 32;
+  static const int MAX_STREAM_REGISTERS = 256;  // Registers all subscriptions may cover
+  static const uint32_t NOTHING_PENDING = 0xFFFFFFFF;
+  
+  struct Subscription {
+    char deviceId[12];
+    char registerId[12];     // Empty = every register of the device
+    uint32_t minIntervalMs;  // 0 = every sample
+    uint16_t deviceHandle;
+    uint16_t registerHandle;
+  };
+
+private:
+  static const int MEMBER_WORDS = 65536 / 32;  // One bit per possible register handle
+  
+  struct PendingSample {
+    DataRecord record;
+    uint32_t lastSent;
+    uint32_t minIntervalMs;
+    uint16_t registerHandle;
+    bool pending;
+  };
+  
+  struct Stats {
+    uint32_t offered;
+    uint32_t streamed;
+    uint32_t coalesced;  // Samples overwritten before they were sent
+  };
+  
+  static StreamSubscriptions* instance;
+  std::atomic<uint32_t> members[MEMBER_WORDS];
+  
+  // Slot table, sorted by register handle. Pollers and the streaming task use
+  // it under `slotLock`; writers fill the spare table and swap.
+  portMUX_TYPE slotLock;
+  PendingSample* samples;
+  PendingSample* spareSamples;
+  int sampleCount;
+  int takeCursor;          // Round-robin start so every register gets its turn
+  Stats stats;
+  TaskHandle_t consumer;   // Streaming task, woken by offer()
+  
+  // Writers only (subscribe/unsubscribe and config changes), under writeMutex
+  ConfigManager* configManager;
+  SemaphoreHandle_t writeMutex;
+  Subscription subscriptions[MAX_SUBSCRIPTIONS];
+  int subscriptionCount;
+  
+  StreamSubscriptions();
+  static bool resolve(Subscription& subscription, const ConfigIndex& index);
+  int find(const char* deviceId, const char* registerId) const;
+  const Subscription* match(uint16_t deviceHandle, uint16_t registerHandle) const;
+  bool rebuild(const ConfigIndex* index, bool truncate);
+  PendingSample* slotFor(uint16_t registerHandle);
+
+public:
+  static StreamSubscriptions* getInstance();
+  
+  bool init(ConfigManager* config);
+  
+  // Apply a "subscriptions" list: mode "replace", "add" or "remove". The list is
+  // validated against the current config before anything changes.
+  bool apply(JsonArrayConst list, const char* mode, String& error);
+  void clear();
+  void getSubscriptions(JsonArray& result);
+  void getStats(JsonObject& result);
+  
+  // Pollers: whether a sample is wanted (lock-free), then hand it over
+  bool isStreamed(uint16_t registerHandle) const {
+    return members[registerHandle >> 5].load(std::memory_order_relaxed) & (1u << (registerHandle & 31));
+  }
+  void offer(const DataRecord& record);
+  
+  // Streaming task. take() copies out up to `max` samples that are due and sets
+  // `nextDueMs` to how long until the next one is (NOTHING_PENDING if none).
+  void setConsumer(TaskHandle_t task) { consumer = task; }
+  int take(DataRecord* out, int max, uint32_t now, uint32_t& nextDueMs);
+  
+  // Subscriptions follow their IDs: handles are re-resolved and vanished ones dropped
+  void onConfigChanged(uint16_t deviceHandle, ConfigChange change, uint32_t generation) override;
+};
+
+#endif
\ No newline at end of file
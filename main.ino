@@ -16,6 +16,7 @@
 #include "ModbusTcpService.h"
 #include "ModbusRtuService.h"
 #include "QueueManager.h"
+#include "StreamSubscriptions.h"
 #include "MqttManager.h"
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -36,6 +37,7 @@ RTCManager* rtcManager = nullptr;
 ModbusTcpService* modbusTcpService = nullptr;
 ModbusRtuService* modbusRtuService = nullptr;
 QueueManager* queueManager = nullptr;
+StreamSubscriptions* streamSubscriptions = nullptr;
 MqttManager* mqttManager = nullptr;
 
 // Cleanup function for failed initialization
@@ -92,6 +94,14 @@ void setup() {
     return;
   }
   
+  // Initialize live stream subscriptions
+  streamSubscriptions = StreamSubscriptions::getInstance();
+  if (!streamSubscriptions || !streamSubscriptions->init(configManager)) {
+    Serial.println("Failed to initialize StreamSubscriptions");
+    cleanup();
+    return;
+  }
+  
   // Initialize server config
   serverConfig = new ServerConfig();
   if (!serverConfig || !serverConfig->begin()) {
@@ -174,6 +184,10 @@ void setup() {
     }
   }
   
+  if (mqttManager) {
+    mqttManager->setCommandHandler(crudHandler);
+  }
+  
   // Initialize BLE manager in PSRAM
   bleManager = (BLEManager*)heap_caps_malloc(sizeof(BLEManager), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
   if (bleManager) {
@@ -0,0 +1,19 @@
+#ifndef BENCHMARK_SINKS_H
+#define BENCHMARK_SINKS_H
+
+// Byte sinks for the encoder callbacks the benchmarks drive: append() collects
+// the output into a std::string, discard() only counts it into a size_t.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+static inline void append(void* context, const uint8_t* data, size_t size) {
+  static_cast<std::string*>(context)->append((const char*)data, size);
+}
+
+static inline void discard(void* context, const uint8_t*, size_t size) {
+  *static_cast<size_t*>(context) += size;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,140 @@
+/*
+ * BLE response compression benchmark (LzssCodec.h/.cpp)
+ * Reports compressed size, ratio, encode/decode time and notifications per
+ * response at common MTUs for representative configuration payloads. Pass
+ * recorded responses (one JSON document per file) to benchmark those instead.
+ *
+ * Build and run on Linux:
+ *   g++ -std=c++17 -O2 -I.. ble_compression_benchmark.cpp ../LzssCodec.cpp -o ble_compression_benchmark
+ *   ./ble_compression_benchmark [response.json ...]
+ */
+
+#include "LzssCodec.h"
+#include "BLEFraming.h"
+#include "benchmark_sinks.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+static std::string deviceJson(int index, int registers) {
+  char text[512];
+  snprintf(text, sizeof(text),
+           "{\"device_name\":\"BENCH_%03d\",\"protocol\":\"RTU\",\"serial_port\":1,\"baud_rate\":9600,"
+           "\"slave_id\":%d,\"refresh_rate_ms\":5000,\"device_id\":\"D%06X\",\"registers\":[",
+           index, index % 247 + 1, (unsigned)(index * 2654435761u) & 0xFFFFFF);
+  std::string json = text;
+  for (int r = 0; r < registers; r++) {
+    snprintf(text, sizeof(text),
+             "%s{\"register_name\":\"REG_%03d\",\"address\":%d,\"function_code\":3,\"data_type\":\"uint16\","
+             "\"description\":\"Scaling benchmark register\",\"register_id\":\"R%06X\"}",
+             r ? "," : "", r, 40001 + r, (unsigned)((index * 100 + r) * 2246822519u) & 0xFFFFFF);
+    json += text;
+  }
+  return json + "]}";
+}
+
+static std::vector<std::pair<std::string, std::string>> builtinPayloads() {
+  std::vector<std::pair<std::string, std::string>> payloads;
+  
+  std::string summary = "{\"status\":\"ok\",\"devices_summary\":[";
+  for (int d = 0; d < 200; d++) {
+    char text[256];
+    snprintf(text, sizeof(text), "%s{\"device_id\":\"D%06X\",\"device_name\":\"BENCH_%03d\",\"protocol\":\"RTU\",\"register_count\":50}",
+             d ? "," : "", (unsigned)(d * 2654435761u) & 0xFFFFFF, d);
+    summary += text;
+  }
+  payloads.push_back({"devices_summary x200", summary + "]}"});
+  
+  std::string device = deviceJson(7, 50);
+  size_t registersAt = device.find("\"registers\":");
+  payloads.push_back({"registers x50", "{\"status\":\"ok\",\"offset\":0," + device.substr(registersAt, device.size() - registersAt - 1) + ",\"total\":50}"});
+  
+  payloads.push_back({"server_config",
+    "{\"status\":\"ok\",\"server_config\":{\"communication\":{\"mode\":\"WIFI\",\"connection_mode\":\"Manual\","
+    "\"ip_address\":\"192.168.10.100\",\"mac_address\":\"00:1A:2B:3C:4D:5E\",\"wifi\":{\"ssid\":\"PlantFloor\","
+    "\"password\":\"********\"}},\"protocol\":\"mqtt\",\"data_interval\":{\"value\":1000,\"unit\":\"ms\"},"
+    "\"mqtt_config\":{\"enabled\":true,\"broker_address\":\"broker.example.com\",\"broker_port\":1883,"
+    "\"client_id\":\"gateway-0001\",\"username\":\"gateway\",\"password\":\"********\",\"topic_publish\":"
+    "\"plant/line1/gateway-0001/data\",\"topic_subscribe\":\"plant/line1/gateway-0001/cmd\",\"keep_alive\":60,"
+    "\"clean_session\":true,\"use_ssl\":false},\"http_config\":{\"enabled\":false,\"endpoint_url\":"
+    "\"https://api.example.com/ingest\",\"method\":\"POST\",\"body_format\":\"json\",\"timeout\":5000,"
+    "\"retry\":3,\"headers\":{\"Authorization\":\"Bearer ********\",\"Content-Type\":\"application/json\"}}}}"});
+    
+  std::string exported = "{\"status\":\"ok\",\"devices\":[";
+  for (int d = 0; d < 20; d++) {
+    exported += (d ? "," : "") + deviceJson(d, 50);
+  }
+  payloads.push_back({"export 20x50", exported + "],\"total\":20}"});
+  return payloads;
+}
+
+// Notifications needed for `bytes` of payload in v2 frames at `mtu`
+static size_t notifications(size_t bytes, size_t mtu) {
+  size_t chunk = mtu - 3;
+  size_t first = chunk - frameHeaderSize(FRAME_FIRST);
+  if (bytes <= first) return 1;
+  size_t rest = chunk - frameHeaderSize(0);
+  return 1 + (bytes - first + rest - 1) / rest;
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::pair<std::string, std::string>> payloads;
+  for (int i = 1; i < argc; i++) {
+    std::ifstream file(argv[i], std::ios::binary);
+    std::stringstream text;
+    text << file.rdbuf();
+    payloads.push_back({argv[i], text.str()});
+  }
+  if (payloads.empty()) {
+    payloads = builtinPayloads();
+  }
+  
+  std::unique_ptr<LzssEncoder> encoder(new LzssEncoder());
+  std::unique_ptr<LzssDecoder> decoder(new LzssDecoder());
+  const int rounds = 50;
+  
+  printf("%-24s %9s %9s %6s %11s %11s %13s %13s\n", "payload", "raw B", "lzss B", "ratio",
+         "enc MB/s", "dec MB/s", "notif@247", "notif@512");
+  for (const auto& payload : payloads) {
+    const std::string& raw = payload.second;
+    std::string compressed;
+    
+    // Encoded in 509-byte writes, like BLEResponseStream receives serializer output
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+      compressed.clear();
+      encoder->begin(append, &compressed);
+      for (size_t offset = 0; offset < raw.size(); offset += 509) {
+        encoder->write((const uint8_t*)raw.data() + offset, std::min<size_t>(509, raw.size() - offset));
+      }
+      encoder->finish();
+    }
+    double encodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / rounds;
+    
+    size_t restored = 0;
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+      restored = 0;
+      decoder->begin(discard, &restored);
+      decoder->write((const uint8_t*)compressed.data(), compressed.size());
+    }
+    double decodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / rounds;
+    if (restored != raw.size()) {
+      printf("%s: round trip failed\n", payload.first.c_str());
+      return 1;
+    }
+    
+    char at247[48], at512[48];
+    snprintf(at247, sizeof(at247), "%zu -> %zu", notifications(raw.size(), 247), notifications(compressed.size(), 247));
+    snprintf(at512, sizeof(at512), "%zu -> %zu", notifications(raw.size(), 512), notifications(compressed.size(), 512));
+    printf("%-24s %9zu %9zu %5.1fx %11.1f %11.1f %13s %13s\n", payload.first.c_str(), raw.size(), compressed.size(),
+           (double)raw.size() / (compressed.size() ? compressed.size() : 1),
+           raw.size() / encodeSeconds / 1e6, raw.size() / decodeSeconds / 1e6, at247, at512);
+  }
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,262 @@
+/*
+ * Host-side unit test for the v2 BLE framing codec (BLEFraming.h/.cpp)
+ * Covers header round trips, fragmented and interleaved messages, v1 text
+ * messages sharing the arena, and the loss/reorder/oversize cases the gateway
+ * must reject.
+ *
+ * Build and run on Linux:
+ *   g++ -std=c++17 -Wall -g -fsanitize=address,undefined -I.. ble_framing_test.cpp ../BLEFraming.cpp -o ble_framing_test
+ *   ./ble_framing_test
+ */
+
+#include "BLEFraming.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("  FAILED line %d: %s\n", __LINE__, #condition); \
+      failures++; \
+    } \
+  } while (0)
+
+typedef std::vector<uint8_t> Frame;
+
+static Frame makeFrame(uint16_t messageId, uint16_t sequence, uint8_t flags, const std::string& payload, uint32_t totalLength = 0) {
+  FrameHeader header = {FRAME_VERSION, flags, messageId, sequence, (uint16_t)payload.size(), totalLength};
+  Frame frame(frameHeaderSize(flags) + payload.size());
+  size_t headerSize = encodeFrameHeader(frame.data(), frame.size(), header);
+  memcpy(frame.data() + headerSize, payload.data(), payload.size());
+  return frame;
+}
+
+// Split `text` into frames of at most `chunk` payload bytes, as a client would
+static std::vector<Frame> fragment(uint16_t messageId, const std::string& text, size_t chunk, bool declareLength = true) {
+  std::vector<Frame> frames;
+  uint16_t sequence = 0;
+  size_t offset = 0;
+  do {
+    size_t count = text.size() - offset < chunk ? text.size() - offset : chunk;
+    uint8_t flags = (offset == 0 ? FRAME_FIRST : 0) | (offset + count == text.size() ? FRAME_LAST : 0);
+    frames.push_back(makeFrame(messageId, sequence++, flags, text.substr(offset, count),
+                               declareLength ? text.size() : 0));
+    offset += count;
+  } while (offset < text.size());
+  return frames;
+}
+
+struct Fixture {
+  uint8_t arena[4 * 256];
+  FrameAssembler assembler;
+  FrameAssembler::Message message;
+  const char* error;
+  
+  Fixture(int slots = 4) : error(nullptr) {
+    assembler.begin(arena, sizeof(arena), slots);
+  }
+  
+  FrameAssembler::Result push(const Frame& frame) {
+    error = nullptr;
+    return assembler.push(frame.data(), frame.size(), message, error);
+  }
+  
+  FrameAssembler::Result pushText(const std::string& text) {
+    error = nullptr;
+    return assembler.pushText((const uint8_t*)text.data(), text.size(), message, error);
+  }
+};
+
+static void testHeaderRoundTrip() {
+  printf("header round trip\n");
+  uint8_t buffer[16];
+  FrameHeader in = {FRAME_VERSION, FRAME_FIRST | FRAME_LAST, 0xBEEF, 0x1234, 3, 0x01020304};
+  size_t size = encodeFrameHeader(buffer, sizeof(buffer), in);
+  CHECK(size == FRAME_HEADER_SIZE + FRAME_LENGTH_SIZE);
+  CHECK(buffer[2] == 0xEF && buffer[3] == 0xBE);  // Little-endian on the wire
+  memcpy(buffer + size, "abc", 3);
+  
+  FrameHeader out;
+  CHECK(decodeFrameHeader(buffer, size + 3, out) == size);
+  CHECK(out.flags == in.flags && out.messageId == in.messageId && out.sequence == in.sequence);
+  CHECK(out.length == 3 && out.totalLength == in.totalLength);
+  
+  CHECK(decodeFrameHeader(buffer, size + 2, out) == 0);  // Payload shorter than declared
+  CHECK(encodeFrameHeader(buffer, 8, in) == 0);          // No room for totalLength
+  
+  FrameHeader middle = {FRAME_VERSION, 0, 1, 2, 0, 0};
+  CHECK(encodeFrameHeader(buffer, sizeof(buffer), middle) == FRAME_HEADER_SIZE);
+}
+
+static void testVersionDetection() {
+  printf("v1/v2 detection\n");
+  const char* json = "{\"op\":\"read\"}";
+  const char* end = "<END>";
+  CHECK(!isFramed((const uint8_t*)json, strlen(json)));
+  CHECK(!isFramed((const uint8_t*)end, strlen(end)));
+  Frame frame = makeFrame(1, 0, FRAME_FIRST | FRAME_LAST, "{}", 2);
+  CHECK(isFramed(frame.data(), frame.size()));
+}
+
+static void testSingleAndFragmented() {
+  printf("single and fragmented messages\n");
+  Fixture f;
+  CHECK(f.push(makeFrame(7, 0, FRAME_FIRST | FRAME_LAST, "{\"op\":\"read\"}", 13)) == FrameAssembler::FRAME_COMPLETE);
+  CHECK(f.message.messageId == 7 && f.message.length == 13);
+  CHECK(strcmp((const char*)f.message.data, "{\"op\":\"read\"}") == 0);  // NUL-terminated
+  f.assembler.release(f.message);
+  CHECK(f.assembler.getPendingCount() == 0);
+  
+  // Payload that contains the old end marker is just data in v2
+  std::string text = "{\"op\":\"create\",\"config\":{\"device_name\":\"<END>\",\"protocol\":\"RTU\"}}";
+  for (bool declared : {true, false}) {
+    std::vector<Frame> frames = fragment(9, text, 10, declared);
+    for (size_t i = 0; i + 1 < frames.size(); i++) {
+      CHECK(f.push(frames[i]) == FrameAssembler::FRAME_PENDING);
+    }
+    CHECK(f.push(frames.back()) == FrameAssembler::FRAME_COMPLETE);
+    CHECK(std::string((const char*)f.message.data, f.message.length) == text);
+    f.assembler.release(f.message);
+  }
+}
+
+static void testInterleaved() {
+  printf("interleaved outstanding messages\n");
+  Fixture f;
+  std::string a = "{\"op\":\"read\",\"type\":\"devices\"}";
+  std::string b = "{\"op\":\"read\",\"type\":\"memory_report\"}";
+  std::vector<Frame> framesA = fragment(1, a, 6);
+  std::vector<Frame> framesB = fragment(2, b, 6);
+  
+  std::string completed[2];
+  size_t ia = 0, ib = 0;
+  while (ia < framesA.size() || ib < framesB.size()) {
+    for (int turn = 0; turn < 2; turn++) {
+      std::vector<Frame>& frames = turn == 0 ? framesA : framesB;
+      size_t& i = turn == 0 ? ia : ib;
+      if (i >= frames.size()) continue;
+      if (f.push(frames[i++]) == FrameAssembler::FRAME_COMPLETE) {
+        completed[f.message.messageId - 1] = std::string((const char*)f.message.data, f.message.length);
+        f.assembler.release(f.message);
+      }
+    }
+  }
+  CHECK(completed[0] == a);
+  CHECK(completed[1] == b);
+}
+
+static void testText() {
+  printf("v1 text messages in the arena\n");
+  Fixture f;
+  std::string text = "{\"op\":\"read\",\"type\":\"devices_summary\"}";
+  for (size_t i = 0; i < text.size(); i += 18) {
+    CHECK(f.pushText(text.substr(i, 18)) == FrameAssembler::FRAME_PENDING);
+  }
+  
+  // A v2 message in between does not disturb the text being assembled
+  CHECK(f.push(makeFrame(0, 0, FRAME_FIRST | FRAME_LAST, "{}", 2)) == FrameAssembler::FRAME_COMPLETE);
+  FrameAssembler::Message framed = f.message;
+  
+  CHECK(f.pushText("<END>") == FrameAssembler::FRAME_COMPLETE);
+  CHECK(f.message.length == text.size());
+  CHECK(strcmp((const char*)f.message.data, text.c_str()) == 0);  // Parsed in place
+  CHECK(f.message.slot != framed.slot);
+  CHECK(f.assembler.getPendingCount() == 2);
+  f.assembler.release(f.message);
+  f.assembler.release(framed);
+  CHECK(f.assembler.getPendingCount() == 0);
+  
+  // Oversize text is discarded up to its "<END>" and reported once
+  for (int i = 0; i < 30; i++) {
+    CHECK(f.pushText(std::string(18, 'z')) == FrameAssembler::FRAME_PENDING);
+  }
+  CHECK(f.pushText("<END>") == FrameAssembler::FRAME_ERROR);
+  CHECK(strcmp(f.error, "Message too large") == 0);
+  CHECK(f.assembler.getPendingCount() == 0);
+  CHECK(f.pushText("{}") == FrameAssembler::FRAME_PENDING);
+  CHECK(f.pushText("<END>") == FrameAssembler::FRAME_COMPLETE);
+  CHECK(f.message.length == 2);
+  f.assembler.release(f.message);
+  
+  // Disconnect drops a partial text message
+  CHECK(f.pushText("{\"op\"") == FrameAssembler::FRAME_PENDING);
+  f.assembler.reset();
+  CHECK(f.assembler.getPendingCount() == 0);
+}
+
+static void testRejections() {
+  printf("loss, reorder and limits\n");
+  std::string text(40, 'x');
+  
+  {
+    Fixture f;  // Lost middle frame
+    std::vector<Frame> frames = fragment(3, text, 10);
+    CHECK(f.push(frames[0]) == FrameAssembler::FRAME_PENDING);
+    CHECK(f.push(frames[2]) == FrameAssembler::FRAME_ERROR);
+    CHECK(f.message.messageId == 3 && strcmp(f.error, "Sequence gap") == 0);
+    CHECK(f.push(frames[3]) == FrameAssembler::FRAME_ERROR);  // Message was abandoned
+    CHECK(f.assembler.getPendingCount() == 0);
+  }
+  {
+    Fixture f;  // Lost first frame
+    std::vector<Frame> frames = fragment(4, text, 10);
+    CHECK(f.push(frames[1]) == FrameAssembler::FRAME_ERROR);
+    CHECK(strcmp(f.error, "Frame for unknown message") == 0);
+  }
+  {
+    Fixture f;  // Declared length disagrees with what arrived
+    std::vector<Frame> frames = fragment(5, text, 10);
+    frames[0] = makeFrame(5, 0, FRAME_FIRST, text.substr(0, 10), 41);
+    for (size_t i = 0; i + 1 < frames.size(); i++) f.push(frames[i]);
+    CHECK(f.push(frames.back()) == FrameAssembler::FRAME_ERROR);
+    CHECK(strcmp(f.error, "Message length mismatch") == 0);
+  }
+  {
+    Fixture f;  // Larger than a slot, declared and undeclared
+    CHECK(f.push(makeFrame(6, 0, FRAME_FIRST, "", 10000)) == FrameAssembler::FRAME_ERROR);
+    CHECK(strcmp(f.error, "Message too large") == 0);
+    std::vector<Frame> frames = fragment(6, std::string(300, 'y'), 100, false);
+    FrameAssembler::Result result = FrameAssembler::FRAME_PENDING;
+    for (const Frame& frame : frames) result = f.push(frame);
+    CHECK(result == FrameAssembler::FRAME_ERROR);
+    CHECK(f.assembler.getPendingCount() == 0);
+  }
+  {
+    Fixture f(2);  // Slot exhaustion; a completed but unreleased message holds its slot
+    CHECK(f.push(makeFrame(1, 0, FRAME_FIRST | FRAME_LAST, "{}", 2)) == FrameAssembler::FRAME_COMPLETE);
+    FrameAssembler::Message held = f.message;
+    CHECK(f.push(makeFrame(2, 0, FRAME_FIRST, "{", 2)) == FrameAssembler::FRAME_PENDING);
+    CHECK(f.push(makeFrame(3, 0, FRAME_FIRST, "{", 2)) == FrameAssembler::FRAME_ERROR);
+    CHECK(strcmp(f.error, "Too many outstanding messages") == 0);
+    
+    f.assembler.reset();  // Disconnect drops partial messages only
+    CHECK(f.assembler.getPendingCount() == 1);
+    CHECK(strcmp((const char*)held.data, "{}") == 0);
+    f.assembler.release(held);
+    CHECK(f.assembler.getPendingCount() == 0);
+  }
+  {
+    Fixture f;  // Malformed
+    uint8_t junk[] = {FRAME_VERSION, FRAME_FIRST, 1, 0};
+    FrameAssembler::Message message;
+    const char* error = nullptr;
+    CHECK(f.assembler.push(junk, sizeof(junk), message, error) == FrameAssembler::FRAME_ERROR);
+    CHECK(strcmp(error, "Malformed frame") == 0);
+  }
+}
+
+int main() {
+  testHeaderRoundTrip();
+  testVersionDetection();
+  testSingleAndFragmented();
+  testInterleaved();
+  testText();
+  testRejections();
+  
+  printf("%s\n", failures == 0 ? "PASS" : "FAIL");
+  return failures == 0 ? 0 : 1;
+}
\ No newline at end of file
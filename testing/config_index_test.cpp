@@ -0,0 +1,237 @@
+/*
+ * Host-side unit test for the config lookup index (ConfigIndex.h/.cpp)
+ * Builds indexes over device configs and checks lookups of every device and
+ * register, unknown and deleted IDs, duplicate register IDs, handles kept
+ * across rebuilds, and that a deleted ID's handle is only handed out again
+ * once the allocation cursor has wrapped around.
+ *
+ * Build and run on Linux (ArduinoJson 6 is header-only):
+ *   g++ -std=c++17 -Wall -g -fsanitize=address,undefined -I.. -I<ArduinoJson>/src config_index_test.cpp ../ConfigIndex.cpp -o config_index_test
+ *   ./config_index_test
+ */
+
+#include "ConfigIndex.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("  FAILED line %d: %s\n", __LINE__, #condition); \
+      failures++; \
+    } \
+  } while (0)
+
+// Config and its index, like a ConfigSnapshot: the index points into the
+// document, so both live and die together
+struct Snapshot {
+  DynamicJsonDocument devices;
+  ConfigIndex index;
+  Snapshot() : devices(256 * 1024) {}
+};
+
+// `registers[d]` register IDs for device "D<d>"; an empty ID list still makes a device
+static std::unique_ptr<Snapshot> build(const std::vector<std::string>& deviceIds,
+                                       const std::vector<std::vector<std::string>>& registers,
+                                       const Snapshot* previous) {
+  std::unique_ptr<Snapshot> snapshot(new Snapshot());
+  JsonObject root = snapshot->devices.to<JsonObject>();
+  for (size_t d = 0; d < deviceIds.size(); d++) {
+    JsonObject device = root.createNestedObject(deviceIds[d]);
+    device["device_id"] = deviceIds[d];
+    JsonArray list = device.createNestedArray("registers");
+    for (const std::string& id : registers[d]) {
+      JsonObject reg = list.createNestedObject();
+      reg["register_id"] = id;
+      reg["address"] = 40001;
+    }
+  }
+  bool built = snapshot->index.build(snapshot->devices.as<JsonObjectConst>(), previous ? &previous->index : nullptr);
+  CHECK(built);
+  return snapshot;
+}
+
+static void testLookup() {
+  printf("Lookup\n");
+  std::vector<std::string> devices = { "D1", "D2", "D3" };
+  std::vector<std::vector<std::string>> registers = { { "R1", "R2" }, {}, { "R3", "R4", "R5" } };
+  std::unique_ptr<Snapshot> snapshot = build(devices, registers, nullptr);
+  const ConfigIndex& index = snapshot->index;
+  
+  CHECK(index.getDeviceCount() == 3);
+  CHECK(index.getRegisterCount() == 5);
+  for (size_t d = 0; d < devices.size(); d++) {
+    uint16_t handle = index.findDevice(devices[d].c_str());
+    CHECK(handle < index.getDeviceLimit());
+    const IndexedDevice* device = index.device(handle);
+    CHECK(device && devices[d] == device->id);
+    CHECK(device && device->config["device_id"] == devices[d].c_str());
+    
+    for (size_t r = 0; r < registers[d].size(); r++) {
+      uint16_t regHandle = index.findRegister(registers[d][r].c_str());
+      const IndexedRegister* reg = index.reg(regHandle);
+      CHECK(reg && registers[d][r] == reg->id);
+      CHECK(reg && reg->device == handle);
+      CHECK(reg && reg->position == r);
+      CHECK(reg && reg->config["address"] == 40001);
+    }
+  }
+  
+  // Unknown IDs, a register ID looked up as a device, and out of range handles
+  CHECK(index.findDevice("D4") == INVALID_HANDLE);
+  CHECK(index.findDevice("R1") == INVALID_HANDLE);
+  CHECK(index.findDevice(nullptr) == INVALID_HANDLE);
+  CHECK(index.findRegister("") == INVALID_HANDLE);
+  CHECK(index.device(INVALID_HANDLE) == nullptr);
+  CHECK(index.reg(index.getRegisterLimit()) == nullptr);
+  
+  // Nothing indexed at all
+  std::unique_ptr<Snapshot> empty = build({}, {}, nullptr);
+  CHECK(empty->index.getDeviceCount() == 0);
+  CHECK(empty->index.findDevice("D1") == INVALID_HANDLE);
+  CHECK(empty->index.findRegister("R1") == INVALID_HANDLE);
+}
+
+// Enough entries for long probe sequences in the hash tables
+static void testManyEntries() {
+  printf("Many entries\n");
+  const int DEVICES = 1500;
+  std::vector<std::string> devices;
+  std::vector<std::vector<std::string>> registers(DEVICES);
+  for (int d = 0; d < DEVICES; d++) {
+    devices.push_back("D" + std::to_string(100000 + d * 7));
+    for (int r = 0; r < 3; r++) {
+      registers[d].push_back("R" + std::to_string(d) + "_" + std::to_string(r));
+    }
+  }
+  std::unique_ptr<Snapshot> snapshot = build(devices, registers, nullptr);
+  const ConfigIndex& index = snapshot->index;
+  CHECK(index.getDeviceCount() == DEVICES);
+  CHECK(index.getRegisterCount() == DEVICES * 3);
+  
+  std::set<uint16_t> deviceHandles, registerHandles;
+  int misses = 0;
+  for (int d = 0; d < DEVICES; d++) {
+    uint16_t handle = index.findDevice(devices[d].c_str());
+    const IndexedDevice* device = index.device(handle);
+    if (!device || devices[d] != device->id) misses++;
+    deviceHandles.insert(handle);
+    for (int r = 0; r < 3; r++) {
+      const IndexedRegister* reg = index.reg(index.findRegister(registers[d][r].c_str()));
+      if (!reg || reg->device != handle || reg->position != r) misses++;
+      registerHandles.insert(index.findRegister(registers[d][r].c_str()));
+    }
+    if (index.findDevice(("X" + std::to_string(d)).c_str()) != INVALID_HANDLE) misses++;
+  }
+  CHECK(misses == 0);
+  CHECK(deviceHandles.size() == (size_t)DEVICES);
+  CHECK(registerHandles.size() == (size_t)DEVICES * 3);
+}
+
+static void testDuplicateRegisters() {
+  printf("Duplicate registers\n");
+  std::unique_ptr<Snapshot> snapshot = build({ "D1", "D2" }, { { "R1", "R2", "R1" }, { "R2" } }, nullptr);
+  const ConfigIndex& index = snapshot->index;
+  CHECK(index.getRegisterCount() == 2);
+  const IndexedRegister* reg = index.reg(index.findRegister("R1"));
+  CHECK(reg && reg->position == 0);
+  reg = index.reg(index.findRegister("R2"));
+  CHECK(reg && reg->device == index.findDevice("D1") && reg->position == 1);
+}
+
+// Kept IDs keep their handles; deleted ones leave their handle empty and are
+// not found; new ones do not take a handle just freed
+static void testHandlesAcrossRebuilds() {
+  printf("Handles across rebuilds\n");
+  std::unique_ptr<Snapshot> first = build({ "D1", "D2", "D3" }, { { "R1" }, { "R2", "R3" }, { "R4" } }, nullptr);
+  uint16_t d1 = first->index.findDevice("D1");
+  uint16_t d2 = first->index.findDevice("D2");
+  uint16_t d3 = first->index.findDevice("D3");
+  uint16_t r2 = first->index.findRegister("R2");
+  uint16_t r3 = first->index.findRegister("R3");
+  uint16_t r4 = first->index.findRegister("R4");
+  
+  // D2 and its registers deleted, D4 added in front, R4 moved behind a new R5
+  std::unique_ptr<Snapshot> second = build({ "D4", "D1", "D3" }, { { "R6" }, { "R1" }, { "R5", "R4" } }, first.get());
+  const ConfigIndex& index = second->index;
+  CHECK(index.findDevice("D1") == d1);
+  CHECK(index.findDevice("D3") == d3);
+  CHECK(index.findDevice("D2") == INVALID_HANDLE);
+  CHECK(index.device(d2) == nullptr);
+  CHECK(index.findRegister("R2") == INVALID_HANDLE);
+  CHECK(index.reg(r2) == nullptr && index.reg(r3) == nullptr);
+  
+  CHECK(index.findRegister("R4") == r4);
+  const IndexedRegister* reg = index.reg(r4);
+  CHECK(reg && reg->device == d3 && reg->position == 1);
+  
+  uint16_t d4 = index.findDevice("D4");
+  CHECK(d4 != INVALID_HANDLE && d4 != d2);
+  for (const char* id : { "R5", "R6" }) {
+    uint16_t handle = index.findRegister(id);
+    CHECK(handle != INVALID_HANDLE && handle != r2 && handle != r3);
+  }
+  
+  // The same config again changes nothing
+  std::unique_ptr<Snapshot> third = build({ "D4", "D1", "D3" }, { { "R6" }, { "R1" }, { "R5", "R4" } }, second.get());
+  CHECK(third->index.findDevice("D4") == d4);
+  CHECK(third->index.findRegister("R5") == index.findRegister("R5"));
+  CHECK(third->index.memoryUsage() == index.memoryUsage());
+}
+
+// Deleting a register and creating another, over and over: the freed handle
+// stays unused until the cursor has gone all the way round, and the tables
+// stop growing
+static void testCursorReuse() {
+  printf("Cursor reuse\n");
+  std::vector<std::string> ids;
+  for (int i = 0; i < 10; i++) {
+    ids.push_back("R" + std::to_string(i));
+  }
+  std::unique_ptr<Snapshot> snapshot = build({ "D1" }, { ids }, nullptr);
+  
+  std::vector<uint16_t> freed;   // In the order they were freed
+  size_t usage = 0;
+  bool reused = false;
+  int next = 10;
+  for (int round = 0; round < 400; round++) {
+    std::string victim = ids[round % ids.size()];
+    freed.push_back(snapshot->index.findRegister(victim.c_str()));
+    ids[round % ids.size()] = "R" + std::to_string(next++);
+    
+    std::unique_ptr<Snapshot> rebuilt = build({ "D1" }, { ids }, snapshot.get());
+    uint16_t handle = rebuilt->index.findRegister(ids[round % ids.size()].c_str());
+    CHECK(handle != INVALID_HANDLE);
+    CHECK(rebuilt->index.getRegisterCount() == 10);
+    
+    // Never one of the last 60 handles freed, this round's included
+    std::vector<uint16_t>::reverse_iterator last = std::find(freed.rbegin(), freed.rend(), handle);
+    if (last != freed.rend()) {
+      CHECK(last - freed.rbegin() >= 60);
+      reused = true;
+    }
+    if (round == 100) usage = rebuilt->index.memoryUsage();
+    if (round > 100) CHECK(rebuilt->index.memoryUsage() == usage);
+    snapshot = std::move(rebuilt);
+  }
+  CHECK(reused);
+  CHECK(snapshot->index.getRegisterLimit() <= 10 * 2 + 64);
+}
+
+int main() {
+  testLookup();
+  testManyEntries();
+  testDuplicateRegisters();
+  testHandlesAcrossRebuilds();
+  testCursorReuse();
+  
+  printf("%s\n", failures == 0 ? "PASS" : "FAIL");
+  return failures == 0 ? 0 : 1;
+}
\ No newline at end of file
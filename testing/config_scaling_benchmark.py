@@ -0,0 +1,223 @@
+"""
+Config Scaling Benchmark
+Provisions many devices and registers over BLE and reports per-operation
+latency and the gateway's memory budget (read/memory_report) as the
+configuration grows.
+
+Usage: python config_scaling_benchmark.py [--devices 200] [--registers 50] [--bulk | --batch]
+"""
+
+import argparse
+import asyncio
+import json
+import statistics
+import time
+from bleak import BleakClient, BleakScanner
+
+# BLE Configuration
+SERVICE_UUID = "00001830-0000-1000-8000-00805f9b34fb"
+COMMAND_CHAR_UUID = "11111111-1111-1111-1111-111111111101"
+RESPONSE_CHAR_UUID = "11111111-1111-1111-1111-111111111102"
+SERVICE_NAME = "SURIOTA GW"
+CHUNK_SIZE = 18
+
+class ScalingBenchmark:
+    def __init__(self, fragment_delay):
+        self.client = None
+        self.response_buffer = ""
+        self.pending = None
+        self.fragment_delay = fragment_delay
+        self.latencies = {}
+    
+    async def connect(self):
+        """Connect to BLE service"""
+        devices = await BleakScanner.discover()
+        device = next((d for d in devices if d.name == SERVICE_NAME), None)
+        if not device:
+            print(f"Service {SERVICE_NAME} not found")
+            return False
+        
+        self.client = BleakClient(device.address)
+        await self.client.connect()
+        await self.client.start_notify(RESPONSE_CHAR_UUID, self._notification_handler)
+        print(f"Connected to {device.name} (MTU {self.client.mtu_size})")
+        return True
+    
+    async def disconnect(self):
+        if self.client and self.client.is_connected:
+            await self.client.disconnect()
+            print("Disconnected")
+    
+    def _notification_handler(self, sender, data):
+        fragment = data.decode('utf-8')
+        if fragment == "<END>":
+            if self.pending and not self.pending.done():
+                try:
+                    self.pending.set_result(json.loads(self.response_buffer))
+                except json.JSONDecodeError:
+                    self.pending.set_result({"status": "error", "message": "unparseable response"})
+            self.response_buffer = ""
+        else:
+            self.response_buffer += fragment
+    
+    async def request(self, name, command, timeout=60.0):
+        """Send a command, wait for its response and record the round-trip time"""
+        json_str = json.dumps(command, separators=(',', ':'))
+        self.pending = asyncio.get_running_loop().create_future()
+        
+        start = time.perf_counter()
+        chunk_size = max(CHUNK_SIZE, min(self.client.mtu_size - 3, 509))
+        for i in range(0, len(json_str), chunk_size):
+            await self.client.write_gatt_char(COMMAND_CHAR_UUID, json_str[i:i+chunk_size].encode())
+            if self.fragment_delay:
+                await asyncio.sleep(self.fragment_delay)
+        await self.client.write_gatt_char(COMMAND_CHAR_UUID, "<END>".encode())
+        response = await asyncio.wait_for(self.pending, timeout)
+        elapsed_ms = (time.perf_counter() - start) * 1000.0
+        
+        self.latencies.setdefault(name, []).append(elapsed_ms)
+        if response.get("status") != "ok":
+            print(f"{name} failed: {response.get('message')}")
+        return response
+    
+    async def memory_report(self, label):
+        response = await self.request("read memory_report", {"op": "read", "type": "memory_report"})
+        report = response.get("memory_report", {})
+        print(f"[{label}] devices={report.get('devices')} registers={report.get('registers')} "
+              f"snapshot={report.get('snapshot_bytes')}B free_heap={report.get('free_heap')}B "
+              f"free_psram={report.get('free_psram')}B flash={report.get('flash_used')}/{report.get('flash_total')}B")
+        return report
+    
+    def print_latencies(self):
+        print("\n=== Per-operation latency (ms) ===")
+        print(f"{'operation':<28}{'count':>7}{'median':>10}{'p95':>10}{'max':>10}")
+        for name, samples in self.latencies.items():
+            ordered = sorted(samples)
+            p95 = ordered[min(len(ordered) - 1, int(len(ordered) * 0.95))]
+            print(f"{name:<28}{len(samples):>7}{statistics.median(samples):>10.1f}{p95:>10.1f}{ordered[-1]:>10.1f}")
+
+def device_config(index):
+    return {
+        "device_name": f"BENCH_{index:03d}",
+        "protocol": "RTU",
+        "serial_port": 1,
+        "baud_rate": 9600,
+        "slave_id": (index % 247) + 1,
+        "refresh_rate_ms": 5000
+    }
+
+def register_config(index):
+    return {
+        "register_name": f"REG_{index:03d}",
+        "address": 40001 + index,
+        "function_code": 3,
+        "data_type": "uint16",
+        "description": "Scaling benchmark register"
+    }
+
+async def bulk_import(bench, args):
+    """Provision everything with one streamed import; returns the new device IDs"""
+    devices = [dict(device_config(d), registers=[register_config(r) for r in range(args.registers)])
+               for d in range(args.devices)]
+    start = time.perf_counter()
+    for i in range(0, len(devices), args.chunk):
+        chunk = devices[i:i + args.chunk]
+        command = {"op": "import", "type": "devices", "devices": chunk}
+        if i + args.chunk < len(devices):
+            command["more"] = True
+        response = await bench.request("import chunk", command)
+        if response.get("status") != "ok":
+            return []
+    print(f"Bulk import of {args.devices} devices x {args.registers} registers: "
+          f"{time.perf_counter() - start:.1f}s")
+    return response.get("device_ids", [])
+
+async def batch_provision(bench, args):
+    """Provision each device and its registers with one batch command; returns the new device IDs"""
+    device_ids = []
+    start = time.perf_counter()
+    for d in range(args.devices):
+        operations = [{"op": "create", "type": "device", "config": device_config(d)}]
+        operations += [{"op": "create", "type": "register", "device_id": "$0", "config": register_config(r)}
+                       for r in range(min(args.registers, 63))]
+        response = await bench.request("batch device", {"op": "batch", "atomic": True, "operations": operations})
+        if not response.get("committed"):
+            break
+        device_ids.append(response["results"][0]["device_id"])
+        
+        if (d + 1) % args.report_every == 0:
+            await bench.memory_report(f"{d + 1} devices")
+    print(f"Batched provisioning of {len(device_ids)} devices x {min(args.registers, 63)} registers: "
+          f"{time.perf_counter() - start:.1f}s")
+    return device_ids
+
+async def run(args):
+    bench = ScalingBenchmark(args.fragment_delay)
+    if not await bench.connect():
+        return
+    
+    try:
+        await bench.memory_report("start")
+        device_ids = []
+        
+        if args.bulk:
+            device_ids = await bulk_import(bench, args)
+            await bench.request("export devices", {"op": "export", "type": "devices"})
+        elif args.batch:
+            device_ids = await batch_provision(bench, args)
+        
+        for d in range(0 if args.bulk or args.batch else args.devices):
+            response = await bench.request("create device", {
+                "op": "create", "type": "device", "config": device_config(d)
+            })
+            device_id = response.get("device_id")
+            if not device_id:
+                break
+            device_ids.append(device_id)
+            
+            for r in range(args.registers):
+                await bench.request("create register", {
+                    "op": "create", "type": "register", "device_id": device_id, "config": register_config(r)
+                })
+            
+            if (d + 1) % args.report_every == 0:
+                await bench.memory_report(f"{d + 1} devices")
+        
+        # Reads against the fully provisioned configuration
+        await bench.request("read devices_summary", {"op": "read", "type": "devices_summary"})
+        for device_id in device_ids[:args.sample]:
+            await bench.request("read device", {"op": "read", "type": "device", "device_id": device_id})
+            await bench.request("read registers", {"op": "read", "type": "registers", "device_id": device_id})
+            await bench.request("read registers_summary", {"op": "read", "type": "registers_summary", "device_id": device_id})
+        
+        await bench.memory_report("provisioned")
+        
+        if args.cleanup:
+            for device_id in device_ids:
+                await bench.request("delete device", {"op": "delete", "type": "device", "device_id": device_id})
+            await bench.memory_report("cleaned up")
+        
+        link = (await bench.request("read link_stats", {"op": "read", "type": "link_stats"})).get("link_stats", {})
+        print(f"BLE link: mtu={link.get('mtu')} out={link.get('bytes_out')}B at {link.get('bytes_out_per_s')}B/s "
+              f"congestion_waits={link.get('congestion_waits')} credit_timeouts={link.get('credit_timeouts')}")
+        
+        bench.print_latencies()
+    
+    finally:
+        await bench.disconnect()
+
+def main():
+    parser = argparse.ArgumentParser(description="Config scaling benchmark over BLE")
+    parser.add_argument("--devices", type=int, default=200)
+    parser.add_argument("--registers", type=int, default=50)
+    parser.add_argument("--report-every", type=int, default=25, help="Memory report interval in devices")
+    parser.add_argument("--sample", type=int, default=10, help="Devices to read back after provisioning")
+    parser.add_argument("--fragment-delay", type=float, default=0.0, help="Delay between command fragments (s)")
+    parser.add_argument("--cleanup", action="store_true", help="Delete the benchmark devices afterwards")
+    parser.add_argument("--bulk", action="store_true", help="Provision with one streamed import instead of per-item creates")
+    parser.add_argument("--chunk", type=int, default=5, help="Devices per import command with --bulk")
+    parser.add_argument("--batch", action="store_true", help="Provision each device and its registers with one batch command")
+    asyncio.run(run(parser.parse_args()))
+
+if __name__ == "__main__":
+    main()
\ No newline at end of file
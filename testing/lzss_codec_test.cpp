@@ -0,0 +1,139 @@
+/*
+ * Host-side unit test for the BLE response compressor (LzssCodec.h/.cpp)
+ * Round-trips JSON-like, random and degenerate inputs through the streaming
+ * encoder and decoder with assorted write sizes, and checks that corrupt
+ * streams are rejected.
+ *
+ * Build and run on Linux:
+ *   g++ -std=c++17 -Wall -g -fsanitize=address,undefined -I.. lzss_codec_test.cpp ../LzssCodec.cpp -o lzss_codec_test
+ *   ./lzss_codec_test
+ */
+
+#include "LzssCodec.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("  FAILED line %d: %s\n", __LINE__, #condition); \
+      failures++; \
+    } \
+  } while (0)
+
+static void append(void* context, const uint8_t* data, size_t size) {
+  static_cast<std::string*>(context)->append((const char*)data, size);
+}
+
+// The encoder and decoder are too large for the stack
+static std::unique_ptr<LzssEncoder> encoder(new LzssEncoder());
+static std::unique_ptr<LzssDecoder> decoder(new LzssDecoder());
+
+static std::string compress(const std::string& input, size_t writeSize) {
+  std::string output;
+  encoder->begin(append, &output);
+  for (size_t offset = 0; offset < input.size(); offset += writeSize) {
+    size_t count = input.size() - offset < writeSize ? input.size() - offset : writeSize;
+    encoder->write((const uint8_t*)input.data() + offset, count);
+  }
+  encoder->finish();
+  return output;
+}
+
+static bool decompress(const std::string& input, size_t writeSize, std::string& output) {
+  output.clear();
+  decoder->begin(append, &output);
+  for (size_t offset = 0; offset < input.size(); offset += writeSize) {
+    size_t count = input.size() - offset < writeSize ? input.size() - offset : writeSize;
+    if (!decoder->write((const uint8_t*)input.data() + offset, count)) return false;
+  }
+  return decoder->finish();
+}
+
+static std::string registersJson(int count) {
+  std::string json = "{\"status\":\"ok\",\"registers\":[";
+  for (int i = 0; i < count; i++) {
+    char entry[256];
+    snprintf(entry, sizeof(entry),
+             "%s{\"register_name\":\"REG_%03d\",\"address\":%d,\"function_code\":3,\"data_type\":\"uint16\","
+             "\"description\":\"Scaling benchmark register\",\"register_id\":\"R%06X\"}",
+             i ? "," : "", i, 40001 + i, (unsigned)(i * 2654435761u) & 0xFFFFFF);
+    json += entry;
+  }
+  return json + "]}";
+}
+
+static void roundTrip(const char* name, const std::string& input) {
+  static const size_t writeSizes[] = {1, 7, 18, 509, 100000};
+  std::string reference;
+  for (size_t writeSize : writeSizes) {
+    std::string compressed = compress(input, writeSize);
+    std::string restored;
+    CHECK(decompress(compressed, writeSize, restored));
+    CHECK(restored == input);
+    CHECK(encoder->getBytesIn() == input.size());
+    CHECK(encoder->getBytesOut() == compressed.size());
+    
+    // Write boundaries do not change the encoding
+    if (reference.empty()) {
+      reference = compressed;
+    }
+    CHECK(compressed == reference);
+  }
+  printf("%-24s %8zu -> %7zu bytes\n", name, input.size(), reference.size());
+}
+
+static void testRoundTrips() {
+  roundTrip("empty", "");
+  roundTrip("one byte", "x");
+  roundTrip("short json", "{\"status\":\"ok\"}");
+  roundTrip("run", std::string(10000, 'a'));
+  roundTrip("registers x200", registersJson(200));
+  
+  std::string noise(20000, '\0');
+  srand(1);
+  for (char& c : noise) c = (char)(rand() & 0xFF);
+  roundTrip("random", noise);
+  
+  // Repeats just inside and just outside the reachable window
+  std::string block = noise.substr(0, 600);
+  std::string far = block + noise.substr(600, LZSS_MAX_OFFSET - 600) + block + noise.substr(5000, 4200) + block;
+  roundTrip("window edges", far);
+  
+  // JSON compresses well; random data grows by at most one control byte per 8
+  CHECK(compress(registersJson(200), 4096).size() * 4 < registersJson(200).size());
+  CHECK(compress(noise, 4096).size() <= noise.size() + noise.size() / 8 + 1);
+}
+
+static void testCorrupt() {
+  printf("corrupt streams\n");
+  std::string restored;
+  
+  // A back-reference before the start of the output
+  const uint8_t before[] = {0x01, 0x05, 0x00};
+  CHECK(!decompress(std::string((const char*)before, sizeof(before)), 16, restored));
+  
+  // Truncated streams: what was decoded is a prefix, and a cut inside a
+  // back-reference is reported
+  std::string input = registersJson(20);
+  std::string compressed = compress(input, 64);
+  int reported = 0;
+  for (size_t i = 1; i < compressed.size(); i++) {
+    if (!decompress(compressed.substr(0, i), 64, restored)) reported++;
+    CHECK(input.compare(0, restored.size(), restored) == 0);
+  }
+  CHECK(reported > 0);
+}
+
+int main() {
+  testRoundTrips();
+  testCorrupt();
+  
+  printf("%s\n", failures == 0 ? "PASS" : "FAIL");
+  return failures == 0 ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,214 @@
+"""
+MQTT Broker Stand-in
+A minimal local MQTT 3.1.1 broker (CONNECT, SUBSCRIBE, PUBLISH QoS 0/1,
+PINGREQ) for exercising the gateway's MQTT command channel without a real
+broker. Point mqtt_config.broker_address at this machine; once the gateway
+subscribes to its command topic, the given commands are published to it and
+every reply on the response topic is printed. Other clients (e.g. mosquitto_pub)
+may connect too; messages are routed between all subscribers.
+
+--puback-delay acknowledges QoS 1 publishes late, like a high-latency cellular
+link, and --drop-every cuts the connection with publishes unacknowledged; the
+telemetry summary then shows whether any sample went missing.
+
+Usage: python mqtt_broker_stub.py [--port 1883] [--command '{"op":"read","type":"devices_summary"}'] [--large 40000]
+                                  [--puback-delay 0.5] [--drop-every 500]
+"""
+
+import argparse
+import asyncio
+import json
+import time
+
+CONNECT, CONNACK, PUBLISH, PUBACK, SUBSCRIBE, SUBACK, PINGREQ, PINGRESP, DISCONNECT = 1, 2, 3, 4, 8, 9, 12, 13, 14
+
+def encode_length(length):
+    out = bytearray()
+    while True:
+        digit = length % 128
+        length //= 128
+        out.append(digit | 0x80 if length else digit)
+        if not length:
+            return bytes(out)
+
+def packet(header, body=b""):
+    return bytes([header]) + encode_length(len(body)) + body
+
+def utf8(text):
+    data = text.encode()
+    return len(data).to_bytes(2, "big") + data
+
+def topic_matches(pattern, topic):
+    pattern_parts, topic_parts = pattern.split("/"), topic.split("/")
+    for i, part in enumerate(pattern_parts):
+        if part == "#":
+            return True
+        if i >= len(topic_parts) or (part != "+" and part != topic_parts[i]):
+            return False
+    return len(pattern_parts) == len(topic_parts)
+
+class Session:
+    def __init__(self, broker, reader, writer):
+        self.broker = broker
+        self.reader = reader
+        self.writer = writer
+        self.client_id = "?"
+        self.subscriptions = []
+        self.next_id = 0
+    
+    async def read_packet(self):
+        header = (await self.reader.readexactly(1))[0]
+        length, shift = 0, 0
+        while True:
+            digit = (await self.reader.readexactly(1))[0]
+            length |= (digit & 0x7F) << shift
+            shift += 7
+            if not digit & 0x80:
+                break
+        return header, await self.reader.readexactly(length)
+    
+    async def send(self, data):
+        self.writer.write(data)
+        await self.writer.drain()
+    
+    async def deliver(self, topic, payload):
+        self.next_id = self.next_id % 65535 + 1
+        await self.send(packet(0x32, utf8(topic) + self.next_id.to_bytes(2, "big") + payload))
+    
+    async def run(self):
+        try:
+            while True:
+                header, body = await self.read_packet()
+                kind = header >> 4
+                if kind == CONNECT:
+                    self.client_id = body[12:12 + int.from_bytes(body[10:12], "big")].decode()
+                    print(f"CONNECT {self.client_id} keepalive={int.from_bytes(body[8:10], 'big')}s")
+                    await self.send(packet(CONNACK << 4, b"\x00\x00"))
+                elif kind == SUBSCRIBE:
+                    packet_id, pos, codes = body[:2], 2, bytearray()
+                    while pos < len(body):
+                        length = int.from_bytes(body[pos:pos + 2], "big")
+                        pattern = body[pos + 2:pos + 2 + length].decode()
+                        self.subscriptions.append(pattern)
+                        codes.append(min(body[pos + 2 + length], 1))
+                        pos += 3 + length
+                        print(f"SUBSCRIBE {self.client_id} {pattern}")
+                        self.broker.on_subscribe(self, pattern)
+                    await self.send(packet(SUBACK << 4, packet_id + bytes(codes)))
+                elif kind == PUBLISH:
+                    qos = (header >> 1) & 0x03
+                    length = int.from_bytes(body[:2], "big")
+                    topic = body[2:2 + length].decode()
+                    pos = 2 + length
+                    ack = packet(PUBACK << 4, body[pos:pos + 2]) if qos else None
+                    pos += 2 if qos else 0
+                    if not await self.broker.route(self, topic, body[pos:]):
+                        print(f"DROP {self.client_id} with publishes unacknowledged")
+                        break
+                    if ack and self.broker.puback_delay:
+                        asyncio.get_running_loop().call_later(self.broker.puback_delay, self.writer.write, ack)
+                    elif ack:
+                        await self.send(ack)
+                elif kind == PINGREQ:
+                    await self.send(packet(PINGRESP << 4))
+                elif kind == DISCONNECT:
+                    break
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+        finally:
+            print(f"DISCONNECT {self.client_id}")
+            self.broker.sessions.discard(self)
+            self.writer.close()
+
+class Broker:
+    def __init__(self, commands, puback_delay, drop_every):
+        self.sessions = set()
+        self.commands = commands
+        self.sent = {}
+        self.telemetry = 0
+        self.samples = set()
+        self.puback_delay = puback_delay
+        self.drop_every = drop_every
+    
+    async def accept(self, reader, writer):
+        session = Session(self, reader, writer)
+        self.sessions.add(session)
+        await session.run()
+    
+    def on_subscribe(self, session, pattern):
+        # The gateway subscribing to its command topic triggers the commands
+        if self.commands and "#" not in pattern and "+" not in pattern:
+            asyncio.get_running_loop().create_task(self.send_commands(session, pattern))
+    
+    async def send_commands(self, session, topic):
+        await asyncio.sleep(0.5)
+        for request_id, command in enumerate(self.commands, 1):
+            command = dict(command, request_id=request_id)
+            payload = json.dumps(command, separators=(",", ":")).encode()
+            self.sent[request_id] = time.perf_counter()
+            print(f"-> {topic} request_id={request_id} {len(payload)}B op={command.get('op')} type={command.get('type')}")
+            await session.deliver(topic, payload)
+    
+    async def route(self, source, topic, payload):
+        """Returns False when the source connection should be dropped instead"""
+        if topic.endswith("/response"):
+            self.print_reply(payload)
+        else:
+            self.telemetry += 1
+            self.samples.add(payload)
+            if self.telemetry % 100 == 1:
+                print(f"<- {topic} telemetry #{self.telemetry} ({len(self.samples)} unique) {payload[:120]!r}")
+            if self.drop_every and self.telemetry % self.drop_every == 0:
+                return False
+        for session in list(self.sessions):
+            if any(topic_matches(pattern, topic) for pattern in session.subscriptions):
+                await session.deliver(topic, payload)
+        return True
+    
+    def print_reply(self, payload):
+        try:
+            reply = json.loads(payload)
+        except ValueError:
+            print(f"<- unparseable reply ({len(payload)}B)")
+            return
+        request_id = reply.get("request_id")
+        elapsed = ""
+        if request_id in self.sent:
+            elapsed = f" in {(time.perf_counter() - self.sent.pop(request_id)) * 1000:.0f} ms"
+        response = reply.get("response", {})
+        print(f"<- request_id={request_id} {len(payload)}B{elapsed} status={response.get('status')} "
+              f"{json.dumps(response)[:200]}")
+
+async def run(args):
+    commands = [json.loads(text) for text in args.command]
+    if args.large:
+        # One import command far beyond the 512-byte buffer of typical MQTT libraries
+        devices = []
+        while len(json.dumps(devices)) < args.large:
+            devices.append({"device_name": f"STUB_{len(devices):03d}", "protocol": "RTU", "serial_port": 1,
+                            "baud_rate": 9600, "slave_id": len(devices) % 247 + 1, "refresh_rate_ms": 5000})
+        commands.append({"op": "import", "type": "devices", "devices": devices})
+    if not commands:
+        commands = [{"op": "read", "type": "devices_summary"}, {"op": "read", "type": "link_stats"}]
+    
+    broker = Broker(commands, args.puback_delay, args.drop_every)
+    server = await asyncio.start_server(broker.accept, args.host, args.port)
+    print(f"Broker stand-in listening on {args.host}:{args.port}")
+    async with server:
+        await server.serve_forever()
+
+def main():
+    parser = argparse.ArgumentParser(description="Local MQTT broker stand-in for the gateway command channel")
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--command", action="append", default=[], help="JSON command to send (repeatable)")
+    parser.add_argument("--large", type=int, default=0, help="Also send a device import of about this many bytes")
+    parser.add_argument("--puback-delay", type=float, default=0.0, help="Delay before acknowledging QoS 1 publishes (s)")
+    parser.add_argument("--drop-every", type=int, default=0, help="Drop the publisher's connection every N samples")
+    try:
+        asyncio.run(run(parser.parse_args()))
+    except KeyboardInterrupt:
+        pass
+
+if __name__ == "__main__":
+    main()
\ No newline at end of file
@@ -0,0 +1,736 @@
+/*
+ * Host-side unit test for the in-tree MQTT client (MqttClient.h/.cpp) and the
+ * acknowledged queue behind it (AckRing.h)
+ * Runs the client against an in-memory broker stand-in: handshake, refused
+ * connections, subscriptions, small and large commands delivered in 1-byte to
+ * 1000-byte reads, oversized messages, QoS 1 acknowledgements both ways, the
+ * publish window, streamed publishes, a broker that stops reading, keepalive,
+ * malformed packets, and queued records surviving dropped connections.
+ *
+ * Build and run on Linux:
+ *   g++ -std=c++17 -Wall -g -fsanitize=address,undefined -I.. mqtt_client_test.cpp ../MqttClient.cpp -o mqtt_client_test
+ *   ./mqtt_client_test
+ */
+
+#include "MqttClient.h"
+#include "AckRing.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+// Send buffer of the clients under test; the broker stand-in takes every byte
+// unless a test limits it, so only one client at a time ever fills it
+static uint8_t outgoing[32 * 1024];
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("  FAILED line %d: %s\n", __LINE__, #condition); \
+      failures++; \
+    } \
+  } while (0)
+
+// Broker side of the connection: bytes queued for the client are handed out
+// at most `readSize` at a time, bytes written by the client are collected
+struct BrokerStub : MqttTransport {
+  std::string toClient;
+  std::string fromClient;
+  size_t readSize = 1000;
+  bool isOpen = false;
+  bool dropped = false;
+  int opens = 0;
+  
+  bool open(const char*, uint16_t) override {
+    isOpen = true;
+    dropped = false;
+    opens++;
+    return true;
+  }
+  void close() override { isOpen = false; }
+  
+  int read(uint8_t* data, size_t size) override {
+    if (dropped) return -1;
+    size_t count = std::min(std::min(size, readSize), toClient.size());
+    memcpy(data, toClient.data(), count);
+    toClient.erase(0, count);
+    return (int)count;
+  }
+  
+  // Bytes the broker still takes before it stops reading; SIZE_MAX = no limit
+  size_t writeRoom = SIZE_MAX;
+  
+  int write(const uint8_t* data, size_t size) override {
+    if (!isOpen || dropped) return -1;
+    size_t count = std::min(size, writeRoom);
+    if (writeRoom != SIZE_MAX) writeRoom -= count;
+    fromClient.append((const char*)data, count);
+    return (int)count;
+  }
+  
+  // Pop the next complete packet the client sent; returns its first byte
+  int nextPacket(std::string& body) {
+    if (fromClient.empty()) return -1;
+    uint32_t length = 0;
+    size_t pos = 1;
+    for (int shift = 0; ; shift += 7) {
+      uint8_t digit = fromClient[pos++];
+      length |= (uint32_t)(digit & 0x7F) << shift;
+      if (!(digit & 0x80)) break;
+    }
+    int header = (uint8_t)fromClient[0];
+    body = fromClient.substr(pos, length);
+    fromClient.erase(0, pos + length);
+    return header;
+  }
+};
+
+static std::string packet(uint8_t header, const std::string& body) {
+  uint8_t length[4];
+  size_t used = MqttClient::encodeLength(length, body.size());
+  return std::string(1, (char)header) + std::string((const char*)length, used) + body;
+}
+
+static std::string u16(uint16_t value) {
+  return std::string(1, (char)(value >> 8)) + std::string(1, (char)(value & 0xFF));
+}
+
+static std::string publishPacket(const std::string& topic, const std::string& payload, int qos, uint16_t id, bool retain = false) {
+  std::string body = u16(topic.size()) + topic + (qos ? u16(id) : "") + payload;
+  return packet(0x30 | (qos << 1) | (retain ? 1 : 0), body);
+}
+
+struct Received {
+  std::vector<MqttMessage> messages;
+  std::vector<std::string> topics;
+  std::vector<std::string> payloads;
+};
+
+static void collect(void* context, const MqttMessage& message) {
+  Received* received = static_cast<Received*>(context);
+  received->messages.push_back(message);
+  received->topics.push_back(message.topic);
+  received->payloads.push_back(message.payload ? std::string((const char*)message.payload, message.length) : "");
+}
+
+static MqttConnectOptions options(uint16_t keepAlive = 60) {
+  MqttConnectOptions opts = { "gw-test", "user", "secret", keepAlive, true };
+  return opts;
+}
+
+// Connect and complete the handshake
+static bool establish(MqttClient& client, BrokerStub& broker, uint32_t now = 0, uint16_t keepAlive = 60) {
+  if (!client.connect("broker", 1883, options(keepAlive), now)) return false;
+  std::string body;
+  if (broker.nextPacket(body) != 0x10) return false;
+  broker.toClient += packet(0x20, std::string("\x00\x00", 2));
+  return client.poll(now) && client.connected();
+}
+
+static void testHandshake() {
+  printf("Handshake\n");
+  BrokerStub broker;
+  std::vector<uint8_t> buffer(1024);
+  MqttClient client;
+  client.begin(&broker, buffer.data(), buffer.size(), outgoing, sizeof(outgoing));
+  
+  CHECK(client.connect("broker", 1883, options(30), 0));
+  CHECK(client.getState() == MqttClient::MQTT_CONNECTING);
+  std::string body;
+  CHECK(broker.nextPacket(body) == 0x10);
+  std::string expected = std::string("\x00\x04MQTT\x04\xC2\x00\x1E", 10) + u16(7) + "gw-test" + u16(4) + "user" + u16(6) + "secret";
+  CHECK(body == expected);
+  
+  // Nothing arrived yet: still connecting, not an error
+  CHECK(client.poll(100));
+  CHECK(!client.connected());
+  
+  broker.toClient += packet(0x20, std::string("\x00\x00", 2));
+  CHECK(client.poll(200));
+  CHECK(client.connected());
+  CHECK(client.getConnectResult() == 0);
+  
+  // Refused: CONNACK return code 5 (not authorized)
+  MqttClient refused;
+  BrokerStub broker2;
+  refused.begin(&broker2, buffer.data(), buffer.size(), outgoing, sizeof(outgoing));
+  CHECK(refused.connect("broker", 1883, options(), 0));
+  broker2.toClient += packet(0x20, std::string("\x00\x05", 2));
+  CHECK(!refused.poll(10));
+  CHECK(refused.getConnectResult() == 5);
+  CHECK(!broker2.isOpen);
+  
+  // No CONNACK at all
+  MqttClient silent;
+  BrokerStub broker3;
+  silent.begin(&broker3, buffer.data(), buffer.size(), outgoing, sizeof(outgoing));
+  CHECK(silent.connect("broker", 1883, options(), 1000));
+  CHECK(silent.poll(1000 + MqttClient::CONNECT_TIMEOUT_MS));
+  CHECK(!silent.poll(1001 + MqttClient::CONNECT_TIMEOUT_MS));
+  
+  // Too small a buffer is refused up front
+  MqttClient tiny;
+  uint8_t small[16];
+  tiny.begin(&broker3, small, sizeof(small), outgoing, sizeof(outgoing));
+  CHECK(!tiny.connect("broker", 1883, options(), 0));
+}
+
+static void testSubscribeAndPublish() {
+  printf("Subscribe and publish\n");
+  BrokerStub broker;
+  std::vector<uint8_t> buffer(1024);
+  MqttClient client;
+  client.begin(&broker, buffer.data(), buffer.size(), outgoing, sizeof(outgoing));
+  CHECK(!client.subscribe("gw/cmd", 1));
+  CHECK(establish(client, broker));
+  
+  CHECK(client.subscribe("gw/cmd", 1));
+  std::string body;
+  CHECK(broker.nextPacket(body) == 0x82);
+  CHECK(body == u16(1) + u16(6) + "gw/cmd" + std::string(1, '\x01'));
+  
+  broker.toClient += packet(0x90, u16(1) + std::string(1, '\x01'));
+  CHECK(client.poll(10));
+  CHECK(client.getStats().subscribeFailures == 0);
+  CHECK(client.subscribe("gw/denied", 1));
+  broker.nextPacket(body);
+  broker.toClient += packet(0x90, u16(2) + std::string(1, '\x80'));
+  CHECK(client.poll(20));
+  CHECK(client.getStats().subscribeFailures == 1);
+  
+  const uint8_t payload[] = "{\"value\":1}";
+  CHECK(client.publish("gw/data", payload, sizeof(payload) - 1, true));
+  CHECK(broker.nextPacket(body) == 0x31);
+  CHECK(body == u16(7) + "gw/data" + "{\"value\":1}");
+  
+  // A payload above 127 and 16383 bytes needs two and three length bytes
+  std::string large(20000, 'x');
+  CHECK(client.publish("t", (const uint8_t*)large.data(), large.size()));
+  CHECK((uint8_t)broker.fromClient[0] == 0x30);
+  CHECK((uint8_t)broker.fromClient[3] == 0x01);
+  CHECK(broker.nextPacket(body) == 0x30);
+  CHECK(body.size() == 3 + large.size());
+  CHECK(MqttClient::publishSize(1, large.size(), 0) == 1 + 3 + 3 + large.size());
+  CHECK(MqttClient::publishSize(7, 1, 1) == 1 + 1 + 2 + 7 + 2 + 1);
+  
+  uint8_t length[4];
+  CHECK(MqttClient::encodeLength(length, 0) == 1 && length[0] == 0);
+  CHECK(MqttClient::encodeLength(length, 127) == 1 && length[0] == 127);
+  CHECK(MqttClient::encodeLength(length, 128) == 2 && length[0] == 0x80 && length[1] == 0x01);
+  CHECK(MqttClient::encodeLength(length, 268435455) == 4 && length[3] == 0x7F);
+}
+
+static void testReceive() {
+  printf("Receive\n");
+  std::vector<uint8_t> buffer(48 * 1024);
+  std::string large = "{\"op\":\"import\",\"devices\":[";
+  while (large.size() < 40000) large += "{\"device_name\":\"D\",\"protocol\":\"RTU\"},";
+  large += "{}]}";
+  
+  for (size_t readSize : { (size_t)1, (size_t)7, (size_t)1000 }) {
+    BrokerStub broker;
+    MqttClient client;
+    Received received;
+    client.begin(&broker, buffer.data(), buffer.size(), outgoing, sizeof(outgoing));
+    client.setHandler(collect, &received);
+    CHECK(establish(client, broker));
+    broker.readSize = readSize;
+    
+    broker.toClient += publishPacket("gw/cmd", "{\"op\":\"read\"}", 0, 0);
+    broker.toClient += publishPacket("gw/cmd", large, 1, 0x1234);
+    broker.toClient += publishPacket("gw/cmd", "", 0, 0, true);
+    
+    // 1-byte reads take many polls; each poll drains what is pending
+    for (int i = 0; i < 3 && received.messages.size() < 3; i++) {
+      CHECK(client.poll(10 + i));
+    }
+    CHECK(received.messages.size() == 3);
+    if (received.messages.size() != 3) continue;
+    CHECK(received.topics[0] == "gw/cmd");
+    CHECK(received.payloads[0] == "{\"op\":\"read\"}");
+    CHECK(received.payloads[1] == large);
+    CHECK(received.messages[1].qos == 1);
+    CHECK(!received.messages[1].truncated);
+    CHECK(received.payloads[2].empty());
+    CHECK(received.messages[2].retained);
+    
+    // Exactly one PUBACK, for the QoS 1 message
+    std::string body;
+    CHECK(broker.nextPacket(body) == 0x40);
+    CHECK(body == u16(0x1234));
+    CHECK(broker.fromClient.empty());
+  }
+}
+
+static void testOversized() {
+  printf("Oversized\n");
+  BrokerStub broker;
+  std::vector<uint8_t> buffer(256);
+  MqttClient client;
+  Received received;
+  client.begin(&broker, buffer.data(), buffer.size(), outgoing, sizeof(outgoing));
+  client.setHandler(collect, &received);
+  CHECK(establish(client, broker));
+  
+  // Larger than the buffer: reported truncated, still acknowledged, and the
+  // stream stays in sync for the message after it
+  broker.toClient += publishPacket("gw/cmd", std::string(5000, 'y'), 1, 7);
+  broker.toClient += publishPacket("gw/cmd", "after", 0, 0);
+  CHECK(client.poll(10));
+  CHECK(received.messages.size() == 2);
+  if (received.messages.size() == 2) {
+    CHECK(received.messages[0].truncated);
+    CHECK(received.messages[0].payload == nullptr);
+    CHECK(received.messages[0].length == 5000);
+    CHECK(received.topics[0] == "gw/cmd");
+    CHECK(received.payloads[1] == "after");
+  }
+  CHECK(client.getStats().oversized == 1);
+  std::string body;
+  CHECK(broker.nextPacket(body) == 0x40);
+  CHECK(body == u16(7));
+  
+  // Even the topic does not fit: dropped without a callback
+  broker.toClient += publishPacket(std::string(300, 't'), "x", 0, 0);
+  CHECK(client.poll(20));
+  CHECK(received.messages.size() == 2);
+  CHECK(client.getStats().oversized == 2);
+  CHECK(client.connected());
+}
+
+static void testKeepalive() {
+  printf("Keepalive\n");
+  BrokerStub broker;
+  std::vector<uint8_t> buffer(256);
+  MqttClient client;
+  client.begin(&broker, buffer.data(), buffer.size(), outgoing, sizeof(outgoing));
+  CHECK(establish(client, broker, 0, 10));
+  
+  std::string body;
+  CHECK(client.poll(4999));
+  CHECK(broker.fromClient.empty());
+  CHECK(client.poll(5000));
+  CHECK(broker.nextPacket(body) == 0xC0);
+  
+  // Answered: the next ping follows half a period later
+  broker.toClient += packet(0xD0, "");
+  CHECK(client.poll(6000));
+  CHECK(client.poll(10000));
+  CHECK(broker.nextPacket(body) == 0xC0);
+  
+  // Unanswered for a whole period: the connection is dropped
+  CHECK(client.poll(20000));
+  CHECK(!client.poll(20001));
+  CHECK(client.getStats().keepaliveTimeouts == 1);
+  CHECK(!broker.isOpen);
+  
+  // Reconnect, then the peer goes away
+  CHECK(establish(client, broker, 30000, 10));
+  broker.dropped = true;
+  CHECK(!client.poll(30010));
+  CHECK(!client.connected());
+}
+
+static void testMalformed() {
+  printf("Malformed\n");
+  std::vector<uint8_t> buffer(256);
+  
+  // Five Remaining Length bytes
+  {
+    BrokerStub broker;
+    MqttClient client;
+    client.begin(&broker, buffer.data(), buffer.size(), outgoing, sizeof(outgoing));
+    CHECK(establish(client, broker));
+    broker.toClient += std::string("\x30\xFF\xFF\xFF\xFF\x01", 6);
+    CHECK(!client.poll(10));
+  }
+  // Topic length beyond the packet
+  {
+    BrokerStub broker;
+    MqttClient client;
+    client.begin(&broker, buffer.data(), buffer.size(), outgoing, sizeof(outgoing));
+    CHECK(establish(client, broker));
+    broker.toClient += packet(0x30, u16(50) + "short");
+    CHECK(!client.poll(10));
+  }
+  // QoS 2 was never requested
+  {
+    BrokerStub broker;
+    MqttClient client;
+    client.begin(&broker, buffer.data(), buffer.size(), outgoing, sizeof(outgoing));
+    CHECK(establish(client, broker));
+    broker.toClient += publishPacket("t", "x", 2, 1);
+    CHECK(!client.poll(10));
+  }
+  // A second CONNACK
+  {
+    BrokerStub broker;
+    MqttClient client;
+    client.begin(&broker, buffer.data(), buffer.size(), outgoing, sizeof(outgoing));
+    CHECK(establish(client, broker));
+    broker.toClient += packet(0x20, std::string("\x00\x00", 2));
+    CHECK(!client.poll(10));
+  }
+}
+
+// Broker side of QoS 1 publishes: records each payload's value and, while
+// `acking`, answers with PUBACK. Returns the number of publishes seen.
+static int serveQos1(BrokerStub& broker, std::vector<uint32_t>& values, bool acking) {
+  int seen = 0;
+  std::string body;
+  int header;
+  while ((header = broker.nextPacket(body)) >= 0) {
+    if (header != 0x32) continue;
+    size_t topicLength = ((uint8_t)body[0] << 8) | (uint8_t)body[1];
+    std::string packetId = body.substr(2 + topicLength, 2);
+    uint32_t value;
+    memcpy(&value, body.data() + 4 + topicLength, sizeof(value));
+    values.push_back(value);
+    seen++;
+    if (acking) {
+      broker.toClient += packet(0x40, packetId);
+    }
+  }
+  return seen;
+}
+
+static void onAcked(void* context, uint32_t tag) {
+  static_cast<std::vector<uint32_t>*>(context)->push_back(tag);
+}
+
+static void testPublishWindow() {
+  printf("Publish window\n");
+  BrokerStub broker;
+  std::vector<uint8_t> buffer(256);
+  MqttClient client;
+  std::vector<uint32_t> acked;
+  client.begin(&broker, buffer.data(), buffer.size(), outgoing, sizeof(outgoing));
+  client.setAckHandler(onAcked, &acked);
+  client.setInflightWindow(4);
+  CHECK(establish(client, broker));
+  
+  const uint8_t payload[] = "v";
+  for (uint32_t tag = 100; tag < 104; tag++) {
+    CHECK(client.canPublish(MqttClient::publishSize(7, 1, 1)));
+    CHECK(client.publishAcked("gw/data", payload, 1, tag));
+  }
+  CHECK(!client.canPublish(MqttClient::publishSize(7, 1, 1)));
+  CHECK(!client.publishAcked("gw/data", payload, 1, 104));
+  CHECK(client.getInflight() == 4);
+  
+  // QoS 1 PUBLISH: flags 0x02, then topic, packet ID and payload
+  std::vector<std::string> ids;
+  std::string body;
+  while (broker.nextPacket(body) == 0x32) {
+    CHECK(body.size() == 2 + 7 + 2 + 1);
+    CHECK(body.substr(2, 7) == "gw/data");
+    ids.push_back(body.substr(9, 2));
+  }
+  CHECK(ids.size() == 4);
+  
+  // Out of order and unknown acknowledgements
+  broker.toClient += packet(0x40, ids[2]);
+  broker.toClient += packet(0x40, u16(0x7777));
+  CHECK(client.poll(10));
+  CHECK(acked.size() == 1 && acked[0] == 102);
+  CHECK(client.getInflight() == 3);
+  CHECK(client.canPublish(MqttClient::publishSize(7, 1, 1)));
+  
+  // A new publish never reuses an ID still in flight
+  CHECK(client.publishAcked("gw/data", payload, 1, 104));
+  CHECK(broker.nextPacket(body) == 0x32);
+  std::string newId = body.substr(9, 2);
+  CHECK(newId != ids[0] && newId != ids[1] && newId != ids[3]);
+  
+  broker.toClient += packet(0x40, ids[0]) + packet(0x40, ids[1]) + packet(0x40, ids[3]) + packet(0x40, newId);
+  CHECK(client.poll(20));
+  CHECK(acked.size() == 5);
+  CHECK(client.getInflight() == 0);
+  CHECK(client.getStats().acked == 5);
+  
+  // No PUBACK at all: the connection is given up and the window emptied
+  CHECK(client.publishAcked("gw/data", payload, 1, 105));
+  CHECK(client.poll(20 + MqttClient::ACK_TIMEOUT_MS));
+  CHECK(!client.poll(21 + MqttClient::ACK_TIMEOUT_MS));
+  CHECK(client.getStats().ackTimeouts == 1);
+  CHECK(client.getInflight() == 0);
+}
+
+// Records leave the queue only when acknowledged, so connections dropped with
+// publishes in flight lose nothing; at most the in-flight ones are duplicated
+static void testNoLossAcrossReconnects() {
+  printf("No loss across reconnects\n");
+  const uint32_t RECORDS = 200;
+  const int WINDOW = 8;
+  static uint32_t storage[256];
+  AckRing<uint32_t, 256> ring;
+  ring.begin(storage);
+  for (uint32_t i = 0; i < RECORDS; i++) {
+    ring.push(i);
+  }
+  
+  BrokerStub broker;
+  std::vector<uint8_t> buffer(256);
+  MqttClient client;
+  client.begin(&broker, buffer.data(), buffer.size(), outgoing, sizeof(outgoing));
+  client.setInflightWindow(WINDOW);
+  client.setAckHandler([](void* context, uint32_t tag) {
+    static_cast<AckRing<uint32_t, 256>*>(context)->acknowledge(tag);
+  }, &ring);
+  
+  std::vector<uint32_t> delivered;
+  uint32_t now = 0;
+  int reconnects = 0;
+  for (int pass = 0; pass < 1000 && !ring.empty(); pass++) {
+    now += 10;
+    if (!client.connected()) {
+      ring.rewind();
+      broker.fromClient.clear();
+      broker.toClient.clear();
+      CHECK(establish(client, broker, now));
+      reconnects++;
+    }
+    
+    uint32_t value, seq;
+    while (client.canPublish(MqttClient::publishSize(7, sizeof(value), 1)) && ring.takeNext(value, seq)) {
+      CHECK(client.publishAcked("gw/data", (const uint8_t*)&value, sizeof(value), seq));
+    }
+    
+    // Every seventh pass the broker receives but never acknowledges, and the
+    // connection drops
+    bool drop = pass % 7 == 6;
+    serveQos1(broker, delivered, !drop);
+    if (drop) {
+      broker.dropped = true;
+    }
+    client.poll(now);
+  }
+  
+  CHECK(ring.empty());
+  CHECK(reconnects > 1);
+  std::set<uint32_t> unique(delivered.begin(), delivered.end());
+  CHECK(unique.size() == RECORDS);
+  CHECK(*unique.rbegin() == RECORDS - 1);
+  CHECK(delivered.size() - RECORDS <= (size_t)(reconnects * WINDOW));
+  printf("  %u records, %zu publishes, %d connections\n", RECORDS, delivered.size(), reconnects);
+}
+
+static void testStreamedPublish() {
+  printf("Streamed publish\n");
+  BrokerStub broker;
+  std::vector<uint8_t> buffer(256);
+  MqttClient client;
+  std::vector<uint32_t> acked;
+  client.begin(&broker, buffer.data(), buffer.size(), outgoing, sizeof(outgoing));
+  client.setAckHandler(onAcked, &acked);
+  CHECK(!client.beginPublish("gw/data", 4, 1, 7));
+  CHECK(establish(client, broker, 0, 10));
+  
+  // Written in pieces, identical on the wire to a one-shot QoS 1 publish
+  std::string body;
+  CHECK(client.beginPublish("gw/data", 11, 1, 7));
+  CHECK(!client.canPublish(1));
+  CHECK(!client.beginPublish("gw/data", 1, 0));
+  CHECK(client.writePayload((const uint8_t*)"[{\"v\":1}", 8));
+  CHECK(client.writePayload((const uint8_t*)"", 0));
+  
+  // Nothing may interleave with the payload: no ping, no PUBACK, until it ends
+  broker.toClient += publishPacket("gw/cmd", "x", 1, 0x99);
+  CHECK(client.poll(5000));
+  CHECK(client.writePayload((const uint8_t*)",1]", 3));
+  CHECK(client.endPublish());
+  CHECK(broker.nextPacket(body) == 0x32);
+  CHECK(body == u16(7) + "gw/data" + u16(1) + "[{\"v\":1},1]");
+  CHECK(broker.fromClient.empty());
+  CHECK(client.getInflight() == 1);
+  
+  broker.toClient += packet(0x40, u16(1));
+  CHECK(client.poll(5001));
+  CHECK(acked.size() == 1 && acked[0] == 7);
+  CHECK(broker.nextPacket(body) == 0x40);
+  CHECK(body == u16(0x99));
+  
+  // QoS 0 with an empty payload
+  CHECK(client.beginPublish("gw/data", 0, 0));
+  CHECK(client.endPublish());
+  CHECK(broker.nextPacket(body) == 0x30);
+  CHECK(body == u16(7) + "gw/data");
+  
+  // More than announced drops the connection, and so does less
+  CHECK(client.beginPublish("gw/data", 2, 0));
+  CHECK(!client.writePayload((const uint8_t*)"abc", 3));
+  CHECK(!client.connected());
+  CHECK(!broker.isOpen);
+  broker.fromClient.clear();
+  CHECK(establish(client, broker, 6000, 10));
+  CHECK(client.beginPublish("gw/data", 2, 1, 8));
+  CHECK(client.writePayload((const uint8_t*)"a", 1));
+  CHECK(!client.endPublish());
+  CHECK(!client.connected());
+  CHECK(client.getInflight() == 0);
+}
+
+// Whatever the broker does not take stays in the send buffer and goes out from
+// poll(); publishes that would not fit there are refused up front
+static void testStalledBroker() {
+  printf("Stalled broker\n");
+  BrokerStub broker;
+  std::vector<uint8_t> buffer(256);
+  std::vector<uint8_t> sendBuffer(200);
+  MqttClient client;
+  client.begin(&broker, buffer.data(), buffer.size(), sendBuffer.data(), sendBuffer.size());
+  CHECK(establish(client, broker, 0, 10));
+  
+  // Partly taken: the rest waits in the send buffer
+  std::string payload(100, 'x');
+  size_t size = MqttClient::publishSize(7, payload.size(), 0);
+  broker.writeRoom = 20;
+  CHECK(client.canPublish(size));
+  CHECK(client.publish("gw/data", (const uint8_t*)payload.data(), payload.size()));
+  CHECK(broker.fromClient.size() == 20);
+  CHECK(client.getSendPending() == size - 20);
+  
+  // No room for another: refused without touching the connection
+  CHECK(!client.canPublish(size));
+  CHECK(!client.publish("gw/data", (const uint8_t*)payload.data(), payload.size()));
+  CHECK(client.connected());
+  CHECK(client.getSendPending() == size - 20);
+  
+  // A small streamed publish still fits, queued behind the first
+  CHECK(client.beginPublish("gw/data", 4, 1, 9));
+  CHECK(client.writePayload((const uint8_t*)"ab", 2));
+  CHECK(client.writePayload((const uint8_t*)"cd", 2));
+  CHECK(client.endPublish());
+  CHECK(broker.fromClient.size() == 20);
+  
+  // Drained in pieces as the broker reads again, both packets intact
+  broker.writeRoom = 30;
+  CHECK(client.poll(100));
+  CHECK(broker.fromClient.size() == 50);
+  broker.writeRoom = SIZE_MAX;
+  CHECK(client.poll(200));
+  CHECK(client.getSendPending() == 0);
+  std::string body;
+  CHECK(broker.nextPacket(body) == 0x30);
+  CHECK(body == u16(7) + "gw/data" + payload);
+  CHECK(broker.nextPacket(body) == 0x32);
+  CHECK(body == u16(7) + "gw/data" + u16(1) + "abcd");
+  CHECK(broker.fromClient.empty());
+  CHECK(client.canPublish(size));
+  
+  // A broker that never reads again misses its PINGRESP deadline
+  broker.writeRoom = 0;
+  CHECK(client.publish("gw/data", (const uint8_t*)payload.data(), payload.size()));
+  CHECK(client.poll(5200));
+  CHECK(!client.poll(15300));
+  CHECK(client.getStats().keepaliveTimeouts == 1);
+  CHECK(client.getSendPending() == 0);
+  
+  // Gone while bytes are buffered: the next flush drops the connection
+  broker.writeRoom = SIZE_MAX;
+  broker.fromClient.clear();
+  CHECK(establish(client, broker, 20000, 10));
+  broker.writeRoom = 0;
+  CHECK(client.publish("gw/data", (const uint8_t*)payload.data(), payload.size()));
+  broker.dropped = true;
+  CHECK(!client.poll(20100));
+  CHECK(!client.connected());
+}
+
+static void testAckRing() {
+  printf("Ack ring\n");
+  static int storage[4];
+  AckRing<int, 4> ring;
+  ring.begin(storage);
+  int value;
+  uint32_t seq[4];
+  
+  for (int i = 0; i < 4; i++) ring.push(i);
+  CHECK(ring.full());
+  for (int i = 0; i < 3; i++) {
+    CHECK(ring.takeNext(value, seq[i]) && value == i);
+  }
+  CHECK(ring.inFlight() == 3 && ring.unsent() == 1);
+  
+  // Acknowledged out of order: the head waits for record 0
+  ring.acknowledge(seq[1]);
+  CHECK(ring.size() == 4);
+  ring.acknowledge(seq[0]);
+  CHECK(ring.size() == 2);
+  
+  // Rewind resends record 2 but not the acknowledged ones
+  ring.rewind();
+  CHECK(ring.takeNext(value, seq[2]) && value == 2);
+  CHECK(ring.takeNext(value, seq[3]) && value == 3);
+  CHECK(!ring.takeNext(value, seq[0]));
+  
+  // Full: the oldest, in flight, is dropped and its late ack ignored
+  ring.push(4);
+  ring.push(5);
+  CHECK(!ring.push(6));
+  CHECK(ring.getDropped() == 1);
+  ring.acknowledge(seq[2]);
+  CHECK(ring.size() == 4);
+  CHECK(ring.front(value) && value == 3);
+  
+  // A batch acknowledged as a range, around an entry acknowledged earlier
+  ring.clear();
+  for (int i = 10; i < 14; i++) ring.push(i);
+  CHECK(ring.peekNext() && *ring.peekNext() == 10);
+  for (int i = 0; i < 4; i++) {
+    CHECK(ring.takeNext(value, seq[i]) && value == 10 + i);
+  }
+  CHECK(ring.peekNext() == nullptr);
+  ring.acknowledge(seq[1]);
+  ring.rewind();
+  CHECK(ring.takeNext(value, seq[0]) && value == 10);
+  CHECK(ring.takeNext(value, seq[2]) && value == 12);
+  CHECK(ring.size() == 4);
+  ring.acknowledgeRange(seq[0], seq[2]);
+  CHECK(ring.size() == 1 && ring.inFlight() == 0);
+  ring.acknowledgeRange(seq[3], seq[3]);
+  CHECK(ring.size() == 1);
+  CHECK(ring.takeNext(value, seq[3]) && value == 13);
+  ring.acknowledgeRange(seq[3], seq[3] - 1);
+  CHECK(ring.size() == 1);
+  ring.acknowledgeRange(seq[3], seq[3]);
+  CHECK(ring.empty());
+  
+  // Entries taken for a message that was never written go back, in order
+  for (int i = 20; i < 24; i++) ring.push(i);
+  for (int i = 0; i < 4; i++) {
+    CHECK(ring.takeNext(value, seq[i]) && value == 20 + i);
+  }
+  ring.unsend(seq[2]);
+  CHECK(ring.inFlight() == 2 && ring.unsent() == 2);
+  CHECK(ring.takeNext(value, seq[2]) && value == 22);
+  ring.unsend(seq[3] + 1);
+  CHECK(ring.unsent() == 1);
+  
+  // Given back from an entry dropped meanwhile: from the oldest one left
+  CHECK(!ring.push(24));
+  ring.unsend(seq[0]);
+  CHECK(ring.inFlight() == 0 && ring.unsent() == 4);
+  CHECK(ring.takeNext(value, seq[0]) && value == 21);
+}
+
+int main() {
+  testHandshake();
+  testSubscribeAndPublish();
+  testReceive();
+  testOversized();
+  testKeepalive();
+  testMalformed();
+  testPublishWindow();
+  testNoLossAcrossReconnects();
+  testStreamedPublish();
+  testStalledBroker();
+  testAckRing();
+  
+  printf("%s\n", failures == 0 ? "PASS" : "FAIL");
+  return failures == 0 ? 0 : 1;
+}
\ No newline at end of file
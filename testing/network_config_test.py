@@ -73,8 +73,8 @@ class ServerConfigClient:
         json_str = json.dumps(command, separators=(',', ':'))
         print(f"Sending command: {json_str}")
         
-        # Send with fragmentation
-        chunk_size = 18
+        # Send with fragmentation sized to the negotiated MTU (payload is MTU - 3)
+        chunk_size = max(18, min(self.client.mtu_size - 3, 509))
         for i in range(0, len(json_str), chunk_size):
             chunk = json_str[i:i+chunk_size]
             print(f"Fragment: '{chunk}'")
@@ -0,0 +1,280 @@
+/*
+ * MQTT payload encoding benchmark (PayloadEncoder.h/.cpp)
+ * Compares JSON, CBOR and packed frames for the same queued records: payload
+ * bytes per sample, bytes per sample on the wire (PUBLISH header and topic
+ * included), and encode time per sample, at several batch sizes. Encodings are
+ * checked first: CBOR is decoded back to the JSON text and packed frames to
+ * the records, so a wrong encoder fails the run.
+ *
+ * Build and run on Linux:
+ *   g++ -std=c++17 -O2 -I.. payload_encoding_benchmark.cpp ../PayloadEncoder.cpp -o payload_encoding_benchmark
+ *   ./payload_encoding_benchmark
+ */
+
+#include "PayloadEncoder.h"
+#include "benchmark_sinks.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static const char* TOPIC = "v1/devices/me/telemetry";
+
+// One poll cycle after another: 20 devices of 10 registers, polled every 5 s
+static std::vector<DataRecord> samples(int count) {
+  static const char* NAMES[] = { "Temperature_Inlet", "Temperature_Outlet", "Pressure_Line", "Flow_Rate",
+                                 "Motor_Current", "Motor_Speed", "Valve_Position", "Energy_Total",
+                                 "Alarm_Status", "Run_Hours" };
+  static const char* TYPES[] = { "float32", "float32", "float32", "float32", "uint16",
+                                 "uint16", "int16", "int32", "bool", "uint16" };
+  std::vector<DataRecord> records(count);
+  for (int i = 0; i < count; i++) {
+    int device = (i / 10) % 20;
+    int reg = i % 10;
+    DataRecord& record = records[i];
+    memset(&record, 0, sizeof(record));
+    record.time = 1760000000u + (i / 200) * 5 + device / 4;
+    record.value = reg < 4 ? 20.0f + reg * 3.7f + (i % 37) * 0.125f : (float)((i * 7 + reg) % 1500);
+    record.address = 40001 + reg * 2;
+    record.deviceHandle = device;
+    record.registerHandle = device * 10 + reg;
+    snprintf(record.deviceId, sizeof(record.deviceId), "D%06X", (unsigned)(device * 2654435761u) & 0xFFFFFF);
+    snprintf(record.registerId, sizeof(record.registerId), "R%06X", (unsigned)(record.registerHandle * 2246822519u) & 0xFFFFFF);
+    snprintf(record.dataType, sizeof(record.dataType), "%s", TYPES[reg]);
+    snprintf(record.name, sizeof(record.name), "%s", NAMES[reg]);
+  }
+  return records;
+}
+
+// --- Decoders for the checks ---
+
+struct Reader {
+  const uint8_t* data;
+  size_t size;
+  size_t pos;
+  bool ok;
+  
+  uint8_t byte() {
+    if (pos >= size) {
+      ok = false;
+      return 0;
+    }
+    return data[pos++];
+  }
+};
+
+static uint32_t cborArgument(Reader& in, uint8_t info) {
+  if (info < 24) return info;
+  int bytes = info == 24 ? 1 : info == 25 ? 2 : info == 26 ? 4 : 0;
+  if (bytes == 0) in.ok = false;
+  uint32_t value = 0;
+  for (int i = 0; i < bytes; i++) value = (value << 8) | in.byte();
+  return value;
+}
+
+// Decodes the CBOR subset the encoder produces back into JSON text
+static bool cborToJson(Reader& in, std::string& json) {
+  uint8_t initial = in.byte();
+  uint8_t major = initial >> 5;
+  if (initial == 0xFA) {
+    uint32_t bits = cborArgument(in, 26);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    char text[20];
+    snprintf(text, sizeof(text), "%.7g", (double)value);
+    json += std::isfinite(value) ? text : "null";
+    return in.ok;
+  }
+  uint32_t argument = cborArgument(in, initial & 0x1F);
+  switch (major) {
+    case 0:
+      json += std::to_string(argument);
+      break;
+    case 3:
+      json += '"';
+      for (uint32_t i = 0; i < argument; i++) {
+        char c = in.byte();
+        if (c == '"' || c == '\\') json += '\\';
+        json += c;
+      }
+      json += '"';
+      break;
+    case 4:
+      json += '[';
+      for (uint32_t i = 0; i < argument; i++) {
+        if (i) json += ',';
+        if (!cborToJson(in, json)) return false;
+      }
+      json += ']';
+      break;
+    case 5:
+      json += '{';
+      for (uint32_t i = 0; i < argument; i++) {
+        if (i) json += ',';
+        if (!cborToJson(in, json)) return false;
+        json += ':';
+        if (!cborToJson(in, json)) return false;
+      }
+      json += '}';
+      break;
+    default:
+      return false;
+  }
+  return in.ok;
+}
+
+static uint32_t varint(Reader& in) {
+  uint32_t value = 0;
+  for (int shift = 0; in.ok; shift += 7) {
+    uint8_t b = in.byte();
+    value |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) break;
+  }
+  return value;
+}
+
+static uint32_t u32(Reader& in) {
+  uint32_t value = 0;
+  for (int shift = 0; shift < 32; shift += 8) value |= (uint32_t)in.byte() << shift;
+  return value;
+}
+
+static bool packedMatches(const std::string& frame, const DataRecord* records, int count) {
+  Reader in = { (const uint8_t*)frame.data(), frame.size(), 0, true };
+  if (in.byte() != PACKED_FRAME_VERSION) return false;
+  uint32_t time = u32(in);
+  if ((int)varint(in) != count) return false;
+  for (int i = 0; i < count; i++) {
+    uint32_t metric = varint(in);
+    uint32_t zigzag = varint(in);
+    time += (int32_t)((zigzag >> 1) ^ -(int32_t)(zigzag & 1));
+    uint32_t bits = u32(in);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    if (metric != records[i].registerHandle || time != records[i].time || value != records[i].value) return false;
+  }
+  return in.ok && in.pos == frame.size();
+}
+
+static std::string encode(PayloadEncoding encoding, const DataRecord* records, int count, bool asArray) {
+  std::string payload;
+  size_t measured = encodePayload(encoding, records, count, asArray, nullptr, nullptr);
+  size_t written = encodePayload(encoding, records, count, asArray, append, &payload);
+  return measured == written && written == payload.size() ? payload : std::string();
+}
+
+static int checkEncodings() {
+  int failures = 0;
+  DataRecord record;
+  memset(&record, 0, sizeof(record));
+  record.time = 1760000000u;
+  record.value = 23.5f;
+  record.address = 40001;
+  record.registerHandle = 300;
+  strcpy(record.deviceId, "D7A3F21");
+  strcpy(record.registerId, "R1B2C3D");
+  strcpy(record.dataType, "float32");
+  strcpy(record.name, "Tank \"A\" level\\\x01");
+  
+  std::string json = encode(PAYLOAD_JSON, &record, 1, false);
+  const char* expected = "{\"time\":1760000000,\"name\":\"Tank \\\"A\\\" level\\\\\\u0001\",\"address\":40001,"
+                         "\"datatype\":\"float32\",\"value\":23.5,\"device_id\":\"D7A3F21\",\"register_id\":\"R1B2C3D\"}";
+  if (json != expected) {
+    printf("json mismatch: %s\n", json.c_str());
+    failures++;
+  }
+  std::string schema;
+  encodeMetricSchema(record, append, &schema);
+  if (schema.find("{\"metric\":300,\"device_id\":\"D7A3F21\",") != 0) {
+    printf("schema mismatch: %s\n", schema.c_str());
+    failures++;
+  }
+  
+  std::vector<DataRecord> records = samples(64);
+  strcpy(records[3].name, "Plain name");
+  records[5].time -= 20;    // Out of order: a negative delta
+  for (int count : { 1, 7, 64 }) {
+    for (bool asArray : { false, true }) {
+      if (!asArray && count > 1) continue;
+      std::string cbor = encode(PAYLOAD_CBOR, records.data(), count, asArray);
+      std::string decoded;
+      Reader in = { (const uint8_t*)cbor.data(), cbor.size(), 0, true };
+      if (cbor.empty() || !cborToJson(in, decoded) || in.pos != cbor.size() ||
+          decoded != encode(PAYLOAD_JSON, records.data(), count, asArray)) {
+        printf("cbor mismatch for %d records\n", count);
+        failures++;
+      }
+    }
+    if (!packedMatches(encode(PAYLOAD_PACKED, records.data(), count, true), records.data(), count)) {
+      printf("packed mismatch for %d records\n", count);
+      failures++;
+    }
+  }
+  
+  PayloadEncoding parsed;
+  if (!parsePayloadEncoding("cbor", parsed) || parsed != PAYLOAD_CBOR || parsePayloadEncoding("xml", parsed) ||
+      strcmp(payloadEncodingName(PAYLOAD_PACKED), "packed") != 0) {
+    printf("encoding names mismatch\n");
+    failures++;
+  }
+  return failures;
+}
+
+// PUBLISH fixed header, topic and QoS 1 packet ID around a payload
+static size_t wireSize(size_t payload, size_t topicLength, bool packetId) {
+  size_t remaining = 2 + topicLength + (packetId ? 2 : 0) + payload;
+  size_t lengthBytes = remaining < 128 ? 1 : remaining < 16384 ? 2 : remaining < 2097152 ? 3 : 4;
+  return 1 + lengthBytes + remaining;
+}
+
+int main() {
+  if (checkEncodings() != 0) {
+    printf("FAIL\n");
+    return 1;
+  }
+  
+  const int total = 12000;
+  std::vector<DataRecord> records = samples(total);
+  const PayloadEncoding encodings[] = { PAYLOAD_JSON, PAYLOAD_CBOR, PAYLOAD_PACKED };
+  
+  printf("%-8s %6s %17s %14s %8s %15s\n", "encoding", "batch", "payload B/sample", "wire B/sample", "vs json",
+         "ns/sample");
+  for (int batch : { 1, 10, 50 }) {
+    double jsonWire = 0;
+    for (PayloadEncoding encoding : encodings) {
+      size_t payloadBytes = 0;
+      size_t wireBytes = 0;
+      for (int i = 0; i < total; i += batch) {
+        size_t size = encodePayload(encoding, records.data() + i, batch, batch > 1, nullptr, nullptr);
+        payloadBytes += size;
+        wireBytes += wireSize(size, strlen(TOPIC), true);
+      }
+      
+      const int rounds = 20;
+      size_t sink = 0;
+      auto start = std::chrono::steady_clock::now();
+      for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < total; i += batch) {
+          encodePayload(encoding, records.data() + i, batch, batch > 1, discard, &sink);
+        }
+      }
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      
+      double wirePerSample = (double)wireBytes / total;
+      if (encoding == PAYLOAD_JSON) jsonWire = wirePerSample;
+      printf("%-8s %6d %17.1f %14.1f %7.0f%% %15.1f\n", payloadEncodingName(encoding), batch,
+             (double)payloadBytes / total, wirePerSample, 100.0 * wirePerSample / jsonWire,
+             seconds * 1e9 / ((double)total * rounds));
+    }
+  }
+  
+  // Packed frames rely on each metric's schema, sent once per connection
+  size_t schemaBytes = 0;
+  for (int i = 0; i < 200; i++) {
+    schemaBytes += wireSize(encodeMetricSchema(records[i], nullptr, nullptr), strlen(TOPIC) + strlen("/schema/000"), false);
+  }
+  printf("packed schema: %.1f B per metric, sent once per metric and connection\n", schemaBytes / 200.0);
+  return 0;
+}
\ No newline at end of file
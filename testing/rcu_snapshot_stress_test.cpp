@@ -0,0 +1,99 @@
+/*
+ * Host-side stress test for RcuSnapshot.h (config snapshots in ConfigManager)
+ * Readers pin snapshots and verify their contents while writers keep publishing
+ * new versions, mirroring the RTU/TCP pollers vs. the BLE command task.
+ *
+ * Build and run on Linux with ThreadSanitizer:
+ *   g++ -std=c++17 -O1 -g -fsanitize=thread -I.. rcu_snapshot_stress_test.cpp -o rcu_snapshot_stress_test
+ *   ./rcu_snapshot_stress_test
+ */
+
+#include "RcuSnapshot.h"
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static const int VALUE_COUNT = 64;
+static const int READER_THREADS = 6;
+static const int WRITER_THREADS = 2;
+static const int PUBLISHES_PER_WRITER = 20000;
+
+static std::atomic<int> liveSnapshots(0);
+static std::atomic<int> failures(0);
+
+struct Snapshot {
+  unsigned version;
+  unsigned values[VALUE_COUNT];
+
+  explicit Snapshot(unsigned v) : version(v) {
+    for (int i = 0; i < VALUE_COUNT; i++) values[i] = v * 31 + i;
+    liveSnapshots++;
+  }
+  ~Snapshot() {
+    // Poison so a reader touching a reclaimed snapshot fails the check
+    for (int i = 0; i < VALUE_COUNT; i++) values[i] = 0xDEADBEEF;
+    liveSnapshots--;
+  }
+};
+
+int main() {
+  RcuSnapshot<Snapshot> rcu;
+  std::mutex writeMutex;  // Writers are serialized, like ConfigManager::writeMutex
+  std::atomic<unsigned> nextVersion(1);
+  std::atomic<bool> writersDone(false);
+  std::atomic<long> pins(0);
+
+  rcu.publish(new Snapshot(0));
+
+  std::vector<std::thread> threads;
+  for (int r = 0; r < READER_THREADS; r++) {
+    threads.emplace_back([&]() {
+      unsigned lastSeen = 0;
+      while (!writersDone.load()) {
+        auto guard = rcu.pin();
+        const Snapshot* snapshot = guard.get();
+        if (snapshot->version < lastSeen) {
+          failures++;  // Versions must never go backwards for one reader
+        }
+        lastSeen = snapshot->version;
+        for (int i = 0; i < VALUE_COUNT; i++) {
+          if (snapshot->values[i] != snapshot->version * 31 + i) {
+            failures++;
+            break;
+          }
+        }
+        pins++;
+      }
+    });
+  }
+
+  for (int w = 0; w < WRITER_THREADS; w++) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < PUBLISHES_PER_WRITER; i++) {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        rcu.publish(new Snapshot(nextVersion++));
+      }
+    });
+  }
+
+  for (int w = 0; w < WRITER_THREADS; w++) {
+    threads[READER_THREADS + w].join();
+  }
+  writersDone = true;
+  for (int r = 0; r < READER_THREADS; r++) {
+    threads[r].join();
+  }
+
+  // With every reader gone, all retired snapshots must be reclaimable
+  rcu.reclaim();
+  int pending = rcu.pendingReclaim();
+
+  printf("pins: %ld, publishes: %d, live snapshots: %d, pending reclaim: %d, failures: %d\n",
+         pins.load(), WRITER_THREADS * PUBLISHES_PER_WRITER, liveSnapshots.load(), pending, failures.load());
+
+  bool ok = failures.load() == 0 && pending == 0 && liveSnapshots.load() == 1;
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
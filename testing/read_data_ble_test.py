@@ -54,11 +54,11 @@ class BLEDataReader:
         await self.client.write_gatt_char(self.COMMAND_CHAR_UUID, "<END>".encode())
         print(f"📤 Sent: {json_str}")
     
-    async def start_streaming(self, device_id):
+    async def start_streaming(self, device_ids, min_interval_ms=0):
         command = {
             "op": "read",
             "type": "data",
-            "device": device_id
+            "subscriptions": [{"device_id": d, "min_interval_ms": min_interval_ms} for d in device_ids]
         }
         await self.send_command(command)
     
@@ -66,7 +66,7 @@ class BLEDataReader:
         command = {
             "op": "read",
             "type": "data",
-            "device": "stop"
+            "device_id": "stop"
         }
         await self.send_command(command)
     
@@ -84,13 +84,13 @@ async def main():
     try:
         print("\n=== BLE Data Streaming Test ===")
         
-        # Get device ID from user
-        device_id = input("Enter device ID to stream (or press Enter for D123ABC): ").strip()
-        if not device_id:
-            device_id = "D123ABC"
+        # Get device IDs from user
+        device_ids = input("Enter device IDs to stream, comma separated (or press Enter for D123ABC): ").strip()
+        device_ids = [d.strip() for d in device_ids.split(",") if d.strip()] or ["D123ABC"]
+        interval = input("Minimum interval per register in ms (or press Enter for every sample): ").strip()
         
-        print(f"\n🚀 Starting data streaming for device: {device_id}")
-        await reader.start_streaming(device_id)
+        print(f"\n🚀 Starting data streaming for devices: {', '.join(device_ids)}")
+        await reader.start_streaming(device_ids, int(interval) if interval else 0)
         
         print("📡 Streaming data... Press Enter to stop")
         input()